@@ -0,0 +1,236 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "spsc_ring_queue.hh"
+
+/*
+ * Compares the lock-free `RingQueue` behind the action queue against the
+ * critical section queue it replaced, on the host.
+ *
+ * The host is not an RP2040, so only the relative cost means anything. A
+ * critical section on the RP2040 is a hardware spin lock taken with the
+ * interrupts disabled, modelled here by a spin lock on an atomic flag.
+ */
+
+// **====================================================**
+// ||          <<<<< Configuration Macros >>>>>          ||
+// **====================================================**
+
+// Same as `AQ_CAPACITY`.
+#define BENCH_CAPACITY 8
+
+// Actions pushed through each queue per run.
+#define BENCH_ACTIONS 1000000
+
+// Runs of each benchmark, the fastest one is reported.
+#define BENCH_RUNS 5
+
+// **===========================================**
+// ||          <<<<< BENCH ACTION >>>>>          ||
+// **===========================================**
+
+/**
+ * Laid out like `stepper_motor::action::Action`, whose header needs the SDK.
+ */
+struct BenchAction {
+  int action_type;
+  union {
+    float percent;
+    int64_t step;
+    uint32_t duration_ms;
+    int null;
+  } data;
+  uint32_t received_us;
+  uint32_t enqueued_us;
+};
+
+// **=======================================**
+// ||          <<<<< BASELINE >>>>>          ||
+// **=======================================**
+
+/**
+ * Stands in for `critical_section_t`.
+ */
+class CriticalSection {
+ private:
+  std::atomic_flag locked = ATOMIC_FLAG_INIT;
+
+ public:
+  void enter() {
+    while (this->locked.test_and_set(std::memory_order_acquire));
+  }
+  void exit() { this->locked.clear(std::memory_order_release); }
+};
+
+/**
+ * The action queue as it was before the `RingQueue`, with every operation
+ * taking the critical section.
+ */
+class CriticalSectionQueue {
+ private:
+  BenchAction buffer[BENCH_CAPACITY];
+  int head;
+  int tail;
+  int count;
+  CriticalSection crit_sec;
+
+ public:
+  CriticalSectionQueue() {
+    this->head = 0;
+    this->tail = 0;
+    this->count = 0;
+  }
+
+  bool enqueue(const BenchAction& action) {
+    this->crit_sec.enter();
+
+    if (this->count >= BENCH_CAPACITY) {
+      this->crit_sec.exit();
+      return false;
+    }
+
+    this->buffer[this->tail] = action;
+    this->tail = (this->tail + 1) % BENCH_CAPACITY;
+    this->count++;
+
+    this->crit_sec.exit();
+    return true;
+  }
+
+  bool dequeue(BenchAction* action) {
+    this->crit_sec.enter();
+
+    if (this->count == 0) {
+      this->crit_sec.exit();
+      return false;
+    }
+
+    *action = this->buffer[this->head];
+    this->head = (this->head + 1) % BENCH_CAPACITY;
+    this->count--;
+
+    this->crit_sec.exit();
+    return true;
+  }
+};
+
+/**
+ * Gives the ring queue the interface of the baseline.
+ */
+class RingActionQueue {
+ private:
+  RingQueue<BenchAction, BENCH_CAPACITY> queue;
+
+ public:
+  bool enqueue(const BenchAction& action) { return this->queue.push(action); }
+  bool dequeue(BenchAction* action) { return this->queue.pop(action); }
+};
+
+// **=========================================**
+// ||          <<<<< BENCHMARKS >>>>>          ||
+// **=========================================**
+
+static double nsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+/**
+ * Enqueues and dequeues one action at a time on a single thread, i.e. the
+ * cost of the operations themselves without any contention.
+ *
+ * \returns The time per enqueue and dequeue pair in nano seconds.
+ */
+template <typename Queue>
+static double benchUncontended() {
+  Queue queue;
+  BenchAction action = {};
+  uint64_t sum = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < BENCH_ACTIONS; i++) {
+    action.data.step = i;
+    queue.enqueue(action);
+    queue.dequeue(&action);
+    sum += action.data.step;
+  }
+  double ns = nsSince(start);
+
+  // Keep the loop from being optimized away.
+  if (sum == 0) printf(" ");
+  return ns / BENCH_ACTIONS;
+}
+
+/**
+ * Streams actions from a producer thread to a consumer thread, like the MQTT
+ * callbacks and the main loop, both yielding to the other while the queue is
+ * full or empty, which also keeps it going on a single CPU.
+ *
+ * Exits if the consumer gets the actions out of order.
+ *
+ * \returns The time per action in nano seconds.
+ */
+template <typename Queue>
+static double benchStreaming() {
+  Queue queue;
+
+  auto start = std::chrono::steady_clock::now();
+  std::thread producer([&queue]() {
+    BenchAction action = {};
+    for (uint32_t i = 0; i < BENCH_ACTIONS; i++) {
+      action.data.step = i;
+      while (!queue.enqueue(action)) std::this_thread::yield();
+    }
+  });
+
+  BenchAction action;
+  for (uint32_t i = 0; i < BENCH_ACTIONS; i++) {
+    while (!queue.dequeue(&action)) std::this_thread::yield();
+    if (action.data.step != i) {
+      fprintf(stderr, "Got action %lld, expected %lu.\n",
+              (long long)action.data.step, (unsigned long)i);
+      exit(1);
+    }
+  }
+  double ns = nsSince(start);
+
+  producer.join();
+  return ns / BENCH_ACTIONS;
+}
+
+/**
+ * Runs a benchmark `BENCH_RUNS` times and gets its fastest run.
+ */
+static double fastest(double (*bench)()) {
+  double best = bench();
+  for (int i = 1; i < BENCH_RUNS; i++) {
+    double ns = bench();
+    if (ns < best) best = ns;
+  }
+  return best;
+}
+
+static void report(const char* name, double baseline_ns, double ring_ns) {
+  printf("%-12s %16.1f %12.1f %8.2fx\n", name, baseline_ns, ring_ns,
+         baseline_ns / ring_ns);
+}
+
+int main() {
+  printf("%d actions of %d bytes through a queue of %d, best of %d runs.\n\n",
+         BENCH_ACTIONS, (int)sizeof(BenchAction), BENCH_CAPACITY, BENCH_RUNS);
+  printf("%-12s %16s %12s %9s\n", "ns/action", "critical section",
+         "ring queue", "speedup");
+
+  report("uncontended", fastest(benchUncontended<CriticalSectionQueue>),
+         fastest(benchUncontended<RingActionQueue>));
+  report("streaming", fastest(benchStreaming<CriticalSectionQueue>),
+         fastest(benchStreaming<RingActionQueue>));
+
+  return 0;
+}
@@ -19,30 +19,80 @@
 #define MEM_LIBC_MALLOC 0
 #endif
 #define MEM_ALIGNMENT 4
-#ifndef MEM_SIZE
-#define MEM_SIZE 56000
-#endif
-#define MEMP_NUM_TCP_SEG 32
 #define MEMP_NUM_ARP_QUEUE 10
-#define MEMP_NUM_SYS_TIMEOUT (LWIP_NUM_SYS_TIMEOUT_INTERNAL + 1)
+#define MEMP_NUM_SYS_TIMEOUT (LWIP_NUM_SYS_TIMEOUT_INTERNAL + 2) /* MQTT, SNTP */
 #define MQTT_REQ_MAX_IN_FLIGHT (10) /* Maximum of subscribe requests */
-#define MQTT_OUTPUT_RINGBUF_SIZE 10000
-#define PBUF_POOL_SIZE 24
 #define LWIP_ARP 1
 #define LWIP_ETHERNET 1
 #define LWIP_ICMP 1
 #define LWIP_RAW 1
-#define TCP_WND (12 * TCP_MSS)
 #define TCP_MSS 1460
+
+// ----- Buffer And Pool Sizes -----
+/*
+ * The lean profile (the `LWIP_LEAN_PROFILE` build option) sizes the buffers
+ * and pools from the high-water marks the device reports on its `snsr/mem`
+ * topic (send PRESS to `cmd/mem`), instead of the generous defaults. To size
+ * them for a setup:
+ * 1. Run the default build through a boot, the discovery messages, moves of
+ *    every window and a Wi-Fi reconnect.
+ * 2. Request the report and take the peaks: `lwip` for MEM_SIZE, `mqtt` for
+ *    MQTT_OUTPUT_RINGBUF_SIZE and `pools` for PBUF_POOL and TCP_SEG.
+ * 3. Override the LEAN_* sizes below with the peaks plus about 50%.
+ * The LEAN_* defaults are unmeasured starting points, not peaks taken from a
+ * device, so take the steps above before relying on them.
+ *
+ * The MQTT ring buffer has to hold the largest discovery message in one go,
+ * so it is sized from that message rather than from a peak. The lwIP sources
+ * can't see the discovery message, its size is given here instead and
+ * ha_device.cc fails the build if a message outgrows it.
+ */
+#if LWIP_LEAN_PROFILE
+#ifndef LEAN_MEM_SIZE
+#define LEAN_MEM_SIZE 16000
+#endif
+// The largest discovery publish (topic, message and MQTT header) in bytes.
+// 8680 for the "main" window with the stock device info.
+#ifndef LEAN_MQTT_DISCOVERY_PUBLISH_SIZE
+#define LEAN_MQTT_DISCOVERY_PUBLISH_SIZE 8680
+#endif
+// Room for the availability and state messages that get queued behind the
+// discovery message before it has drained.
+#ifndef LEAN_MQTT_OUTPUT_MARGIN
+#define LEAN_MQTT_OUTPUT_MARGIN 1024
+#endif
+#ifndef LEAN_MQTT_OUTPUT_RINGBUF_SIZE
+#define LEAN_MQTT_OUTPUT_RINGBUF_SIZE \
+  (LEAN_MQTT_DISCOVERY_PUBLISH_SIZE + LEAN_MQTT_OUTPUT_MARGIN)
+#endif
+#ifndef LEAN_PBUF_POOL_SIZE
+#define LEAN_PBUF_POOL_SIZE 8
+#endif
+#define MEM_SIZE LEAN_MEM_SIZE
+#define MQTT_OUTPUT_RINGBUF_SIZE LEAN_MQTT_OUTPUT_RINGBUF_SIZE
+#define PBUF_POOL_SIZE LEAN_PBUF_POOL_SIZE
+#define TCP_WND (4 * TCP_MSS)
+#define TCP_SND_BUF (4 * TCP_MSS)
+#else
+#ifndef MEM_SIZE
+#define MEM_SIZE 56000
+#endif
+#define MQTT_OUTPUT_RINGBUF_SIZE 10000
+#define PBUF_POOL_SIZE 24
+#define TCP_WND (12 * TCP_MSS)
 #define TCP_SND_BUF (8 * TCP_MSS)
+#endif
 #define TCP_SND_QUEUELEN ((4 * (TCP_SND_BUF) + (TCP_MSS - 1)) / (TCP_MSS))
+#define MEMP_NUM_TCP_SEG TCP_SND_QUEUELEN
 #define LWIP_NETIF_STATUS_CALLBACK 1
 #define LWIP_NETIF_LINK_CALLBACK 1
 #define LWIP_NETIF_HOSTNAME 1
 #define LWIP_NETCONN 0
-#define MEM_STATS 0
+// The heap and pool stats feed the memory report.
+#define LWIP_STATS 1
+#define MEM_STATS 1
 #define SYS_STATS 0
-#define MEMP_STATS 0
+#define MEMP_STATS 1
 #define LINK_STATS 0
 // #define ETH_PAD_SIZE                2
 #define LWIP_CHKSUM_ALGORITHM 3
@@ -56,6 +106,17 @@
 #define DHCP_DOES_ARP_CHECK 0
 #define LWIP_DHCP_DOES_ACD_CHECK 0
 
+// SNTP, to be able to schedule actions at absolute times.
+#define SNTP_SERVER_DNS 1
+#ifdef __cplusplus
+extern "C" {
+#endif
+void sntpSetSystemTime(unsigned int sec);
+#ifdef __cplusplus
+}
+#endif
+#define SNTP_SET_SYSTEM_TIME(sec) sntpSetSystemTime(sec)
+
 #ifndef NDEBUG
 #define LWIP_DEBUG 1
 #define LWIP_STATS 1
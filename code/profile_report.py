@@ -0,0 +1,149 @@
+#! /usr/bin/env python3
+"""
+Symbolizes a dump of the sampling profiler into a flat profile.
+
+Start sampling with a "START" on the cmd/prof topic of a window, then send
+"DUMP" to get the samples published on snsr/prof, or "USB" to get them printed
+as "PROFILE <hex>" lines. Capture the publishes with e.g.:
+
+  mosquitto_sub -h <broker> -t '<base><window>/snsr/prof' -F %x > dump.txt
+
+and symbolize them against the ELF of the firmware that took them:
+
+  ./profile_report.py build/IoT_Window_V3.elf dump.txt
+
+The dump carries a CRC-32 of the flash image, which is checked against the .bin
+built next to the ELF so that a dump isn't symbolized against the wrong build.
+"""
+
+import argparse
+import bisect
+import re
+import struct
+import subprocess
+import sys
+import zlib
+from collections import defaultdict
+from pathlib import Path
+
+# Keep in sync with profiler.hh.
+CHUNK_MAGIC = 0x4650
+CHUNK_VERSION = 1
+HEADER = struct.Struct("<HBBHHIIIII")
+ENTRY = struct.Struct("<II")
+
+HEX_LINE = re.compile(r"^(?:PROFILE )?([0-9a-fA-F]+)\s*$")
+
+
+def read_chunks(lines):
+    """Gets the header and the entries of every chunk in the lines."""
+    chunks = {}
+    for line in lines:
+        match = HEX_LINE.match(line.strip())
+        if match is None or len(match.group(1)) % 2 != 0:
+            continue
+
+        data = bytes.fromhex(match.group(1))
+        if len(data) < HEADER.size:
+            continue
+        header = HEADER.unpack_from(data)
+        if header[0] != CHUNK_MAGIC or header[1] != CHUNK_VERSION:
+            continue
+
+        count = header[2]
+        entries = [
+            ENTRY.unpack_from(data, HEADER.size + i * ENTRY.size)
+            for i in range(count)
+            if HEADER.size + (i + 1) * ENTRY.size <= len(data)
+        ]
+        chunks[header[3]] = (header, entries)
+
+    return chunks
+
+
+def read_symbols(nm, elf):
+    """Gets the function symbols of the ELF, sorted by address."""
+    output = subprocess.run(
+        [nm, "--defined-only", "--numeric-sort", "--print-size", "--demangle",
+         str(elf)],
+        check=True, capture_output=True, text=True).stdout
+
+    symbols = []
+    for line in output.splitlines():
+        fields = line.split(maxsplit=3)
+        if len(fields) == 4 and fields[2] in "tTwW":
+            # Thumb function symbols have their lowest bit set.
+            address = int(fields[0], 16) & ~1
+            symbols.append((address, int(fields[1], 16), fields[3]))
+
+    return symbols
+
+
+def symbolize(symbols, starts, pc):
+    """Gets the function a program counter is in."""
+    i = bisect.bisect_right(starts, pc) - 1
+    if i >= 0:
+        address, size, name = symbols[i]
+        if pc < address + size:
+            return name
+    return f"0x{pc:08x}"
+
+
+def check_image(elf, image_crc, image_size):
+    """Warns if the .bin next to the ELF is not the image that was sampled."""
+    image = elf.with_suffix(".bin")
+    if not image.exists():
+        print(f"warning: {image} not found, can't check the build",
+              file=sys.stderr)
+        return
+
+    data = image.read_bytes()[:image_size]
+    if len(data) != image_size or zlib.crc32(data) != image_crc:
+        print(f"warning: the dump was not taken with {image.name}, "
+              "the symbols are likely wrong", file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("elf", type=Path, help="IoT_Window_V3.elf")
+    parser.add_argument("dumps", nargs="*", help="dump files, or stdin")
+    parser.add_argument("--nm", default="arm-none-eabi-nm")
+    parser.add_argument("--top", type=int, default=40,
+                        help="functions to list (default 40)")
+    args = parser.parse_args()
+
+    lines = []
+    for path in args.dumps or ["-"]:
+        lines += (sys.stdin if path == "-" else open(path)).readlines()
+
+    chunks = read_chunks(lines)
+    if not chunks:
+        print("No profiler chunks found.")
+        return
+
+    header = chunks[min(chunks)][0]
+    total, image_crc, image_size, samples, dropped, interval_us = header[4:]
+    missing = [seq for seq in range(total) if seq not in chunks]
+    if missing:
+        print(f"warning: chunks {missing} are missing", file=sys.stderr)
+    check_image(args.elf, image_crc, image_size)
+
+    symbols = read_symbols(args.nm, args.elf)
+    starts = [address for address, _, _ in symbols]
+
+    hits = defaultdict(int)
+    for _, entries in chunks.values():
+        for pc, count in entries:
+            hits[(pc & 1, symbolize(symbols, starts, pc & ~1))] += count
+
+    print(f"{samples} samples every ~{interval_us}us "
+          f"({samples * interval_us / 1e6:.1f}s), {dropped} dropped")
+    print(f"{'%':>6} {'samples':>8}  core  function")
+    ranked = sorted(hits.items(), key=lambda item: item[1], reverse=True)
+    for (core, name), count in ranked[:args.top]:
+        print(f"{100 * count / max(samples, 1):6.2f} {count:8}  {core:>4}  "
+              f"{name}")
+
+
+if __name__ == "__main__":
+    main()
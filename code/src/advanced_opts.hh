@@ -32,18 +32,34 @@
 #define CALIBRATION_SPEED_PRIMARY 5
 #define CALIBRATION_SPEED_SECONDARY 1
 
-// **===============================================**
-// ||          <<<<< LIMIT SWITCHES >>>>>           ||
-// **===============================================**
-
-// #if (HOME_SIDE == RIGHT_SIDE)
-// #define LS_HOME LS_RIGHT
-// #else
-// #define LS_HOME LS_LEFT
-// #endif
-#define LS_HOME ((HOME_SIDE == RIGHT_SIDE) ? LS_RIGHT : LS_LEFT)
-#define LS_CLOSED ((CLOSED_SIDE == RIGHT_SIDE) ? LS_RIGHT : LS_LEFT)
-#define LS_OPEN ((OPEN_SIDE == RIGHT_SIDE) ? LS_RIGHT : LS_LEFT)
+// Distance to back off from an end stop between calibration passes.
+#define CALIBRATION_BACK_OFF_MM 7
+
+// **================================================**
+// ||          <<<<< STALL DETECTION >>>>>           ||
+// **================================================**
+
+// StallGuard is unreliable at low speeds, stall detection is disabled by the
+// driver below this speed (mm/s).
+#define STALL_MIN_SPEED 2
+
+// Speed used when homing against a stall instead of a limit switch. Must be
+// above STALL_MIN_SPEED.
+#define SENSORLESS_HOMING_SPEED 4
+
+// Homing gives up after travelling this far without finding an end stop.
+#define HOMING_MAX_TRAVEL_MM (DEFAULT_WINDOW_WIDTH_MM + 50)
+
+// A limit switch that is still triggered after backing off this far is
+// considered stuck.
+#define LS_STUCK_BACK_OFF_MM 20
+
+// **========================================**
+// ||          <<<<< WINDOWS >>>>>           ||
+// **========================================**
+
+#define WINDOW_COUNT_ONE(index, id, name) +1
+#define WINDOW_COUNT (0 WINDOWS(WINDOW_COUNT_ONE))
 
 // **=========================================**
 // ||          <<<<< POSITION >>>>>           ||
@@ -77,4 +93,165 @@
 #define WIFI_CONNECTION_MAX_TIMEOUT 30000
 #define WIFI_CONNECTION_MAX_ATTEMPTS -1  // Set to -1 for no max.
 
+/*
+ * A fast boot skips the cosmetic delays and LED blinks of the setup and homes
+ * the windows on the second core while Wi-Fi and MQTT come up, so the windows
+ * become controllable as soon as the slower of the two is done. Set to 0 for
+ * the original one step after the other boot.
+ */
+#define FAST_BOOT 1
+
+// How often to poll for the MQTT connection after a connection attempt.
+#define MQTT_CONNECT_POLL_MS 10
+
+// **==============================================**
+// ||          <<<<< MQTT COMMANDS >>>>>           ||
+// **==============================================**
+
+/*
+ * Every command topic of every window is rate limited by a token bucket. A
+ * topic accepts a burst of up to MQTT_COMMAND_BURST commands and then one more
+ * every MQTT_COMMAND_REFILL_MS milliseconds, anything over that is dropped
+ * before it is parsed. STOP commands are never dropped.
+ */
+#define MQTT_COMMAND_BURST 5
+#define MQTT_COMMAND_REFILL_MS 500
+
+/*
+ * The echo topic of every window has a bucket of its own, tighter than the
+ * other topics as each probe costs a publish, so that probing the latency
+ * can't crowd out the publishes of the window.
+ */
+#define MQTT_ECHO_BURST 2
+#define MQTT_ECHO_REFILL_MS 1000
+
+// How often to publish the accepted and dropped command counts at most.
+#define MQTT_COMMAND_STATS_INTERVAL_MS 10000
+
+// **===========================================**
+// ||          <<<<< SUPERVISOR >>>>>           ||
+// **===========================================**
+
+/*
+ * The hardware watchdog is only fed while every supervised task checks in
+ * within its deadline (ms). Otherwise the device reboots and reports the task
+ * that missed its deadline on the next boot.
+ */
+#define SUPERVISOR_WATCHDOG_TIMEOUT_MS 8388  // Max for RP2040.
+#define SUPERVISOR_MAIN_LOOP_DEADLINE_MS 3000
+#define SUPERVISOR_MOTION_DEADLINE_MS 1000
+
+/*
+ * A connection attempt checks in while it waits for the network, so this only
+ * has to cover the main loop going around. Kept below the watchdog timeout, a
+ * hang that stops the supervisor from being serviced reboots after the
+ * watchdog timeout anyways, so a longer deadline would never apply.
+ */
+#define SUPERVISOR_WIFI_DEADLINE_MS 5000
+
+/*
+ * The MQTT client is not reconnected once it loses the broker, so the device
+ * is rebooted to reconnect it after this long.
+ */
+#define SUPERVISOR_MQTT_DEADLINE_MS (5 * 60 * 1000)
+
+// How often blocking loops, such as homing, check in at most.
+#define SUPERVISOR_POLL_INTERVAL_MS 100
+
+// **========================================**
+// ||          <<<<< LOGGING >>>>>           ||
+// **========================================**
+
+/*
+ * Runtime messages are recorded raw into a ring in RAM and only formatted and
+ * printed while the main loop is idle. Messages above this level (ERROR, WARN,
+ * INFO or DEBUG) are compiled out.
+ */
+#define LOG_LEVEL LOG_LEVEL_INFO
+
+// Most records printed per round of the main loop while the motors move.
+#define LOG_DRAIN_MOVING_MAX 2
+
+// **======================================**
+// ||          <<<<< POWER >>>>>           ||
+// **======================================**
+
+/*
+ * A motor that hasn't moved for MOTOR_IDLE_TIMEOUT_MS is powered down. The
+ * lead screw can't be back driven by the window, so the position stays valid
+ * without any holding torque. With MOTOR_IDLE_DISABLE the driver is disabled
+ * altogether, otherwise its standstill current drops to MOTOR_HOLD_CURRENT
+ * (out of 31) over UART, which falls back to disabling it without a UART.
+ */
+#define MOTOR_IDLE_TIMEOUT_MS 10000
+#define MOTOR_IDLE_DISABLE 1
+#define MOTOR_HOLD_CURRENT 8
+#define MOTOR_RUN_CURRENT 31
+
+// How long a powered down driver gets to energize the coils before the first
+// step.
+#define MOTOR_WAKE_SETTLE_US 2000
+
+/*
+ * Once nothing has moved or been waiting to move for SYSTEM_IDLE_TIMEOUT_MS,
+ * the Wi-Fi radio goes into power saving and the system clock is scaled down
+ * to SYSTEM_IDLE_CLOCK_KHZ. The next action brings both back before it starts.
+ */
+#define SYSTEM_IDLE_TIMEOUT_MS 60000
+#define SYSTEM_CLOCK_KHZ 125000
+#define SYSTEM_IDLE_CLOCK_KHZ 48000
+#define SYSTEM_IDLE_WIFI_PM CYW43_DEFAULT_PM
+
+// **=================================================**
+// ||          <<<<< POSITION JOURNAL >>>>>           ||
+// **=================================================**
+
+/*
+ * The position of every motor is journaled to flash once it has been at rest
+ * for JOURNAL_SETTLE_MS, so that a boot after a power cut can skip homing.
+ * JOURNAL_TRUST_POLICY decides when a journaled position is taken over:
+ * - JOURNAL_TRUST_NEVER:          Always home.
+ * - JOURNAL_TRUST_AT_END_STOP:    Only if the window was left fully open or
+ *                                 closed and that limit switch is triggered.
+ * - JOURNAL_TRUST_SWITCHES_MATCH: If the limit switches agree with where the
+ *                                 window was left, anywhere along its travel.
+ * After JOURNAL_MAX_RESTORES boots in a row without homing, the motor is homed
+ * anyway to get rid of any drift.
+ */
+#define JOURNAL_TRUST_NEVER 0
+#define JOURNAL_TRUST_AT_END_STOP 1
+#define JOURNAL_TRUST_SWITCHES_MATCH 2
+
+#define JOURNAL_TRUST_POLICY JOURNAL_TRUST_SWITCHES_MATCH
+#define JOURNAL_MAX_RESTORES 10
+#define JOURNAL_SETTLE_MS 5000
+
+// **=========================================**
+// ||          <<<<< ODOMETER >>>>>           ||
+// **=========================================**
+
+/*
+ * Every motor counts its travel, its time spent moving and its moves, stops
+ * and limit switch contacts. The counts are saved to the key value store under
+ * the ID of the motor followed by ODOMETER_KEY_SUFFIX whenever the position is
+ * saved, but at most every ODOMETER_SAVE_INTERVAL_MS, and published every
+ * ODOMETER_PUBLISH_INTERVAL_MS.
+ */
+#define ODOMETER_KEY_SUFFIX "/odo"
+#define ODOMETER_SAVE_INTERVAL_MS (60 * 60 * 1000)
+#define ODOMETER_PUBLISH_INTERVAL_MS (60 * 60 * 1000)
+
+// **============================================**
+// ||          <<<<< EVENT TRACE >>>>>           ||
+// **============================================**
+
+/*
+ * The categories of events recorded in the trace ring, any of the TRACE_CAT_*
+ * in trace.hh or'ed together. Events of the other categories are compiled out,
+ * 0 leaves only an empty ring. The ring holds TRACE_CAPACITY events of 8 bytes
+ * each, a power of two.
+ */
+#define TRACE_CATEGORIES TRACE_CAT_ALL
+#define TRACE_CAPACITY 512
+
 #endif
@@ -0,0 +1,31 @@
+#ifndef CRC32_HH
+#define CRC32_HH
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Calculates the CRC-32 (IEEE 802.3) of a block of memory.
+ *
+ * Bitwise rather than table driven, everything it guards is small and written
+ * rarely.
+ *
+ * @param data The memory to calculate the CRC of.
+ * @param len The length of the memory in bytes.
+ * @param crc The CRC of the memory in front of `data`, to calculate the CRC of
+ *            several blocks as if they were one.
+ */
+inline uint32_t crc32(const void* data, size_t len, uint32_t crc = 0) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  crc = ~crc;
+
+  for (size_t i = 0; i < len; i++) {
+    crc ^= bytes[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+
+  return ~crc;
+}
+
+#endif
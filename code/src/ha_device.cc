@@ -2,8 +2,9 @@
 
 #include <cyw43_configport.h>
 #include <hardware/gpio.h>
-#include <hardware/watchdog.h>
+#include <limits.h>
 #include <lwip/apps/mqtt.h>
+#include <math.h>
 #include <pico/time.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -11,13 +12,22 @@
 #include <string.h>
 
 #include "action_queue.hh"
+#include "advanced_opts.hh"
 #include "ha_device_info.hh"
+#include "led_pattern.hh"
+#include "logger.hh"
+#include "mem_stats.hh"
 #include "mqtt_topics.hh"
 #include "network.hh"
+#include "timer_wheel.hh"
+#include "opts.hh"
 #include "pico/cyw43_arch.h"
 #include "pins.hh"
+#include "profiler.hh"
+#include "supervisor.hh"
 #include "secrets.hh"
 #include "stepper_motor.hh"
+#include "trace.hh"
 
 #define MQTT_SUBSCRIBE(client, topic, err)                                \
   for (int i = 0; i < 3; i++) {                                           \
@@ -25,20 +35,14 @@
     err = mqtt_sub_unsub(client, topic, 1, mqttSubRequestCb, NULL, true); \
     cyw43_arch_lwip_end();                                                \
     if (err != ERR_OK) {                                                  \
-      printf("Failed to subscribe to %s with error %d\n", topic, err);    \
-      for (int i = 0; i < 2; i++) {                                       \
-        gpio_put(YELLOW_LED_PIN, 1);                                      \
-        sleep_ms(100);                                                    \
-        gpio_put(YELLOW_LED_PIN, 0);                                      \
-        sleep_ms(100);                                                    \
-      }                                                                   \
+      LOG_WARN("Failed to subscribe to %s with error %d\n", topic, err);  \
+      ledPlay(&LED_CODE_SUB_RETRY);                                       \
     } else {                                                              \
-      printf("Succesfully subscribed to %s\n", topic);                    \
-      watchdog_update();                                                  \
+      LOG_INFO("Succesfully subscribed to %s\n", topic);                  \
+      supervisorService();                                                \
       break;                                                              \
     }                                                                     \
-  }                                                                       \
-  sleep_ms(150);
+  }
 
 enum InPub {
   OTHER,
@@ -49,73 +53,404 @@ enum InPub {
   QUIET,
   SOFT_START,
   SPEED,
+  ACCELERATION,
   HOME,
   CALIBRATE,
+  BATCH,
+  SCHEDULE,
+  MEMORY,
+  TRACE_DUMP,
+  PROFILE,
+  ECHO,
 };
 
+// Number of incoming publish IDs.
+#define INPUB_COUNT (ECHO + 1)
+
+// ----- Batch Commands -----
+/*
+ * A batch command is a binary payload of back to back records, each an opcode
+ * byte followed by the big-endian argument of the opcode, if it has one:
+ *
+ *   0x01 OPEN
+ *   0x02 CLOSE
+ *   0x03 MOVE_TO_PERCENT  u8 percent (0 to 100)
+ *   0x04 MOVE_TO_STEP     i32 step
+ *   0x05 HOME
+ *   0x06 CALIBRATE
+ *   0x07 WAIT             u16 milliseconds
+ *
+ * E.g. close, wait 2s, open to 15%: 02 07 07 d0 03 0f
+ */
+#define BATCH_OP_OPEN 0x01
+#define BATCH_OP_CLOSE 0x02
+#define BATCH_OP_MOVE_TO_PERCENT 0x03
+#define BATCH_OP_MOVE_TO_STEP 0x04
+#define BATCH_OP_HOME 0x05
+#define BATCH_OP_CALIBRATE 0x06
+#define BATCH_OP_WAIT 0x07
+
+// ----- Scheduled Commands -----
+/*
+ * A scheduled command is a text payload of the form "<when> <command>":
+ * - when:    "+<seconds>" from now, or "@<unix time>" in seconds once the time
+ *            is known through SNTP. Digits only, at most `TW_MAX_DELAY_MS`
+ *            ahead.
+ * - command: "OPEN", "CLOSE", "PERCENT <percent>" or "STEP <step>", the step
+ *            in digits only.
+ *
+ * E.g. "+600 CLOSE" or "@1767250800 PERCENT 20". "CLEAR" cancels all the
+ * commands scheduled for the window.
+ */
+#define SCHEDULE_PAYLOAD_MAX_LEN 48
+
+// ----- Numeric Commands -----
+// Longest payload of the numeric command topics, e.g. "12.5" for the speed.
+#define NUMBER_PAYLOAD_MAX_LEN 16
+
+// ----- Dumps -----
+// Publishes of a dump chunk that may fail in a row before the dump is given
+// up.
+#define DUMP_MAX_RETRIES 50
+
 // **===============================================**
 // ||          <<<<< STATIC VARIABLES>>>>>          ||
 // **===============================================**
 
-// Stores the ID of the incoming message topic.
+// Stores the ID of the incoming message topic and the window it is for.
 // Used to transfer topic from the incoming topic callback to the incoming data
 // callback.
 static enum InPub inpub_id;
+static stepper_motor::StepperMotor* inpub_window;
+
+// When the incoming publish callback was entered, `time_us_32`. Actions queued
+// for the publish are stamped with it.
+static uint32_t inpub_received_us;
 
 static mqtt_client_t* mqtt_client;
 
-static stepper_motor::StepperMotor* window_sm;
+static stepper_motor::StepperMotor* windows;
+static int window_count;
 
-// **===============================================**
-// ||          <<<<< LED ERROR CODES >>>>>          ||
-// **===============================================**
+// Holds the scheduled commands of all windows until they are due.
+static stepper_motor::action::TimerWheel* timers;
+
+// Discovery topics and messages of the windows, in the same order as
+// `WINDOWS`.
+#define HA_WINDOW_DISCOVERY_TOPIC_ENTRY(index, id, name) \
+  HA_WINDOW_MQTT_DISCOVERY_TOPIC(id),
+#define HA_WINDOW_DISCOVERY_MSG_ENTRY(index, id, name) \
+  HA_WINDOW_MQTT_DISCOVERY_MSG(id, name),
+
+static const char* const window_discovery_topics[] = {
+    WINDOWS(HA_WINDOW_DISCOVERY_TOPIC_ENTRY)};
+static const char* const window_discovery_msgs[] = {
+    WINDOWS(HA_WINDOW_DISCOVERY_MSG_ENTRY)};
+
+// Token buckets rate limiting each command topic of each window. The last row
+// is shared by the topics of unknown windows.
+struct TokenBucket {
+  uint32_t tokens;
+  uint64_t refill_us;  // When the last token was added.
+};
+static struct TokenBucket command_buckets[WINDOW_COUNT + 1][INPUB_COUNT];
+
+// Whether the incoming publish is over the rate limit of its topic.
+static bool inpub_throttled;
+
+// Commands let through and dropped by the rate limits, per window.
+static volatile uint32_t commands_accepted[WINDOW_COUNT];
+static volatile uint32_t commands_dropped[WINDOW_COUNT];
+
+// The window that asked for a memory report, NULL if none is wanted.
+static stepper_motor::StepperMotor* volatile memory_report_window = NULL;
+
+// The window that asked for a trace dump, NULL if none is wanted, and whether
+// the dump goes to USB rather than MQTT.
+static stepper_motor::StepperMotor* volatile trace_dump_window = NULL;
+static volatile bool trace_dump_usb = false;
+
+// The same for a dump of the profiler.
+static stepper_motor::StepperMotor* volatile profile_dump_window = NULL;
+static volatile bool profile_dump_usb = false;
+
+// A dump sent a chunk per main loop round, over MQTT or USB.
+struct ChunkedDump {
+  stepper_motor::StepperMotor* window;  // NULL if no dump is in progress.
+  bool usb;
+  uint16_t seq;
+  uint16_t total;
+  int failures;  // Publishes of the current chunk that failed.
+};
+
+// The bytes a discovery message takes up in the MQTT output ring buffer, with
+// its topic and the MQTT header.
+#define HA_WINDOW_DISCOVERY_PUBLISH_SIZE(id, name)     \
+  (sizeof(HA_WINDOW_MQTT_DISCOVERY_MSG(id, name)) +    \
+   sizeof(HA_WINDOW_MQTT_DISCOVERY_TOPIC(id)) + 8)
+
+// Every discovery message has to fit into the MQTT output ring buffer in one
+// go, or it could never be published.
+#define HA_WINDOW_DISCOVERY_MSG_FITS(index, id, name)                    \
+  static_assert(HA_WINDOW_DISCOVERY_PUBLISH_SIZE(id, name) <=            \
+                    MQTT_OUTPUT_RINGBUF_SIZE,                            \
+                "The discovery message of window " id                    \
+                " doesn't fit into MQTT_OUTPUT_RINGBUF_SIZE");
+WINDOWS(HA_WINDOW_DISCOVERY_MSG_FITS)
 
-// Blue | On;
-// Red  | 3x | 150ms:100ms
-void pubErrLedCode() {
-  gpio_put(BLUE_LED_PIN, 1);
-  for (int i = 0; i < 3; i++) {
-    gpio_put(RED_LED_PIN, 1);
-    sleep_ms(150);
-    gpio_put(RED_LED_PIN, 0);
-    sleep_ms(100);
+#if LWIP_LEAN_PROFILE
+// The lean ring buffer is sized from the discovery message in lwipopts.h.
+#define HA_WINDOW_DISCOVERY_MSG_SIZED(index, id, name)                   \
+  static_assert(HA_WINDOW_DISCOVERY_PUBLISH_SIZE(id, name) <=            \
+                    LEAN_MQTT_DISCOVERY_PUBLISH_SIZE,                    \
+                "The discovery message of window " id                    \
+                " outgrew LEAN_MQTT_DISCOVERY_PUBLISH_SIZE, raise it");
+WINDOWS(HA_WINDOW_DISCOVERY_MSG_SIZED)
+#endif
+
+// **==============================================**
+// ||          <<<<< COMMAND INTAKE >>>>>          ||
+// **==============================================**
+
+/**
+ * Gets whether a command is a STOP, which must always get through.
+ */
+static bool isStopCommand(enum InPub id, const u8_t* data, u16_t len) {
+  return id == GENERAL && len >= 4 && memcmp((char*)data, "STOP", 4) == 0;
+}
+
+/**
+ * Decodes a batch command into actions.
+ *
+ * \param data The batch payload, see `BATCH_OP_OPEN`.
+ * \param len The length of the payload.
+ * \param actions Where to decode the actions to.
+ * \param max_count The most actions to decode.
+ *
+ * \returns The number of actions decoded, or -1 if the payload is malformed or
+ * holds more than `max_count` actions.
+ */
+static int decodeBatch(const u8_t* data, u16_t len,
+                       stepper_motor::action::Action* actions, int max_count) {
+  using namespace stepper_motor::action;
+
+  int count = 0;
+  u16_t i = 0;
+  while (i < len) {
+    if (count >= max_count) return -1;
+    Action* action = &actions[count++];
+    action->data.null = 0;
+
+    switch (data[i++]) {
+      case BATCH_OP_OPEN:
+        action->action_type = ActionType::OPEN;
+        break;
+      case BATCH_OP_CLOSE:
+        action->action_type = ActionType::CLOSE;
+        break;
+      case BATCH_OP_MOVE_TO_PERCENT:
+        if (len - i < 1) return -1;
+        action->action_type = ActionType::MOVE_TO_PERCENT;
+        action->data.percent = CLAMP(0.0, (float)data[i], 100.0);
+        i += 1;
+        break;
+      case BATCH_OP_MOVE_TO_STEP:
+        if (len - i < 4) return -1;
+        action->action_type = ActionType::MOVE_TO_STEP;
+        action->data.step = (int32_t)(
+            ((uint32_t)data[i] << 24) | ((uint32_t)data[i + 1] << 16) |
+            ((uint32_t)data[i + 2] << 8) | (uint32_t)data[i + 3]);
+        i += 4;
+        break;
+      case BATCH_OP_HOME:
+        action->action_type = ActionType::HOME;
+        break;
+      case BATCH_OP_CALIBRATE:
+        action->action_type = ActionType::CALIBRATE;
+        break;
+      case BATCH_OP_WAIT:
+        if (len - i < 2) return -1;
+        action->action_type = ActionType::WAIT;
+        action->data.duration_ms = ((uint32_t)data[i] << 8) | data[i + 1];
+        i += 2;
+        break;
+      default:
+        return -1;
+    }
   }
-  gpio_put(BLUE_LED_PIN, 0);
+
+  return count;
 }
 
-// Blue   | On;
-// Yellow | 3x | 150ms:100ms
-void subErrLedCode() {
-  gpio_put(BLUE_LED_PIN, 1);
-  for (int i = 0; i < 3; i++) {
-    gpio_put(YELLOW_LED_PIN, 1);
-    sleep_ms(150);
-    gpio_put(YELLOW_LED_PIN, 0);
-    sleep_ms(100);
+/**
+ * Parses the payload of a numeric command. The payload isn't NUL terminated,
+ * so it's copied out first.
+ *
+ * \param data The payload.
+ * \param len The length of the payload.
+ * \param value Where to store the number.
+ *
+ * \returns Whether the payload was a number and nothing else.
+ */
+static bool parseNumber(const u8_t* data, u16_t len, float* value) {
+  char payload[NUMBER_PAYLOAD_MAX_LEN];
+  if (len == 0 || len >= sizeof(payload)) return false;
+  memcpy(payload, data, len);
+  payload[len] = '\0';
+
+  char* end;
+  *value = strtof(payload, &end);
+  return end != payload && *end == '\0' && isfinite(*value);
+}
+
+/**
+ * Parses a decimal number made of digits only, without a sign or white space.
+ *
+ * \param str The digits, followed by anything else.
+ * \param max The largest number allowed.
+ * \param value Where to store the number.
+ *
+ * \returns Where the digits end, or NULL if there are none or the number is
+ * larger than `max`.
+ */
+static const char* parseDigits(const char* str, uint64_t max,
+                               uint64_t* value) {
+  const char* end = str;
+  *value = 0;
+  while ('0' <= *end && *end <= '9') {
+    uint64_t digit = *end - '0';
+    if (*value > (max - digit) / 10) return NULL;
+    *value = *value * 10 + digit;
+    end++;
+  }
+
+  return (end == str) ? NULL : end;
+}
+
+/**
+ * Parses a scheduled command.
+ *
+ * \param payload The NUL terminated payload, see `SCHEDULE_PAYLOAD_MAX_LEN`.
+ * \param action Where to store the action to schedule.
+ * \param delay_ms Where to store how long from now the action is due.
+ *
+ * \returns Whether the payload was valid. An absolute time is invalid while the
+ * time of day isn't known yet, and so is a time more than `TW_MAX_DELAY_MS`
+ * ahead.
+ */
+static bool parseSchedule(const char* payload,
+                          stepper_motor::action::Action* action,
+                          uint64_t* delay_ms) {
+  using namespace stepper_motor::action;
+
+  // --- When ---
+  const char* end;
+  uint64_t seconds;
+  if (payload[0] == '+') {
+    end = parseDigits(payload + 1, TW_MAX_DELAY_MS / 1000, &seconds);
+    *delay_ms = seconds * 1000;
+  } else if (payload[0] == '@') {
+    end = parseDigits(payload + 1, UINT64_MAX / 1000, &seconds);
+    uint64_t now_ms;
+    if (!getUnixTimeMs(&now_ms)) return false;
+    *delay_ms = (seconds * 1000 > now_ms) ? seconds * 1000 - now_ms : 0;
+  } else {
+    return false;
   }
-  gpio_put(BLUE_LED_PIN, 0);
+  if (end == NULL || *end != ' ' || *delay_ms > TW_MAX_DELAY_MS) return false;
+  const char* command = end + 1;
+
+  // --- Command ---
+  action->data.null = 0;
+  if (strcmp(command, "OPEN") == 0) {
+    action->action_type = ActionType::OPEN;
+  } else if (strcmp(command, "CLOSE") == 0) {
+    action->action_type = ActionType::CLOSE;
+  } else if (strncmp(command, "PERCENT ", 8) == 0) {
+    float percent;
+    if (command[8] == ' ' ||
+        !parseNumber((const u8_t*)command + 8, strlen(command + 8), &percent))
+      return false;
+    action->action_type = ActionType::MOVE_TO_PERCENT;
+    action->data.percent = CLAMP(0.0, percent, 100.0);
+  } else if (strncmp(command, "STEP ", 5) == 0) {
+    uint64_t step;
+    end = parseDigits(command + 5, INT64_MAX, &step);
+    if (end == NULL || *end != '\0') return false;
+    action->action_type = ActionType::MOVE_TO_STEP;
+    action->data.step = step;
+  } else {
+    return false;
+  }
+
+  return true;
 }
 
-// Blue | 5x | 100ms:50ms
-void connectionErrLedCode() {
-  for (int i = 0; i < 3; i++) {
-    gpio_put(BLUE_LED_PIN, 1);
-    sleep_ms(100);
-    gpio_put(BLUE_LED_PIN, 0);
-    sleep_ms(50);
+/**
+ * Takes a token from a bucket, first adding the tokens that accumulated since
+ * the last time.
+ *
+ * \param bucket The bucket.
+ * \param now_us The current time in micro seconds since boot.
+ * \param burst The most tokens the bucket holds.
+ * \param refill_ms How often a token is added, in milli seconds.
+ *
+ * \returns Whether there was a token to take.
+ */
+static bool takeToken(struct TokenBucket* bucket, uint64_t now_us,
+                      uint32_t burst, uint32_t refill_ms) {
+  const uint64_t refill_us = refill_ms * 1000ULL;
+
+  uint64_t refills = (now_us - bucket->refill_us) / refill_us;
+  if (refills > 0) {
+    bucket->tokens = MIN(bucket->tokens + refills, burst);
+    bucket->refill_us += refills * refill_us;
   }
+
+  if (bucket->tokens == 0) return false;
+
+  // A full bucket doesn't accumulate any more, so the refill starts over from
+  // the first token taken.
+  if (bucket->tokens == burst) bucket->refill_us = now_us;
+  bucket->tokens--;
+  return true;
 }
 
-// Blue + Yellow | 3x | 150ms:100ms
-void pubDiscoveryMsgErrLedCode() {
-  for (int i = 0; i < 3; i++) {
-    gpio_put(BLUE_LED_PIN, 1);
-    gpio_put(YELLOW_LED_PIN, 1);
-    sleep_ms(150);
-    gpio_put(BLUE_LED_PIN, 0);
-    gpio_put(YELLOW_LED_PIN, 0);
-    sleep_ms(100);
+/**
+ * Gets the index of a window, or `window_count` for no window.
+ */
+static int getWindowIndex(stepper_motor::StepperMotor* window) {
+  return (window == NULL) ? window_count : (int)(window - windows);
+}
+
+/**
+ * Queues an action for a window, reporting it back over MQTT if it can't be
+ * queued.
+ */
+static bool enqueueAction(stepper_motor::StepperMotor* window,
+                          stepper_motor::action::Action action) {
+  action.received_us = inpub_received_us;
+  if (window->action_queue.enqueue(action)) {
+    TRACE(TRACE_CAT_COMMAND, TRACE_COMMAND_ENQUEUED, getWindowIndex(window),
+          action.action_type);
+    return true;
   }
+
+  TRACE(TRACE_CAT_COMMAND, TRACE_COMMAND_REJECTED, getWindowIndex(window),
+        action.action_type);
+  LOG_WARN("[%s] Action queue full, rejecting %s.\n", window->getId(),
+           stepper_motor::action::getActionTypeName(action.action_type));
+  window->publishRejectedAction(action.action_type);
+  return false;
+}
+
+static bool enqueueAction(stepper_motor::StepperMotor* window,
+                          stepper_motor::action::ActionType action_type) {
+  stepper_motor::action::Action action;
+  action.action_type = action_type;
+  action.data.null = 0;
+
+  return enqueueAction(window, action);
 }
 
 // **===============================================**
@@ -126,54 +461,130 @@ void pubDiscoveryMsgErrLedCode() {
 
 /* Called when publish is complete either with success or failure */
 static void mqttPubRequestCb(void* arg, err_t result) {
+  TRACE_LWIP_SCOPE(TRACE_CB_PUBLISH_REQUEST);
+  TRACE(TRACE_CAT_PUBLISH, TRACE_PUBLISH_RESULT, 0, result);
+
   if (result != ERR_OK) {
-    printf("Publish result: %d\n", result);
-    pubErrLedCode();
+    LOG_ERROR("Publish result: %d\n", result);
+    ledPlay(&LED_CODE_PUB_ERR);
   }
 }
 
 static void mqttSubRequestCb(void* arg, err_t result) {
+  TRACE_LWIP_SCOPE(TRACE_CB_SUBSCRIBE_REQUEST);
+
   if (result != ERR_OK) {
-    printf("Publish result: %d\n", result);
-    subErrLedCode();
+    LOG_ERROR("Subscribe result: %d\n", result);
+    ledPlay(&LED_CODE_SUB_ERR);
   } else {
-    watchdog_update();
+    supervisorService();
   }
 }
 
-static void mqttIncomingPublishCb(void* arg, const char* topic, u32_t tot_len) {
-  printf("Incoming publish at topic %s with total length %u\n", topic,
-         (unsigned int)tot_len);
+/**
+ * Finds the window and the command an incoming publish topic is for and stores
+ * them in `inpub_window` and `inpub_id`.
+ */
+static void decodeInpubTopic(const char* topic) {
+  inpub_id = OTHER;
+  inpub_window = NULL;
+
+  // Topics are of the form <base><window id>/<subtopic>.
+  if (strncmp(topic, MQTT_TOPIC_BASE, strlen(MQTT_TOPIC_BASE)) != 0) return;
+  const char* window_id = topic + strlen(MQTT_TOPIC_BASE);
+  const char* subtopic = strchr(window_id, '/');
+  if (subtopic == NULL) return;
+  size_t window_id_len = subtopic - window_id;
+  subtopic++;
 
-  /* Decode topic string into a user defined reference */
-  if (strcmp(topic, MQTT_TOPIC_COMMAND_GENERAL) == 0) {
+  // Find the window the topic is for.
+  for (int i = 0; i < window_count; i++) {
+    const char* id = windows[i].getId();
+    if (strlen(id) == window_id_len &&
+        strncmp(id, window_id, window_id_len) == 0) {
+      inpub_window = &windows[i];
+      break;
+    }
+  }
+  if (inpub_window == NULL) return;
+
+  /* Decode subtopic string into a user defined reference */
+  if (strcmp(subtopic, MQTT_SUBTOPIC_COMMAND_GENERAL) == 0) {
     inpub_id = GENERAL;
-  } else if (strcmp(topic, MQTT_TOPIC_COMMAND_POSITION_PERCENT) == 0) {
+  } else if (strcmp(subtopic, MQTT_SUBTOPIC_COMMAND_POSITION_PERCENT) == 0) {
     inpub_id = POSITION_PERCENT;
-  } else if (strcmp(topic, MQTT_TOPIC_COMMAND_POSITION_STEPS) == 0) {
+  } else if (strcmp(subtopic, MQTT_SUBTOPIC_COMMAND_POSITION_STEPS) == 0) {
     inpub_id = POSITION_STEPS;
-  } else if (strcmp(topic, MQTT_TOPIC_COMMAND_POSITION_MM) == 0) {
+  } else if (strcmp(subtopic, MQTT_SUBTOPIC_COMMAND_POSITION_MM) == 0) {
     inpub_id = POSITION_MM;
-  } else if (strcmp(topic, MQTT_TOPIC_COMMAND_QUIET) == 0) {
+  } else if (strcmp(subtopic, MQTT_SUBTOPIC_COMMAND_QUIET) == 0) {
     inpub_id = QUIET;
-  } else if (strcmp(topic, MQTT_TOPIC_COMMAND_SOFT_START) == 0) {
+  } else if (strcmp(subtopic, MQTT_SUBTOPIC_COMMAND_SOFT_START) == 0) {
     inpub_id = SOFT_START;
-  } else if (strcmp(topic, MQTT_TOPIC_COMMAND_SPEED) == 0) {
+  } else if (strcmp(subtopic, MQTT_SUBTOPIC_COMMAND_SPEED) == 0) {
     inpub_id = SPEED;
-  } else if (strcmp(topic, MQTT_TOPIC_COMMAND_HOME) == 0) {
+  } else if (strcmp(subtopic, MQTT_SUBTOPIC_COMMAND_ACCELERATION) == 0) {
+    inpub_id = ACCELERATION;
+  } else if (strcmp(subtopic, MQTT_SUBTOPIC_COMMAND_HOME) == 0) {
     inpub_id = HOME;
-  } else if (strcmp(topic, MQTT_TOPIC_COMMAND_CALIBRATE) == 0) {
+  } else if (strcmp(subtopic, MQTT_SUBTOPIC_COMMAND_CALIBRATE) == 0) {
     inpub_id = CALIBRATE;
+  } else if (strcmp(subtopic, MQTT_SUBTOPIC_COMMAND_BATCH) == 0) {
+    inpub_id = BATCH;
+  } else if (strcmp(subtopic, MQTT_SUBTOPIC_COMMAND_SCHEDULE) == 0) {
+    inpub_id = SCHEDULE;
+  } else if (strcmp(subtopic, MQTT_SUBTOPIC_COMMAND_MEMORY) == 0) {
+    inpub_id = MEMORY;
+  } else if (strcmp(subtopic, MQTT_SUBTOPIC_COMMAND_TRACE) == 0) {
+    inpub_id = TRACE_DUMP;
+  } else if (strcmp(subtopic, MQTT_SUBTOPIC_COMMAND_PROFILE) == 0) {
+    inpub_id = PROFILE;
+  } else if (strcmp(subtopic, MQTT_SUBTOPIC_COMMAND_ECHO) == 0) {
+    inpub_id = ECHO;
   } else {
     /* For all other topics */
     inpub_id = OTHER;
   }
 }
 
+static void mqttIncomingPublishCb(void* arg, const char* topic, u32_t tot_len) {
+  inpub_received_us = time_us_32();
+  TRACE_LWIP_SCOPE(TRACE_CB_INCOMING_PUBLISH);
+
+  decodeInpubTopic(topic);
+
+  // Commands over the rate limit of their topic are dropped before any more
+  // work is done on them.
+  struct TokenBucket* bucket =
+      &command_buckets[getWindowIndex(inpub_window)][inpub_id];
+  if (inpub_id == ECHO)
+    inpub_throttled = !takeToken(bucket, time_us_64(), MQTT_ECHO_BURST,
+                                 MQTT_ECHO_REFILL_MS);
+  else
+    inpub_throttled = !takeToken(bucket, time_us_64(), MQTT_COMMAND_BURST,
+                                 MQTT_COMMAND_REFILL_MS);
+  if (inpub_throttled) return;
+
+  LOG_DEBUG("Incoming publish for window %d, command %d, total length %u\n",
+            getWindowIndex(inpub_window), (int)inpub_id, (unsigned int)tot_len);
+}
+
 static void mqttIncomingDataCb(void* arg, const u8_t* data, u16_t len,
                                u8_t flags) {
-  printf("Incoming publish payload with length %d, flags %u\n", len,
-         (unsigned int)flags);
+  TRACE_LWIP_SCOPE(TRACE_CB_INCOMING_DATA);
+
+  // Drop throttled commands, except for STOP which must always get through.
+  if (inpub_throttled && !isStopCommand(inpub_id, data, len)) {
+    if ((flags & MQTT_DATA_FLAG_LAST) && inpub_window != NULL) {
+      commands_dropped[getWindowIndex(inpub_window)]++;
+      TRACE(TRACE_CAT_COMMAND, TRACE_COMMAND_DROPPED,
+            getWindowIndex(inpub_window), inpub_id);
+    }
+    return;
+  }
+
+  LOG_DEBUG("Incoming publish payload with length %d, flags %u\n", len,
+            (unsigned int)flags);
 
   if (flags & MQTT_DATA_FLAG_LAST) {
     /* Last fragment of payload received (or whole part if payload fits receive
@@ -181,21 +592,28 @@ static void mqttIncomingDataCb(void* arg, const u8_t* data, u16_t len,
 
     /* Call function or do action depending on reference, in this case inpub_id
      */
+    stepper_motor::StepperMotor* window_sm = inpub_window;
+    if (window_sm == NULL) inpub_id = OTHER;
+
+    if (window_sm != NULL) {
+      commands_accepted[getWindowIndex(window_sm)]++;
+      TRACE(TRACE_CAT_COMMAND, TRACE_COMMAND_RECEIVED,
+            getWindowIndex(window_sm), inpub_id);
+    }
+
     switch (inpub_id) {
       case GENERAL: {
         if (len >= 4 && memcmp((char*)data, "OPEN", 4) == 0) {
-          window_sm->action_queue.enqueue(
-              stepper_motor::action::ActionType::OPEN);
-          printf("Opening...\n");
+          enqueueAction(window_sm, stepper_motor::action::ActionType::OPEN);
+          LOG_INFO("Opening...\n");
 
         } else if (len >= 5 && memcmp((char*)data, "CLOSE", 5) == 0) {
-          window_sm->action_queue.enqueue(
-              stepper_motor::action::ActionType::CLOSE);
-          printf("Closing...\n");
+          enqueueAction(window_sm, stepper_motor::action::ActionType::CLOSE);
+          LOG_INFO("Closing...\n");
         } else if (len >= 4 && memcmp((char*)data, "STOP", 4) == 0) {
-          window_sm->stop();
+          window_sm->requestStop();
         } else {
-          printf("Unknown general command\n");
+          LOG_WARN("Unknown general command\n");
         }
 
         break;
@@ -203,7 +621,7 @@ static void mqttIncomingDataCb(void* arg, const u8_t* data, u16_t len,
       case POSITION_PERCENT: {
         using namespace stepper_motor::action;
 
-        printf("Move to percentage position command recieved.\n");
+        LOG_INFO("Move to percentage position command recieved.\n");
 
         // Parse the percentage integer from the data (a float is not expected
         // from HA).
@@ -222,14 +640,14 @@ static void mqttIncomingDataCb(void* arg, const u8_t* data, u16_t len,
         action.data.percent = CLAMP(0.0, (float)percent_constructor, 100.0);
 
         // Enqueue the constructed action.
-        window_sm->action_queue.enqueue(action);
+        enqueueAction(window_sm, action);
 
         break;
       }
       case POSITION_STEPS: {
         using namespace stepper_motor::action;
 
-        printf("Move to step position command recieved.\n");
+        LOG_INFO("Move to step position command recieved.\n");
 
         // Create an action.
         Action action;
@@ -245,101 +663,207 @@ static void mqttIncomingDataCb(void* arg, const u8_t* data, u16_t len,
         }
 
         // Enqueue the constructed action.
-        window_sm->action_queue.enqueue(action);
+        enqueueAction(window_sm, action);
 
         break;
       }
       case POSITION_MM: {
-        /* Don't trust the publisher, check zero termination */
-        if (data[len - 1] == 0) {
-          printf("mqtt_incoming_data_cb: %s\n", (const char*)data);
-        }
-        printf("TODO: Do position mm command stuff\n");
+        LOG_WARN("TODO: Do position mm command stuff\n");
         break;
       }
       case QUIET: {
         if (len >= 2 && memcmp((char*)data, "ON", 2) == 0) {
-          printf("Enabling quiet mode.\n");
-          window_sm->setQuietMode(true);
+          LOG_INFO("Enabling quiet mode.\n");
+          window_sm->control.config.edit()->quiet_mode = true;
+          window_sm->control.config.publish();
         } else if (len >= 3 && memcmp((char*)data, "OFF", 3) == 0) {
-          printf("Disabling quiet mode.\n");
-          window_sm->setQuietMode(false);
+          LOG_INFO("Disabling quiet mode.\n");
+          window_sm->control.config.edit()->quiet_mode = false;
+          window_sm->control.config.publish();
         }
 
         break;
       }
       case SOFT_START: {
         if (len >= 2 && memcmp((char*)data, "ON", 2) == 0) {
-          printf("Enabling soft start mode.\n");
-          window_sm->setSoftStartMode(true);
+          LOG_INFO("Enabling soft start mode.\n");
+          window_sm->control.config.edit()->soft_start_mode = true;
+          window_sm->control.config.publish();
         } else if (len >= 3 && memcmp((char*)data, "OFF", 3) == 0) {
-          printf("Disabling soft start mode.\n");
-          window_sm->setSoftStartMode(false);
+          LOG_INFO("Disabling soft start mode.\n");
+          window_sm->control.config.edit()->soft_start_mode = false;
+          window_sm->control.config.publish();
         }
 
         break;
       }
       case SPEED: {
-        float new_speed = MAX((atof((char*)data)), 0.01);
-        window_sm->setSpeed(new_speed);
-        printf("Setting motor speed to %f (requested speed: %f)\n",
-               window_sm->getSpeed(), new_speed);
+        float new_speed;
+        if (!parseNumber(data, len, &new_speed) || new_speed < 0.01) {
+          LOG_WARN("Invalid speed command\n");
+          break;
+        }
+        window_sm->control.config.edit()->speed = new_speed;
+        window_sm->control.config.publish();
+        LOG_INFO("Requesting motor speed %f\n", new_speed);
+        break;
+      }
+      case ACCELERATION: {
+        // Home Assistant may send a whole number as e.g. "5.0".
+        float value;
+        if (!parseNumber(data, len, &value) || value < 1 || value > INT_MAX) {
+          LOG_WARN("Invalid acceleration command\n");
+          break;
+        }
+        int new_acceleration = (int)value;
+        window_sm->control.config.edit()->acceleration = new_acceleration;
+        window_sm->control.config.publish();
+        LOG_INFO("Requesting soft start acceleration %d\n", new_acceleration);
         break;
       }
       case HOME: {
-        printf("Home command recieved.\n");
+        LOG_INFO("Home command recieved.\n");
         if (len >= 5 && memcmp((char*)data, "PRESS", 5) == 0)
-          window_sm->action_queue.enqueue(
-              stepper_motor::action::ActionType::HOME);
+          enqueueAction(window_sm, stepper_motor::action::ActionType::HOME);
         break;
       }
       case CALIBRATE: {
-        printf("Calibrate command recieved.\n");
+        LOG_INFO("Calibrate command recieved.\n");
         if (len >= 5 && memcmp((char*)data, "PRESS", 5) == 0)
-          window_sm->action_queue.enqueue(
-              stepper_motor::action::ActionType::CALIBRATE);
+          enqueueAction(window_sm,
+                        stepper_motor::action::ActionType::CALIBRATE);
+        break;
+      }
+      case BATCH: {
+        using namespace stepper_motor::action;
+
+        Action actions[AQ_CAPACITY];
+        int count = decodeBatch(data, len, actions, AQ_CAPACITY);
+        if (count < 0) {
+          LOG_WARN("Malformed batch command\n");
+          break;
+        }
+
+        for (int i = 0; i < count; i++)
+          actions[i].received_us = inpub_received_us;
+
+        // The whole batch is queued or none of it is.
+        if (count > 0 && !window_sm->action_queue.enqueueAll(actions, count)) {
+          TRACE(TRACE_CAT_COMMAND, TRACE_COMMAND_REJECTED,
+                getWindowIndex(window_sm), actions[0].action_type);
+          LOG_WARN("[%s] Action queue full, rejecting batch of %d.\n",
+                   window_sm->getId(), count);
+          window_sm->publishRejectedAction(actions[0].action_type);
+          break;
+        }
+
+        for (int i = 0; i < count; i++)
+          TRACE(TRACE_CAT_COMMAND, TRACE_COMMAND_ENQUEUED,
+                getWindowIndex(window_sm), actions[i].action_type);
+        break;
+      }
+      case SCHEDULE: {
+        using namespace stepper_motor::action;
+
+        char payload[SCHEDULE_PAYLOAD_MAX_LEN];
+        if (len >= sizeof(payload)) break;
+        memcpy(payload, data, len);
+        payload[len] = '\0';
+
+        if (strcmp(payload, "CLEAR") == 0) {
+          int cancelled = timers->cancel(&window_sm->action_queue);
+          LOG_INFO("[%s] Cancelled %d scheduled commands.\n",
+                   window_sm->getId(), cancelled);
+          break;
+        }
+
+        Action action;
+        uint64_t delay_ms;
+        if (!parseSchedule(payload, &action, &delay_ms)) {
+          LOG_WARN("Malformed or unschedulable command\n");
+          break;
+        }
+
+        if (timers->schedule(&window_sm->action_queue, action, delay_ms)) {
+          LOG_INFO("[%s] Scheduled %s in %llums.\n", window_sm->getId(),
+                   getActionTypeName(action.action_type), delay_ms);
+        } else {
+          LOG_WARN("[%s] Too many scheduled commands, rejecting %s.\n",
+                   window_sm->getId(), getActionTypeName(action.action_type));
+          window_sm->publishRejectedAction(action.action_type);
+        }
+        break;
+      }
+      case MEMORY: {
+        if (len >= 5 && memcmp((char*)data, "PRESS", 5) == 0)
+          memory_report_window = window_sm;
+        break;
+      }
+      case TRACE_DUMP: {
+        // "DUMP" publishes the trace ring, "USB" prints it.
+        if (len >= 4 && memcmp((char*)data, "DUMP", 4) == 0) {
+          trace_dump_usb = false;
+          trace_dump_window = window_sm;
+        } else if (len >= 3 && memcmp((char*)data, "USB", 3) == 0) {
+          trace_dump_usb = true;
+          trace_dump_window = window_sm;
+        }
+        break;
+      }
+      case PROFILE: {
+        // "START" and "STOP" sampling, "DUMP" publishes the samples and "USB"
+        // prints them, both stop sampling first.
+        if (len >= 5 && memcmp((char*)data, "START", 5) == 0) {
+          LOG_INFO("Profiler started.\n");
+          profilerStart();
+        } else if (len >= 4 && memcmp((char*)data, "STOP", 4) == 0) {
+          profilerStop();
+        } else if (len >= 4 && memcmp((char*)data, "DUMP", 4) == 0) {
+          profilerStop();
+          profile_dump_usb = false;
+          profile_dump_window = window_sm;
+        } else if (len >= 3 && memcmp((char*)data, "USB", 3) == 0) {
+          profilerStop();
+          profile_dump_usb = true;
+          profile_dump_window = window_sm;
+        }
+        break;
+      }
+      case ECHO: {
+        // Sent straight back from the callback, so that Home Assistant can
+        // time the round trip through the broker without the main loop in it.
+        // Probes are only ever dropped by their own rate limit.
+        window_sm->basicMqttPublish(MQTT_SUBTOPIC_SENSOR_ECHO, data, len, 0, 0);
         break;
       }
       case OTHER: {
-        printf("mqtt_incoming_data_cb: Ignoring payload...\n");
+        LOG_DEBUG("mqtt_incoming_data_cb: Ignoring payload...\n");
         break;
       }
     }
   } else {
     /* Handle fragmented payload, store in buffer, write to file or whatever */
-    printf("TODO: Handel fragmented MQTT payloads.\n");
+    LOG_WARN("TODO: Handel fragmented MQTT payloads.\n");
   }
 }
 
 static void mqttConnectionCb(mqtt_client_t* client, void* arg,
                              mqtt_connection_status_t status) {
+  TRACE_LWIP_SCOPE(TRACE_CB_CONNECTION);
+  TRACE(TRACE_CAT_LINK, TRACE_MQTT_CONNECTION, 0, status);
+
   err_t err;
   if (status == MQTT_CONNECT_ACCEPTED) {
     // Setup callback for incoming publish requests.
     mqtt_set_inpub_callback(client, mqttIncomingPublishCb, mqttIncomingDataCb,
                             arg);
 
-    // Subscribe to topics.
-    MQTT_SUBSCRIBE(client, MQTT_TOPIC_COMMAND_GENERAL, err);
-    MQTT_SUBSCRIBE(client, MQTT_TOPIC_COMMAND_SPEED, err)
-    MQTT_SUBSCRIBE(client, MQTT_TOPIC_COMMAND_QUIET, err)
-    MQTT_SUBSCRIBE(client, MQTT_TOPIC_COMMAND_SOFT_START, err)
-    MQTT_SUBSCRIBE(client, MQTT_TOPIC_COMMAND_POSITION_MM, err)
-    MQTT_SUBSCRIBE(client, MQTT_TOPIC_COMMAND_POSITION_STEPS, err)
-    MQTT_SUBSCRIBE(client, MQTT_TOPIC_COMMAND_POSITION_PERCENT, err)
-    MQTT_SUBSCRIBE(client, MQTT_TOPIC_COMMAND_HOME, err)
-    MQTT_SUBSCRIBE(client, MQTT_TOPIC_COMMAND_CALIBRATE, err)
+    // Subscribe to the command topics of all windows.
+    MQTT_SUBSCRIBE(client, MQTT_TOPIC_COMMAND_ALL_WINDOWS, err);
 
   } else {
     // On error, blink error code and try to reconnect.
-    for (int i = 0; i < 2; i++) {
-      gpio_put(RED_LED_PIN, 1);
-      gpio_put(YELLOW_LED_PIN, 1);
-      sleep_ms(200);
-      gpio_put(RED_LED_PIN, 0);
-      gpio_put(YELLOW_LED_PIN, 0);
-      sleep_ms(100);
-    }
+    ledPlay(&LED_CODE_MQTT_CONNECT_ERR);
     mqttDoConnect(client);
   }
 }
@@ -377,19 +901,18 @@ bool mqttDoConnect(mqtt_client_t* client) {
   if (err != ERR_OK) {
     switch (err) {
       case ERR_RTE:
-        printf("MQTT ERROR: Routing problem.\n");
+        LOG_WARN("MQTT ERROR: Routing problem.\n");
         break;
       default:
-        printf("mqtt_connect return %d\n", err);
+        LOG_WARN("mqtt_connect return %d\n", err);
         break;
     }
-    printf("Wifi connection status: %d\n",
-           cyw43_wifi_link_status(&cyw43_state, CYW43_ITF_STA));
-    if (cyw43_wifi_link_status(&cyw43_state, CYW43_ITF_STA) != CYW43_LINK_JOIN)
-      wifiConnect();
+    LOG_INFO("Wifi connection status: %d\n",
+             cyw43_wifi_link_status(&cyw43_state, CYW43_ITF_STA));
 
-    connectionErrLedCode();
-    sleep_ms(200);
+    // Rejoining the Wi-Fi network is left to the caller, this may be called
+    // from the connection callback where nothing may wait on the network.
+    ledPlay(&LED_CODE_CONNECTION_ERR);
   }
 
   return (err == ERR_OK);
@@ -400,35 +923,52 @@ bool mqttDoConnect(mqtt_client_t* client) {
 // **===================================================**
 
 /**
- * Sets-up the home assistant device by sending the MQTT discovery message and
- * publishing that the device is available.
+ * Sets-up the home assistant devices by sending the MQTT discovery message of
+ * each window and publishing that the device is available.
  *
  * \param client The MQTT client to use to publish the messages.
- * \param sm The stepper motor for the window.
+ * \param sms The stepper motors of the windows, in the order of `WINDOWS`.
+ * \param count The number of windows.
+ * \param timer_wheel The timer wheel to hold scheduled commands in. Must only
+ * be ticked while holding the lwIP lock.
  */
-void haDeviceSetup(mqtt_client_t* client, stepper_motor::StepperMotor* sm) {
-  char buf[64];
-  window_sm = sm;
+void haDeviceSetup(mqtt_client_t* client, stepper_motor::StepperMotor* sms,
+                   int count, stepper_motor::action::TimerWheel* timer_wheel) {
+  windows = sms;
+  window_count = count;
+  timers = timer_wheel;
   err_t err;
 
-  // HA Device Discovery Message.
-  do {
-    cyw43_arch_lwip_begin();
-    {
-      const char* pub_payload = HA_DEVICE_MQTT_DISCOVERY_MSG;
-      u8_t qos = 1;    /* 0 1 or 2, see MQTT specification */
-      u8_t retain = 1; /* Retain discovery message for if/when HA restarts. */
-      err = mqtt_publish(client, HA_DEVICE_MQTT_DISCOVERY_TOPIC, pub_payload,
-                         strlen(pub_payload), qos, retain, mqttPubRequestCb,
-                         NULL);
-      if (err != ERR_OK) {
-        printf("Discovery Message Publish err: %d\n", err);
-        pubDiscoveryMsgErrLedCode();
-      }
+  // Start every command topic with a full burst.
+  for (int i = 0; i <= WINDOW_COUNT; i++) {
+    for (int j = 0; j < INPUB_COUNT; j++) {
+      command_buckets[i][j].tokens =
+          (j == ECHO) ? MQTT_ECHO_BURST : MQTT_COMMAND_BURST;
+      command_buckets[i][j].refill_us = time_us_64();
     }
-    cyw43_arch_lwip_end();
-    if (err != ERR_OK) sleep_ms(300);
-  } while (err != ERR_OK);
+  }
+
+  // HA Device Discovery Message, one device per window.
+  for (int i = 0; i < window_count; i++) {
+    do {
+      cyw43_arch_lwip_begin();
+      {
+        const char* pub_payload = window_discovery_msgs[i];
+        u8_t qos = 1;    /* 0 1 or 2, see MQTT specification */
+        u8_t retain = 1; /* Retain discovery message for if/when HA restarts. */
+        err = mqtt_publish(client, window_discovery_topics[i], pub_payload,
+                           strlen(pub_payload), qos, retain, mqttPubRequestCb,
+                           NULL);
+        if (err != ERR_OK) {
+          printf("Discovery Message Publish err: %d\n", err);
+          ledPlay(&LED_CODE_PUB_DISCOVERY_MSG_ERR);
+        }
+      }
+      cyw43_arch_lwip_end();
+      if (err != ERR_OK) networkSleepMs(300);
+    } while (err != ERR_OK);
+    supervisorService();
+  }
 
   // Make device available in home assistant.
   do {
@@ -442,14 +982,142 @@ void haDeviceSetup(mqtt_client_t* client, stepper_motor::StepperMotor* sm) {
                          NULL);
       if (err != ERR_OK) {
         printf("Availability Message Publish err: %d\n", err);
-        pubErrLedCode();
+        ledPlay(&LED_CODE_PUB_ERR);
       }
     }
     cyw43_arch_lwip_end();
-    if (err != ERR_OK) sleep_ms(300);
+    if (err != ERR_OK) networkSleepMs(300);
   } while (err != ERR_OK);
 
   // Publish device states.
-  window_sm->publish_updates = true;
-  window_sm->publishAll();
+  for (int i = 0; i < window_count; i++) {
+    windows[i].publish_updates = true;
+    windows[i].publishAll();
+  }
+}
+
+/**
+ * Publishes how many commands each window let through and dropped, if that
+ * changed since the last time. Does nothing if the last publish was less than
+ * `MQTT_COMMAND_STATS_INTERVAL_MS` ago, so it can be called every main loop.
+ */
+void haPublishCommandStats() {
+  static uint64_t last_publish_us = 0;
+  static uint32_t published_accepted[WINDOW_COUNT];
+  static uint32_t published_dropped[WINDOW_COUNT];
+
+  uint64_t now_us = time_us_64();
+  if (now_us - last_publish_us < MQTT_COMMAND_STATS_INTERVAL_MS * 1000ULL)
+    return;
+  last_publish_us = now_us;
+
+  for (int i = 0; i < window_count; i++) {
+    uint32_t accepted = commands_accepted[i];
+    uint32_t dropped = commands_dropped[i];
+    if (accepted == published_accepted[i] && dropped == published_dropped[i])
+      continue;
+
+    char buf[48];
+    snprintf(buf, sizeof(buf), "{\"accepted\":%lu,\"dropped\":%lu}",
+             (unsigned long)accepted, (unsigned long)dropped);
+    if (windows[i].basicMqttPublish(MQTT_SUBTOPIC_SENSOR_COMMAND_STATS, buf, 0,
+                                    0)) {
+      published_accepted[i] = accepted;
+      published_dropped[i] = dropped;
+    }
+  }
+}
+
+/**
+ * Publishes the memory report to the window that asked for one, if any. Call
+ * every main loop.
+ */
+void haPublishMemoryStats() {
+  stepper_motor::StepperMotor* window = memory_report_window;
+  if (window == NULL) return;
+  memory_report_window = NULL;
+
+  char buf[768];
+  cyw43_arch_lwip_begin();
+  int len = memStatsFormat(buf, sizeof(buf));
+  cyw43_arch_lwip_end();
+  if (len >= (int)sizeof(buf)) LOG_WARN("Memory report cut short.\n");
+
+  window->basicMqttPublish(MQTT_SUBTOPIC_SENSOR_MEMORY, buf, 0, 0);
+}
+
+/**
+ * Sends a chunk of a dump, as a binary publish to a topic of the window that
+ * asked for the dump, or as a line of a prefix followed by the chunk in hex on
+ * USB. A publish that fails is tried again on the next call, most likely the
+ * output ring buffer was full.
+ *
+ * \param dump The dump, `seq` is the chunk to send.
+ * \param subtopic The topic to publish the chunk to.
+ * \param usb_prefix What to start the line with on USB.
+ * \param chunk The chunk.
+ * \param len The length of the chunk in bytes.
+ *
+ * \returns Whether the dump is over.
+ */
+static bool sendDumpChunk(ChunkedDump* dump, const char* subtopic,
+                          const char* usb_prefix, const uint8_t* chunk,
+                          size_t len) {
+  if (dump->usb) {
+    printf("%s ", usb_prefix);
+    for (size_t i = 0; i < len; i++) printf("%02x", chunk[i]);
+    printf("\n");
+  } else if (!dump->window->basicMqttPublish(subtopic, chunk, len, 0, 0)) {
+    // Don't keep at it for good if the broker is gone.
+    if (++dump->failures < DUMP_MAX_RETRIES) return false;
+    LOG_WARN("Dump to %s abandoned at chunk %u of %u.\n", subtopic,
+             dump->seq + 1, dump->total);
+    dump->seq = dump->total;
+  }
+
+  dump->failures = 0;
+  if (++dump->seq < dump->total) return false;
+
+  dump->window = NULL;
+  return true;
+}
+
+/**
+ * Dumps the trace ring for the window that asked for it, if any, one chunk per
+ * call so that the dump doesn't hold up the main loop. Call every main loop.
+ */
+void haPublishTrace() {
+  static ChunkedDump dump = {};
+
+  if (dump.window == NULL) {
+    stepper_motor::StepperMotor* window = trace_dump_window;
+    if (window == NULL) return;
+    trace_dump_window = NULL;
+    dump = {window, trace_dump_usb, 0, traceDumpBegin(), 0};
+  }
+
+  uint8_t chunk[TRACE_CHUNK_MAX_SIZE];
+  size_t len = traceDumpChunk(dump.seq, chunk, sizeof(chunk));
+  if (sendDumpChunk(&dump, MQTT_SUBTOPIC_SENSOR_TRACE, "TRACE", chunk, len))
+    traceDumpEnd();
+}
+
+/**
+ * Dumps the profiler histogram for the window that asked for it, if any, one
+ * chunk per call. The dump waits until the flash image has been hashed. Call
+ * every main loop.
+ */
+void haPublishProfile() {
+  static ChunkedDump dump = {};
+
+  if (dump.window == NULL) {
+    stepper_motor::StepperMotor* window = profile_dump_window;
+    if (window == NULL || !profilerDumpReady()) return;
+    profile_dump_window = NULL;
+    dump = {window, profile_dump_usb, 0, profilerDumpChunks(), 0};
+  }
+
+  uint8_t chunk[PROFILER_CHUNK_MAX_SIZE];
+  size_t len = profilerDumpChunk(dump.seq, chunk, sizeof(chunk));
+  sendDumpChunk(&dump, MQTT_SUBTOPIC_SENSOR_PROFILE, "PROFILE", chunk, len);
 }
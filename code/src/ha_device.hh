@@ -7,9 +7,8 @@
 #include "ha_device_info.hh"
 #include "mqtt_topics.hh"
 #include "stepper_motor.hh"
+#include "timer_wheel.hh"
 
-// #define HA_DEVICE_MQTT_DISCOVERY_TOPIC_MAIN_WINDOW \
-//   "homeassistant/cover/" HA_DEVICE_ID "/config"
 // dev  |-> device
 // ids  |-> identifiers
 // name |-> name
@@ -20,292 +19,527 @@
 // sn   |-> serial_number
 // o    |-> origin
 // cmps |-> components
-#define HA_DEVICE_MQTT_DISCOVERY_MSG                              \
-  "{"                                                             \
-  "\"dev\":{" /* device */                                        \
-  "\"ids\":\"" HA_DEVICE_ID                                       \
-  "\"," /* identifiers */                                         \
-  "\"name\":\"" HA_DEVICE_ID                                      \
-  "\"," /* name */                                                \
-  "\"mf\":\"" HA_DEVICE_MANUFACTURER                              \
-  "\"," /* manufacturer */                                        \
-  "\"mdl\":\"" HA_DEVICE_MODEL                                    \
-  "\"," /* model */                                               \
-  "\"sw\":\"" HA_DEVICE_SOFTWARE_VERSION                          \
-  "\"," /* sw_version */                                          \
-  "\"sn\":\"" HA_DEVICE_SERIAL_NUMBER                             \
-  "\"," /* serial_number */                                       \
-  "\"hw\":\"" HA_DEVICE_HARDWARE_VERSION                          \
-  "\"" /* hw_version */                                           \
-  "},"                                                            \
-  "\"o\":{" /* origin */                                          \
-  "\"name\":\"foobar\","                                          \
-  "\"sw\":\"" HA_DEVICE_SOFTWARE_VERSION                          \
-  "\"" /* sw_version */                                           \
-  "},"                                                            \
-  "\"cmps\":{" /* components */                                   \
-                                                                  \
-  /* Main Window Component */                                     \
-  "\"" HA_DEVICE_ID                                               \
-  "-Main_Window\":{"                                              \
-  "\"name\":\"Main Window\","                                     \
-  "\"unique_id\":\"" HA_DEVICE_ID                                 \
-  "-Main_Window\","                                               \
-  "\"optimistic\":\"false\","                                     \
-  "\"availability\":{"                                            \
-  "\"payload_available\":\"online\","                             \
-  "\"payload_not_available\":\"offline\","                        \
-  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                          \
-  "\""                                                            \
-  "},"                                                            \
-  "\"p\":\"cover\","                                              \
-  "\"device_class\":\"window\","                                  \
-  "\"payload_open\":\"OPEN\","                                    \
-  "\"payload_close\":\"CLOSE\","                                  \
-  "\"payload_stop\":\"STOP\","                                    \
-  "\"state_topic\":\"" MQTT_TOPIC_STATE_GENERAL                   \
-  "\","                                                           \
-  "\"command_topic\":\"" MQTT_TOPIC_COMMAND_GENERAL               \
-  "\","                                                           \
-  "\"position_topic\":\"" MQTT_TOPIC_STATE_POSITION_PERCENT       \
-  "\","                                                           \
-  "\"set_position_topic\":\"" MQTT_TOPIC_COMMAND_POSITION_PERCENT \
-  "\","                                                           \
-  "\"value_template\":\"{{ value }}\""                            \
-  "},"                                                            \
-                                                                  \
-  /* Main Window Speed Component */                               \
-  "\"" HA_DEVICE_ID                                               \
-  "-Main_Window_Speed\":{"                                        \
-  "\"name\":\"Main Window Speed\","                               \
-  "\"unique_id\":\"" HA_DEVICE_ID                                 \
-  "-Main_Window_Speed\","                                         \
-  "\"optimistic\":\"false\","                                     \
-  "\"availability\":{"                                            \
-  "\"payload_available\":\"online\","                             \
-  "\"payload_not_available\":\"offline\","                        \
-  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                          \
-  "\""                                                            \
-  "},"                                                            \
-  "\"p\":\"number\","                                             \
-  "\"min\":0,"                                                    \
-  "\"max\":255,"                                                  \
-  "\"mode\":\"box\","                                             \
-  "\"step\":\"0.01\","                                            \
-  "\"device_class\":\"speed\","                                   \
-  "\"unit_of_measurement\":\"mm/s\","                             \
-  "\"state_topic\":\"" MQTT_TOPIC_STATE_SPEED                     \
-  "\","                                                           \
-  "\"command_topic\":\"" MQTT_TOPIC_COMMAND_SPEED                 \
-  "\","                                                           \
-  "\"value_template\":\"{{ float(value) }}\","                    \
-  "\"command_template\":\"{{ value }}\""                          \
-  "},"                                                            \
-                                                                  \
-  /* Main Window Position Steps Component */                      \
-  "\"" HA_DEVICE_ID                                               \
-  "-Main_Window_Position_Steps\":{"                               \
-  "\"name\":\"Main Window Position Steps\","                      \
-  "\"unique_id\":\"" HA_DEVICE_ID                                 \
-  "-Main_Window_Position_Steps\","                                \
-  "\"optimistic\":\"false\","                                     \
-  "\"availability\":{"                                            \
-  "\"payload_available\":\"online\","                             \
-  "\"payload_not_available\":\"offline\","                        \
-  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                          \
-  "\""                                                            \
-  "},"                                                            \
-  "\"p\":\"number\","                                             \
-  "\"min\":-10000000000000000000," /* 1e19 */                     \
-  "\"max\":10000000000000000000,"  /* 1e19 */                     \
-  "\"mode\":\"box\","                                             \
-  "\"state_topic\":\"" MQTT_TOPIC_STATE_POSITION_STEPS            \
-  "\","                                                           \
-  "\"command_topic\":\"" MQTT_TOPIC_COMMAND_POSITION_STEPS        \
-  "\","                                                           \
-  "\"icon\":\"mdi:tape-measure\""                                 \
-  "},"                                                            \
-                                                                  \
-  /* Main Window Position Millimeters Component */                \
-  "\"" HA_DEVICE_ID                                               \
-  "-Main_Window_Position_Millimeters\": {"                        \
-  "\"name\":\"Main Window Position Millimeters\","                \
-  "\"unique_id\":\"" HA_DEVICE_ID                                 \
-  "-Main_Window_Position_Millimeters\","                          \
-  "\"optimistic\":\"false\","                                     \
-  "\"availability\":{"                                            \
-  "\"payload_available\":\"online\","                             \
-  "\"payload_not_available\":\"offline\","                        \
-  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                          \
-  "\""                                                            \
-  "},"                                                            \
-  "\"p\":\"number\","                                             \
-  "\"min\":-100000000000," /* 1e */                               \
-  "\"max\":1000000000000," /* 1e */                               \
-  "\"mode\":\"box\","                                             \
-  "\"step\":\"0.1\","                                             \
-  "\"unit_of_measurement\":\"mm\","                               \
-  "\"state_topic\":\"" MQTT_TOPIC_STATE_POSITION_MM               \
-  "\","                                                           \
-  "\"command_topic\":\"" MQTT_TOPIC_COMMAND_POSITION_MM           \
-  "\","                                                           \
-  "\"icon\":\"mdi:tape-measure\""                                 \
-  "},"                                                            \
-                                                                  \
-  /* Quiet Mode Switch Component */                               \
-  "\"" HA_DEVICE_ID                                               \
-  "-Quiet_Mode_Switch\":{"                                        \
-  "\"name\":\"Quiet Mode\","                                      \
-  "\"unique_id\":\"" HA_DEVICE_ID                                 \
-  "-Quiet_Mode_Switch\","                                         \
-  "\"optimistic\":\"false\","                                     \
-  "\"availability\":{"                                            \
-  "\"payload_available\":\"online\","                             \
-  "\"payload_not_available\":\"offline\","                        \
-  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                          \
-  "\""                                                            \
-  "},"                                                            \
-  "\"p\":\"switch\","                                             \
-  "\"state_topic\":\"" MQTT_TOPIC_STATE_QUIET                     \
-  "\","                                                           \
-  "\"command_topic\":\"" MQTT_TOPIC_COMMAND_QUIET                 \
-  "\","                                                           \
-  "\"icon\":\"mdi:volume-off\""                                   \
-  "},"                                                            \
-                                                                  \
-  /* Soft Start Switch Component */                               \
-  "\"" HA_DEVICE_ID                                               \
-  "-Soft_Start_Switch\":{"                                        \
-  "\"name\":\"Motor Soft Start\","                                \
-  "\"unique_id\":\"" HA_DEVICE_ID                                 \
-  "-Soft_Start_Switch\","                                         \
-  "\"optimistic\":\"false\","                                     \
-  "\"availability\":{"                                            \
-  "\"payload_available\":\"online\","                             \
-  "\"payload_not_available\":\"offline\","                        \
-  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                          \
-  "\""                                                            \
-  "},"                                                            \
-  "\"p\":\"switch\","                                             \
-  "\"state_topic\":\"" MQTT_TOPIC_STATE_SOFT_START                \
-  "\","                                                           \
-  "\"command_topic\":\"" MQTT_TOPIC_COMMAND_SOFT_START            \
-  "\","                                                           \
-  "\"icon\":\"mdi:chart-bell-curve-cumulative\""                  \
-  "},"                                                            \
-                                                                  \
-  /* Home Button */                                               \
-  "\"" HA_DEVICE_ID                                               \
-  "-Home_Button\":{"                                              \
-  "\"name\":\"Home\","                                            \
-  "\"unique_id\":\"" HA_DEVICE_ID                                 \
-  "-Home_Button\","                                               \
-  "\"optimistic\":\"false\","                                     \
-  "\"availability\":{"                                            \
-  "\"payload_available\":\"online\","                             \
-  "\"payload_not_available\":\"offline\","                        \
-  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                          \
-  "\""                                                            \
-  "},"                                                            \
-  "\"p\":\"button\","                                             \
-  "\"state_topic\":\"" MQTT_TOPIC_STATE_QUIET                     \
-  "\","                                                           \
-  "\"command_topic\":\"" MQTT_TOPIC_COMMAND_HOME                  \
-  "\","                                                           \
-  "\"icon\":\"mdi:home-switch\""                                  \
-  "},"                                                            \
-                                                                  \
-  /* Calibrate Button */                                          \
-  "\"" HA_DEVICE_ID                                               \
-  "-Calibrate_Button\":{"                                         \
-  "\"name\":\"Calibrate\","                                       \
-  "\"unique_id\":\"" HA_DEVICE_ID                                 \
-  "-Calibrate_Button\","                                          \
-  "\"optimistic\":\"false\","                                     \
-  "\"availability\":{"                                            \
-  "\"payload_available\":\"online\","                             \
-  "\"payload_not_available\":\"offline\","                        \
-  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                          \
-  "\""                                                            \
-  "},"                                                            \
-  "\"p\":\"button\","                                             \
-  "\"state_topic\":\"" MQTT_TOPIC_STATE_QUIET                     \
-  "\","                                                           \
-  "\"command_topic\":\"" MQTT_TOPIC_COMMAND_CALIBRATE             \
-  "\","                                                           \
-  "\"icon\":\"mdi:math-compass\""                                 \
-  "},"                                                            \
-                                                                  \
-  /* Micro Step Sensor */                                         \
-  "\"" HA_DEVICE_ID                                               \
-  "-Micro_Step_Sensor\":{"                                        \
-  "\"name\":\"Micro Steps\","                                     \
-  "\"unique_id\":\"" HA_DEVICE_ID                                 \
-  "-Micro_Step_Sensor\","                                         \
-  "\"optimistic\":\"false\","                                     \
-  "\"availability\":{"                                            \
-  "\"payload_available\":\"online\","                             \
-  "\"payload_not_available\":\"offline\","                        \
-  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                          \
-  "\""                                                            \
-  "},"                                                            \
-  "\"p\":\"sensor\","                                             \
-  "\"device_class\":null,"                                        \
-  "\"state_topic\":\"" MQTT_TOPIC_SENSOR_MICRO_STEPS              \
-  "\","                                                           \
-  "\"icon\":\"mdi:angle-acute\","                                 \
-  "\"qos\":1"                                                     \
-  "},"                                                            \
-                                                                  \
-  /* Step Delay Sensor */                                         \
-  "\"" HA_DEVICE_ID                                               \
-  "-Half_Step_Delay_Sensor\":{"                                   \
-  "\"name\":\"Half Step Delay\","                                 \
-  "\"unique_id\":\"" HA_DEVICE_ID                                 \
-  "-Half_Step_Delay_Sensor\","                                    \
-  "\"optimistic\":\"false\","                                     \
-  "\"availability\":{"                                            \
-  "\"payload_available\":\"online\","                             \
-  "\"payload_not_available\":\"offline\","                        \
-  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                          \
-  "\""                                                            \
-  "},"                                                            \
-  "\"p\":\"sensor\","                                             \
-  "\"device_class\":\"duration\","                                \
-  "\"unit_of_measurement\":\"µs\","                               \
-  "\"state_topic\":\"" MQTT_TOPIC_SENSOR_HALF_STEP_DELAY          \
-  "\","                                                           \
-  "\"icon\":\"mdi:timer-sand-complete\""                          \
-  "},"                                                            \
-                                                                  \
-  /* Window Full Open Measurement Sensor */                       \
-  "\"" HA_DEVICE_ID                                               \
-  "-Window_Full_Open_Measurement_Sensor\":{"                      \
-  "\"name\":\"Fully Open Position\","                             \
-  "\"unique_id\":\"" HA_DEVICE_ID                                 \
-  "-Window_Full_Open_Measurement_Sensor\","                       \
-  "\"optimistic\":\"false\","                                     \
-  "\"availability\":{"                                            \
-  "\"payload_available\":\"online\","                             \
-  "\"payload_not_available\":\"offline\","                        \
-  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                          \
-  "\""                                                            \
-  "},"                                                            \
-  "\"p\":\"sensor\","                                             \
-  "\"device_class\":\"distance\","                                \
-  "\"unit_of_measurement\":\"mm\","                               \
-  "\"state_topic\":\"" MQTT_TOPIC_SENSOR_FULL_OPEN_MEASUREMENT    \
-  "\","                                                           \
-  "\"icon\":\"mdi:tape-measure\""                                 \
-  "}"                                                             \
-                                                                  \
-  "},"                                                            \
-  "\"qos\":0"                                                     \
+#define HA_WINDOW_MQTT_DISCOVERY_MSG(id, name)                      \
+  "{"                                                               \
+  "\"dev\":{" /* device */                                          \
+  "\"ids\":\"" HA_DEVICE_ID "_" id                                  \
+  "\"," /* identifiers */                                           \
+  "\"name\":\"" name                                                \
+  "\"," /* name */                                                  \
+  "\"mf\":\"" HA_DEVICE_MANUFACTURER                                \
+  "\"," /* manufacturer */                                          \
+  "\"mdl\":\"" HA_DEVICE_MODEL                                      \
+  "\"," /* model */                                                 \
+  "\"sw\":\"" HA_DEVICE_SOFTWARE_VERSION                            \
+  "\"," /* sw_version */                                            \
+  "\"sn\":\"" HA_DEVICE_SERIAL_NUMBER                               \
+  "\"," /* serial_number */                                         \
+  "\"hw\":\"" HA_DEVICE_HARDWARE_VERSION                            \
+  "\"" /* hw_version */                                             \
+  "},"                                                              \
+  "\"o\":{" /* origin */                                            \
+  "\"name\":\"foobar\","                                            \
+  "\"sw\":\"" HA_DEVICE_SOFTWARE_VERSION                            \
+  "\"" /* sw_version */                                             \
+  "},"                                                              \
+  "\"cmps\":{" /* components */                                     \
+                                                                    \
+  /* Window Component */                                            \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Window\":{"                                                     \
+  "\"name\":null,"                                                  \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Window\","                                                      \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"cover\","                                                \
+  "\"device_class\":\"window\","                                    \
+  "\"payload_open\":\"OPEN\","                                      \
+  "\"payload_close\":\"CLOSE\","                                    \
+  "\"payload_stop\":\"STOP\","                                      \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_STATE_GENERAL)                \
+  "\","                                                             \
+  "\"command_topic\":\""                                            \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_COMMAND_GENERAL)              \
+  "\","                                                             \
+  "\"position_topic\":\""                                           \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_STATE_POSITION_PERCENT)       \
+  "\","                                                             \
+  "\"set_position_topic\":\""                                       \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_COMMAND_POSITION_PERCENT)     \
+  "\","                                                             \
+  "\"value_template\":\"{{ value }}\""                              \
+  "},"                                                              \
+                                                                    \
+  /* Speed Component */                                             \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Window_Speed\":{"                                               \
+  "\"name\":\"Speed\","                                             \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Window_Speed\","                                                \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"number\","                                               \
+  "\"min\":0,"                                                      \
+  "\"max\":255,"                                                    \
+  "\"mode\":\"box\","                                               \
+  "\"step\":\"0.01\","                                              \
+  "\"device_class\":\"speed\","                                     \
+  "\"unit_of_measurement\":\"mm/s\","                               \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_STATE_SPEED)                  \
+  "\","                                                             \
+  "\"command_topic\":\""                                            \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_COMMAND_SPEED)                \
+  "\","                                                             \
+  "\"value_template\":\"{{ float(value) }}\","                      \
+  "\"command_template\":\"{{ value }}\""                            \
+  "},"                                                              \
+                                                                    \
+  /* Acceleration Component */                                      \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Window_Acceleration\":{"                                        \
+  "\"name\":\"Acceleration\","                                      \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Window_Acceleration\","                                         \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"number\","                                               \
+  "\"min\":1,"                                                      \
+  "\"max\":250,"                                                    \
+  "\"mode\":\"box\","                                               \
+  "\"step\":\"1\","                                                 \
+  "\"entity_category\":\"config\","                                 \
+  "\"unit_of_measurement\":\"us/level\","                           \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_STATE_ACCELERATION)           \
+  "\","                                                             \
+  "\"command_topic\":\""                                            \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_COMMAND_ACCELERATION)         \
+  "\","                                                             \
+  "\"value_template\":\"{{ int(value) }}\","                        \
+  "\"command_template\":\"{{ value }}\""                            \
+  "},"                                                              \
+                                                                    \
+  /* Position Steps Component */                                    \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Window_Position_Steps\":{"                                      \
+  "\"name\":\"Position Steps\","                                    \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Window_Position_Steps\","                                       \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"number\","                                               \
+  "\"min\":-10000000000000000000," /* 1e19 */                       \
+  "\"max\":10000000000000000000,"  /* 1e19 */                       \
+  "\"mode\":\"box\","                                               \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_STATE_POSITION_STEPS)         \
+  "\","                                                             \
+  "\"command_topic\":\""                                            \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_COMMAND_POSITION_STEPS)       \
+  "\","                                                             \
+  "\"icon\":\"mdi:tape-measure\""                                   \
+  "},"                                                              \
+                                                                    \
+  /* Position Millimeters Component */                              \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Window_Position_Millimeters\": {"                               \
+  "\"name\":\"Position Millimeters\","                              \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Window_Position_Millimeters\","                                 \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"number\","                                               \
+  "\"min\":-100000000000," /* 1e */                                 \
+  "\"max\":1000000000000," /* 1e */                                 \
+  "\"mode\":\"box\","                                               \
+  "\"step\":\"0.1\","                                               \
+  "\"unit_of_measurement\":\"mm\","                                 \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_STATE_POSITION_MM)            \
+  "\","                                                             \
+  "\"command_topic\":\""                                            \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_COMMAND_POSITION_MM)          \
+  "\","                                                             \
+  "\"icon\":\"mdi:tape-measure\""                                   \
+  "},"                                                              \
+                                                                    \
+  /* Quiet Mode Switch Component */                                 \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Quiet_Mode_Switch\":{"                                          \
+  "\"name\":\"Quiet Mode\","                                        \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Quiet_Mode_Switch\","                                           \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"switch\","                                               \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_STATE_QUIET)                  \
+  "\","                                                             \
+  "\"command_topic\":\""                                            \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_COMMAND_QUIET)                \
+  "\","                                                             \
+  "\"icon\":\"mdi:volume-off\""                                     \
+  "},"                                                              \
+                                                                    \
+  /* Soft Start Switch Component */                                 \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Soft_Start_Switch\":{"                                          \
+  "\"name\":\"Motor Soft Start\","                                  \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Soft_Start_Switch\","                                           \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"switch\","                                               \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_STATE_SOFT_START)             \
+  "\","                                                             \
+  "\"command_topic\":\""                                            \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_COMMAND_SOFT_START)           \
+  "\","                                                             \
+  "\"icon\":\"mdi:chart-bell-curve-cumulative\""                    \
+  "},"                                                              \
+                                                                    \
+  /* Home Button */                                                 \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Home_Button\":{"                                                \
+  "\"name\":\"Home\","                                              \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Home_Button\","                                                 \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"button\","                                               \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_STATE_QUIET)                  \
+  "\","                                                             \
+  "\"command_topic\":\""                                            \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_COMMAND_HOME)                 \
+  "\","                                                             \
+  "\"icon\":\"mdi:home-switch\""                                    \
+  "},"                                                              \
+                                                                    \
+  /* Calibrate Button */                                            \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Calibrate_Button\":{"                                           \
+  "\"name\":\"Calibrate\","                                         \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Calibrate_Button\","                                            \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"button\","                                               \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_STATE_QUIET)                  \
+  "\","                                                             \
+  "\"command_topic\":\""                                            \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_COMMAND_CALIBRATE)            \
+  "\","                                                             \
+  "\"icon\":\"mdi:math-compass\""                                   \
+  "},"                                                              \
+                                                                    \
+  /* Micro Step Sensor */                                           \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Micro_Step_Sensor\":{"                                          \
+  "\"name\":\"Micro Steps\","                                       \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Micro_Step_Sensor\","                                           \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"sensor\","                                               \
+  "\"device_class\":null,"                                          \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_SENSOR_MICRO_STEPS)           \
+  "\","                                                             \
+  "\"icon\":\"mdi:angle-acute\","                                   \
+  "\"qos\":1"                                                       \
+  "},"                                                              \
+                                                                    \
+  /* Step Delay Sensor */                                           \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Half_Step_Delay_Sensor\":{"                                     \
+  "\"name\":\"Half Step Delay\","                                   \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Half_Step_Delay_Sensor\","                                      \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"sensor\","                                               \
+  "\"device_class\":\"duration\","                                  \
+  "\"unit_of_measurement\":\"µs\","                                 \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_SENSOR_HALF_STEP_DELAY)       \
+  "\","                                                             \
+  "\"icon\":\"mdi:timer-sand-complete\""                            \
+  "},"                                                              \
+                                                                    \
+  /* Window Full Open Measurement Sensor */                         \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Window_Full_Open_Measurement_Sensor\":{"                        \
+  "\"name\":\"Fully Open Position\","                               \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Window_Full_Open_Measurement_Sensor\","                         \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"sensor\","                                               \
+  "\"device_class\":\"distance\","                                  \
+  "\"unit_of_measurement\":\"mm\","                                 \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_SENSOR_FULL_OPEN_MEASUREMENT) \
+  "\","                                                             \
+  "\"icon\":\"mdi:tape-measure\""                                   \
+  "},"                                                              \
+                                                                    \
+  /* Stall Sensor */                                                \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Stall_Sensor\":{"                                               \
+  "\"name\":\"Last Stall Position\","                               \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Stall_Sensor\","                                                \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"sensor\","                                               \
+  "\"entity_category\":\"diagnostic\","                             \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_SENSOR_STALL)                 \
+  "\","                                                             \
+  "\"value_template\":\"{{ value_json.pos }}\","                    \
+  "\"json_attributes_topic\":\""                                    \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_SENSOR_STALL)                 \
+  "\","                                                             \
+  "\"icon\":\"mdi:car-brake-alert\""                                \
+  "},"                                                              \
+                                                                    \
+  /* Rejected Command Sensor */                                     \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Rejected_Command_Sensor\":{"                                    \
+  "\"name\":\"Last Rejected Command\","                             \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Rejected_Command_Sensor\","                                     \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"sensor\","                                               \
+  "\"entity_category\":\"diagnostic\","                             \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_SENSOR_REJECTED_COMMAND)      \
+  "\","                                                             \
+  "\"value_template\":\"{{ value_json.action }}\","                 \
+  "\"json_attributes_topic\":\""                                    \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_SENSOR_REJECTED_COMMAND)      \
+  "\","                                                             \
+  "\"icon\":\"mdi:playlist-remove\""                                \
+  "},"                                                              \
+                                                                    \
+  /* Command Stats Sensor */                                        \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Command_Stats_Sensor\":{"                                       \
+  "\"name\":\"Dropped Commands\","                                  \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Command_Stats_Sensor\","                                        \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"sensor\","                                               \
+  "\"entity_category\":\"diagnostic\","                             \
+  "\"state_class\":\"total_increasing\","                           \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_SENSOR_COMMAND_STATS)         \
+  "\","                                                             \
+  "\"value_template\":\"{{ value_json.dropped }}\","                \
+  "\"json_attributes_topic\":\""                                    \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_SENSOR_COMMAND_STATS)         \
+  "\","                                                             \
+  "\"icon\":\"mdi:traffic-light\""                                  \
+  "},"                                                              \
+                                                                    \
+  /* Boot Times Sensor */                                           \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Boot_Times_Sensor\":{"                                          \
+  "\"name\":\"Boot Time\","                                         \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Boot_Times_Sensor\","                                           \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"sensor\","                                               \
+  "\"entity_category\":\"diagnostic\","                             \
+  "\"device_class\":\"duration\","                                  \
+  "\"unit_of_measurement\":\"ms\","                                 \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_SENSOR_BOOT_TIMES)            \
+  "\","                                                             \
+  "\"value_template\":\"{{ value_json.ready }}\","                  \
+  "\"json_attributes_topic\":\""                                    \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_SENSOR_BOOT_TIMES)            \
+  "\","                                                             \
+  "\"icon\":\"mdi:timer-outline\""                                  \
+  "},"                                                              \
+                                                                    \
+  /* Wake Latency Sensor */                                         \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Wake_Latency_Sensor\":{"                                        \
+  "\"name\":\"Wake Latency\","                                      \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Wake_Latency_Sensor\","                                         \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"sensor\","                                               \
+  "\"entity_category\":\"diagnostic\","                             \
+  "\"device_class\":\"duration\","                                  \
+  "\"unit_of_measurement\":\"ms\","                                 \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_SENSOR_WAKE_LATENCY)          \
+  "\","                                                             \
+  "\"icon\":\"mdi:sleep-off\""                                      \
+  "},"                                                              \
+                                                                    \
+  /* Step Jitter Sensor */                                          \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Step_Jitter_Sensor\":{"                                         \
+  "\"name\":\"Step Jitter P99\","                                   \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Step_Jitter_Sensor\","                                          \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"sensor\","                                               \
+  "\"entity_category\":\"diagnostic\","                             \
+  "\"unit_of_measurement\":\"us\","                                 \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_SENSOR_STEP_JITTER)           \
+  "\","                                                             \
+  "\"value_template\":\"{{ value_json.p99 }}\","                    \
+  "\"json_attributes_topic\":\""                                    \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_SENSOR_STEP_JITTER)           \
+  "\","                                                             \
+  "\"icon\":\"mdi:chart-bell-curve\""                               \
+  "},"                                                              \
+                                                                    \
+  /* Command Latency Sensor */                                      \
+  "\"" HA_DEVICE_ID "_" id                                          \
+  "-Command_Latency_Sensor\":{"                                     \
+  "\"name\":\"Command Reaction P99\","                               \
+  "\"unique_id\":\"" HA_DEVICE_ID "_" id                            \
+  "-Command_Latency_Sensor\","                                      \
+  "\"optimistic\":\"false\","                                       \
+  "\"availability\":{"                                              \
+  "\"payload_available\":\"online\","                               \
+  "\"payload_not_available\":\"offline\","                          \
+  "\"topic\":\"" MQTT_TOPIC_AVAILABILITY                            \
+  "\""                                                              \
+  "},"                                                              \
+  "\"p\":\"sensor\","                                               \
+  "\"entity_category\":\"diagnostic\","                             \
+  "\"device_class\":\"duration\","                                  \
+  "\"unit_of_measurement\":\"ms\","                                 \
+  "\"state_topic\":\""                                              \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_SENSOR_COMMAND_LATENCY)       \
+  "\","                                                             \
+  "\"value_template\":\"{{ value_json.react.p99 / 1000 }}\","       \
+  "\"json_attributes_topic\":\""                                    \
+  MQTT_WINDOW_TOPIC(id, MQTT_SUBTOPIC_SENSOR_COMMAND_LATENCY)       \
+  "\","                                                             \
+  "\"icon\":\"mdi:timer-sand\""                                     \
+  "}"                                                               \
+                                                                    \
+  "},"                                                              \
+  "\"qos\":0"                                                       \
   "}"
 
 bool basicMqttPublish(const char* topic, const char* payload, u8_t qos,
                       u8_t retain);
 bool mqttDoConnect(mqtt_client_t* client);
-void haDeviceSetup(mqtt_client_t* client, stepper_motor::StepperMotor* sm);
+void haDeviceSetup(mqtt_client_t* client, stepper_motor::StepperMotor* windows,
+                   int window_count, stepper_motor::action::TimerWheel* timers);
+void haPublishCommandStats();
+void haPublishMemoryStats();
+void haPublishTrace();
+void haPublishProfile();
 
 #endif
@@ -0,0 +1,317 @@
+#include "kv_store.hh"
+
+#include <hardware/flash.h>
+#include <pico/error.h>
+#include <pico/flash.h>
+#include <pico/time.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "crc32.hh"
+#include "journal.hh"
+#include "logger.hh"
+
+// **======================================**
+// ||          <<<<< LAYOUT >>>>>          ||
+// **======================================**
+
+/*
+ * The store is a snapshot of every key value pair, kept in two flash sectors
+ * right below the position journal. A commit writes the whole snapshot to the
+ * sector that isn't active with a higher generation, so the previous snapshot
+ * stays intact until the new one is complete. The snapshot with the highest
+ * generation and a matching CRC is the active one.
+ *
+ * A snapshot is a header followed by the entries, each entry is a `KvEntry`
+ * followed by the key and the value, both padded to 4 bytes.
+ */
+
+#define KV_STORE_OFFSET \
+  (PICO_FLASH_SIZE_BYTES - (JOURNAL_SECTORS + 2) * FLASH_SECTOR_SIZE)
+
+#define KV_STORE_MAGIC 0x4B565354  // "KVST"
+
+// Longest the other core may take to get out of the way of a flash write.
+#define KV_STORE_SAFE_TIMEOUT_MS 100
+
+#define KV_ALIGN(len) (((len) + 3) & ~3)
+#define KV_ENTRY_SIZE(key_len, value_len) \
+  (sizeof(KvEntry) + KV_ALIGN(key_len) + KV_ALIGN(value_len))
+
+struct KvHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t length;  // Of the entries in bytes.
+  uint32_t generation;
+  uint32_t crc;  // Of everything above and the entries.
+};
+
+struct KvEntry {
+  uint8_t key_len;
+  uint8_t reserved;
+  uint16_t value_len;
+};
+
+#define KV_STORE_CAPACITY (KV_STORE_SIZE - sizeof(KvHeader))
+
+static_assert(KV_STORE_SIZE % FLASH_PAGE_SIZE == 0,
+              "The store must be made up of whole flash pages");
+static_assert(KV_STORE_SIZE <= FLASH_SECTOR_SIZE,
+              "The store must fit into a flash sector");
+
+// **================================================**
+// ||          <<<<< STATIC VARIABLES >>>>>          ||
+// **================================================**
+
+// Where changes are made before they are committed, only valid while `dirty`.
+alignas(KvHeader) static uint8_t staging[KV_STORE_SIZE];
+
+static bool initialized = false;
+static int active = -1;  // The sector of the active snapshot, -1 if none.
+static uint32_t generation = 0;
+static bool dirty = false;
+static uint64_t last_change_us = 0;
+
+// **=====================================**
+// ||          <<<<< FLASH >>>>>          ||
+// **=====================================**
+
+/**
+ * Gets the snapshot in one of the two sectors, read through XIP.
+ */
+static const KvHeader* snapshotAt(int sector) {
+  return (const KvHeader*)(XIP_BASE + KV_STORE_OFFSET +
+                           sector * FLASH_SECTOR_SIZE);
+}
+
+static uint32_t snapshotCrc(const KvHeader* header) {
+  uint32_t crc = crc32(header, offsetof(KvHeader, crc));
+  return crc32(header + 1, header->length, crc);
+}
+
+static bool snapshotValid(const KvHeader* header) {
+  return header->magic == KV_STORE_MAGIC &&
+         header->version == KV_STORE_VERSION &&
+         header->length <= KV_STORE_CAPACITY &&
+         header->crc == snapshotCrc(header);
+}
+
+/**
+ * Writes the staged snapshot into a sector. Runs with the other core locked
+ * out and interrupts disabled.
+ *
+ * The header is on the first page, which is programmed last. A write that gets
+ * cut off leaves the magic erased and the snapshot is simply not valid.
+ *
+ * \param param The sector to write to.
+ */
+static void writeSnapshot(void* param) {
+  uint32_t offset = KV_STORE_OFFSET + *(int*)param * FLASH_SECTOR_SIZE;
+
+  flash_range_erase(offset, FLASH_SECTOR_SIZE);
+  if (KV_STORE_SIZE > FLASH_PAGE_SIZE)
+    flash_range_program(offset + FLASH_PAGE_SIZE, staging + FLASH_PAGE_SIZE,
+                        KV_STORE_SIZE - FLASH_PAGE_SIZE);
+  flash_range_program(offset, staging, FLASH_PAGE_SIZE);
+}
+
+// **=========================================**
+// ||          <<<<< KEY VALUE >>>>>          ||
+// **=========================================**
+
+/**
+ * Finds the active snapshot.
+ */
+static void kvInit() {
+  initialized = true;
+
+  for (int sector = 0; sector < 2; sector++) {
+    const KvHeader* header = snapshotAt(sector);
+    if (!snapshotValid(header)) continue;
+
+    if (active < 0 || (int32_t)(header->generation - generation) > 0) {
+      active = sector;
+      generation = header->generation;
+    }
+  }
+
+  if (active >= 0)
+    LOG_INFO("Key value store generation %lu found in sector %d.\n",
+             (unsigned long)generation, active);
+  else
+    LOG_INFO("No key value store found, starting empty.\n");
+}
+
+/**
+ * Gets the snapshot every read sees, the staged one if it has changes that
+ * aren't committed yet, or else the active one in flash.
+ *
+ * \returns The snapshot, or NULL if there isn't any yet.
+ */
+static const KvHeader* currentSnapshot() {
+  if (!initialized) kvInit();
+
+  if (dirty) return (const KvHeader*)staging;
+  if (active >= 0) return snapshotAt(active);
+  return NULL;
+}
+
+/**
+ * Finds the entry of a key in a snapshot.
+ *
+ * \returns The entry, or NULL if the key isn't in the snapshot.
+ */
+static const KvEntry* findEntry(const KvHeader* header, const char* key,
+                                size_t key_len) {
+  if (header == NULL) return NULL;
+
+  const uint8_t* entries = (const uint8_t*)(header + 1);
+  uint32_t offset = 0;
+  while (offset + sizeof(KvEntry) <= header->length) {
+    const KvEntry* entry = (const KvEntry*)(entries + offset);
+    if (entry->key_len == key_len && memcmp(entry + 1, key, key_len) == 0)
+      return entry;
+
+    offset += KV_ENTRY_SIZE(entry->key_len, entry->value_len);
+  }
+
+  return NULL;
+}
+
+/**
+ * Gets the value of an entry, right after its padded key.
+ */
+static const uint8_t* valueOf(const KvEntry* entry) {
+  return (const uint8_t*)(entry + 1) + KV_ALIGN(entry->key_len);
+}
+
+/**
+ * Gets the value of a key.
+ *
+ * The value is not copied, it's read in place, straight from flash unless it
+ * was changed since the last commit. The pointer stays valid until the next
+ * call to `kvSet` or `kvService`.
+ *
+ * \param key The key to get the value of.
+ * \param value Where to store a pointer to the value.
+ * \param len Where to store the length of the value in bytes.
+ *
+ * \returns Whether the key is in the store.
+ */
+bool kvGet(const char* key, const void** value, uint16_t* len) {
+  size_t key_len = strlen(key);
+  const KvEntry* entry = findEntry(currentSnapshot(), key, key_len);
+  if (entry == NULL) return false;
+
+  *value = valueOf(entry);
+  *len = entry->value_len;
+  return true;
+}
+
+/**
+ * Sets the value of a key. The change is committed to flash later on by
+ * `kvService`, a value that doesn't change costs nothing.
+ *
+ * \param key The key to set the value of, at most `KV_STORE_MAX_KEY_LEN` long.
+ * \param value The value.
+ * \param len The length of the value in bytes.
+ *
+ * \returns Whether the value could be set, false if the key is too long or
+ *          the store is full.
+ */
+bool kvSet(const char* key, const void* value, uint16_t len) {
+  size_t key_len = strlen(key);
+  if (key_len == 0 || key_len > KV_STORE_MAX_KEY_LEN) return false;
+
+  const KvHeader* current = currentSnapshot();
+  const KvEntry* entry = findEntry(current, key, key_len);
+  if (entry != NULL && entry->value_len == len &&
+      memcmp(valueOf(entry), value, len) == 0)
+    return true;
+
+  // Start the staged snapshot off as a copy of the active one.
+  KvHeader* header = (KvHeader*)staging;
+  if (!dirty) {
+    if (current != NULL) {
+      memcpy(staging, current, sizeof(KvHeader) + current->length);
+    } else {
+      memset(header, 0, sizeof(KvHeader));
+      header->magic = KV_STORE_MAGIC;
+      header->version = KV_STORE_VERSION;
+    }
+    entry = findEntry(header, key, key_len);
+  }
+
+  uint8_t* entries = (uint8_t*)(header + 1);
+  uint32_t length = header->length;
+
+  // Take the old entry out, everything after it moves up.
+  uint32_t old_size = 0;
+  uint32_t old_offset = length;
+  if (entry != NULL) {
+    old_size = KV_ENTRY_SIZE(entry->key_len, entry->value_len);
+    old_offset = (const uint8_t*)entry - entries;
+  }
+
+  uint32_t new_size = KV_ENTRY_SIZE(key_len, len);
+  if (length - old_size + new_size > KV_STORE_CAPACITY) {
+    LOG_WARN("Key value store full, could not set \"%s\".\n", key);
+    return false;
+  }
+
+  memmove(entries + old_offset, entries + old_offset + old_size,
+          length - old_offset - old_size);
+  length -= old_size;
+
+  // Append the new entry, padding included so the CRC is repeatable.
+  uint8_t* added = entries + length;
+  memset(added, 0, new_size);
+  *(KvEntry*)added = {(uint8_t)key_len, 0, len};
+  memcpy(added + sizeof(KvEntry), key, key_len);
+  memcpy(added + sizeof(KvEntry) + KV_ALIGN(key_len), value, len);
+  header->length = length + new_size;
+
+  dirty = true;
+  last_change_us = time_us_64();
+  return true;
+}
+
+/**
+ * Commits the staged changes to flash once they have settled for
+ * `KV_STORE_SETTLE_MS`.
+ *
+ * Only the core doing the write is paused while the flash is busy, the other
+ * core, if running, is locked out through `flash_safe_execute`. Call from the
+ * main loop of core 0.
+ *
+ * \param moving Whether a motor is moving, nothing is written while one is.
+ */
+void kvService(bool moving) {
+  if (!dirty || moving ||
+      time_us_64() - last_change_us < KV_STORE_SETTLE_MS * 1000ULL)
+    return;
+
+  KvHeader* header = (KvHeader*)staging;
+  header->generation = generation + 1;
+  header->crc = snapshotCrc(header);
+
+  // Nothing past the entries is looked at, leave it erased.
+  uint32_t used = sizeof(KvHeader) + header->length;
+  memset(staging + used, 0xFF, KV_STORE_SIZE - used);
+
+  int target = (active == 0) ? 1 : 0;
+  int result = flash_safe_execute(writeSnapshot, &target,
+                                  KV_STORE_SAFE_TIMEOUT_MS);
+  if (result != PICO_OK || !snapshotValid(snapshotAt(target))) {
+    LOG_WARN("Could not commit the key value store (%d), retrying.\n",
+             result);
+    last_change_us = time_us_64();
+    return;
+  }
+
+  active = target;
+  generation = header->generation;
+  dirty = false;
+  LOG_INFO("Key value store generation %lu committed.\n",
+           (unsigned long)generation);
+}
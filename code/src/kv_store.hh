@@ -0,0 +1,41 @@
+#ifndef KV_STORE_HH
+#define KV_STORE_HH
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// **====================================================**
+// ||          <<<<< Configuration Macros >>>>>          ||
+// **====================================================**
+
+// Bytes the whole store may take up, header included. A multiple of the flash
+// page size (256B) and at most a sector (4kB).
+#ifndef KV_STORE_SIZE
+#define KV_STORE_SIZE 1024
+#endif
+
+// Longest key in characters.
+#ifndef KV_STORE_MAX_KEY_LEN
+#define KV_STORE_MAX_KEY_LEN 32
+#endif
+
+// How long the store waits after the last change before committing to flash,
+// so that a burst of changes costs a single erase.
+#ifndef KV_STORE_SETTLE_MS
+#define KV_STORE_SETTLE_MS 2000
+#endif
+
+// Bump whenever the layout of the store changes, a store of another version is
+// treated as empty.
+#define KV_STORE_VERSION 1
+
+// **=========================================**
+// ||          <<<<< KEY VALUE >>>>>          ||
+// **=========================================**
+
+bool kvGet(const char* key, const void** value, uint16_t* len);
+bool kvSet(const char* key, const void* value, uint16_t len);
+
+void kvService(bool moving);
+
+#endif
@@ -0,0 +1,192 @@
+#include "led_pattern.hh"
+
+#include <hardware/gpio.h>
+#include <pico/critical_section.h>
+#include <pico/time.h>
+
+#include "pins.hh"
+#include "ring_queue.hh"
+
+// **=========================================**
+// ||          <<<<< LED CODES >>>>>          ||
+// **=========================================**
+
+// Red, Yellow, Blue | Wave 3x | 100ms per LED
+static const LedStep boot_wave_steps[] = {
+    {LED_RED, 100},
+    {LED_RED | LED_YELLOW, 100},
+    {LED_RED | LED_YELLOW | LED_BLUE, 100},
+    {LED_YELLOW | LED_BLUE, 100},
+    {LED_BLUE, 100},
+    {0, 100},
+};
+const LedPattern LED_BOOT_WAVE =
+    LED_PATTERN(boot_wave_steps, 3, LED_RED | LED_YELLOW | LED_BLUE);
+
+// Blue | On;
+// Red  | 3x | 150ms:100ms
+static const LedStep pub_err_steps[] = {
+    {LED_BLUE | LED_RED, 150},
+    {LED_BLUE, 100},
+};
+const LedPattern LED_CODE_PUB_ERR =
+    LED_PATTERN(pub_err_steps, 3, LED_BLUE | LED_RED);
+
+// Blue   | On;
+// Yellow | 3x | 150ms:100ms
+static const LedStep sub_err_steps[] = {
+    {LED_BLUE | LED_YELLOW, 150},
+    {LED_BLUE, 100},
+};
+const LedPattern LED_CODE_SUB_ERR =
+    LED_PATTERN(sub_err_steps, 3, LED_BLUE | LED_YELLOW);
+
+// Yellow | 2x | 100ms:100ms
+static const LedStep sub_retry_steps[] = {
+    {LED_YELLOW, 100},
+    {0, 100},
+};
+const LedPattern LED_CODE_SUB_RETRY =
+    LED_PATTERN(sub_retry_steps, 2, LED_YELLOW);
+
+// Blue | 3x | 100ms:50ms
+static const LedStep connection_err_steps[] = {
+    {LED_BLUE, 100},
+    {0, 50},
+};
+const LedPattern LED_CODE_CONNECTION_ERR =
+    LED_PATTERN(connection_err_steps, 3, LED_BLUE);
+
+// Red + Yellow | 2x | 200ms:100ms
+static const LedStep mqtt_connect_err_steps[] = {
+    {LED_RED | LED_YELLOW, 200},
+    {0, 100},
+};
+const LedPattern LED_CODE_MQTT_CONNECT_ERR =
+    LED_PATTERN(mqtt_connect_err_steps, 2, LED_RED | LED_YELLOW);
+
+// Blue + Yellow | 3x | 150ms:100ms
+static const LedStep pub_discovery_msg_err_steps[] = {
+    {LED_BLUE | LED_YELLOW, 150},
+    {0, 100},
+};
+const LedPattern LED_CODE_PUB_DISCOVERY_MSG_ERR =
+    LED_PATTERN(pub_discovery_msg_err_steps, 3, LED_BLUE | LED_YELLOW);
+
+// **================================================**
+// ||          <<<<< STATIC VARIABLES >>>>>          ||
+// **================================================**
+
+// The pins of the LEDs, in the order of their mask bits.
+static const uint led_pins[] = {RED_LED_PIN, YELLOW_LED_PIN, BLUE_LED_PIN};
+
+// Guards everything below against the players on the other contexts.
+static critical_section_t led_lock;
+
+static RingQueue<const LedPattern*, LED_PATTERN_QUEUE_CAPACITY> led_queue;
+static const LedPattern* playing = NULL;
+static uint8_t step;
+static uint8_t repeats_left;
+static uint8_t steady_leds = 0;  // What the LEDs show while no pattern plays.
+
+// **============================================**
+// ||          <<<<< LED PATTERNS >>>>>          ||
+// **============================================**
+
+/**
+ * Puts the current step of the playing pattern over the steady state of the
+ * LEDs onto the pins. Called with the lock held.
+ */
+static void showLeds() {
+  uint8_t leds = steady_leds;
+  if (playing != NULL)
+    leds = (leds & ~playing->leds) | playing->steps[step].leds;
+
+  for (uint i = 0; i < sizeof(led_pins) / sizeof(led_pins[0]); i++)
+    gpio_put(led_pins[i], leds & (1 << i));
+}
+
+/**
+ * Moves on to the next step, starting the next queued pattern once the playing
+ * one is done. Called with the lock held.
+ *
+ * \returns How long to show the new step for in micro seconds, or 0 once there
+ * is nothing left to play.
+ */
+static int64_t advance() {
+  if (playing != NULL && ++step >= playing->step_count) {
+    step = 0;
+    if (--repeats_left == 0) playing = NULL;
+  }
+
+  if (playing == NULL && led_queue.pop(&playing)) {
+    step = 0;
+    repeats_left = playing->repeats;
+  }
+
+  showLeds();
+  return (playing != NULL) ? playing->steps[step].duration_ms * 1000LL : 0;
+}
+
+/**
+ * Shows the next step when the current one is over.
+ *
+ * \returns How long from when this alarm was due to show the next step for, or
+ * 0 to stop playing.
+ */
+static int64_t ledAlarmCb(alarm_id_t id, void* user_data) {
+  critical_section_enter_blocking(&led_lock);
+  int64_t delay_us = advance();
+  critical_section_exit(&led_lock);
+  return delay_us;
+}
+
+/**
+ * Initializes the pattern player. The LED pins must already be initialized.
+ */
+void ledPatternInit() { critical_section_init(&led_lock); }
+
+/**
+ * Queues a pattern to be played after the ones already queued and returns right
+ * away. The pattern is played from an alarm, so the caller never waits on the
+ * LEDs. Safe to call from interrupts, such as the lwIP callbacks.
+ *
+ * \param pattern The pattern to play. Must stay valid until played.
+ *
+ * \returns Whether the pattern was queued, false if the queue is full.
+ */
+bool ledPlay(const LedPattern* pattern) {
+  if (pattern->step_count == 0 || pattern->repeats == 0) return true;
+
+  critical_section_enter_blocking(&led_lock);
+  bool queued = led_queue.push(pattern);
+
+  // Start playing if the player is idle. The first step is shown right here
+  // and the alarm takes over from the second.
+  if (queued && playing == NULL) {
+    int64_t delay_us = advance();
+
+    // Drop the pattern if no alarm is free to play it.
+    if (add_alarm_in_us(delay_us, ledAlarmCb, NULL, true) < 0) {
+      playing = NULL;
+      showLeds();
+    }
+  }
+  critical_section_exit(&led_lock);
+
+  return queued;
+}
+
+/**
+ * Turns LEDs on or off outside of patterns. A pattern that is playing stays on
+ * top of the change until it is done.
+ *
+ * \param leds Mask of the LEDs to change.
+ * \param on Whether to turn the LEDs on.
+ */
+void ledSet(uint8_t leds, bool on) {
+  critical_section_enter_blocking(&led_lock);
+  steady_leds = (on) ? (steady_leds | leds) : (steady_leds & ~leds);
+  showLeds();
+  critical_section_exit(&led_lock);
+}
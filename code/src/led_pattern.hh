@@ -0,0 +1,64 @@
+#ifndef LED_PATTERN_HH
+#define LED_PATTERN_HH
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// **====================================**
+// ||          <<<<< LEDS >>>>>          ||
+// **====================================**
+
+// LED masks for the patterns.
+#define LED_RED (1 << 0)
+#define LED_YELLOW (1 << 1)
+#define LED_BLUE (1 << 2)
+
+// Longest line of patterns waiting to be played.
+#ifndef LED_PATTERN_QUEUE_CAPACITY
+#define LED_PATTERN_QUEUE_CAPACITY 8
+#endif
+
+// Defines a pattern from an array of steps.
+#define LED_PATTERN(steps, repeats, leds) \
+  {steps, sizeof(steps) / sizeof(steps[0]), repeats, leds}
+
+/**
+ * Which LEDs are on for how long.
+ */
+struct LedStep {
+  uint8_t leds;  // Mask of the LEDs that are on.
+  uint16_t duration_ms;
+};
+
+/**
+ * A sequence of steps played a number of times. While a pattern plays it only
+ * takes over the LEDs it uses, the other LEDs keep their steady state.
+ */
+struct LedPattern {
+  const LedStep* steps;
+  uint8_t step_count;
+  uint8_t repeats;
+  uint8_t leds;  // Mask of the LEDs the pattern uses.
+};
+
+// **=========================================**
+// ||          <<<<< LED CODES >>>>>          ||
+// **=========================================**
+
+extern const LedPattern LED_BOOT_WAVE;
+extern const LedPattern LED_CODE_PUB_ERR;
+extern const LedPattern LED_CODE_SUB_ERR;
+extern const LedPattern LED_CODE_SUB_RETRY;
+extern const LedPattern LED_CODE_CONNECTION_ERR;
+extern const LedPattern LED_CODE_MQTT_CONNECT_ERR;
+extern const LedPattern LED_CODE_PUB_DISCOVERY_MSG_ERR;
+
+// **============================================**
+// ||          <<<<< LED PATTERNS >>>>>          ||
+// **============================================**
+
+void ledPatternInit();
+bool ledPlay(const LedPattern* pattern);
+void ledSet(uint8_t leds, bool on);
+
+#endif
@@ -0,0 +1,144 @@
+#include "logger.hh"
+
+#include <hardware/sync.h>
+#include <pico/time.h>
+#include <stdio.h>
+
+#include "common.hh"
+#include "ring_queue.hh"
+
+// Longest formatted message, longer ones are cut short.
+#define LOG_LINE_MAX_LEN 160
+
+// **================================================**
+// ||          <<<<< STATIC VARIABLES >>>>>          ||
+// **================================================**
+
+static RingQueue<LogRecord, LOG_CAPACITY> log_ring;
+
+// Serializes the producers, which include the lwIP callbacks. NULL until
+// `logInit`, records are printed right away until then.
+static spin_lock_t* log_lock = NULL;
+
+// Records dropped because the ring was full, since the last drain.
+static volatile uint32_t log_dropped = 0;
+
+// **======================================**
+// ||          <<<<< LOGGER >>>>>          ||
+// **======================================**
+
+/**
+ * Formats a record and prints it.
+ *
+ * Goes through the format one conversion at a time and takes the matching
+ * argument out of the words of the record, in the size `logPackArg` stored it
+ * in.
+ */
+static void printRecord(const LogRecord& record) {
+  static const char level_chars[] = {' ', 'E', 'W', 'I', 'D'};
+
+  char line[LOG_LINE_MAX_LEN];
+  int line_len = 0;
+  int word = 0;
+
+  const char* c = record.format;
+  while (*c != '\0' && line_len < (int)sizeof(line) - 1) {
+    if (*c != '%') {
+      line[line_len++] = *c++;
+      continue;
+    }
+
+    // Copy one conversion, e.g. "%-8.2f", to print it on its own.
+    char spec[16];
+    int spec_len = 0;
+    spec[spec_len++] = *c++;
+    while (*c != '\0' && strchr("-+ #0123456789.hlzjt", *c) != NULL &&
+           spec_len < (int)sizeof(spec) - 2)
+      spec[spec_len++] = *c++;
+    if (*c == '\0') break;
+    char conversion = *c++;
+    spec[spec_len++] = conversion;
+    spec[spec_len] = '\0';
+
+    bool is_long_long = strstr(spec, "ll") != NULL;
+    char* out = &line[line_len];
+    size_t out_len = sizeof(line) - line_len;
+    int written = 0;
+
+    if (conversion == '%') {
+      written = snprintf(out, out_len, "%%");
+    } else if (word >= LOG_MAX_WORDS) {
+      written = snprintf(out, out_len, "?");
+    } else if (strchr("fFeEgGaA", conversion) != NULL) {
+      float value;
+      memcpy(&value, &record.words[word++], sizeof(value));
+      written = snprintf(out, out_len, spec, (double)value);
+    } else if (conversion == 's' || conversion == 'p') {
+      written = snprintf(out, out_len, spec,
+                         (const char*)(uintptr_t)record.words[word++]);
+    } else if (is_long_long && word + 1 < LOG_MAX_WORDS) {
+      uint64_t value = record.words[word] |
+                       ((uint64_t)record.words[word + 1] << 32);
+      word += 2;
+      written = snprintf(out, out_len, spec, value);
+    } else {
+      written = snprintf(out, out_len, spec, record.words[word++]);
+    }
+
+    if (written > 0) line_len = MIN(line_len + written, (int)sizeof(line) - 1);
+  }
+  line[line_len] = '\0';
+
+  printf("%lu.%03lu %c %s", (unsigned long)(record.time_us / 1000000),
+         (unsigned long)(record.time_us / 1000 % 1000),
+         level_chars[MIN(record.level, LOG_LEVEL_DEBUG)], line);
+}
+
+/**
+ * Initializes the log ring. Until then, records are printed right away.
+ */
+void logInit() { log_lock = spin_lock_instance(spin_lock_claim_unused(true)); }
+
+/**
+ * Adds a record to the log ring, stamped with the current time.
+ */
+void logPush(const LogRecord& record) {
+  LogRecord stamped = record;
+  stamped.time_us = time_us_32();
+
+  if (log_lock == NULL) {
+    printRecord(stamped);
+    return;
+  }
+
+  uint32_t saved_irq = spin_lock_blocking(log_lock);
+  if (!log_ring.push(stamped)) log_dropped++;
+  spin_unlock(log_lock, saved_irq);
+}
+
+/**
+ * Prints the records in the log ring, oldest first. Call from an idle path,
+ * printing blocks while the stdio output is busy.
+ *
+ * \param max_records The most records to print.
+ *
+ * \returns The number of records printed.
+ */
+uint32_t logDrain(uint32_t max_records) {
+  uint32_t printed = 0;
+  LogRecord record;
+  while (printed < max_records && log_ring.pop(&record)) {
+    printRecord(record);
+    printed++;
+  }
+
+  if (log_dropped > 0 && log_ring.isEmpty()) {
+    uint32_t saved_irq = spin_lock_blocking(log_lock);
+    uint32_t dropped = log_dropped;
+    log_dropped = 0;
+    spin_unlock(log_lock, saved_irq);
+    printf("Log ring full, dropped %lu records.\n", (unsigned long)dropped);
+  }
+
+  return printed;
+}
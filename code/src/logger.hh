@@ -0,0 +1,129 @@
+#ifndef LOGGER_HH
+#define LOGGER_HH
+
+#include <stdint.h>
+#include <string.h>
+
+#include <type_traits>
+
+#include "advanced_opts.hh"
+
+// **==========================================**
+// ||          <<<<< LOG LEVELS >>>>>          ||
+// **==========================================**
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Arguments of one record, in 32 bit words. 64 bit integers take two.
+#define LOG_MAX_WORDS 6
+
+// Records waiting to be printed. Must be a power of two.
+#ifndef LOG_CAPACITY
+#define LOG_CAPACITY 64
+#endif
+
+/*
+ * Messages less severe than `LOG_LEVEL` are compiled out. Their arguments are
+ * still type checked, so variables only used in log messages don't go unused.
+ */
+#define LOG_AT(level, format, ...)              \
+  do {                                          \
+    if constexpr ((level) <= LOG_LEVEL)         \
+      logWrite((level), format, ##__VA_ARGS__); \
+  } while (0)
+
+#define LOG_ERROR(format, ...) LOG_AT(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_AT(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_AT(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define LOG_DEBUG(format, ...) LOG_AT(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+
+// **======================================**
+// ||          <<<<< LOGGER >>>>>          ||
+// **======================================**
+
+/**
+ * A log message waiting to be printed.
+ *
+ * The format string is never copied. It is a literal that stays in flash, so
+ * its address identifies the message. The arguments are stored raw and only
+ * formatted when the record is printed.
+ */
+struct LogRecord {
+  const char* format;
+  uint32_t time_us;
+  uint8_t level;
+  uint32_t words[LOG_MAX_WORDS];
+};
+
+void logInit();
+void logPush(const LogRecord& record);
+uint32_t logDrain(uint32_t max_records);
+
+/**
+ * Gets how many words an argument of a type takes in a record.
+ */
+template <typename T>
+constexpr int logArgWords() {
+  return (std::is_integral_v<T> && sizeof(T) > 4) ? 2 : 1;
+}
+
+/**
+ * Stores an argument raw in the words of a record.
+ *
+ * Floating point arguments are stored as a float, so a float argument skips
+ * the conversion to double that formatting it needs until it is printed.
+ * Strings are stored as their address and must outlive the record.
+ */
+template <typename T>
+inline void logPackArg(uint32_t* words, int* count, T arg) {
+  if constexpr (std::is_floating_point_v<T>) {
+    float value = arg;
+    memcpy(&words[(*count)++], &value, sizeof(value));
+  } else if constexpr (std::is_pointer_v<T>) {
+    words[(*count)++] = (uint32_t)(uintptr_t)arg;
+  } else if constexpr (std::is_enum_v<T>) {
+    words[(*count)++] = (uint32_t)arg;
+  } else if constexpr (sizeof(T) > 4) {
+    words[(*count)++] = (uint32_t)(uint64_t)arg;
+    words[(*count)++] = (uint32_t)((uint64_t)arg >> 32);
+  } else {
+    words[(*count)++] = (uint32_t)arg;
+  }
+}
+
+/**
+ * Records a log message to be printed later by `logDrain`. Takes about as long
+ * as copying the record into the ring, so it is cheap enough for interrupts.
+ * The message is dropped if the ring is full.
+ *
+ * Use the `LOG_*` macros rather than calling this directly.
+ *
+ * @param level The level of the message.
+ * @param format A printf format string literal, without `*` widths.
+ * @param args The arguments of the format. Strings must outlive the record.
+ */
+template <typename... Args>
+inline void logWrite(uint8_t level, const char* format, Args... args) {
+  static_assert((0 + ... + logArgWords<Args>()) <= LOG_MAX_WORDS,
+                "Too many log arguments");
+
+  LogRecord record;
+  record.format = format;
+  record.level = level;
+  record.time_us = 0;  // Filled in by `logPush`.
+
+  int count = 0;
+  (logPackArg(record.words, &count, args), ...);
+
+  logPush(record);
+}
+
+#endif
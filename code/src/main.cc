@@ -1,13 +1,275 @@
 #include <hardware/gpio.h>
 #include <hardware/watchdog.h>
 #include <pico/cyw43_arch.h>
+#include <pico/multicore.h>
 #include <pico/stdio.h>
+#include <pico/time.h>
 
+#include "advanced_opts.hh"
 #include "ha_device.hh"
+#include "journal.hh"
+#include "kv_store.hh"
+#include "led_pattern.hh"
+#include "logger.hh"
+#include "mem_stats.hh"
+#include "motion_scheduler.hh"
+#include "mqtt_topics.hh"
 #include "network.hh"
 #include "opts.hh"
 #include "pins.hh"
+#include "power.hh"
+#include "profiler.hh"
 #include "stepper_motor.hh"
+#include "supervisor.hh"
+#include "timer_wheel.hh"
+#include "trace.hh"
+#include "wake_event.hh"
+
+#include <atomic>
+
+// How often to publish all the stepper motor data to insure the server stays in
+// sync (20 minutes).
+#define PUBLISH_ALL_INTERVAL_US (20ULL * 60 * 1000 * 1000)
+
+// Longest the main loop sleeps for while idle, well within its supervisor
+// deadline.
+#define MAIN_LOOP_MAX_SLEEP_US (1000 * 1000)
+
+// How long the board LED stays on and off for while the main loop is running.
+#define HEARTBEAT_HALF_PERIOD_MS 250
+
+// When the main loop last went around (32 bit for atomic access).
+static volatile uint32_t main_loop_alive_us = 0;
+
+/**
+ * When each phase of the boot finished, in milli seconds since boot.
+ */
+struct BootTimes {
+  uint32_t chip_ms;   // Wi-Fi chip and lwIP initialized.
+  uint32_t wifi_ms;   // Joined the Wi-Fi network.
+  uint32_t mqtt_ms;   // Connected to the MQTT broker.
+  uint32_t homed_ms;  // All windows homed.
+  uint32_t ready_ms;  // Taking commands.
+};
+
+static struct BootTimes boot_times;
+
+// The windows homed on core 1 during a fast boot, and whether that's done.
+static stepper_motor::StepperMotor* boot_windows;
+static std::atomic<bool> boot_homing_done(false);
+
+// Constructs the stepper motor of a window from its entry in `WINDOWS`.
+#define WINDOW_STEPPER_MOTOR(index, id, name)                              \
+  stepper_motor::StepperMotor(                                             \
+      id, MQTT_WINDOW_TOPIC_BASE(id),                                      \
+      {SM##index##_ENABLE_PIN, SM##index##_DIR_PIN, SM##index##_PULSE_PIN, \
+       SM##index##_MS1_PIN, SM##index##_MS2_PIN, SM##index##_DIAG_PIN,     \
+       SM##index##_LS_LEFT, SM##index##_LS_RIGHT},                         \
+      SM##index##_UART, SM##index##_UART_TX_PIN, SM##index##_UART_RX_PIN,  \
+      MS_64, INITIAL_MOTOR_SPEED, mqtt_client),
+
+/**
+ * Stops or starts again supervising the tasks the main loop checks in for,
+ * around actions that block the main loop.
+ *
+ * \param supervised Whether to supervise the tasks.
+ */
+static void superviseMainLoop(bool supervised) {
+  const SupervisedTask tasks[] = {TASK_MAIN_LOOP, TASK_WIFI, TASK_MQTT};
+  for (SupervisedTask task : tasks) {
+    if (supervised)
+      supervisorResume(task);
+    else
+      supervisorSuspend(task);
+  }
+}
+
+/**
+ * Starts the next queued action of a window.
+ *
+ * Moves only get started here and are then performed by the motion scheduler.
+ * Homing and calibrating are performed right away and block until done.
+ *
+ * \param sm The stepper motor of the window.
+ * \param action The action to perform.
+ */
+static void performAction(stepper_motor::StepperMotor* sm,
+                          stepper_motor::action::Action action) {
+  using namespace stepper_motor::action;
+
+  // Time the action through to its first step, if it moves the window.
+  sm->latency.begin(action, time_us_32());
+
+  // Perform appropriate operation.
+  switch (action.action_type) {
+    // Open window.
+    case ActionType::OPEN: {
+      LOG_INFO("[%s] Open window operation activated (queue size: %d)\n",
+               sm->getId(), sm->action_queue.getCount());
+      sm->open();
+      break;
+    }
+
+    // Close window.
+    case ActionType::CLOSE: {
+      LOG_INFO("[%s] Close window operation activated (queue size: %d)\n",
+               sm->getId(), sm->action_queue.getCount());
+      sm->close();
+      break;
+    }
+
+    // Move to percentage position.
+    case ActionType::MOVE_TO_PERCENT: {
+      // Parse the percentage value.
+      float percentage = CLAMP(0.0, action.data.percent, 100.0);
+
+      LOG_INFO("[%s] Move to %f%% operation activated (queue size: %d)\n",
+               sm->getId(), percentage, sm->action_queue.getCount());
+
+      // Move to the requested position.
+      sm->moveToPositionPercentage(percentage);
+
+      break;
+    }
+
+    // Move to step position.
+    case ActionType::MOVE_TO_STEP: {
+      // Parse the step value.
+      uint64_t step = MAX(0, action.data.step);
+
+      LOG_INFO("[%s] Move to step %llu operation activated (queue size: %d)\n",
+               sm->getId(), step, sm->action_queue.getCount());
+
+      // Move to the requested position.
+      sm->moveToPosition(step);
+
+      break;
+    }
+
+    case ActionType::HOME: {
+      superviseMainLoop(false);
+      sm->home();
+      superviseMainLoop(true);
+      break;
+    }
+
+    case ActionType::CALIBRATE: {
+      superviseMainLoop(false);
+      sm->calibrate();
+      superviseMainLoop(true);
+      break;
+    }
+
+    // Pause before the next action.
+    case ActionType::WAIT: {
+      LOG_INFO("[%s] Wait %lums operation activated (queue size: %d)\n",
+               sm->getId(), (unsigned long)action.data.duration_ms,
+               sm->action_queue.getCount());
+      sm->dwell(action.data.duration_ms * 1000ULL);
+      break;
+    }
+
+    // Do nothing.
+    case ActionType::NONE:
+      break;
+  }
+}
+
+/**
+ * Homes every window whose position didn't survive the reboot, one at a time.
+ *
+ * \param windows The stepper motors of the windows, `WINDOW_COUNT` of them.
+ * \param lock_network Whether to hold the network lock while homing, see
+ * `StepperMotor::home`.
+ */
+static void homeWindows(stepper_motor::StepperMotor* windows,
+                        bool lock_network) {
+  for (int i = 0; i < WINDOW_COUNT; i++) {
+    windows[i].enable();
+
+    // Only home the motors whose position didn't survive the reboot.
+    if (windows[i].restorePosition()) continue;
+
+    printf("[%s] Homeing...\n", windows[i].getId());
+    windows[i].home(lock_network);
+    printf("[%s] Homeing Complete.\n", windows[i].getId());
+  }
+
+  boot_times.homed_ms = to_ms_since_boot(get_absolute_time());
+}
+
+/**
+ * Homes the windows of a fast boot on core 1, while core 0 brings up the
+ * network.
+ *
+ * Core 1 homes without taking the network lock, which would hold up the Wi-Fi
+ * join on core 0 until the homing is done, and in poll mode may not be taken
+ * from core 1 at all. The motors don't publish anything until the Home
+ * Assistant device is set up, which waits for the homing to be done, so core 1
+ * never touches lwIP. Homing on its own core also keeps the network interrupts
+ * from making the steps stutter. When the network is polled, only core 0 ever
+ * polls it.
+ */
+static void homeWindowsCore1() {
+  homeWindows(boot_windows, false);
+  boot_homing_done.store(true, std::memory_order_release);
+}
+
+/**
+ * Publishes how long each phase of the boot took to every window, retained so
+ * that the time to ready can be tracked across reboots.
+ */
+static void publishBootTimes(stepper_motor::StepperMotor* windows) {
+  char buf[128];
+  snprintf(buf, sizeof(buf),
+           "{\"chip\":%lu,\"wifi\":%lu,\"mqtt\":%lu,\"homed\":%lu,"
+           "\"ready\":%lu,\"fast\":%s}",
+           (unsigned long)boot_times.chip_ms, (unsigned long)boot_times.wifi_ms,
+           (unsigned long)boot_times.mqtt_ms,
+           (unsigned long)boot_times.homed_ms,
+           (unsigned long)boot_times.ready_ms, (FAST_BOOT) ? "true" : "false");
+
+  for (int i = 0; i < WINDOW_COUNT; i++)
+    windows[i].basicMqttPublish(MQTT_SUBTOPIC_SENSOR_BOOT_TIMES, buf, 1, 1);
+}
+
+/**
+ * Publishes how long it took to get back to full performance from the low
+ * power state to every window, in milli seconds.
+ *
+ * \param windows The stepper motors of the windows, `WINDOW_COUNT` of them.
+ * \param latency_us How long it took in micro seconds.
+ */
+static void publishWakeLatency(stepper_motor::StepperMotor* windows,
+                               uint32_t latency_us) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%lu.%03lu", (unsigned long)(latency_us / 1000),
+           (unsigned long)(latency_us % 1000));
+
+  for (int i = 0; i < WINDOW_COUNT; i++)
+    windows[i].basicMqttPublish(MQTT_SUBTOPIC_SENSOR_WAKE_LATENCY, buf, 0, 0);
+}
+
+/**
+ * Blinks the board LED for as long as the main loop keeps going around.
+ *
+ * Runs as a worker of the async context of the Wi-Fi chip, which the board LED
+ * is connected to, and re-schedules itself. The LED stays off once the main
+ * loop hasn't gone around for a while, to show it might be stuck.
+ */
+static void heartbeatCb(async_context_t* context,
+                        async_at_time_worker_t* worker) {
+  static bool led_on = false;
+
+  led_on = !led_on &&
+           (time_us_32() - main_loop_alive_us < 2 * MAIN_LOOP_MAX_SLEEP_US);
+  cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, led_on);
+
+  async_context_add_at_time_worker_in_ms(context, worker,
+                                         HEARTBEAT_HALF_PERIOD_MS);
+}
+
+static async_at_time_worker_t heartbeat_worker;
 
 /**
  * This is the main program start for the IoT window device.
@@ -39,9 +301,24 @@ int main() {
   // ||          <<<<< GENERAL SETUP >>>>>          ||
   // **=============================================**
 
+  // Paint the stacks for the memory report before they are used much.
+  memStatsInit();
+
+  // Let the system clock be scaled down while idle without changing the baud
+  // rates, this has to happen before any UART is set up.
+  powerInit();
+
   // Initialize IO on the pico.
   stdio_init_all();
-  sleep_ms(1000);
+
+  // Give a USB serial console the time to attach before anything is printed.
+  if (!FAST_BOOT) sleep_ms(1000);
+
+  // Defer runtime log messages to the idle path of the main loop.
+  logInit();
+
+  // Start recording the event trace.
+  traceInit();
 
   // Once stdio has been initialized, announce the start of the program.
   printf("Program Start\n");
@@ -51,132 +328,162 @@ int main() {
   // that device).
   printf("Initializing Pins... ");
   init_pins();
+  ledPatternInit();
   printf("done.\n");
 
   // Wave LEDs to visualize the start of the program without the need of a
-  // console.
-  {
-    uint led_order[4] = {RED_LED_PIN, YELLOW_LED_PIN, BLUE_LED_PIN};
-    int ms = 100;
-
-    // Wave 3 times.
-    for (int i = 0; i < 3; i++) {
-      for (uint pin : led_order) {
-        gpio_put(pin, 1);
-        sleep_ms(ms);
-      }
-      for (uint pin : led_order) {
-        gpio_put(pin, 0);
-        sleep_ms(ms);
-      }
-    }
-  }
+  // console. The wave plays in the background while the setup goes on.
+  ledPlay(&LED_BOOT_WAVE);
 
   // **========================================**
   // ||          <<<<< WATCHDOG >>>>>          ||
   // **========================================**
 
   // Enable the yellow LED if the reboot was caused by the watchdog.
-  if (watchdog_enable_caused_reboot()) gpio_put(YELLOW_LED_PIN, 1);
+  if (watchdog_enable_caused_reboot()) ledSet(LED_YELLOW, true);
 
-  printf("Enabling watchdog...");
-  watchdog_enable(8388, 1);  // 8.388 seconds, max for RP2040.
-  printf(" done.\n");
+  // Report which task caused the last reboot, if any, and enable the watchdog.
+  printf("Enabling watchdog...\n");
+  supervisorInit(SUPERVISOR_WATCHDOG_TIMEOUT_MS);
 
   // **=============================================**
   // ||          <<<<< NETWORK SETUP >>>>>          ||
   // **=============================================**
 
-  // Initialize the network connection.
+  // Initialize the Wi-Fi chip, the network is joined after the motors are set
+  // up so a fast boot can home them meanwhile.
   printf("Initializing Networking... ");
-  if (networkInit() != 0) {
+  if (networkChipInit() != 0) {
     printf("Failed! Exiting.\n");
     stdio_flush();
     return -1;
-  } else {
-    printf("Success.\n");
   }
+  boot_times.chip_ms = to_ms_since_boot(get_absolute_time());
 
   // Print the memory size and the ring buffer size used by lwIP for debugging.
   if (MQTT_DEBUG)
     printf("MEMSIZE size: %d\nRINGBUF size: %d\n", MEM_SIZE,
            MQTT_OUTPUT_RINGBUF_SIZE);
 
-  // ----- MQTT Setup -----
-  printf("Setting up mqtt...\n");
-
   // Get lwIP locks while creating the MQTT client.
   cyw43_arch_lwip_begin();
   mqtt_client_t* mqtt_client = mqtt_client_new();
   cyw43_arch_lwip_end();
 
-  // Attempt connection to the MQTT server and repeat until successful.
-  printf("Insurring mqtt connection...\n");
-  bool mqtt_setup_success;
-  do {
-    mqtt_setup_success = mqttDoConnect(mqtt_client);
-
-    // Give MQTT subscribe requests that happen in the callback a chance to
-    // complete.
-    sleep_ms(1000);
-  } while (!mqtt_setup_success);
-  printf("MQTT setup finished.\n");
-
   // **============================================**
   // ||          <<<<< DEVICE SETUP >>>>>          ||
   // **============================================**
 
-  // Initialize stepper motor for the window.
-  stepper_motor::StepperMotor window_sm(SM_ENABLE_PIN, SM_DIR_PIN, SM_PULSE_PIN,
-                                        SM_MS1_PIN, SM_MS2_PIN, MS_64,
-                                        INITIAL_MOTOR_SPEED, mqtt_client);
-  printf("Motor setup complete.\n");
+  // Initialize the stepper motors of the windows. Guaranteed copy elision
+  // constructs each motor in place, which matters as the motors register
+  // themselves for the stall interrupt.
+  stepper_motor::StepperMotor windows[WINDOW_COUNT] = {
+      WINDOWS(WINDOW_STEPPER_MOTOR)};
+  printf("Motor setup complete (%d windows).\n", WINDOW_COUNT);
 
-  // Setup the Home Assistant device.
-  haDeviceSetup(mqtt_client, &window_sm);
+  // Let a single scheduler drive the moves of all the windows so they can move
+  // at the same time.
+  stepper_motor::MotionScheduler scheduler;
+  for (stepper_motor::StepperMotor& sm : windows) scheduler.addMotor(&sm);
+
+  // Holds the actions scheduled for later until they are due.
+  stepper_motor::action::TimerWheel timers;
 
   // ----- WINDOW STEPPER MOTOR HOMING -----
   /*
    * Performs the homing operation for the window stepper motor.
    *
-   * During the homing process the locks for lwIP and thus the network chip
-   * itself are acquired. Even though control of the network chip is not
-   * actively needed for this operation, the interrupts that occur due to the
-   * network activity (specifically from the MQTT service) can cause problems
-   * with the homing process. Problems range from stuttering during the motor
-   * movement which can lead to an inaccurate reading of the home position and
-   * unwanted noise, to the homing process getting interrupted and failing to
-   * continue.
+   * A fast boot homes the windows on core 1 right away, while core 0 joins the
+   * network and connects to MQTT. Otherwise the windows are homed once the
+   * Home Assistant device is set up.
    *
-   * Acquiring the locks simply makes the homing process smoother and more
-   * reliable.
-   *
-   * Additionally, at prior to the motor being homed, any online device does not
-   * know what state the window/motor is in and thus control of it via the
-   * network isn't recommended anyways.
+   * Prior to the motor being homed, any online device does not know what state
+   * the window/motor is in and thus control of it via the network isn't
+   * recommended anyways.
    *
    * For options related to the homing process such as the direction/side to
    * home to and which limit switch is on which side of the window, see the
    * `opts.h` file.
    */
+  if (FAST_BOOT) {
+    boot_windows = windows;
+    multicore_launch_core1(homeWindowsCore1);
+  }
+
+  // ----- Wi-Fi Setup -----
+  if (networkConnect() != 0) {
+    printf("Failed! Exiting.\n");
+    stdio_flush();
+    return -1;
+  } else {
+    printf("Success.\n");
+  }
+  boot_times.wifi_ms = to_ms_since_boot(get_absolute_time());
+
+  // ----- MQTT Setup -----
+  printf("Setting up mqtt...\n");
+
+  // Attempt connection to the MQTT server and repeat until successful.
+  printf("Insurring mqtt connection...\n");
+  bool mqtt_setup_success;
+  do {
+    mqtt_setup_success = mqttDoConnect(mqtt_client);
+    if (!mqtt_setup_success &&
+        cyw43_wifi_link_status(&cyw43_state, CYW43_ITF_STA) != CYW43_LINK_JOIN)
+      wifiConnect();
 
-  // Turn on the board led while the stepper motor is homing.
-  cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 1);
+    // Give MQTT subscribe requests that happen in the callback a chance to
+    // complete. A fast boot moves on as soon as the broker accepted.
+    uint64_t wait_until_us = time_us_64() + 1000 * 1000;
+    while (time_us_64() < wait_until_us) {
+      supervisorService();
+      if (FAST_BOOT && mqtt_setup_success) {
+        cyw43_arch_lwip_begin();
+        bool connected = mqtt_client_is_connected(mqtt_client);
+        cyw43_arch_lwip_end();
+        if (connected) break;
+      }
+      networkSleepMs(MQTT_CONNECT_POLL_MS);
+    }
+  } while (!mqtt_setup_success);
+  printf("MQTT setup finished.\n");
+  boot_times.mqtt_ms = to_ms_since_boot(get_absolute_time());
+
+  // Wait for core 1 to finish homing before the motors are handed over to the
+  // Home Assistant device, then put core 1 back to sleep.
+  if (FAST_BOOT) {
+    while (!boot_homing_done.load(std::memory_order_acquire)) {
+      supervisorService();
+      networkSleepMs(MQTT_CONNECT_POLL_MS);
+    }
+    multicore_reset_core1();
+  }
 
-  // Enable the motor (turn it on).
-  window_sm.enable();
+  // Setup the Home Assistant device.
+  haDeviceSetup(mqtt_client, windows, WINDOW_COUNT, &timers);
 
-  // Perform the homing operation.
-  printf("Homeing...\n");
-  window_sm.home();
-  printf("Homeing Complete.\n");
+  if (!FAST_BOOT) {
+    // Turn on the board led while the stepper motor is homing.
+    cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 1);
+
+    // Enable the motors (turn them on) and perform the homing operations, one
+    // window at a time.
+    homeWindows(windows, true);
+  }
 
   // Disable the yellow LED that indicated this boot was caused by the watchdog
   // timing out.
-  gpio_put(YELLOW_LED_PIN, 0);
+  ledSet(LED_YELLOW, false);
 
   // Publish the current state of the device.
-  window_sm.publishAll();
+  for (stepper_motor::StepperMotor& sm : windows) {
+    sm.publishAll();
+    sm.publishOdometer();
+  }
+
+  boot_times.ready_ms = to_ms_since_boot(get_absolute_time());
+  printf("Ready %lums after boot.\n", (unsigned long)boot_times.ready_ms);
+  publishBootTimes(windows);
 
   /*
   **=========================================================================**
@@ -190,16 +497,42 @@ int main() {
   **=========================================================================**
   */
 
-  unsigned int loop_iteration = 0;
+  // Blink the board LED in the background.
+  heartbeat_worker.do_work = heartbeatCb;
+  async_context_add_at_time_worker_in_ms(cyw43_arch_async_context(),
+                                         &heartbeat_worker, 0);
+
+  // From here on the watchdog is only fed while the main loop keeps going
+  // around, the Wi-Fi link stays up and the MQTT client stays connected. Moving
+  // motors are supervised by the motion scheduler.
+  supervisorStart(TASK_MAIN_LOOP, SUPERVISOR_MAIN_LOOP_DEADLINE_MS);
+  supervisorStart(TASK_WIFI, SUPERVISOR_WIFI_DEADLINE_MS);
+  supervisorStart(TASK_MQTT, SUPERVISOR_MQTT_DEADLINE_MS);
+  supervisorStart(TASK_MOTION, SUPERVISOR_MOTION_DEADLINE_MS);
+  supervisorSuspend(TASK_MOTION);
+
+  uint64_t last_publish_all_us = time_us_64();
+  uint64_t last_odometer_us = time_us_64();
   while (true) {
-    // Feed watchdog on each loop.
-    watchdog_update();
+    supervisorCheckIn(TASK_MAIN_LOOP);
+    main_loop_alive_us = time_us_32();
+
+    // When the network is polled, service it once every round, i.e. between
+    // two batches of steps, unless a motor is soft starting, whose edges
+    // can't be delayed. The motion scheduler fits in more services where the
+    // moves leave room for them.
+    if (!scheduler.isRamping()) networkPoll();
 
     // If the network connection is down, set the red LED on and attempt to
     // reconnect.
     if (cyw43_wifi_link_status(&cyw43_state, CYW43_ITF_STA) !=
         CYW43_LINK_JOIN) {
-      gpio_put(RED_LED_PIN, 1);
+      ledSet(LED_RED, true);
+
+      // Reconnecting blocks the main loop, Wi-Fi is supervised by the
+      // connection attempts meanwhile.
+      supervisorSuspend(TASK_MAIN_LOOP);
+      supervisorSuspend(TASK_MQTT);
 
       // Leave the network.
       wifiDisconnect();
@@ -207,9 +540,22 @@ int main() {
       // Reconnect to the network.
       wifiConnect();
 
-      gpio_put(RED_LED_PIN, 0);
+      supervisorResume(TASK_MAIN_LOOP);
+      supervisorResume(TASK_MQTT);
+
+      ledSet(LED_RED, false);
+    } else {
+      supervisorCheckIn(TASK_WIFI);
     }
 
+    cyw43_arch_lwip_begin();
+    bool mqtt_connected = mqtt_client_is_connected(mqtt_client);
+    cyw43_arch_lwip_end();
+    if (mqtt_connected) supervisorCheckIn(TASK_MQTT);
+
+    // Feed the watchdog if every task is keeping up.
+    supervisorService();
+
     // ----- PROCESS STEPPER MOTOR ACTIONS -----
     /*
      * Requested actions are set during network interrupts such as when an
@@ -238,94 +584,122 @@ int main() {
      * (non-percentage positioning) or for emergency stops (assuming networking
      * is still operational).
      *
-     * The action queue allows multiple actions to be queued sequentially.
-     * Actions are processed in FIFO order - first action queued is first
-     * executed. The queue holds up to 8 actions by default.
+     * Each window has its own action queue which allows multiple actions to be
+     * queued sequentially. Actions are processed in FIFO order - first action
+     * queued is first executed. The queue holds up to 8 actions by default.
+     *
+     * Moves don't block: starting an action only sets the move up, the motion
+     * scheduler then performs the moves of all windows at the same time in
+     * short batches between rounds of the main loop.
+     *
+     * Control commands (stop, speed and mode changes) don't go through the
+     * action queue at all but through a separate control lane, which is
+     * applied every round. They take effect within one batch no matter how
+     * many actions are queued.
      */
 
-    if (window_sm.hasQueuedActions()) {
+    // Release the scheduled actions that are due into their action queues. The
+    // MQTT callbacks enqueue actions too, holding the lwIP lock keeps them from
+    // running at the same time so each queue still has a single producer.
+    cyw43_arch_lwip_begin();
+    timers.tick(time_us_64());
+    cyw43_arch_lwip_end();
+
+    for (stepper_motor::StepperMotor& sm : windows) {
       using namespace stepper_motor::action;
 
-      // Get the next action and its argument from the queue.
-      Action action = window_sm.action_queue.dequeue();
-
-      // Perform appropriate operation.
-      switch (action.action_type) {
-        // Open window.
-        case ActionType::OPEN: {
-          printf("Open window operation activated (queue size: %d)\n",
-                 window_sm.action_queue.getCount());
-          bool open_success = window_sm.open();
-          break;
-        }
-
-        // Close window.
-        case ActionType::CLOSE: {
-          printf("Close window operation activated (queue size: %d)\n",
-                 window_sm.action_queue.getCount());
-          bool close_success = window_sm.close();
-          break;
-        }
-
-        // Move to percentage position.
-        case ActionType::MOVE_TO_PERCENT: {
-          // Parse the percentage value.
-          float percentage = CLAMP(0.0, action.data.percent, 100.0);
-
-          printf("Move to %f%% operation activated (queue size: %d)\n",
-                 percentage, window_sm.action_queue.getCount());
-
-          // Move to the requested position.
-          window_sm.moveToPositionPercentage(percentage);
-
-          break;
-        }
-
-        // Move to step position.
-        case ActionType::MOVE_TO_STEP: {
-          // Parse the step value.
-          uint64_t step = MAX(0, action.data.step);
-
-          printf("Move to step %llu operation activated (queue size: %d)\n",
-                 step, window_sm.action_queue.getCount());
-
-          // Move to the requested position.
-          window_sm.moveToPosition(step);
-
-          break;
-        }
-
-        case ActionType::HOME: {
-          window_sm.home();
-          break;
-        }
-
-        case ActionType::CALIBRATE: {
-          window_sm.calibrate();
-          break;
-        }
-
-        // Do nothing.
-        case ActionType::NONE:
-          break;
+      sm.applyControl();
+
+      // A window only starts its next action once its current move is done.
+      // Windows with nothing to do power their motor down after a while.
+      if (sm.isMoving() || !sm.hasQueuedActions()) {
+        sm.serviceIdle(time_us_64());
+        continue;
       }
+
+      // Homing and calibrating block, so wait for the other windows to stop
+      // moving before starting them.
+      Action next_action;
+      if (scheduler.isActive() && sm.action_queue.peek(&next_action) &&
+          (next_action.action_type == ActionType::HOME ||
+           next_action.action_type == ActionType::CALIBRATE))
+        continue;
+
+      // Get back to full performance before the action takes its first step.
+      if (powerIsLow()) publishWakeLatency(windows, powerRestore());
+
+      // Get the next action and its argument from the queue and start it.
+      performAction(&sm, sm.action_queue.dequeue());
     }
 
-    // Every ~20 minutes, publish all the stepper motor data to
-    // insure the server stays in sync.
-    if (loop_iteration % 1800 == 0) {
-      window_sm.publishAll();
+    // Save power on the radio and the clocks once nothing has been moving or
+    // waiting to move for a while.
+    bool busy = scheduler.isActive();
+    for (stepper_motor::StepperMotor& sm : windows)
+      busy = busy || sm.hasQueuedActions();
+    powerService(busy);
+
+    // Journal the positions the motors came to rest at and commit changed
+    // settings.
+    stepper_motor::journalService(scheduler.isActive());
+    kvService(scheduler.isActive());
+
+    // Hash the flash image a block at a time for the profiler dumps.
+    profilerService(scheduler.isActive());
+
+    // Publish all the stepper motor data every so often to insure the server
+    // stays in sync.
+    if (time_us_64() - last_publish_all_us >= PUBLISH_ALL_INTERVAL_US) {
+      for (stepper_motor::StepperMotor& sm : windows) sm.publishAll();
+      last_publish_all_us = time_us_64();
     }
 
-    // Blink the board led through each main loop cycle.
-    // This helps show whether the main loop is continuing or if the program
-    // might be stuck somewhere.
-    cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 1);
-    sleep_ms(250);
-    cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 0);
-    sleep_ms(250);
+    // Publish how much the windows have worked every so often.
+    if (time_us_64() - last_odometer_us >=
+        ODOMETER_PUBLISH_INTERVAL_MS * 1000ULL) {
+      for (stepper_motor::StepperMotor& sm : windows) sm.publishOdometer();
+      last_odometer_us = time_us_64();
+    }
 
-    // Increment the loop iteration. It is fine if this wraps.
-    loop_iteration += 1;
+    // Report how many commands got through the rate limits and how many were
+    // dropped.
+    haPublishCommandStats();
+
+    // Track how full the publishes of this round got the MQTT output buffer,
+    // and report the memory high-water marks if asked to.
+    cyw43_arch_lwip_begin();
+    memStatsSample(mqtt_client);
+    cyw43_arch_lwip_end();
+    haPublishMemoryStats();
+
+    // Dump the event trace and the profiler, a chunk per round, if asked to.
+    haPublishTrace();
+    haPublishProfile();
+
+    // Print what was logged since the last round. Only a few records at a time
+    // while the motors move, so that printing doesn't hold up the next batch.
+    logDrain(scheduler.isActive() ? LOG_DRAIN_MOVING_MAX : UINT32_MAX);
+
+    // While any window is moving, step the motors for a short batch and then
+    // come back around to pick up new actions.
+    if (scheduler.isActive()) {
+      scheduler.run(MOTION_BATCH_US);
+      continue;
+    }
+
+    // ----- SLEEP UNTIL THERE IS SOMETHING TO DO -----
+    /*
+     * New actions, control requests and Wi-Fi link changes wake the loop right
+     * away. Otherwise it sleeps until the next scheduled action or periodic
+     * publish is due, but no longer than `MAIN_LOOP_MAX_SLEEP_US` so the
+     * watchdog still gets fed. When the network is polled, it's serviced
+     * whenever the Wi-Fi chip has work in the meantime.
+     */
+    uint64_t wake_us = MIN(timers.getNextTickUs(),
+                           last_publish_all_us + PUBLISH_ALL_INTERVAL_US);
+    wake_us =
+        MIN(wake_us, last_odometer_us + ODOMETER_PUBLISH_INTERVAL_MS * 1000ULL);
+    wake_us = MIN(wake_us, time_us_64() + MAIN_LOOP_MAX_SLEEP_US);
+    networkWaitUntil(&main_loop_wake, wake_us);
   }
 }
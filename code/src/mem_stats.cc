@@ -0,0 +1,143 @@
+#include "mem_stats.hh"
+
+#include <lwip/apps/mqtt_priv.h>
+#include <lwip/memp.h>
+#include <lwip/stats.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "common.hh"
+
+// **======================================**
+// ||          <<<<< STACKS >>>>>          ||
+// **======================================**
+
+/*
+ * The stacks are painted with a known word at boot. The deepest a stack ever
+ * got is where the paint ends, scanning up from the bottom of the stack.
+ */
+
+#define STACK_PAINT 0xDEADBEEF
+
+// Left unpainted right below the stack pointer of core 0 when painting, for
+// the painting itself.
+#define STACK_PAINT_MARGIN 64
+
+// From the linker script.
+extern uint32_t __StackBottom;
+extern uint32_t __StackTop;
+extern uint32_t __StackOneBottom;
+extern uint32_t __StackOneTop;
+extern char end;
+extern char __HeapLimit;
+
+/**
+ * Gets the most of a painted stack that was ever used, in bytes.
+ */
+static uint32_t stackPeak(const uint32_t* bottom, const uint32_t* top) {
+  const uint32_t* word = bottom;
+  while (word < top && *word == STACK_PAINT) word++;
+  return (top - word) * sizeof(uint32_t);
+}
+
+// **====================================**
+// ||          <<<<< LWIP >>>>>          ||
+// **====================================**
+
+// The names of the lwIP pools, in the order of `lwip_stats.memp`.
+#define LWIP_MEMPOOL(name, num, size, desc) #name,
+static const char* const memp_names[] = {
+#include <lwip/priv/memp_std.h>
+};
+
+// The most that was ever waiting in the MQTT output ring buffer, in bytes.
+static uint32_t mqtt_ringbuf_max = 0;
+
+// **============================================**
+// ||          <<<<< MEMORY STATS >>>>>          ||
+// **============================================**
+
+/**
+ * Paints the stacks of both cores. Call first thing in `main`, before core 1
+ * is launched.
+ */
+void memStatsInit() {
+  uint32_t* sp = (uint32_t*)__builtin_frame_address(0);
+  for (uint32_t* word = &__StackBottom; word < sp - STACK_PAINT_MARGIN / 4;
+       word++)
+    *word = STACK_PAINT;
+
+  for (uint32_t* word = &__StackOneBottom; word < &__StackOneTop; word++)
+    *word = STACK_PAINT;
+}
+
+/**
+ * Samples how much is waiting in the MQTT output ring buffer. lwIP doesn't
+ * track its high-water mark, so call right after publishing, while holding
+ * the lwIP lock.
+ *
+ * \param client The MQTT client to sample.
+ */
+void memStatsSample(mqtt_client_t* client) {
+  int32_t len = (int32_t)client->output.put - client->output.get;
+  if (len < 0) len += MQTT_OUTPUT_RINGBUF_SIZE;
+
+  if ((uint32_t)len > mqtt_ringbuf_max) mqtt_ringbuf_max = len;
+}
+
+/**
+ * Writes the high-water marks of the memory as JSON, each as
+ * `[peak, size]` in bytes, or `[peak, size, errors]` in elements for the
+ * lwIP pools:
+ * - heap:  The C heap, its peak is how far it was ever grown.
+ * - stack: The stacks of core 0 and core 1.
+ * - lwip:  The lwIP heap, unless lwIP allocates from the C heap.
+ * - mqtt:  The MQTT output ring buffer.
+ * - pools: Every lwIP pool.
+ *
+ * Call while holding the lwIP lock.
+ *
+ * \param buf Where to write the JSON to.
+ * \param size The size of `buf`.
+ *
+ * \returns The length of the JSON, `size` or more if it didn't fit.
+ */
+int memStatsFormat(char* buf, size_t size) {
+  struct mallinfo heap = mallinfo();
+  size_t len = 0;
+
+#define APPEND(...) \
+  len += snprintf(buf + MIN(len, size), size - MIN(len, size), __VA_ARGS__)
+
+  APPEND("{\"heap\":[%lu,%lu],", (unsigned long)heap.arena,
+         (unsigned long)(&__HeapLimit - &end));
+  APPEND("\"stack\":[[%lu,%lu],[%lu,%lu]],",
+         (unsigned long)stackPeak(&__StackBottom, &__StackTop),
+         (unsigned long)((&__StackTop - &__StackBottom) * 4),
+         (unsigned long)stackPeak(&__StackOneBottom, &__StackOneTop),
+         (unsigned long)((&__StackOneTop - &__StackOneBottom) * 4));
+#if !MEM_LIBC_MALLOC
+  APPEND("\"lwip\":[%lu,%lu],", (unsigned long)lwip_stats.mem.max,
+         (unsigned long)lwip_stats.mem.avail);
+#endif
+  APPEND("\"mqtt\":[%lu,%lu],", (unsigned long)mqtt_ringbuf_max,
+         (unsigned long)MQTT_OUTPUT_RINGBUF_SIZE);
+
+  // The pools are only set up once lwIP is.
+  APPEND("\"pools\":{");
+  bool first = true;
+  for (int i = 0; i < MEMP_MAX; i++) {
+    if (lwip_stats.memp[i] == NULL) continue;
+    APPEND("%s\"%s\":[%lu,%lu,%lu]", (first) ? "" : ",", memp_names[i],
+           (unsigned long)lwip_stats.memp[i]->max,
+           (unsigned long)lwip_stats.memp[i]->avail,
+           (unsigned long)lwip_stats.memp[i]->err);
+    first = false;
+  }
+  APPEND("}}");
+
+#undef APPEND
+
+  return len;
+}
@@ -0,0 +1,12 @@
+#ifndef MEM_STATS_HH
+#define MEM_STATS_HH
+
+#include <lwip/apps/mqtt.h>
+#include <stddef.h>
+
+void memStatsInit();
+
+void memStatsSample(mqtt_client_t* client);
+int memStatsFormat(char* buf, size_t size);
+
+#endif
@@ -13,37 +13,71 @@
 // Availability topic.
 #define MQTT_TOPIC_AVAILABILITY MQTT_TOPIC_BASE "avail"
 
+// **=======================================================**
+// ||          <<<<< WINDOW ATTRIBUTE TOPICS >>>>>          ||
+// **=======================================================**
+
+// Window base topic. Every window publishes and subscribes under its own base,
+// `id` must be a string literal.
+#define MQTT_WINDOW_TOPIC_BASE(id) MQTT_TOPIC_BASE id "/"
+#define MQTT_WINDOW_TOPIC(id, subtopic) MQTT_WINDOW_TOPIC_BASE(id) subtopic
+
+// Subscribes to the command topics of all windows at once.
+#define MQTT_TOPIC_COMMAND_ALL_WINDOWS MQTT_TOPIC_BASE "+/cmd/#"
+
 // --- State Topics ---
-#define MQTT_TOPIC_STATE_GENERAL MQTT_TOPIC_BASE "state/gnrl"
-#define MQTT_TOPIC_STATE_SPEED MQTT_TOPIC_BASE "state/speed"
-#define MQTT_TOPIC_STATE_QUIET MQTT_TOPIC_BASE "state/quiet"
-#define MQTT_TOPIC_STATE_POSITION_STEPS MQTT_TOPIC_BASE "state/steps"
-#define MQTT_TOPIC_STATE_POSITION_MM MQTT_TOPIC_BASE "state/mm"
-#define MQTT_TOPIC_STATE_POSITION_PERCENT MQTT_TOPIC_BASE "state/percent"
-#define MQTT_TOPIC_STATE_SOFT_START MQTT_TOPIC_BASE "state/softstart"
+#define MQTT_SUBTOPIC_STATE_GENERAL "state/gnrl"
+#define MQTT_SUBTOPIC_STATE_SPEED "state/speed"
+#define MQTT_SUBTOPIC_STATE_QUIET "state/quiet"
+#define MQTT_SUBTOPIC_STATE_POSITION_STEPS "state/steps"
+#define MQTT_SUBTOPIC_STATE_POSITION_MM "state/mm"
+#define MQTT_SUBTOPIC_STATE_POSITION_PERCENT "state/percent"
+#define MQTT_SUBTOPIC_STATE_SOFT_START "state/softstart"
+#define MQTT_SUBTOPIC_STATE_ACCELERATION "state/accel"
 
 // --- Command Topics ---
-#define MQTT_TOPIC_COMMAND_GENERAL MQTT_TOPIC_BASE "cmd/gnrl"
-#define MQTT_TOPIC_COMMAND_SPEED MQTT_TOPIC_BASE "cmd/speed"
-#define MQTT_TOPIC_COMMAND_QUIET MQTT_TOPIC_BASE "cmd/quiet"
-#define MQTT_TOPIC_COMMAND_POSITION_STEPS MQTT_TOPIC_BASE "cmd/steps"
-#define MQTT_TOPIC_COMMAND_POSITION_MM MQTT_TOPIC_BASE "cmd/mm"
-#define MQTT_TOPIC_COMMAND_POSITION_PERCENT MQTT_TOPIC_BASE "cmd/percent"
-#define MQTT_TOPIC_COMMAND_SOFT_START MQTT_TOPIC_BASE "cmd/softstart"
+#define MQTT_SUBTOPIC_COMMAND_GENERAL "cmd/gnrl"
+#define MQTT_SUBTOPIC_COMMAND_SPEED "cmd/speed"
+#define MQTT_SUBTOPIC_COMMAND_QUIET "cmd/quiet"
+#define MQTT_SUBTOPIC_COMMAND_POSITION_STEPS "cmd/steps"
+#define MQTT_SUBTOPIC_COMMAND_POSITION_MM "cmd/mm"
+#define MQTT_SUBTOPIC_COMMAND_POSITION_PERCENT "cmd/percent"
+#define MQTT_SUBTOPIC_COMMAND_SOFT_START "cmd/softstart"
+#define MQTT_SUBTOPIC_COMMAND_ACCELERATION "cmd/accel"
 
-#define MQTT_TOPIC_COMMAND_HOME MQTT_TOPIC_BASE "cmd/home"
-#define MQTT_TOPIC_COMMAND_CALIBRATE MQTT_TOPIC_BASE "cmd/calibrate"
+#define MQTT_SUBTOPIC_COMMAND_HOME "cmd/home"
+#define MQTT_SUBTOPIC_COMMAND_CALIBRATE "cmd/calibrate"
+#define MQTT_SUBTOPIC_COMMAND_BATCH "cmd/batch"
+#define MQTT_SUBTOPIC_COMMAND_SCHEDULE "cmd/sched"
+#define MQTT_SUBTOPIC_COMMAND_MEMORY "cmd/mem"
+#define MQTT_SUBTOPIC_COMMAND_TRACE "cmd/trace"
+#define MQTT_SUBTOPIC_COMMAND_PROFILE "cmd/prof"
+#define MQTT_SUBTOPIC_COMMAND_ECHO "cmd/echo"
 
 // --- Sensor Topics ---
-#define MQTT_TOPIC_SENSOR_MICRO_STEPS MQTT_TOPIC_BASE "snsr/micrstp"
-#define MQTT_TOPIC_SENSOR_HALF_STEP_DELAY MQTT_TOPIC_BASE "snsr/stepdelay"
-#define MQTT_TOPIC_SENSOR_FULL_OPEN_MEASUREMENT \
-  MQTT_TOPIC_BASE "snsr/fullopnmsr"
+#define MQTT_SUBTOPIC_SENSOR_MICRO_STEPS "snsr/micrstp"
+#define MQTT_SUBTOPIC_SENSOR_HALF_STEP_DELAY "snsr/stepdelay"
+#define MQTT_SUBTOPIC_SENSOR_FULL_OPEN_MEASUREMENT "snsr/fullopnmsr"
+#define MQTT_SUBTOPIC_SENSOR_STALL "snsr/stall"
+#define MQTT_SUBTOPIC_SENSOR_REJECTED_COMMAND "snsr/cmdrej"
+#define MQTT_SUBTOPIC_SENSOR_COMMAND_STATS "snsr/cmdstats"
+#define MQTT_SUBTOPIC_SENSOR_BOOT_TIMES "snsr/boot"
+#define MQTT_SUBTOPIC_SENSOR_WAKE_LATENCY "snsr/wake"
+#define MQTT_SUBTOPIC_SENSOR_MEMORY "snsr/mem"
+#define MQTT_SUBTOPIC_SENSOR_TRACE "snsr/trace"
+#define MQTT_SUBTOPIC_SENSOR_PROFILE "snsr/prof"
+#define MQTT_SUBTOPIC_SENSOR_STEP_JITTER "snsr/jitter"
+#define MQTT_SUBTOPIC_SENSOR_COMMAND_LATENCY "snsr/latency"
+#define MQTT_SUBTOPIC_SENSOR_ECHO "snsr/echo"
+#define MQTT_SUBTOPIC_SENSOR_ODOMETER "snsr/odo"
 
 // **================================================**
 // ||          <<<<< DEVICE DISCOVERY >>>>>          ||
 // **================================================**
 
-#define HA_DEVICE_MQTT_DISCOVERY_TOPIC "hass/device/" HA_DEVICE_ID "/config"
+// Each window is discovered as its own device so Home Assistant can place
+// them in different areas.
+#define HA_WINDOW_MQTT_DISCOVERY_TOPIC(id) \
+  "hass/device/" HA_DEVICE_ID "_" id "/config"
 
 #endif
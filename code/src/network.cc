@@ -1,11 +1,31 @@
 #include "network.hh"
 
-#include <hardware/watchdog.h>
+#include <lwip/apps/sntp.h>
 #include <math.h>
 #include <pico/cyw43_arch.h>
+#include <pico/time.h>
 
 #include "advanced_opts.hh"
+#include "led_pattern.hh"
+#include "opts.hh"
 #include "secrets.hh"
+#include "supervisor.hh"
+#include "trace.hh"
+#include "wake_event.hh"
+
+// Unix time at boot in micro seconds, 0 until SNTP has set the time. Only
+// accessed from the lwIP context.
+static int64_t unix_time_at_boot_us = 0;
+
+/**
+ * Wakes the main loop to deal with a change of the Wi-Fi link.
+ */
+static void linkChangedCb(struct netif* netif) {
+  TRACE_LWIP_SCOPE(TRACE_CB_LINK_CHANGED);
+  TRACE(TRACE_CAT_LINK, TRACE_LINK_CHANGED, 0, netif_is_link_up(netif));
+
+  main_loop_wake.signal();
+}
 
 void setHostname() {
   // Acquire the network lock.
@@ -14,6 +34,7 @@ void setHostname() {
   // Set the host name.
   struct netif* n = &cyw43_state.netif[CYW43_ITF_STA];
   netif_set_hostname(n, "IoT_Window");
+  netif_set_link_callback(n, linkChangedCb);
   netif_set_up(n);
 
   // Release the network lock.
@@ -26,16 +47,62 @@ void wifiDisconnect() {
   setHostname();
 }
 
+/**
+ * Makes one attempt to join the predefined Wi-Fi network, like
+ * `cyw43_arch_wifi_connect_timeout_ms` does, but checks in with the supervisor
+ * every `SUPERVISOR_POLL_INTERVAL_MS` while waiting. A single attempt may take
+ * far longer than the watchdog timeout.
+ *
+ * \param timeout_ms How long to try for in milli seconds.
+ *
+ * \returns 0 on success, or the error of `cyw43_arch_wifi_connect_timeout_ms`.
+ */
+static int wifiConnectAttempt(uint32_t timeout_ms) {
+  int err = cyw43_arch_wifi_connect_async(WIFI_SSID, WIFI_PASSWORD,
+                                          CYW43_AUTH_WPA2_AES_PSK);
+  if (err) return err;
+
+  absolute_time_t until = make_timeout_time_ms(timeout_ms);
+  int status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+  while (status != CYW43_LINK_UP && status != CYW43_LINK_BADAUTH &&
+         status != CYW43_LINK_FAIL) {
+    // Keep trying while the network isn't there.
+    if (status == CYW43_LINK_NONET) {
+      err = cyw43_arch_wifi_connect_async(WIFI_SSID, WIFI_PASSWORD,
+                                          CYW43_AUTH_WPA2_AES_PSK);
+      if (err) return err;
+    }
+    if (time_reached(until)) return PICO_ERROR_TIMEOUT;
+
+    supervisorCheckIn(TASK_WIFI);
+    supervisorService();
+
+    absolute_time_t wake = make_timeout_time_ms(SUPERVISOR_POLL_INTERVAL_MS);
+    if (absolute_time_diff_us(until, wake) > 0) wake = until;
+    cyw43_arch_poll();
+    cyw43_arch_wait_for_work_until(wake);
+
+    status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+  }
+
+  if (status == CYW43_LINK_UP) return 0;
+  return (status == CYW43_LINK_BADAUTH) ? PICO_ERROR_BADAUTH
+                                        : PICO_ERROR_CONNECT_FAILED;
+}
+
 /**
  * Attempts to connect to the predefined Wi-Fi network.
  *
+ * Blocks and keeps the network going meanwhile, so it must never be called
+ * from an lwIP callback.
+ *
  * @returns 0 on success, -1 if the Wi-Fi password is incorrect or the maximum
  * number of attempts was reached.
  */
 int wifiConnect() {
   // Turn on the blue LED to signal that the Wi-Fi connection process is in
   // progress.
-  gpio_put(BLUE_LED_PIN, 1);
+  ledSet(LED_BLUE, true);
 
   // Start the connection timeout at the predefined minimum.
   // This value will be doubled each time the connection fails due to timeout
@@ -51,8 +118,10 @@ int wifiConnect() {
   int connect_attempt = 0;
   while (connect_attempt++ != WIFI_CONNECTION_MAX_ATTEMPTS &&
          link_state != CYW43_LINK_JOIN) {
-    // Feed the watchdog during extended connection attempts.
-    watchdog_update();
+    // Every attempt counts as progress, so that the watchdog is still fed
+    // during extended connection attempts.
+    supervisorCheckIn(TASK_WIFI);
+    supervisorService();
 
     // If not the first connection attempt, print out the attempt number and the
     // link state.
@@ -94,8 +163,7 @@ int wifiConnect() {
     }
 
     // Attempt to connect to the Wi-Fi network.
-    status_code = cyw43_arch_wifi_connect_timeout_ms(
-        WIFI_SSID, WIFI_PASSWORD, CYW43_AUTH_WPA2_AES_PSK, connection_timeout);
+    status_code = wifiConnectAttempt(connection_timeout);
 
     switch (status_code) {
       // If the Wi-Fi connection failed with an incorrect password, immediately
@@ -105,7 +173,7 @@ int wifiConnect() {
         // also result in a bad auth, but technically it is still a success.
         if (cyw43_wifi_link_status(&cyw43_state, CYW43_ITF_STA) !=
             CYW43_LINK_JOIN) {
-          gpio_put(BLUE_LED_PIN, 0);
+          ledSet(LED_BLUE, false);
           printf(
               "\033[0K"
               "WiFi: Incorrect password.\n");
@@ -115,7 +183,7 @@ int wifiConnect() {
 
       // When the Wi-Fi connection is successful, return a success.
       case 0: {
-        gpio_put(BLUE_LED_PIN, 0);
+        ledSet(LED_BLUE, false);
         printf("\033[0K");  // Clear the stuff we printed.
         return 0;
       }
@@ -131,7 +199,7 @@ int wifiConnect() {
       default: {
         // Cycle the board LED to signal that the process has not frozen.
         for (int i = 0; i < 3; i++) {
-          watchdog_update();
+          supervisorService();
           cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 0);
           sleep_ms(50);
           cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 1);
@@ -145,7 +213,7 @@ int wifiConnect() {
   }
 
   printf("\033[0K");          // Clear the stuff we printed.
-  gpio_put(BLUE_LED_PIN, 0);  // Turn the blue LED back off.
+  ledSet(LED_BLUE, false);  // Turn the blue LED back off.
   return (link_state == CYW43_LINK_JOIN) ? 0 : -1;
 }
 
@@ -155,6 +223,16 @@ int wifiConnect() {
  * \returns -1 on failure, 0 on success.
  */
 int networkInit() {
+  if (networkChipInit() != 0) return -1;
+  return networkConnect();
+}
+
+/**
+ * Initializes the Wi-Fi chip and lwIP, without joining the network yet.
+ *
+ * \returns -1 on failure, 0 on success.
+ */
+int networkChipInit() {
   // ----- Initialize Wi-Fi chip -----
 
   if (cyw43_arch_init_with_country(CYW43_COUNTRY_CANADA)) {
@@ -163,14 +241,15 @@ int networkInit() {
   }
 
   // Blink board LED 5 times fast and leave on to signal chip initialization
-  // success.
-  for (int i = 0; i < 10; i++) {
-    watchdog_update();
+  // success. A fast boot skips straight to leaving it on.
+  for (int i = 0; i < 10 && !FAST_BOOT; i++) {
+    supervisorService();
     cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 0);
     sleep_ms(50);
     cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 1);
     sleep_ms(100);
   }
+  cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 1);
 
   // ----- Host Setup -----
 
@@ -180,21 +259,32 @@ int networkInit() {
   // Set the device host name.
   setHostname();
 
-  // ----- Connect to the Network -----
+  return 0;
+}
 
+/**
+ * Joins the Wi-Fi network. The chip must already be initialized by
+ * `networkChipInit`.
+ *
+ * \returns -1 on failure, 0 on success.
+ */
+int networkConnect() {
   if (wifiConnect() != 0) {
     return -1;
   }
 
+  // Start keeping the time of day.
+  timeSyncInit();
+
   // Set Wi-Fi performance mode.
   while (cyw43_wifi_pm(&cyw43_state, CYW43_PERFORMANCE_PM) != 0) {
-    sleep_ms(100);
+    networkSleepMs(100);
   };
 
   // Blink the board led fast 10 times to indicate a Wi-Fi connection was
-  // made.
-  for (int i = 0; i < 10; i++) {
-    watchdog_update();
+  // made, unless booting fast.
+  for (int i = 0; i < 10 && !FAST_BOOT; i++) {
+    supervisorService();
     cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 1);
     sleep_ms(100);
     cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 0);
@@ -204,3 +294,100 @@ int networkInit() {
   // Return 0 for success.
   return 0;
 }
+
+/**
+ * Starts periodically getting the time of day from `SNTP_SERVER`.
+ */
+void timeSyncInit() {
+  cyw43_arch_lwip_begin();
+  sntp_setoperatingmode(SNTP_OPMODE_POLL);
+  sntp_setservername(0, SNTP_SERVER);
+  sntp_init();
+  cyw43_arch_lwip_end();
+}
+
+/**
+ * Sets the time of day, called by SNTP with every response.
+ *
+ * \param sec The current unix time in seconds.
+ */
+extern "C" void sntpSetSystemTime(unsigned int sec) {
+  unix_time_at_boot_us = (int64_t)sec * 1000000 - (int64_t)time_us_64();
+}
+
+/**
+ * Gets the current unix time. Call from the lwIP context only.
+ *
+ * \param unix_time_ms Where to store the time in milli seconds. Untouched if
+ * the time isn't known.
+ *
+ * \returns Whether the time is known, i.e. SNTP has set it at least once.
+ */
+bool getUnixTimeMs(uint64_t* unix_time_ms) {
+  if (unix_time_at_boot_us == 0) return false;
+
+  *unix_time_ms = (unix_time_at_boot_us + (int64_t)time_us_64()) / 1000;
+  return true;
+}
+
+/**
+ * Processes whatever the Wi-Fi chip and lwIP have pending, in poll mode. In
+ * the background mode that happens in interrupts and this does nothing.
+ *
+ * Only ever called from core 0, at points where a delay doesn't matter.
+ */
+void networkPoll() {
+#if NETWORK_POLLED
+  cyw43_arch_poll();
+#endif
+}
+
+/**
+ * Sleeps for a while, keeping the network going in poll mode.
+ *
+ * Must never be called from an lwIP callback. Polling runs the lwIP timers and
+ * the packets received meanwhile, which would re-enter lwIP in the middle of
+ * the callback, and lwIP isn't reentrant.
+ *
+ * \param ms How long to sleep for in milli seconds.
+ */
+void networkSleepMs(uint32_t ms) {
+#if NETWORK_POLLED
+  absolute_time_t until = make_timeout_time_ms(ms);
+  do {
+    cyw43_arch_poll();
+    cyw43_arch_wait_for_work_until(until);
+  } while (absolute_time_diff_us(get_absolute_time(), until) > 0);
+  cyw43_arch_poll();
+#else
+  sleep_ms(ms);
+#endif
+}
+
+/**
+ * Sleeps until an event is signalled or a deadline passes, then clears the
+ * event.
+ *
+ * In poll mode the lwIP callbacks that signal the event only run when the
+ * network is polled, so the network is polled whenever the Wi-Fi chip has
+ * work, and otherwise the core sleeps until the chip or the deadline wakes it.
+ *
+ * \param event The event to wait for.
+ * \param until_us The deadline in micro seconds since boot.
+ *
+ * \returns Whether the event was signalled.
+ */
+bool networkWaitUntil(WakeEvent* event, uint64_t until_us) {
+#if NETWORK_POLLED
+  cyw43_arch_poll();
+  while (!event->isSignalled() && time_us_64() < until_us) {
+    cyw43_arch_wait_for_work_until(from_us_since_boot(until_us));
+    cyw43_arch_poll();
+  }
+
+  // Returns right away, only clears the event.
+  return event->waitUntil(0);
+#else
+  return event->waitUntil(until_us);
+#endif
+}
@@ -1,8 +1,30 @@
 #ifndef NETWORK_HH
 #define NETWORK_HH
 
+#include <stdbool.h>
+#include <stdint.h>
+
+// Whether the network is polled from the main loop rather than serviced in
+// interrupts, chosen by the `NETWORK_POLL_MODE` build option.
+#if PICO_CYW43_ARCH_POLL
+#define NETWORK_POLLED 1
+#else
+#define NETWORK_POLLED 0
+#endif
+
 int networkInit();
+int networkChipInit();
+int networkConnect();
 int wifiConnect();
 void wifiDisconnect();
 
+void timeSyncInit();
+bool getUnixTimeMs(uint64_t* unix_time_ms);
+
+class WakeEvent;
+
+void networkPoll();
+void networkSleepMs(uint32_t ms);
+bool networkWaitUntil(WakeEvent* event, uint64_t until_us);
+
 #endif
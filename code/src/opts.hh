@@ -13,9 +13,25 @@
 
 #define CLOSED_SIDE RIGHT_SIDE
 
-// Which limit switch is on which side.
-#define LS_LEFT LS_1
-#define LS_RIGHT LS_2
+/*
+ * The windows driven by this device, one stepper motor each. Each entry is
+ * X(index, id, name):
+ * - index: Selects the pins of the window, SM<index>_* in pins.hh.
+ * - id:    Used in the MQTT topics and Home Assistant IDs of the window.
+ * - name:  The name of the window in Home Assistant.
+ *
+ * e.g. two windows side by side:
+ *   #define WINDOWS(X)                \
+ *     X(0, "left", "Left Window")    \
+ *     X(1, "right", "Right Window")
+ */
+#define WINDOWS(X) X(0, "main", "Main Window")
+
+// Which limit switch is on which side, for each window.
+#define SM0_LS_LEFT LS_1
+#define SM0_LS_RIGHT LS_2
+#define SM1_LS_LEFT LS_3
+#define SM1_LS_RIGHT LS_4
 
 // Which side to home to.
 #define HOME_SIDE RIGHT_SIDE
@@ -23,4 +39,21 @@
 /** Initial speed of the motor in mm/s on boot up. */
 #define INITIAL_MOTOR_SPEED 5.0
 
+// Stop the motor when the driver reports a stall (TMC2209 StallGuard4 on the
+// DIAG pin). Requires the DIAG pin to be wired up.
+#define STALL_DETECTION 1
+
+// StallGuard sensitivity (0-255). Higher values detect a stall sooner but may
+// false trigger on a stiff window. Tune this for your window.
+#define STALL_THRESHOLD 60
+
+// The SNTP server to get the time of day from, for actions scheduled at an
+// absolute time. Ideally a server on the local network, e.g. the router or the
+// Home Assistant host, so scheduling keeps working if the internet is down.
+#define SNTP_SERVER "pool.ntp.org"
+
+// If a limit switch never triggers or is stuck triggered while homing, fall
+// back to homing against the physical end of the window using stall detection.
+#define SENSORLESS_HOMING_FALLBACK 1
+
 #endif
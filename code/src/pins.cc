@@ -21,10 +21,4 @@ void init_pins() {
   INIT_LED_PIN(RED_LED_PIN);
   INIT_LED_PIN(YELLOW_LED_PIN);
   INIT_LED_PIN(BLUE_LED_PIN);
-
-  // Limit Switches
-  gpio_init(LS_1);
-  gpio_init(LS_2);
-  gpio_set_pulls(LS_1, true, false);  // Pull up
-  gpio_set_pulls(LS_2, true, false);  // Pull up
 }
@@ -5,17 +5,55 @@
 #define YELLOW_LED_PIN 1
 #define BLUE_LED_PIN 2
 
+// **========================================**
+// ||          <<<<< WINDOW 0 >>>>>          ||
+// **========================================**
+
 // Stepper Motor Pins
-#define SM_ENABLE_PIN 17  // Stepper Motor Enable Pin
-#define SM_DIR_PIN 20     // Stepper Motor Direction Pin
-#define SM_PULSE_PIN 18   // Stepper Motor Pulse Pin
-#define SM_MS1_PIN 16     // Stepper Motor Micro-Step Pin A
-#define SM_MS2_PIN 19     // Stepper Motor Micro-Step Pin B
+#define SM0_ENABLE_PIN 17  // Stepper Motor Enable Pin
+#define SM0_DIR_PIN 20     // Stepper Motor Direction Pin
+#define SM0_PULSE_PIN 18   // Stepper Motor Pulse Pin
+#define SM0_MS1_PIN 16     // Stepper Motor Micro-Step Pin A
+#define SM0_MS2_PIN 19     // Stepper Motor Micro-Step Pin B
+#define SM0_DIAG_PIN 21    // Stepper Motor Driver DIAG (stall) Pin
+
+// Stepper Motor Driver UART (TMC2209 PDN_UART, single wire).
+// Set SM0_UART to NULL if the UART is not wired up. The driver address is set
+// by the micro-step pins, so drivers can't share a UART.
+#define SM0_UART uart1
+#define SM0_UART_TX_PIN 4
+#define SM0_UART_RX_PIN 5
 
 // Limit Switch Pins
 #define LS_1 12  // Limit switch 1
 #define LS_2 13  // Limit switch 2
 
+// **========================================**
+// ||          <<<<< WINDOW 1 >>>>>          ||
+// **========================================**
+// Only used if a second window is added to `WINDOWS` in opts.hh.
+
+// Stepper Motor Pins
+#define SM1_ENABLE_PIN 6
+#define SM1_DIR_PIN 7
+#define SM1_PULSE_PIN 8
+#define SM1_MS1_PIN 9
+#define SM1_MS2_PIN 10
+#define SM1_DIAG_PIN 11
+
+// No UART left for a second driver, stall detection uses the DIAG pin only.
+#define SM1_UART NULL
+#define SM1_UART_TX_PIN 0
+#define SM1_UART_RX_PIN 0
+
+// Limit Switch Pins
+#define LS_3 14  // Limit switch 3
+#define LS_4 15  // Limit switch 4
+
+// **===================================================**
+// ||          <<<<< MICRO-STEP ENCODING >>>>>          ||
+// **===================================================**
+
 // Micro-Step Configurations (Low bit for MS1, high bit for MS2).
 #define MS_8 0b00
 #define MS_16 0b11
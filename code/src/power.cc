@@ -0,0 +1,114 @@
+#include "power.hh"
+
+#include <hardware/clocks.h>
+#include <pico/cyw43_arch.h>
+#include <pico/time.h>
+
+#include "advanced_opts.hh"
+#include "logger.hh"
+
+// **================================================**
+// ||          <<<<< STATIC VARIABLES >>>>>          ||
+// **================================================**
+
+static bool low_power = false;
+static uint64_t last_busy_us = 0;
+
+// **======================================**
+// ||          <<<<< CLOCKS >>>>>          ||
+// **======================================**
+
+/**
+ * Runs the peripherals from the 48MHz USB PLL.
+ *
+ * Changing the system clock also moves the peripheral clock along with it by
+ * default, which would change the baud rate of the UARTs the drivers are
+ * talking over. Pinning it to the USB PLL keeps it the same at any system
+ * clock.
+ */
+static void pinPeripheralClock() {
+  clock_configure(clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB,
+                  48 * MHZ, 48 * MHZ);
+}
+
+/**
+ * Changes the system clock.
+ *
+ * The lwIP lock is held throughout so that the background work of the Wi-Fi
+ * chip doesn't talk to it while the clock changes underneath.
+ *
+ * \param khz The new system clock in kHz.
+ *
+ * \returns Whether the system clock could be set.
+ */
+static bool setSystemClock(uint32_t khz) {
+  cyw43_arch_lwip_begin();
+  bool success = set_sys_clock_khz(khz, false);
+  pinPeripheralClock();
+  cyw43_arch_lwip_end();
+
+  return success;
+}
+
+// **=====================================**
+// ||          <<<<< POWER >>>>>          ||
+// **=====================================**
+
+/**
+ * Pins the peripheral clock so the system clock can be scaled later on. Call
+ * before any UART is initialized.
+ */
+void powerInit() {
+  pinPeripheralClock();
+  last_busy_us = time_us_64();
+}
+
+/**
+ * Gets whether the device is in its low power state.
+ */
+bool powerIsLow() { return low_power; }
+
+/**
+ * Puts the Wi-Fi radio into power saving and scales the system clock down once
+ * the device hasn't been busy for `SYSTEM_IDLE_TIMEOUT_MS`.
+ *
+ * \param busy Whether anything is moving or waiting to move right now.
+ */
+void powerService(bool busy) {
+  uint64_t now_us = time_us_64();
+  if (busy) last_busy_us = now_us;
+
+  if (low_power || now_us - last_busy_us < SYSTEM_IDLE_TIMEOUT_MS * 1000ULL)
+    return;
+
+  cyw43_wifi_pm(&cyw43_state, SYSTEM_IDLE_WIFI_PM);
+  if (!setSystemClock(SYSTEM_IDLE_CLOCK_KHZ))
+    LOG_WARN("Could not scale the system clock down to %lukHz.\n",
+             (unsigned long)SYSTEM_IDLE_CLOCK_KHZ);
+
+  low_power = true;
+  LOG_INFO("Entered low power after %lums idle.\n",
+           (unsigned long)SYSTEM_IDLE_TIMEOUT_MS);
+}
+
+/**
+ * Brings the system clock and the Wi-Fi radio back to full performance.
+ *
+ * \returns How long it took to get back to full performance in micro seconds,
+ *          0 if the device wasn't in its low power state.
+ */
+uint32_t powerRestore() {
+  last_busy_us = time_us_64();
+  if (!low_power) return 0;
+
+  uint64_t start_us = time_us_64();
+
+  setSystemClock(SYSTEM_CLOCK_KHZ);
+  cyw43_wifi_pm(&cyw43_state, CYW43_PERFORMANCE_PM);
+  low_power = false;
+
+  uint32_t latency_us = (uint32_t)(time_us_64() - start_us);
+  LOG_INFO("Left low power in %luus.\n", (unsigned long)latency_us);
+
+  return latency_us;
+}
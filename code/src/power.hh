@@ -0,0 +1,13 @@
+#ifndef POWER_HH
+#define POWER_HH
+
+#include <stdbool.h>
+#include <stdint.h>
+
+void powerInit();
+
+bool powerIsLow();
+void powerService(bool busy);
+uint32_t powerRestore();
+
+#endif
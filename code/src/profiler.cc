@@ -0,0 +1,244 @@
+#include "profiler.hh"
+
+#include <hardware/irq.h>
+#include <hardware/timer.h>
+#include <pico/platform.h>
+#include <string.h>
+
+#include "common.hh"
+#include "crc32.hh"
+
+static_assert((PROFILER_SLOTS & (PROFILER_SLOTS - 1)) == 0,
+              "PROFILER_SLOTS must be a power of two");
+static_assert(PROFILER_CHUNK_ENTRIES <= UINT8_MAX,
+              "A chunk counts its entries in a byte");
+
+// Slots a sample may probe for its program counter before it is dropped.
+#define PROFILER_MAX_PROBES 8
+
+// Bytes of the flash image hashed per call of `profilerService`.
+#define PROFILER_HASH_BLOCK 4096
+
+// From the linker script.
+extern char __flash_binary_start;
+extern char __flash_binary_end;
+
+#define IMAGE_SIZE ((uint32_t)(&__flash_binary_end - &__flash_binary_start))
+
+// **================================================**
+// ||          <<<<< STATIC VARIABLES >>>>>          ||
+// **================================================**
+
+// Hit counts by program counter, open addressed. Only written by the sampling
+// interrupt, only read while the profiler is stopped.
+static ProfilerEntry histogram[PROFILER_SLOTS];
+static volatile uint32_t samples = 0;
+static volatile uint32_t dropped = 0;
+
+// The hardware alarm taking the samples, -1 until the first start.
+static int alarm_num = -1;
+static volatile bool running = false;
+static uint32_t next_sample_us;
+static uint32_t jitter_state = 1;
+
+// The CRC-32 of the flash image, complete once `image_hashed` reaches the size
+// of the image.
+static uint32_t image_crc = 0;
+static uint32_t image_hashed = 0;
+
+// **=========================================**
+// ||          <<<<< SAMPLING >>>>>           ||
+// **=========================================**
+
+/**
+ * Counts a hit of a program counter in the histogram.
+ *
+ * \returns Whether there was room for it.
+ */
+static inline bool countHit(uint32_t key) {
+  uint32_t slot = ((key * 2654435761u) >> 16) & (PROFILER_SLOTS - 1);
+
+  for (int probe = 0; probe < PROFILER_MAX_PROBES; probe++) {
+    ProfilerEntry* entry = &histogram[(slot + probe) & (PROFILER_SLOTS - 1)];
+    if (entry->count == 0) entry->pc = key;
+    if (entry->pc == key) {
+      entry->count++;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Adds the program counter an interrupt was taken at to the histogram and
+ * sets the alarm for the next sample.
+ *
+ * \param frame The exception frame pushed by the interrupt, the program
+ * counter is its 7th word.
+ */
+extern "C" void __used profilerSample(const uint32_t* frame) {
+  timer_hw->intr = 1u << alarm_num;
+  if (!running) return;
+
+  samples++;
+  if (!countHit(frame[6] | get_core_num())) dropped++;
+
+  // Jitter the interval by up to a quarter either way, xorshift is cheap
+  // enough.
+  jitter_state ^= jitter_state << 13;
+  jitter_state ^= jitter_state >> 17;
+  jitter_state ^= jitter_state << 5;
+  next_sample_us += PROFILER_INTERVAL_US * 3 / 4 +
+                    (((jitter_state >> 16) * (PROFILER_INTERVAL_US / 2)) >> 16);
+
+  // The alarm only compares the low 32 bits, a time already passed would
+  // only come around again in 71 minutes.
+  if ((int32_t)(next_sample_us - timer_hw->timerawl) < 2)
+    next_sample_us = timer_hw->timerawl + PROFILER_INTERVAL_US;
+  timer_hw->alarm[alarm_num] = next_sample_us;
+}
+
+/**
+ * The handler of the sampling interrupt. Finds the exception frame on the
+ * stack in use when the interrupt was taken and hands it to `profilerSample`,
+ * which returns from the interrupt for it.
+ */
+static void __attribute__((naked)) profilerIrqHandler() {
+  __asm volatile(
+      "movs r0, #4\n"
+      "mov r1, lr\n"
+      "tst r0, r1\n"
+      "beq 1f\n"
+      "mrs r0, psp\n"
+      "b 2f\n"
+      "1:\n"
+      "mrs r0, msp\n"
+      "2:\n"
+      "ldr r1, =profilerSample\n"
+      "bx r1\n");
+}
+
+// **========================================**
+// ||          <<<<< PROFILER >>>>>          ||
+// **========================================**
+
+/**
+ * Clears the histogram and starts sampling the core this is called on.
+ *
+ * The sampling interrupt has the highest priority, so it also samples the
+ * other interrupt handlers. Code that runs with interrupts disabled is
+ * counted against where it enables them again.
+ */
+void profilerStart() {
+  profilerStop();
+
+  if (alarm_num < 0) {
+    alarm_num = hardware_alarm_claim_unused(true);
+    irq_set_exclusive_handler(TIMER_IRQ_0 + alarm_num, profilerIrqHandler);
+    irq_set_priority(TIMER_IRQ_0 + alarm_num, PICO_HIGHEST_IRQ_PRIORITY);
+  }
+
+  memset(histogram, 0, sizeof(histogram));
+  samples = 0;
+  dropped = 0;
+  running = true;
+
+  hw_set_bits(&timer_hw->inte, 1u << alarm_num);
+  irq_set_enabled(TIMER_IRQ_0 + alarm_num, true);
+  next_sample_us = timer_hw->timerawl + PROFILER_INTERVAL_US;
+  timer_hw->alarm[alarm_num] = next_sample_us;
+}
+
+/**
+ * Stops sampling. The histogram is kept until the next start.
+ */
+void profilerStop() {
+  running = false;
+  if (alarm_num < 0) return;
+
+  irq_set_enabled(TIMER_IRQ_0 + alarm_num, false);
+  hw_clear_bits(&timer_hw->inte, 1u << alarm_num);
+  timer_hw->armed = 1u << alarm_num;
+}
+
+/**
+ * Hashes the next block of the flash image, which identifies the build the
+ * program counters of a dump belong to. Hashing all of it takes a fraction of
+ * a second, so it is done a block per call. Call from the main loop.
+ *
+ * \param moving Whether a motor is moving, nothing is hashed while one is.
+ */
+void profilerService(bool moving) {
+  if (moving || image_hashed >= IMAGE_SIZE) return;
+
+  uint32_t len = MIN(PROFILER_HASH_BLOCK, IMAGE_SIZE - image_hashed);
+  image_crc = crc32(&__flash_binary_start + image_hashed, len, image_crc);
+  image_hashed += len;
+}
+
+/**
+ * Gets whether a dump can be taken, which needs the profiler to be stopped and
+ * the flash image to be hashed.
+ */
+bool profilerDumpReady() {
+  return !running && image_hashed >= IMAGE_SIZE;
+}
+
+/**
+ * Gets the number of chunks in a dump of the histogram, at least one so that
+ * even an empty dump gets a header out.
+ */
+uint16_t profilerDumpChunks() {
+  uint32_t used = 0;
+  for (int i = 0; i < PROFILER_SLOTS; i++)
+    if (histogram[i].count != 0) used++;
+
+  return MAX(1, (used + PROFILER_CHUNK_ENTRIES - 1) / PROFILER_CHUNK_ENTRIES);
+}
+
+/**
+ * Writes one chunk of a dump of the histogram, only the entries that were hit.
+ * Only call once `profilerDumpReady`.
+ *
+ * \param seq The index of the chunk.
+ * \param buf Where to write the chunk to.
+ * \param size The size of `buf`, at least `PROFILER_CHUNK_MAX_SIZE`.
+ *
+ * \returns The length of the chunk in bytes, or 0 if there is no such chunk.
+ */
+size_t profilerDumpChunk(uint16_t seq, uint8_t* buf, size_t size) {
+  uint16_t total = profilerDumpChunks();
+  if (seq >= total || size < PROFILER_CHUNK_MAX_SIZE) return 0;
+
+  // Skip the entries of the chunks in front of this one.
+  uint32_t skip = (uint32_t)seq * PROFILER_CHUNK_ENTRIES;
+  uint32_t count = 0;
+  for (int i = 0; i < PROFILER_SLOTS && count < PROFILER_CHUNK_ENTRIES; i++) {
+    if (histogram[i].count == 0) continue;
+    if (skip > 0) {
+      skip--;
+      continue;
+    }
+
+    memcpy(buf + sizeof(ProfilerChunkHeader) + count * sizeof(ProfilerEntry),
+           &histogram[i], sizeof(ProfilerEntry));
+    count++;
+  }
+
+  ProfilerChunkHeader header = {
+      PROFILER_CHUNK_MAGIC,
+      PROFILER_CHUNK_VERSION,
+      (uint8_t)count,
+      seq,
+      total,
+      image_crc,
+      image_hashed,
+      samples,
+      dropped,
+      PROFILER_INTERVAL_US,
+  };
+  memcpy(buf, &header, sizeof(header));
+
+  return sizeof(header) + count * sizeof(ProfilerEntry);
+}
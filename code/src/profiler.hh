@@ -0,0 +1,73 @@
+#ifndef PROFILER_HH
+#define PROFILER_HH
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "advanced_opts.hh"
+
+// **====================================================**
+// ||          <<<<< Configuration Macros >>>>>          ||
+// **====================================================**
+
+// Average time between samples. Each sample is taken up to a quarter of it
+// early or late, so that the samples don't lock on to periodic work.
+#ifndef PROFILER_INTERVAL_US
+#define PROFILER_INTERVAL_US 1000
+#endif
+
+// Distinct program counters the histogram can hold. Must be a power of two.
+#ifndef PROFILER_SLOTS
+#define PROFILER_SLOTS 512
+#endif
+
+// Histogram entries per dump chunk.
+#define PROFILER_CHUNK_ENTRIES 64
+
+// **========================================**
+// ||          <<<<< PROFILER >>>>>          ||
+// **========================================**
+
+/**
+ * One entry of the histogram. The program counter is always even, so its
+ * lowest bit holds the core the sample was taken on.
+ */
+struct ProfilerEntry {
+  uint32_t pc;
+  uint32_t count;
+};
+
+/**
+ * The header of each dump chunk, followed by `count` entries. All fields are
+ * little endian.
+ */
+struct ProfilerChunkHeader {
+  uint16_t magic;        // `PROFILER_CHUNK_MAGIC`.
+  uint8_t version;       // `PROFILER_CHUNK_VERSION`.
+  uint8_t count;         // Entries in this chunk.
+  uint16_t seq;          // Index of this chunk in the dump.
+  uint16_t total;        // Chunks in the dump.
+  uint32_t image_crc;    // CRC-32 of the flash image, to match it to a build.
+  uint32_t image_size;   // Of the flash image in bytes.
+  uint32_t samples;      // Taken since the profiler was started.
+  uint32_t dropped;      // Samples that found the histogram full.
+  uint32_t interval_us;  // `PROFILER_INTERVAL_US`.
+};
+
+#define PROFILER_CHUNK_MAGIC 0x4650  // "PF"
+#define PROFILER_CHUNK_VERSION 1
+#define PROFILER_CHUNK_MAX_SIZE  \
+  (sizeof(ProfilerChunkHeader) + \
+   PROFILER_CHUNK_ENTRIES * sizeof(ProfilerEntry))
+
+void profilerStart();
+void profilerStop();
+
+void profilerService(bool moving);
+
+bool profilerDumpReady();
+uint16_t profilerDumpChunks();
+size_t profilerDumpChunk(uint16_t seq, uint8_t* buf, size_t size);
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef RING_QUEUE_HH
+#define RING_QUEUE_HH
+
+#include <hardware/sync.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "spsc_ring_queue.hh"
+
+// **===============================================**
+// ||          <<<<< MPSC Ring Queue >>>>>          ||
+// **===============================================**
+
+/**
+ * A FIFO queue for any number of producers and one consumer.
+ *
+ * The Cortex-M0+ has no compare-and-swap, so the producers are serialized by
+ * one of the RP2040 hardware spin locks. The lock is only held for the push
+ * itself and the consumer side stays lock-free.
+ *
+ * @tparam T The type of the queue members. Copied in and out of the queue.
+ * @tparam Capacity The number of members the queue can hold. Must be a power
+ * of two.
+ */
+template <typename T, uint32_t Capacity>
+class MpscRingQueue {
+ private:
+  RingQueue<T, Capacity> queue;
+  spin_lock_t* push_lock;
+
+ public:
+  /**
+   * Initializes an empty queue and claims a hardware spin lock for it.
+   */
+  MpscRingQueue() {
+    this->push_lock = spin_lock_instance(spin_lock_claim_unused(true));
+  }
+
+  static constexpr uint32_t getCapacity() { return Capacity; }
+  uint32_t getCount() { return this->queue.getCount(); }
+  bool isEmpty() { return this->queue.isEmpty(); }
+  bool isFull() { return this->queue.isFull(); }
+
+  /**
+   * Adds a member to the tail of the queue.
+   *
+   * Safe to call from any context on either core.
+   *
+   * @param value The member to add.
+   * @param position Where to store the position of the member in the queue,
+   * for use with `isQueued`. May be NULL.
+   *
+   * @returns TRUE if the member was added, FALSE if the queue is full.
+   */
+  bool push(const T& value, uint32_t* position = NULL) {
+    uint32_t saved_irq = spin_lock_blocking(this->push_lock);
+    bool success = this->queue.push(value, position);
+    spin_unlock(this->push_lock, saved_irq);
+    return success;
+  }
+
+  /**
+   * Adds several members to the tail of the queue at once, all or nothing.
+   *
+   * Safe to call from any context on either core.
+   */
+  bool pushAll(const T* values, uint32_t count) {
+    uint32_t saved_irq = spin_lock_blocking(this->push_lock);
+    bool success = this->queue.pushAll(values, count);
+    spin_unlock(this->push_lock, saved_irq);
+    return success;
+  }
+
+  bool isQueued(uint32_t position) { return this->queue.isQueued(position); }
+
+  bool peek(T* value, uint32_t* position = NULL) {
+    return this->queue.peek(value, position);
+  }
+  bool pop(T* value, uint32_t* position = NULL) {
+    return this->queue.pop(value, position);
+  }
+
+  /**
+   * Requests that every member currently in the queue gets dropped.
+   *
+   * Safe to call from any context on either core.
+   */
+  void requestClear() {
+    uint32_t saved_irq = spin_lock_blocking(this->push_lock);
+    this->queue.requestClear();
+    spin_unlock(this->push_lock, saved_irq);
+  }
+};
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef SPSC_RING_QUEUE_HH
+#define SPSC_RING_QUEUE_HH
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+// **===============================================**
+// ||          <<<<< SPSC Ring Queue >>>>>          ||
+// **===============================================**
+
+/**
+ * A lock-free FIFO queue for exactly one producer and one consumer.
+ *
+ * The producer and consumer may run in different contexts, e.g. an lwIP
+ * callback and the main loop, or the two cores. Neither side ever disables
+ * interrupts or waits on the other.
+ *
+ * `head` and `tail` count every pop and push and are only ever written by the
+ * consumer and producer respectively. They are free running and only masked
+ * down to a buffer index when accessing the buffer, so the capacity must be a
+ * power of two and all of the slots are usable.
+ *
+ * Only plain atomic loads and stores are used, which the Cortex-M0+ supports
+ * without any read-modify-write instructions. Nothing in here depends on the
+ * Pico SDK, so the queue also builds on the host (see bench/).
+ *
+ * @tparam T The type of the queue members. Copied in and out of the queue.
+ * @tparam Capacity The number of members the queue can hold. Must be a power
+ * of two.
+ */
+template <typename T, uint32_t Capacity>
+class RingQueue {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "RingQueue capacity must be a power of two");
+
+ private:
+  static constexpr uint32_t MASK = Capacity - 1;
+
+  T buffer[Capacity];              // Queue members buffer.
+  std::atomic<uint32_t> head;      // Pops so far, written by the consumer.
+  std::atomic<uint32_t> tail;      // Pushes so far, written by the producer.
+  std::atomic<uint32_t> clear_to;  // Where a requested clear ends.
+
+  /**
+   * Drops everything before a clear requested with `requestClear`.
+   *
+   * A request is only applied if it lies between the head and the tail, so
+   * requests that have already been applied are ignored.
+   *
+   * Consumer only.
+   */
+  uint32_t applyClear() {
+    uint32_t head = this->head.load(std::memory_order_relaxed);
+    uint32_t tail = this->tail.load(std::memory_order_acquire);
+    uint32_t clear_to = this->clear_to.load(std::memory_order_acquire);
+
+    if (clear_to - head <= tail - head && clear_to != head) {
+      head = clear_to;
+      this->head.store(head, std::memory_order_release);
+    }
+
+    return head;
+  }
+
+  /**
+   * Gets where the head will be once any requested clear has been applied.
+   */
+  uint32_t getEffectiveHead(uint32_t tail) {
+    uint32_t head = this->head.load(std::memory_order_seq_cst);
+    uint32_t clear_to = this->clear_to.load(std::memory_order_acquire);
+
+    if (clear_to - head <= tail - head) head = clear_to;
+    return head;
+  }
+
+ public:
+  /**
+   * Initializes an empty queue.
+   */
+  RingQueue() : head(0), tail(0), clear_to(0) {}
+
+  /**
+   * Gets the maximum number of members the queue can hold.
+   */
+  static constexpr uint32_t getCapacity() { return Capacity; }
+
+  /**
+   * Gets the number of members currently in the queue.
+   *
+   * Exact on the consumer side. Elsewhere it may already be out of date by the
+   * time it is returned.
+   */
+  uint32_t getCount() {
+    uint32_t head = this->head.load(std::memory_order_acquire);
+    uint32_t tail = this->tail.load(std::memory_order_acquire);
+    return tail - head;
+  }
+
+  /** Gets whether the queue is empty. */
+  bool isEmpty() { return (this->getCount() == 0); }
+
+  /** Gets whether the queue is full. */
+  bool isFull() { return (this->getCount() >= Capacity); }
+
+  /**
+   * Adds a member to the tail of the queue.
+   *
+   * Producer only.
+   *
+   * @param value The member to add.
+   * @param position Where to store the position of the member in the queue,
+   * for use with `isQueued`. May be NULL.
+   *
+   * @returns TRUE if the member was added, FALSE if the queue is full.
+   */
+  bool push(const T& value, uint32_t* position = NULL) {
+    uint32_t tail = this->tail.load(std::memory_order_relaxed);
+    uint32_t head = this->head.load(std::memory_order_acquire);
+    if (tail - head >= Capacity) return false;
+
+    this->buffer[tail & MASK] = value;
+
+    // Publish the member only once it has been written.
+    this->tail.store(tail + 1, std::memory_order_release);
+
+    if (position != NULL) *position = tail;
+    return true;
+  }
+
+  /**
+   * Adds several members to the tail of the queue at once, all or nothing.
+   *
+   * The consumer sees either none or all of the members.
+   *
+   * Producer only.
+   *
+   * @param values The members to add, in order.
+   * @param count The number of members to add.
+   *
+   * @returns TRUE if the members were added, FALSE if the queue doesn't have
+   * room for all of them.
+   */
+  bool pushAll(const T* values, uint32_t count) {
+    uint32_t tail = this->tail.load(std::memory_order_relaxed);
+    uint32_t head = this->head.load(std::memory_order_acquire);
+    if (count > Capacity - (tail - head)) return false;
+
+    for (uint32_t i = 0; i < count; i++)
+      this->buffer[(tail + i) & MASK] = values[i];
+
+    // Publish the members only once they have all been written.
+    this->tail.store(tail + count, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Gets whether a pushed member is still in the queue, i.e. it has neither
+   * been popped nor dropped by a clear.
+   *
+   * Producer only. Only the consumer can remove members, so a FALSE result is
+   * final while a TRUE result may already be out of date.
+   *
+   * @param position The position of the member, as given by `push`.
+   */
+  bool isQueued(uint32_t position) {
+    uint32_t tail = this->tail.load(std::memory_order_relaxed);
+    uint32_t head = this->getEffectiveHead(tail);
+    return (position - head < tail - head);
+  }
+
+  /**
+   * Copies the member at the head of the queue without removing it.
+   *
+   * Consumer only.
+   *
+   * @param value Where to copy the member to. Untouched if the queue is empty.
+   * @param position Where to store the position of the member in the queue.
+   * May be NULL.
+   *
+   * @returns TRUE if there was a member to copy, FALSE if the queue is empty.
+   */
+  bool peek(T* value, uint32_t* position = NULL) {
+    uint32_t head = this->applyClear();
+    uint32_t tail = this->tail.load(std::memory_order_acquire);
+    if (head == tail) return false;
+
+    *value = this->buffer[head & MASK];
+    if (position != NULL) *position = head;
+    return true;
+  }
+
+  /**
+   * Removes the member at the head of the queue.
+   *
+   * Consumer only.
+   *
+   * @param value Where to copy the removed member to. Untouched if the queue
+   * is empty.
+   * @param position Where to store the position the member had in the queue.
+   * May be NULL.
+   *
+   * @returns TRUE if a member was removed, FALSE if the queue is empty.
+   */
+  bool pop(T* value, uint32_t* position = NULL) {
+    if (!this->peek(value, position)) return false;
+
+    // Free the slot only once the member has been copied out.
+    uint32_t head = this->head.load(std::memory_order_relaxed);
+    this->head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Requests that every member currently in the queue gets dropped.
+   *
+   * Safe to call from either side. The members are dropped by the consumer
+   * the next time it peeks or pops, members pushed after the request are kept.
+   */
+  void requestClear() {
+    this->clear_to.store(this->tail.load(std::memory_order_acquire),
+                         std::memory_order_release);
+  }
+};
+
+#endif
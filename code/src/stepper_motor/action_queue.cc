@@ -1,85 +1,140 @@
 #include "action_queue.hh"
 
-#include <pico/critical_section.h>
+#include <pico/time.h>
 
-using namespace stepper_motor::action;
+#include <atomic>
 
-ActionQueue::ActionQueue() {
-  this->head = 0;
-  this->tail = 0;
-  this->count = 0;
+#include "ring_queue.hh"
+#include "wake_event.hh"
 
-  critical_section_init(&this->crit_sec);
-}
+using namespace stepper_motor::action;
 
-void ActionQueue::deinit() { critical_section_deinit(&this->crit_sec); }
+bool stepper_motor::action::isPositionAction(ActionType action_type) {
+  return (action_type == ActionType::MOVE_TO_PERCENT ||
+          action_type == ActionType::MOVE_TO_STEP);
+}
 
-bool ActionQueue::isEmpty() { return (this->count == 0); }
+const char* stepper_motor::action::getActionTypeName(ActionType action_type) {
+  switch (action_type) {
+    case ActionType::OPEN:
+      return "open";
+    case ActionType::CLOSE:
+      return "close";
+    case ActionType::MOVE_TO_PERCENT:
+      return "move_to_percent";
+    case ActionType::MOVE_TO_STEP:
+      return "move_to_step";
+    case ActionType::HOME:
+      return "home";
+    case ActionType::CALIBRATE:
+      return "calibrate";
+    case ActionType::WAIT:
+      return "wait";
+    case ActionType::NONE:
+    default:
+      return "none";
+  }
+}
 
-bool ActionQueue::isFull() { return (this->count >= AQ_CAPACITY); }
+ActionQueue::ActionQueue() : target_seq(0) {
+  this->target.action_type = ActionType::NONE;
+  this->target_for = 0;
+  this->last_position = 0;
+  this->last_is_position = false;
+}
 
-int ActionQueue::getCount() { return this->count; }
+bool ActionQueue::isEmpty() { return this->queue.isEmpty(); }
 
-int ActionQueue::getCapacity() { return AQ_CAPACITY; }
+bool ActionQueue::isFull() { return this->queue.isFull(); }
 
-Action* ActionQueue::peek() {
-  Action* result = NULL;
+int ActionQueue::getCount() { return this->queue.getCount(); }
 
-  // Acquire the lock.
-  critical_section_enter_blocking(&this->crit_sec);
+int ActionQueue::getCapacity() { return this->queue.getCapacity(); }
 
-  // If the queue is not empty, get the head of the queue.
-  if (!this->isEmpty()) result = &this->buffer[this->head];
+/**
+ * Replaces the queued position action at a ring position. Producer only.
+ */
+void ActionQueue::writeTarget(uint32_t position, Action action) {
+  uint32_t seq = this->target_seq.load(std::memory_order_relaxed);
 
-  // Release the lock and return the result.
-  critical_section_exit(&this->crit_sec);
-  return result;
+  this->target_seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  this->target = action;
+  this->target_for = position;
+  this->target_seq.store(seq + 2, std::memory_order_release);
 }
 
-void ActionQueue::clear() {
-  critical_section_enter_blocking(&this->crit_sec);
-
-  this->head = 0;
-  this->tail = 0;
-  this->count = 0;
-
-  critical_section_exit(&this->crit_sec);
+/**
+ * Gets the replacement for the position action at a ring position, retrying if
+ * the producer updates it mid-read.
+ *
+ * \returns Whether the action at the position has been replaced.
+ */
+bool ActionQueue::readTarget(uint32_t position, Action* action) {
+  Action target;
+  uint32_t target_for;
+  uint32_t seq;
+
+  do {
+    seq = this->target_seq.load(std::memory_order_acquire);
+    target = this->target;
+    target_for = this->target_for;
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((seq & 1) ||
+           seq != this->target_seq.load(std::memory_order_relaxed));
+
+  if (seq == 0 || target_for != position) return false;
+
+  *action = target;
+  return true;
 }
 
-bool ActionQueue::enqueue(Action action) {
-  // Acquire the lock for performing operations.
-  critical_section_enter_blocking(&this->crit_sec);
-
-  // Return false if the queue is already full.
-  if (this->isFull()) {
-    critical_section_exit(&this->crit_sec);
-    return false;
-  }
+bool ActionQueue::peek(Action* action) {
+  uint32_t position;
+  if (!this->queue.peek(action, &position)) return false;
 
-  // If the queue is not full, add the action to the queue.
-  else {
-    switch (action.action_type) {
-      // None actions are never queued.
-      case ActionType::NONE:
-        break;
+  if (isPositionAction(action->action_type))
+    this->readTarget(position, action);
+  return true;
+}
 
-      default:
-        // Add the action to the queue buffer.
-        this->buffer[this->tail] = action;
+void ActionQueue::clear() { this->queue.requestClear(); }
 
-        // Record the addition of another action to the queue.
-        this->tail = AQ_ADVANCE_INDEX(this->tail);
-        this->count++;
+bool ActionQueue::enqueue(Action action) {
+  // None actions are never queued.
+  if (action.action_type == ActionType::NONE) return true;
 
-        break;
-    };
+  action.enqueued_us = time_us_32();
 
-    // Release the lock on the CS.
-    critical_section_exit(&this->crit_sec);
+  if (!isPositionAction(action.action_type)) {
+    this->last_is_position = false;
+    if (!this->queue.push(action)) return false;
 
-    // Return that the enqueue operation succeeded.
+    main_loop_wake.signal();
     return true;
   }
+
+  // Replace the previous position action if it is still queued.
+  if (this->last_is_position &&
+      this->queue.isQueued(this->last_position)) {
+    this->writeTarget(this->last_position, action);
+
+    // The consumer dequeues a position action before looking for its
+    // replacement. So if the action is still queued after the replacement was
+    // written, the replacement is guaranteed to be seen. Otherwise, queue it
+    // up on its own; at worst the same target is moved to twice, the second
+    // time being a no-op.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (this->queue.isQueued(this->last_position)) {
+      main_loop_wake.signal();
+      return true;
+    }
+  }
+
+  // Add the action to the queue, fails if the queue is already full.
+  this->last_is_position = this->queue.push(action, &this->last_position);
+  if (this->last_is_position) main_loop_wake.signal();
+  return this->last_is_position;
 }
 
 bool ActionQueue::enqueue(ActionType action_type, ActionData action_data) {
@@ -98,34 +153,35 @@ bool ActionQueue::enqueue(ActionType action_type) {
   return this->enqueue(action);
 }
 
+bool ActionQueue::enqueueAll(Action* actions, int count) {
+  if (count <= 0) return true;
+
+  uint32_t now_us = time_us_32();
+  for (int i = 0; i < count; i++) actions[i].enqueued_us = now_us;
+
+  this->last_is_position = false;
+  if (!this->queue.pushAll(actions, count)) return false;
+
+  main_loop_wake.signal();
+  return true;
+}
+
 Action ActionQueue::dequeue() {
-  // Acquire the lock for performing operations.
-  critical_section_enter_blocking(&this->crit_sec);
+  Action action;
+  uint32_t position;
 
   // If the queue is empty, return a "NONE" action with no data.
-  if (this->isEmpty()) {
-    critical_section_exit(&this->crit_sec);
-
-    Action action;
+  if (!this->queue.pop(&action, &position)) {
     action.action_type = ActionType::NONE;
     action.data.null = 0;
-
-    return action;
   }
 
-  // If the queue is not empty, pop off and return the action at the head of the
-  // queue.
-  else {
-    // Get the head action.
-    Action action = this->buffer[this->head];
-
-    // Remove the action from the queue.
-    this->head = AQ_ADVANCE_INDEX(this->head);
-    this->count--;
-
-    // Release the lock.
-    critical_section_exit(&this->crit_sec);
-
-    return action;
+  // Only look for a replacement once the action has been dequeued, see
+  // `enqueue`.
+  else if (isPositionAction(action.action_type)) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    this->readTarget(position, &action);
   }
+
+  return action;
 }
@@ -1,30 +1,24 @@
 #ifndef ACTION_QUEUE_HH
 #define ACTION_QUEUE_HH
 
-#include <pico/critical_section.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <atomic>
+
+#include "ring_queue.hh"
+
 // **====================================================**
 // ||          <<<<< Configuration Macros >>>>>          ||
 // **====================================================**
 
-// Queue capacity (number of actions that can be queued).
+// Queue capacity (number of actions that can be queued). Must be a power of
+// two.
 #ifndef AQ_CAPACITY
 #define AQ_CAPACITY 8
 #endif
 
-// **===================================================**
-// ||          <<<<< Action Queue Macros >>>>>          ||
-// **===================================================**
-
-/**
- * Advance an index with wrap-around.
- * @param idx The index to advance
- */
-#define AQ_ADVANCE_INDEX(idx) (((idx) + 1) % AQ_CAPACITY)
-
 // **==================================================**
 // ||          <<<<< Action Definitions >>>>>          ||
 // **==================================================**
@@ -40,34 +34,68 @@ enum class ActionType {
   MOVE_TO_PERCENT,
   MOVE_TO_STEP,
   HOME,
-  CALIBRATE
+  CALIBRATE,
+  WAIT
 };
 
 union ActionData {
   float percent;
   int64_t step;
+  uint32_t duration_ms;
   int null = 0;
 };
 
 /**
  * Represents a single queued action with its argument.
+ *
+ * The stamps time the action on its way through the firmware, see
+ * `CommandLatency`. They are `time_us_32` times.
  */
 struct Action {
   ActionType action_type;
   union ActionData data;
+  uint32_t received_us = 0;  // Entry of the MQTT callback, 0 if not over MQTT.
+  uint32_t enqueued_us = 0;  // Set by the queue.
 };
 
+/**
+ * Gets whether an action moves to an absolute position, i.e. whether only the
+ * latest of several such actions in a row matters.
+ */
+bool isPositionAction(ActionType action_type);
+
+/**
+ * Gets the name of an action type, e.g. for reporting it over MQTT.
+ */
+const char* getActionTypeName(ActionType action_type);
+
 /**
  * A FIFO (First-In-First-Out) queue for stepper motor actions.
- * Uses a circular buffer implementation.
+ *
+ * Built on a lock-free `RingQueue`: actions are enqueued by the MQTT callbacks
+ * (the single producer) and peeked at and dequeued by the main loop (the
+ * single consumer) without ever disabling interrupts.
+ *
+ * Consecutive position actions are coalesced: while the last enqueued action
+ * is a position action that is still waiting in the queue, a new position
+ * action replaces it instead of taking up another slot. The replacement lives
+ * outside of the ring in a seqlock protected slot so the producer can update
+ * it while the consumer may be reading it.
  */
 class ActionQueue {
  private:
-  Action buffer[AQ_CAPACITY];   // Queue members buffer.
-  uint8_t head;                 // Index of front element.
-  uint8_t tail;                 // Index of next empty slot.
-  uint8_t count;                // Number of elements in queue.
-  critical_section_t crit_sec;  // Critical section for the queue.
+  RingQueue<Action, AQ_CAPACITY> queue;
+
+  // --- Coalesced Position Target ---
+  Action target;                     // Replaces the queued action at...
+  uint32_t target_for;               // ...this ring position.
+  std::atomic<uint32_t> target_seq;  // Odd while the target is being written.
+  uint32_t last_position;            // Ring position of the last position
+                                     // action, if `last_is_position`.
+  bool last_is_position;             // Producer only.
+
+  void writeTarget(uint32_t position, Action action);
+  bool readTarget(uint32_t position, Action* action);
 
  public:
   /**
@@ -75,11 +103,6 @@ class ActionQueue {
    */
   ActionQueue();
 
-  /**
-   * De-initializes this action queue.
-   */
-  void deinit();
-
   /** Gets whether the queue is empty. */
   bool isEmpty();
 
@@ -99,25 +122,36 @@ class ActionQueue {
   int getCapacity();
 
   /**
-   * Gets the action at the head of the queue without removing it.
+   * Gets a copy of the action at the head of the queue without removing it.
+   *
+   * Main loop only.
    *
-   * @return The pointer to the action at the head of the queue at the time of
-   * the function call.
+   * @param action Where to copy the action to.
+   *
+   * @return TRUE if there was an action to copy, FALSE if the queue is empty.
    */
-  Action* peek();
+  bool peek(Action* action);
 
   /**
    * Clears the queue.
+   *
+   * Safe to call from the MQTT callbacks and the main loop. The actions are
+   * dropped the next time the main loop looks at the queue.
    */
   void clear();
 
   /**
    * Enqueues an action.
    *
+   * A position action directly following another position action that hasn't
+   * been dequeued yet replaces it instead.
+   *
+   * The action is stamped with the time it was enqueued.
+   *
    * @param action The action to enqueue.
    *
-   * @returns TRUE if the action was successfully enqueued, FALSE if an error
-   * occurred such as the queue already being full.
+   * @returns TRUE if the action was successfully enqueued (or coalesced),
+   * FALSE if an error occurred such as the queue already being full.
    */
   bool enqueue(Action action);
 
@@ -143,7 +177,26 @@ class ActionQueue {
   bool enqueue(ActionType action_type);
 
   /**
-   * Dequeues and returns the element from the head of the queue.
+   * Enqueues several actions at once, all or nothing.
+   *
+   * The main loop sees either none or all of the actions, so it can look ahead
+   * through the whole sequence from the start. The actions are never coalesced
+   * with each other or with actions already in the queue.
+   *
+   * @param actions The actions to enqueue, in order. Must not contain "NONE"
+   * actions. They are stamped with the time they were enqueued.
+   * @param count The number of actions.
+   *
+   * @returns TRUE if the actions were enqueued, FALSE if the queue doesn't have
+   * room for all of them.
+   */
+  bool enqueueAll(Action* actions, int count);
+
+  /**
+   * Dequeues and returns the element from the head of the queue, or a "NONE"
+   * action if the queue is empty.
+   *
+   * Main loop only.
    */
   Action dequeue();
 };
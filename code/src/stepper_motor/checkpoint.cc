@@ -0,0 +1,187 @@
+#include "checkpoint.hh"
+
+#include <hardware/watchdog.h>
+#include <pico/platform.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "crc32.hh"
+
+using namespace stepper_motor;
+
+// **=================================================**
+// ||          <<<<< SCRATCH REGISTERS >>>>>          ||
+// **=================================================**
+
+/*
+ * The checkpoint record itself lives in RAM that isn't cleared on boot, which
+ * keeps its contents across a watchdog reboot. Only three watchdog scratch
+ * registers are free (0 belongs to the supervisor, 4 to 7 to the SDK), too few
+ * for the positions of several motors, so they hold what proves the record is
+ * still the one that was written last:
+ * - 1: [31:24] `CHECKPOINT_MAGIC`, [23:0] the low bits of the record sequence.
+ * - 2: The CRC-32 of the record.
+ * - 3: A bit per slot whose motor is in the middle of a move.
+ *
+ * The scratch registers are cleared by a power on reset, so a record that
+ * survived a power cycle by chance is never trusted.
+ */
+
+#define CHECKPOINT_SCRATCH_HEADER 1
+#define CHECKPOINT_SCRATCH_CRC 2
+#define CHECKPOINT_SCRATCH_MOVING 3
+
+#define CHECKPOINT_MAGIC 0xC7u
+#define CHECKPOINT_SEQUENCE_MASK 0xFFFFFFu
+
+#define CHECKPOINT_HEADER(sequence) \
+  ((CHECKPOINT_MAGIC << 24) | ((sequence) & CHECKPOINT_SEQUENCE_MASK))
+
+// **================================================**
+// ||          <<<<< STATIC VARIABLES >>>>>          ||
+// **================================================**
+
+struct CheckpointRecord {
+  uint32_t sequence;
+  uint32_t slot_count;
+  PositionCheckpoint slots[CHECKPOINT_MAX_SLOTS];
+};
+
+static CheckpointRecord __uninitialized_ram(record);
+
+static bool initialized = false;
+static int slot_count = 0;
+static uint32_t trusted_slots = 0;  // A bit per slot that may be restored.
+
+// **==========================================**
+// ||          <<<<< CHECKPOINT >>>>>          ||
+// **==========================================**
+
+/**
+ * Calculates the CRC-32 of the checkpoint record.
+ */
+static uint32_t recordCrc() { return crc32(&record, sizeof(record)); }
+
+/**
+ * Makes the current contents of the record the ones a watchdog reboot trusts.
+ *
+ * The record is written before the scratch registers, a reboot in between
+ * leaves a CRC that doesn't match and nothing gets trusted.
+ */
+static void commit() {
+  record.sequence++;
+  watchdog_hw->scratch[CHECKPOINT_SCRATCH_CRC] = recordCrc();
+  watchdog_hw->scratch[CHECKPOINT_SCRATCH_HEADER] =
+      CHECKPOINT_HEADER(record.sequence);
+}
+
+/**
+ * Checks whether the record left behind by the previous boot can be trusted
+ * and which of its slots weren't in the middle of a move.
+ *
+ * Slots that can't be trusted are invalidated right away, so that another
+ * watchdog reboot before they are saved again doesn't trust them either.
+ */
+static void checkpointInit() {
+  initialized = true;
+
+  uint32_t header = watchdog_hw->scratch[CHECKPOINT_SCRATCH_HEADER];
+  uint32_t moving = watchdog_hw->scratch[CHECKPOINT_SCRATCH_MOVING];
+
+  bool consistent =
+      watchdog_enable_caused_reboot() &&
+      header == CHECKPOINT_HEADER(record.sequence) &&
+      watchdog_hw->scratch[CHECKPOINT_SCRATCH_CRC] == recordCrc() &&
+      record.slot_count <= CHECKPOINT_MAX_SLOTS;
+
+  if (consistent) {
+    for (uint32_t i = 0; i < record.slot_count; i++) {
+      if (record.slots[i].valid && !(moving & (1u << i)))
+        trusted_slots |= 1u << i;
+      else
+        record.slots[i].valid = false;
+    }
+
+    printf("Position checkpoint %lu found, moving slots: 0x%lx.\n",
+           (unsigned long)record.sequence, (unsigned long)moving);
+  } else {
+    memset(&record, 0, sizeof(record));
+  }
+
+  watchdog_hw->scratch[CHECKPOINT_SCRATCH_MOVING] = 0;
+  commit();
+}
+
+/**
+ * Gets a checkpoint slot for a motor.
+ *
+ * Slots are handed out in order, so a motor must be registered in the same
+ * order on every boot to get its own checkpoint back.
+ *
+ * \returns The slot of the motor, or -1 if all slots are taken.
+ */
+int stepper_motor::checkpointRegister() {
+  if (!initialized) checkpointInit();
+  if (slot_count >= CHECKPOINT_MAX_SLOTS) return -1;
+
+  int slot = slot_count++;
+  if (record.slot_count < (uint32_t)slot_count) {
+    record.slot_count = slot_count;
+    commit();
+  }
+
+  return slot;
+}
+
+/**
+ * Gets the checkpoint a motor left behind before a watchdog reboot.
+ *
+ * A checkpoint is only handed out once, and only if the record is consistent
+ * and the motor wasn't in the middle of a move.
+ *
+ * \param slot The slot of the motor.
+ * \param checkpoint Where to store the checkpoint.
+ *
+ * \returns Whether there is a checkpoint to trust.
+ */
+bool stepper_motor::checkpointRestore(int slot,
+                                      PositionCheckpoint* checkpoint) {
+  if (slot < 0 || !(trusted_slots & (1u << slot))) return false;
+  trusted_slots &= ~(1u << slot);
+
+  *checkpoint = record.slots[slot];
+  return true;
+}
+
+/**
+ * Marks a motor as being in the middle of a move, which makes its checkpoint
+ * untrusted until it's saved again. Cheap enough to call on every step.
+ *
+ * \param slot The slot of the motor.
+ */
+void stepper_motor::checkpointMoveStart(int slot) {
+  if (slot < 0) return;
+
+  trusted_slots &= ~(1u << slot);
+  hw_set_bits(&watchdog_hw->scratch[CHECKPOINT_SCRATCH_MOVING], 1u << slot);
+}
+
+/**
+ * Checkpoints the position of a motor at the end of a move.
+ *
+ * \param slot The slot of the motor.
+ * \param step_position The position of the motor.
+ * \param window_open_step_position The fully open position of the window.
+ * \param state The `State` of the motor.
+ */
+void stepper_motor::checkpointSave(int slot, int64_t step_position,
+                                   int64_t window_open_step_position,
+                                   uint8_t state) {
+  if (slot < 0) return;
+
+  record.slots[slot] = {step_position, window_open_step_position, state, true};
+  commit();
+
+  // Only clear the mid-move marker once the new position is committed.
+  hw_clear_bits(&watchdog_hw->scratch[CHECKPOINT_SCRATCH_MOVING], 1u << slot);
+}
@@ -0,0 +1,42 @@
+#ifndef CHECKPOINT_HH
+#define CHECKPOINT_HH
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// **====================================================**
+// ||          <<<<< Configuration Macros >>>>>          ||
+// **====================================================**
+
+// Most motors that can be checkpointed.
+#ifndef CHECKPOINT_MAX_SLOTS
+#define CHECKPOINT_MAX_SLOTS 4
+#endif
+
+// **==========================================**
+// ||          <<<<< CHECKPOINT >>>>>          ||
+// **==========================================**
+
+namespace stepper_motor {
+
+/**
+ * The position of a motor at the end of its last move.
+ */
+struct PositionCheckpoint {
+  int64_t step_position;
+  int64_t window_open_step_position;
+  uint8_t state;  // A `State`.
+  bool valid;     // Whether the slot has been saved since it was last trusted.
+};
+
+int checkpointRegister();
+
+bool checkpointRestore(int slot, PositionCheckpoint* checkpoint);
+
+void checkpointMoveStart(int slot);
+void checkpointSave(int slot, int64_t step_position,
+                    int64_t window_open_step_position, uint8_t state);
+
+}  // namespace stepper_motor
+
+#endif
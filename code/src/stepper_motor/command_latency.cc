@@ -0,0 +1,128 @@
+#include "command_latency.hh"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "common.hh"
+
+using namespace stepper_motor;
+
+static const char* const stage_names[LATENCY_STAGES] = {
+    "callback", "queue", "start", "react", "motion"};
+
+CommandLatency::CommandLatency() {
+  memset(this->samples, 0, sizeof(this->samples));
+  memset(this->counts, 0, sizeof(this->counts));
+  this->pending = false;
+  this->stepped = false;
+}
+
+/**
+ * Adds the latency of a command to a stage, replacing the oldest once the
+ * stage holds `CL_SAMPLES`.
+ */
+void CommandLatency::add(LatencyStage stage, uint32_t latency_us) {
+  this->samples[stage][this->counts[stage] % CL_SAMPLES] = latency_us;
+  this->counts[stage]++;
+}
+
+/**
+ * Gets a percentile of the latencies a stage holds, by nearest rank. With fewer
+ * than 100 latencies held, the 99th percentile is the longest of them.
+ *
+ * \param stage The stage.
+ * \param percent The percentile, 0 to 100.
+ */
+uint32_t CommandLatency::percentile(LatencyStage stage, uint32_t percent) {
+  int held = MIN(this->counts[stage], (uint32_t)CL_SAMPLES);
+  if (held == 0) return 0;
+
+  // Insertion sort a copy, there are only a few latencies to sort.
+  uint32_t sorted[CL_SAMPLES];
+  for (int i = 0; i < held; i++) {
+    uint32_t latency_us = this->samples[stage][i];
+    int j = i;
+    for (; j > 0 && sorted[j - 1] > latency_us; j--) sorted[j] = sorted[j - 1];
+    sorted[j] = latency_us;
+  }
+
+  int rank = (held * percent + 99) / 100;
+  return sorted[MAX(rank, 1) - 1];
+}
+
+/**
+ * Starts timing a command as it is dequeued. Commands that don't move the
+ * window, or don't move it on their own like homing, aren't timed.
+ *
+ * \param action The dequeued action.
+ * \param dequeued_us When it was dequeued, `time_us_32`.
+ */
+void CommandLatency::begin(const action::Action& action,
+                           uint32_t dequeued_us) {
+  using namespace action;
+
+  this->pending = (action.action_type == ActionType::OPEN ||
+                   action.action_type == ActionType::CLOSE ||
+                   isPositionAction(action.action_type));
+  this->stepped = false;
+  this->received_us = action.received_us;
+  this->enqueued_us = action.enqueued_us;
+  this->dequeued_us = dequeued_us;
+}
+
+/**
+ * Ends timing the command at the end of its move and adds its latencies to
+ * the stages.
+ *
+ * \param now_us When the move ended, `time_us_32`.
+ *
+ * \returns Whether a command was timed, i.e. whether there are new latencies
+ * to report. A command that ended without taking a step is dropped.
+ */
+bool CommandLatency::finish(uint32_t now_us) {
+  bool timed = this->pending && this->stepped;
+  this->pending = false;
+  if (!timed) return false;
+
+  if (this->received_us != 0) {
+    this->add(LATENCY_CALLBACK, this->enqueued_us - this->received_us);
+    this->add(LATENCY_REACT, this->first_edge_us - this->received_us);
+  }
+  this->add(LATENCY_QUEUE, this->dequeued_us - this->enqueued_us);
+  this->add(LATENCY_START, this->first_edge_us - this->dequeued_us);
+  this->add(LATENCY_MOTION, now_us - this->first_edge_us);
+
+  return true;
+}
+
+/**
+ * Writes the latencies of the stages as JSON, each stage an object of its
+ * `p50`, `p99` and `max` in micro seconds and the number `n` of commands they
+ * were taken over, e.g. {"callback":{"p50":..,"p99":..,"max":..,"n":..},...}.
+ *
+ * \param buf Where to write the JSON to.
+ * \param size The size of `buf`.
+ *
+ * \returns The length of the JSON, `size` or more if it didn't fit.
+ */
+int CommandLatency::format(char* buf, size_t size) {
+  size_t len = 0;
+
+#define APPEND(...) \
+  len += snprintf(buf + MIN(len, size), size - MIN(len, size), __VA_ARGS__)
+
+  for (int i = 0; i < LATENCY_STAGES; i++) {
+    LatencyStage stage = (LatencyStage)i;
+    APPEND("%s\"%s\":{\"p50\":%lu,\"p99\":%lu,\"max\":%lu,\"n\":%lu}",
+           (i == 0) ? "{" : ",", stage_names[i],
+           (unsigned long)this->percentile(stage, 50),
+           (unsigned long)this->percentile(stage, 99),
+           (unsigned long)this->percentile(stage, 100),
+           (unsigned long)MIN(this->counts[i], (uint32_t)CL_SAMPLES));
+  }
+  APPEND("}");
+
+#undef APPEND
+
+  return len;
+}
@@ -0,0 +1,85 @@
+#ifndef COMMAND_LATENCY_HH
+#define COMMAND_LATENCY_HH
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "action_queue.hh"
+
+// **====================================================**
+// ||          <<<<< Configuration Macros >>>>>          ||
+// **====================================================**
+
+// Commands each stage keeps the latency of, the percentiles are taken over
+// the latest of them.
+#ifndef CL_SAMPLES
+#define CL_SAMPLES 32
+#endif
+
+// **===============================================**
+// ||          <<<<< Command Latency >>>>>          ||
+// **===============================================**
+
+namespace stepper_motor {
+
+/**
+ * The stages a command goes through on its way to moving the window.
+ */
+enum LatencyStage {
+  LATENCY_CALLBACK,  // From the MQTT callback to the action queue.
+  LATENCY_QUEUE,     // Waiting in the action queue for the main loop.
+  LATENCY_START,     // From being dequeued to the first step pulse.
+  LATENCY_REACT,     // From the MQTT callback to the first step pulse.
+  LATENCY_MOTION,    // From the first step pulse to the end of the move.
+  LATENCY_STAGES
+};
+
+/**
+ * Times the commands that move a window through each stage, from the MQTT
+ * callback they arrived in to the end of their move, and keeps the latest
+ * `CL_SAMPLES` latencies of each stage.
+ *
+ * Only commands that take a step are timed. Commands that didn't arrive over
+ * MQTT, e.g. scheduled ones, are only timed from the action queue on.
+ */
+class CommandLatency {
+ private:
+  uint32_t samples[LATENCY_STAGES][CL_SAMPLES];
+  uint32_t counts[LATENCY_STAGES];  // Latencies added to each stage.
+
+  // --- Command Being Timed ---
+  bool pending;
+  bool stepped;
+  uint32_t received_us;  // 0 if the command didn't arrive over MQTT.
+  uint32_t enqueued_us;
+  uint32_t dequeued_us;
+  uint32_t first_edge_us;
+
+  void add(LatencyStage stage, uint32_t latency_us);
+  uint32_t percentile(LatencyStage stage, uint32_t percent);
+
+ public:
+  CommandLatency();
+
+  void begin(const action::Action& action, uint32_t dequeued_us);
+
+  /**
+   * Stamps the first step pulse of the command being timed. Called for the
+   * first edge of every move, so it does nothing after the first.
+   *
+   * @param now_us The time of the edge, `time_us_32`.
+   */
+  inline void markFirstEdge(uint32_t now_us) {
+    if (!this->pending || this->stepped) return;
+    this->stepped = true;
+    this->first_edge_us = now_us;
+  }
+
+  bool finish(uint32_t now_us);
+  int format(char* buf, size_t size);
+};
+
+}  // namespace stepper_motor
+
+#endif
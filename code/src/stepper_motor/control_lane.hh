@@ -0,0 +1,182 @@
+#ifndef CONTROL_LANE_HH
+#define CONTROL_LANE_HH
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "wake_event.hh"
+
+namespace stepper_motor::action {
+
+/**
+ * A single "latest wins" control command.
+ *
+ * Requests overwrite each other, so the mailbox never fills up and only the
+ * last requested value is ever applied. Written by one producer and taken by
+ * one consumer using plain atomic loads and stores.
+ */
+template <typename T>
+class ControlMailbox {
+ private:
+  std::atomic<T> value;
+  std::atomic<uint32_t> requested;  // Requests so far, written by the producer.
+  uint32_t taken;                   // Requests taken, consumer only.
+
+ public:
+  ControlMailbox() : value(T()), requested(0) { this->taken = 0; }
+
+  /**
+   * Requests a value, replacing any request that wasn't taken yet.
+   */
+  void request(T value) {
+    this->value.store(value, std::memory_order_relaxed);
+    this->requested.store(this->requested.load(std::memory_order_relaxed) + 1,
+                          std::memory_order_release);
+    main_loop_wake.signal();
+  }
+
+  /**
+   * Gets whether there is a request that wasn't taken yet.
+   */
+  bool isPending() {
+    return (this->requested.load(std::memory_order_acquire) != this->taken);
+  }
+
+  /**
+   * Takes the pending request, if any.
+   *
+   * If a new request comes in while taking, the new value may be taken early.
+   * It then gets taken again next time, which is harmless as applying the same
+   * value twice is a no-op.
+   *
+   * @param value Where to store the requested value. Untouched if there is no
+   * pending request.
+   *
+   * @returns TRUE if there was a pending request.
+   */
+  bool take(T* value) {
+    uint32_t requested = this->requested.load(std::memory_order_acquire);
+    if (requested == this->taken) return false;
+
+    *value = this->value.load(std::memory_order_relaxed);
+    this->taken = requested;
+    return true;
+  }
+};
+
+/**
+ * The user configurable settings of a stepper motor.
+ */
+struct MotorConfig {
+  float speed;               // Requested speed in mm/s.
+  bool quiet_mode;           // Whether to move at quiet speeds only.
+  bool soft_start_mode;      // Whether to ramp up the speed at the move start.
+  uint32_t acceleration;     // How much the soft start ramp shortens the half
+                             // step delay per level (us).
+};
+
+/**
+ * A versioned, double-buffered `MotorConfig`.
+ *
+ * The producer edits a private staging copy and then publishes all of it at
+ * once into whichever of the two buffers the consumer isn't being pointed at.
+ * The consumer takes the latest published copy and retries if the producer
+ * managed to publish twice while it was copying, so it never sees a torn
+ * configuration.
+ */
+class MotorConfigBuffer {
+ private:
+  MotorConfig buffers[2];
+  std::atomic<uint32_t> version;  // Publishes so far, `buffers[version & 1]`
+                                  // is the latest.
+  MotorConfig staging;            // Producer only.
+  uint32_t taken_version;         // Consumer only.
+
+ public:
+  MotorConfigBuffer() : version(0) { this->taken_version = 0; }
+
+  /**
+   * Sets the initial configuration. Must be called before the producer or
+   * consumer use the buffer.
+   */
+  void init(MotorConfig config) {
+    this->staging = config;
+    this->buffers[0] = config;
+    this->buffers[1] = config;
+  }
+
+  /**
+   * Gets the staging copy to edit. Producer only.
+   */
+  MotorConfig* edit() { return &this->staging; }
+
+  /**
+   * Publishes the staging copy. Producer only.
+   */
+  void publish() {
+    uint32_t version = this->version.load(std::memory_order_relaxed) + 1;
+    this->buffers[version & 1] = this->staging;
+    this->version.store(version, std::memory_order_release);
+    main_loop_wake.signal();
+  }
+
+  /**
+   * Gets whether a configuration was published that wasn't taken yet.
+   */
+  bool isPending() {
+    return (this->version.load(std::memory_order_acquire) !=
+            this->taken_version);
+  }
+
+  /**
+   * Takes the latest published configuration, if it wasn't taken yet.
+   * Consumer only.
+   *
+   * @param config Where to copy the configuration to. Untouched if there is no
+   * new configuration.
+   *
+   * @returns TRUE if there was a new configuration.
+   */
+  bool take(MotorConfig* config) {
+    uint32_t version;
+
+    do {
+      version = this->version.load(std::memory_order_acquire);
+      if (version == this->taken_version) return false;
+
+      *config = this->buffers[version & 1];
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      // The buffer that was copied only gets overwritten by the publish after
+      // next.
+    } while (this->version.load(std::memory_order_relaxed) - version >= 2);
+
+    this->taken_version = version;
+    return true;
+  }
+};
+
+/**
+ * The control lane of a stepper motor.
+ *
+ * Control commands (stop and configuration changes) don't wait behind queued
+ * moves in the `ActionQueue` (the motion lane). They are requested from the
+ * MQTT callbacks and applied by the main loop at every step batch boundary, so
+ * they take effect within one `MOTION_BATCH_US` no matter how many moves are
+ * queued.
+ *
+ * Each command has a capacity of one with a "latest wins" overflow policy,
+ * unlike the motion lane which holds `AQ_CAPACITY` actions and rejects new ones
+ * when full.
+ */
+class ControlLane {
+ public:
+  ControlMailbox<bool> stop;
+  MotorConfigBuffer config;
+};
+
+}  // namespace stepper_motor::action
+
+#endif
@@ -0,0 +1,97 @@
+#include "jitter_histogram.hh"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "common.hh"
+
+using namespace stepper_motor;
+
+// log2(JH_EXACT_BUCKETS), where the doubling buckets start.
+#define JH_EXACT_BITS (31 - __builtin_clz(JH_EXACT_BUCKETS))
+
+/**
+ * Gets the bucket of a lateness past the exact buckets. Each following bucket
+ * covers a power of two, [16, 32), [32, 64) and so on.
+ */
+int JitterHistogram::bucketOf(uint32_t late_us) {
+  int bucket = JH_EXACT_BUCKETS + (31 - __builtin_clz(late_us)) - JH_EXACT_BITS;
+  return MIN(bucket, JH_BUCKETS - 1);
+}
+
+/**
+ * Gets the latest lateness that falls into a bucket, UINT32_MAX for the last.
+ */
+uint32_t JitterHistogram::bucketEnd(int bucket) {
+  if (bucket < JH_EXACT_BUCKETS) return bucket;
+  if (bucket == JH_BUCKETS - 1) return UINT32_MAX;
+  return (JH_EXACT_BUCKETS << (bucket - JH_EXACT_BUCKETS + 1)) - 1;
+}
+
+/**
+ * Empties the histogram for a new move.
+ */
+void JitterHistogram::reset() {
+  memset(this->buckets, 0, sizeof(this->buckets));
+  this->edges = 0;
+  this->max_us = 0;
+  this->overruns = 0;
+}
+
+uint32_t JitterHistogram::getEdges() { return this->edges; }
+
+/**
+ * Gets a percentile of the lateness, rounded up to the end of its bucket but
+ * never past the latest edge.
+ *
+ * \param percent The percentile, 0 to 100.
+ */
+uint32_t JitterHistogram::percentile(uint32_t percent) {
+  // The rank of the edge at the percentile, rounded up.
+  uint32_t rank = ((uint64_t)this->edges * percent + 99) / 100;
+  uint32_t seen = 0;
+
+  for (int i = 0; i < JH_BUCKETS; i++) {
+    seen += this->buckets[i];
+    if (seen >= rank && seen > 0) return MIN(bucketEnd(i), this->max_us);
+  }
+
+  return this->max_us;
+}
+
+/**
+ * Writes a summary of the histogram as JSON:
+ * - edges:    Edges counted.
+ * - p50, p99: Percentiles of the lateness in micro seconds.
+ * - max:      The latest edge in micro seconds.
+ * - overruns: Edges late by at least their commanded interval.
+ * - hist:     The count of each bucket, up to the last one used.
+ *
+ * \param buf Where to write the JSON to.
+ * \param size The size of `buf`.
+ *
+ * \returns The length of the JSON, `size` or more if it didn't fit.
+ */
+int JitterHistogram::format(char* buf, size_t size) {
+  size_t len = 0;
+
+#define APPEND(...) \
+  len += snprintf(buf + MIN(len, size), size - MIN(len, size), __VA_ARGS__)
+
+  APPEND("{\"edges\":%lu,\"p50\":%lu,\"p99\":%lu,\"max\":%lu,\"overruns\":%lu,",
+         (unsigned long)this->edges, (unsigned long)this->percentile(50),
+         (unsigned long)this->percentile(99), (unsigned long)this->max_us,
+         (unsigned long)this->overruns);
+
+  int used = JH_BUCKETS;
+  while (used > 0 && this->buckets[used - 1] == 0) used--;
+
+  APPEND("\"hist\":[");
+  for (int i = 0; i < used; i++)
+    APPEND("%s%lu", (i == 0) ? "" : ",", (unsigned long)this->buckets[i]);
+  APPEND("]}");
+
+#undef APPEND
+
+  return len;
+}
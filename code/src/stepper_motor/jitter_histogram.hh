@@ -0,0 +1,72 @@
+#ifndef JITTER_HISTOGRAM_HH
+#define JITTER_HISTOGRAM_HH
+
+#include <stddef.h>
+#include <stdint.h>
+
+// **====================================================**
+// ||          <<<<< Configuration Macros >>>>>          ||
+// **====================================================**
+
+// Lateness up to this many micro seconds gets a bucket of its own, beyond it
+// the buckets double in width. Must be a power of two.
+#define JH_EXACT_BUCKETS 16
+
+// Buckets in total, the last one takes everything later than the others.
+#define JH_BUCKETS 28
+
+// **================================================**
+// ||          <<<<< Jitter Histogram >>>>>          ||
+// **================================================**
+
+namespace stepper_motor {
+
+/**
+ * A histogram of how late the pulse edges of a move came against when they
+ * were due, i.e. how much longer each interval between two edges was than
+ * commanded.
+ *
+ * An edge that is late by at least its commanded interval is counted as an
+ * overrun, the step it belongs to took at least twice as long as commanded.
+ */
+class JitterHistogram {
+  static_assert((JH_EXACT_BUCKETS & (JH_EXACT_BUCKETS - 1)) == 0,
+                "JH_EXACT_BUCKETS must be a power of two");
+
+ private:
+  uint32_t buckets[JH_BUCKETS];
+  uint32_t edges;
+  uint32_t max_us;
+  uint32_t overruns;
+
+  static int bucketOf(uint32_t late_us);
+  static uint32_t bucketEnd(int bucket);
+
+ public:
+  JitterHistogram() { this->reset(); }
+
+  void reset();
+
+  /**
+   * Counts an edge. Cheap enough for every edge, an edge late by more than
+   * `JH_EXACT_BUCKETS` costs a count of the leading zeros on top.
+   *
+   * @param late_us How late the edge came in micro seconds.
+   * @param interval_us The commanded interval before the edge.
+   */
+  inline void record(uint32_t late_us, uint32_t interval_us) {
+    this->edges++;
+    if (late_us > this->max_us) this->max_us = late_us;
+    if (late_us >= interval_us) this->overruns++;
+    this->buckets[(late_us < JH_EXACT_BUCKETS) ? late_us
+                                               : bucketOf(late_us)]++;
+  }
+
+  uint32_t getEdges();
+  uint32_t percentile(uint32_t percent);
+  int format(char* buf, size_t size);
+};
+
+}  // namespace stepper_motor
+
+#endif
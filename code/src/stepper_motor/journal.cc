@@ -0,0 +1,498 @@
+#include "journal.hh"
+
+#include <hardware/flash.h>
+#include <pico/error.h>
+#include <pico/flash.h>
+#include <pico/time.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "advanced_opts.hh"
+#include "crc32.hh"
+#include "logger.hh"
+
+using namespace stepper_motor;
+
+// **======================================**
+// ||          <<<<< LAYOUT >>>>>          ||
+// **======================================**
+
+/*
+ * The journal is a ring of fixed size records in the last `JOURNAL_SECTORS`
+ * sectors of the flash. Records are only ever appended, the newest record of a
+ * motor is the one with the highest sequence number. Going around the ring
+ * spreads the erases evenly over the sectors.
+ *
+ * Before the first step taken after all the motors were at rest, every motor
+ * gets a MOVING record, and once they have all been still for
+ * `JOURNAL_SETTLE_MS` a rest record. A motor that starts while another one is
+ * already moving thus never has to wait for the flash, which would stall the
+ * steps of the other one. A rest record is only written if the motor's newest
+ * record isn't the same, so a whole burst of moves costs two records per motor.
+ *
+ * Before a sector gets erased, the newest records of the motors that only have
+ * their newest record in it are written again after the erase, from RAM.
+ */
+
+#define JOURNAL_OFFSET \
+  (PICO_FLASH_SIZE_BYTES - JOURNAL_SECTORS * FLASH_SECTOR_SIZE)
+#define JOURNAL_SIZE (JOURNAL_SECTORS * FLASH_SECTOR_SIZE)
+
+#define JOURNAL_MAGIC 0xA5
+
+// Longest the other core may take to get out of the way of a flash write.
+#define JOURNAL_SAFE_TIMEOUT_MS 100
+#define JOURNAL_FLAG_MOVING (1 << 0)
+
+// Records left free at the end of a sector when moving on to the next sector
+// at rest, so that the next moves never have to wait for an erase.
+#define JOURNAL_RESERVE_RECORDS (2 * JOURNAL_MAX_SLOTS)
+
+struct JournalRecord {
+  uint8_t magic;
+  uint8_t slot;
+  uint8_t flags;
+  uint8_t restores;
+  uint32_t sequence;
+  int64_t step_position;
+  int64_t window_open_step_position;
+  uint32_t reserved;
+  uint32_t crc;  // Of everything above.
+};
+
+static_assert(FLASH_PAGE_SIZE % sizeof(JournalRecord) == 0,
+              "Journal records must not straddle flash pages");
+static_assert(JOURNAL_SECTORS >= 2, "The journal needs at least 2 sectors");
+
+// **================================================**
+// ||          <<<<< STATIC VARIABLES >>>>>          ||
+// **================================================**
+
+static struct {
+  JournalRecord last;    // The newest record of the slot in flash.
+  uint32_t last_offset;  // Where `last` is in the journal.
+  bool in_flash;         // Whether `last` is valid.
+  bool restorable;       // Whether `last` may still be handed out.
+  uint8_t restores;
+
+  // The rest record waiting for the motor to settle.
+  bool pending;
+  int64_t step_position;
+  int64_t window_open_step_position;
+} slots[JOURNAL_MAX_SLOTS];
+
+static bool initialized = false;
+static int slot_count = 0;
+static uint32_t cursor = 0;    // Where the next record goes in the journal.
+static uint32_t sequence = 0;  // Of the newest record.
+static uint64_t last_save_us = 0;
+
+// **=====================================**
+// ||          <<<<< FLASH >>>>>          ||
+// **=====================================**
+
+/**
+ * Gets the record at an offset into the journal, read through XIP.
+ */
+static const JournalRecord* recordAt(uint32_t offset) {
+  return (const JournalRecord*)(XIP_BASE + JOURNAL_OFFSET + offset);
+}
+
+static uint32_t recordCrc(const JournalRecord* record) {
+  return crc32(record, offsetof(JournalRecord, crc));
+}
+
+static bool recordValid(const JournalRecord* record) {
+  return record->magic == JOURNAL_MAGIC && record->slot < JOURNAL_MAX_SLOTS &&
+         record->crc == recordCrc(record);
+}
+
+/**
+ * Gets whether a part of the journal is erased and can be programmed.
+ */
+static bool isErased(uint32_t offset, uint32_t len) {
+  const uint32_t* words = (const uint32_t*)(XIP_BASE + JOURNAL_OFFSET + offset);
+  for (uint32_t i = 0; i < len / 4; i++)
+    if (words[i] != 0xFFFFFFFF) return false;
+  return true;
+}
+
+/*
+ * Nothing may run from flash while it's being erased or programmed, so both
+ * go through `flash_safe_execute`, which disables the interrupts and locks the
+ * other core out if it's running, like the key value store does.
+ */
+
+static void eraseSectorUnsafe(void* param) {
+  flash_range_erase(JOURNAL_OFFSET + *(uint32_t*)param, FLASH_SECTOR_SIZE);
+}
+
+struct PageWrite {
+  uint32_t offset;
+  const uint8_t* page;
+};
+
+static void programPageUnsafe(void* param) {
+  PageWrite* write = (PageWrite*)param;
+  flash_range_program(JOURNAL_OFFSET + write->offset, write->page,
+                      FLASH_PAGE_SIZE);
+}
+
+/**
+ * Erases a sector of the journal.
+ *
+ * \returns Whether the sector was erased.
+ */
+static bool eraseSector(uint32_t offset) {
+  int result =
+      flash_safe_execute(eraseSectorUnsafe, &offset, JOURNAL_SAFE_TIMEOUT_MS);
+  if (result == PICO_OK) return true;
+
+  LOG_WARN("Could not erase journal sector 0x%lx (%d).\n",
+           (unsigned long)offset, result);
+  return false;
+}
+
+/**
+ * Programs a page of the journal.
+ *
+ * \returns Whether the page was programmed.
+ */
+static bool programPage(uint32_t offset, const uint8_t* page) {
+  PageWrite write = {offset, page};
+  int result =
+      flash_safe_execute(programPageUnsafe, &write, JOURNAL_SAFE_TIMEOUT_MS);
+  if (result == PICO_OK) return true;
+
+  LOG_WARN("Could not program journal page 0x%lx (%d).\n",
+           (unsigned long)offset, result);
+  return false;
+}
+
+// **=======================================**
+// ||          <<<<< JOURNAL >>>>>          ||
+// **=======================================**
+
+static bool openSector();
+
+/**
+ * Appends records to the journal, programming each flash page once.
+ *
+ * \param records The records to append, their sequence numbers and CRCs are
+ *                filled in.
+ * \param count The number of records.
+ *
+ * \returns Whether all the records were appended. The records of a page that
+ * couldn't be written are left out of the RAM copy too, along with the ones
+ * after them.
+ */
+static bool append(JournalRecord* records, int count) {
+  uint8_t page[FLASH_PAGE_SIZE];
+
+  int i = 0;
+  while (i < count) {
+    if (cursor % FLASH_SECTOR_SIZE == 0 &&
+        !isErased(cursor, FLASH_SECTOR_SIZE) && !openSector())
+      return false;
+
+    // Fill the rest of the page at the cursor. The bytes that are already
+    // programmed get programmed again with the same value, which leaves them
+    // as they are.
+    uint32_t page_offset = cursor & ~(FLASH_PAGE_SIZE - 1);
+    memcpy(page, recordAt(page_offset), FLASH_PAGE_SIZE);
+
+    int first = i;
+    uint32_t first_offset = cursor;
+    do {
+      // Anything other than erased flash at the cursor, e.g. from a write that
+      // got cut off, is skipped along with the rest of the sector.
+      if (!isErased(cursor, sizeof(JournalRecord))) {
+        cursor = (cursor / FLASH_SECTOR_SIZE + 1) * FLASH_SECTOR_SIZE;
+        cursor %= JOURNAL_SIZE;
+        break;
+      }
+
+      JournalRecord* record = &records[i++];
+      record->sequence = sequence + (i - first);
+      record->crc = recordCrc(record);
+      memcpy(page + (cursor - page_offset), record, sizeof(JournalRecord));
+
+      cursor = (cursor + sizeof(JournalRecord)) % JOURNAL_SIZE;
+    } while (i < count && cursor % FLASH_PAGE_SIZE != 0);
+
+    if (i == first) continue;
+    if (!programPage(page_offset, page)) {
+      cursor = first_offset;
+      return false;
+    }
+
+    for (int j = first; j < i; j++) {
+      JournalRecord* record = &records[j];
+      slots[record->slot].last = *record;
+      slots[record->slot].last_offset =
+          first_offset + (j - first) * sizeof(JournalRecord);
+      slots[record->slot].in_flash = true;
+    }
+    sequence += i - first;
+  }
+
+  return true;
+}
+
+/**
+ * Erases the sector at the cursor and carries over the newest records of the
+ * motors that only had them in it.
+ *
+ * \returns Whether the sector was erased. A motor whose record couldn't be
+ * carried over has no position in the journal until it comes to rest again.
+ */
+static bool openSector() {
+  JournalRecord carried[JOURNAL_MAX_SLOTS];
+  int count = 0;
+
+  for (int slot = 0; slot < JOURNAL_MAX_SLOTS; slot++) {
+    if (!slots[slot].in_flash ||
+        slots[slot].last_offset / FLASH_SECTOR_SIZE !=
+            cursor / FLASH_SECTOR_SIZE)
+      continue;
+
+    carried[count++] = slots[slot].last;
+  }
+
+  if (!eraseSector(cursor)) return false;
+
+  for (int i = 0; i < count; i++) slots[carried[i].slot].in_flash = false;
+  append(carried, count);
+  return true;
+}
+
+/**
+ * Builds a record from what is known about a motor.
+ */
+static JournalRecord makeRecord(int slot, uint8_t flags, int64_t step_position,
+                                int64_t window_open_step_position) {
+  JournalRecord record;
+  memset(&record, 0xFF, sizeof(record));
+
+  record.magic = JOURNAL_MAGIC;
+  record.slot = slot;
+  record.flags = flags;
+  record.restores = slots[slot].restores;
+  record.step_position = step_position;
+  record.window_open_step_position = window_open_step_position;
+
+  return record;
+}
+
+/**
+ * Finds the newest record of every motor and where the next record goes.
+ */
+static void journalInit() {
+  initialized = true;
+
+  bool found = false;
+  uint32_t newest_offset = 0;
+
+  for (uint32_t offset = 0; offset < JOURNAL_SIZE;
+       offset += sizeof(JournalRecord)) {
+    const JournalRecord* record = recordAt(offset);
+    if (!recordValid(record)) continue;
+
+    if (!found || record->sequence > sequence) {
+      found = true;
+      sequence = record->sequence;
+      newest_offset = offset;
+    }
+
+    if (!slots[record->slot].in_flash ||
+        record->sequence > slots[record->slot].last.sequence) {
+      slots[record->slot].last = *record;
+      slots[record->slot].last_offset = offset;
+      slots[record->slot].in_flash = true;
+    }
+  }
+
+  cursor = (found) ? (newest_offset + sizeof(JournalRecord)) % JOURNAL_SIZE : 0;
+
+  printf("Position journal: %s, next record at 0x%lx.\n",
+         (found) ? "found" : "empty", (unsigned long)cursor);
+}
+
+/**
+ * Gets a journal slot for a motor and marks its journaled position as used up,
+ * so that a power cut before the motor comes to rest again doesn't leave a
+ * position behind that might be stale.
+ *
+ * Slots are handed out in order, so a motor must be registered in the same
+ * order on every boot to get its own position back. Must be called before core
+ * 1 is started.
+ *
+ * \returns The slot of the motor, or -1 if all slots are taken.
+ */
+int stepper_motor::journalRegister() {
+  if (!initialized) journalInit();
+  if (slot_count >= JOURNAL_MAX_SLOTS) return -1;
+
+  int slot = slot_count++;
+  JournalRecord* last = &slots[slot].last;
+
+  if (slots[slot].in_flash) {
+    slots[slot].restores = last->restores;
+    slots[slot].restorable = !(last->flags & JOURNAL_FLAG_MOVING);
+  }
+
+  if (slots[slot].restorable) {
+    JournalRecord moving =
+        makeRecord(slot, JOURNAL_FLAG_MOVING, last->step_position,
+                   last->window_open_step_position);
+    append(&moving, 1);
+  }
+
+  return slot;
+}
+
+/**
+ * Gets the position a motor was at rest at before the device booted.
+ *
+ * Only handed out once, and only if the motor came to rest after its last
+ * move. Counts towards the restores since the motor was last homed.
+ *
+ * \param slot The slot of the motor.
+ * \param entry Where to store the position.
+ *
+ * \returns Whether there is a position.
+ */
+bool stepper_motor::journalRestore(int slot, JournalEntry* entry) {
+  if (slot < 0 || !slots[slot].restorable) return false;
+  slots[slot].restorable = false;
+
+  entry->step_position = slots[slot].last.step_position;
+  entry->window_open_step_position = slots[slot].last.window_open_step_position;
+  entry->restores = slots[slot].restores;
+
+  if (slots[slot].restores < UINT8_MAX) slots[slot].restores++;
+  return true;
+}
+
+/**
+ * Drops the position a motor was at rest at before the device booted, without
+ * counting a restore, e.g. when the position was taken from elsewhere.
+ *
+ * \param slot The slot of the motor.
+ */
+void stepper_motor::journalDiscard(int slot) {
+  if (slot >= 0) slots[slot].restorable = false;
+}
+
+/**
+ * Journals that a motor is about to move, unless that is already the newest
+ * thing journaled for it. Cheap enough to call on every step, it only ever
+ * writes to flash on the first step after all the motors were at rest.
+ *
+ * That first write journals every other motor as moving too, with their rest
+ * records to follow once all the motors settled. Nothing is written until then
+ * (see `journalService`), so a motor starting while another one is moving
+ * never holds up the steps of the other one for a flash write.
+ *
+ * Must only be called from core 1 while the motor's newest record is a MOVING
+ * one, which `journalRegister` makes sure of during a fast boot.
+ *
+ * \param slot The slot of the motor.
+ */
+void stepper_motor::journalMoveStart(int slot) {
+  if (slot < 0) return;
+
+  slots[slot].restorable = false;
+  slots[slot].pending = false;
+
+  if (!slots[slot].in_flash || (slots[slot].last.flags & JOURNAL_FLAG_MOVING))
+    return;
+
+  JournalRecord batch[JOURNAL_MAX_SLOTS];
+  int count = 0;
+
+  for (int other = 0; other < slot_count; other++) {
+    const JournalRecord* last = &slots[other].last;
+    if (!slots[other].in_flash || (last->flags & JOURNAL_FLAG_MOVING))
+      continue;
+
+    batch[count++] =
+        makeRecord(other, JOURNAL_FLAG_MOVING, last->step_position,
+                   last->window_open_step_position);
+
+    // Put the motors that stay where they are back to rest with the others.
+    if (other != slot && !slots[other].pending) {
+      slots[other].pending = true;
+      slots[other].step_position = last->step_position;
+      slots[other].window_open_step_position =
+          last->window_open_step_position;
+    }
+  }
+
+  append(batch, count);
+}
+
+/**
+ * Notes the position a motor came to rest at, to be journaled once it has been
+ * still for `JOURNAL_SETTLE_MS`.
+ *
+ * \param slot The slot of the motor.
+ * \param step_position The position of the motor.
+ * \param window_open_step_position The fully open position of the window.
+ * \param homed Whether the motor was just homed, which resets its restores.
+ */
+void stepper_motor::journalSave(int slot, int64_t step_position,
+                                int64_t window_open_step_position, bool homed) {
+  if (slot < 0) return;
+
+  slots[slot].pending = true;
+  slots[slot].step_position = step_position;
+  slots[slot].window_open_step_position = window_open_step_position;
+  if (homed) slots[slot].restores = 0;
+
+  last_save_us = time_us_64();
+}
+
+/**
+ * Journals the positions of the motors that have settled, all at once, and
+ * moves on to the next sector ahead of time if the current one is almost full.
+ *
+ * Call from the main loop on core 0.
+ *
+ * \param moving Whether any motor is moving, nothing is written while one is.
+ */
+void stepper_motor::journalService(bool moving) {
+  if (moving || !initialized ||
+      time_us_64() - last_save_us < JOURNAL_SETTLE_MS * 1000ULL)
+    return;
+
+  JournalRecord batch[JOURNAL_MAX_SLOTS];
+  int count = 0;
+
+  for (int slot = 0; slot < slot_count; slot++) {
+    if (!slots[slot].pending) continue;
+    slots[slot].pending = false;
+
+    // Nothing to write if the motor came back to rest where it already was.
+    const JournalRecord* last = &slots[slot].last;
+    if (slots[slot].in_flash && !(last->flags & JOURNAL_FLAG_MOVING) &&
+        last->step_position == slots[slot].step_position &&
+        last->window_open_step_position ==
+            slots[slot].window_open_step_position &&
+        last->restores == slots[slot].restores)
+      continue;
+
+    batch[count++] = makeRecord(slot, 0, slots[slot].step_position,
+                                slots[slot].window_open_step_position);
+  }
+
+  if (count > 0) append(batch, count);
+
+  uint32_t sector_left = FLASH_SECTOR_SIZE - cursor % FLASH_SECTOR_SIZE;
+  if (cursor % FLASH_SECTOR_SIZE != 0 &&
+      sector_left < JOURNAL_RESERVE_RECORDS * sizeof(JournalRecord)) {
+    cursor = (cursor + sector_left) % JOURNAL_SIZE;
+    if (!isErased(cursor, FLASH_SECTOR_SIZE)) openSector();
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef JOURNAL_HH
+#define JOURNAL_HH
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// **====================================================**
+// ||          <<<<< Configuration Macros >>>>>          ||
+// **====================================================**
+
+// Number of flash sectors (4kB each) at the end of the flash the journal is
+// spread over. At least 2.
+#ifndef JOURNAL_SECTORS
+#define JOURNAL_SECTORS 4
+#endif
+
+// Most motors that can be journaled.
+#ifndef JOURNAL_MAX_SLOTS
+#define JOURNAL_MAX_SLOTS 4
+#endif
+
+// **=======================================**
+// ||          <<<<< JOURNAL >>>>>          ||
+// **=======================================**
+
+namespace stepper_motor {
+
+/**
+ * The position of a motor as last journaled before the device booted.
+ */
+struct JournalEntry {
+  int64_t step_position;
+  int64_t window_open_step_position;
+  uint8_t restores;  // Boots that took the position over since the last homing.
+};
+
+int journalRegister();
+
+bool journalRestore(int slot, JournalEntry* entry);
+void journalDiscard(int slot);
+
+void journalMoveStart(int slot);
+void journalSave(int slot, int64_t step_position,
+                 int64_t window_open_step_position, bool homed);
+
+void journalService(bool moving);
+
+}  // namespace stepper_motor
+
+#endif
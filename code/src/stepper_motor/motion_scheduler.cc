@@ -0,0 +1,116 @@
+#include "motion_scheduler.hh"
+
+#include <pico/time.h>
+
+#include "logger.hh"
+#include "network.hh"
+#include "stepper_motor.hh"
+#include "supervisor.hh"
+
+using namespace stepper_motor;
+
+/**
+ * Initializes a motion scheduler with no motors.
+ */
+MotionScheduler::MotionScheduler() {
+  this->motor_count = 0;
+  this->longest_poll_us = 0;
+  this->reported_poll_us = 0;
+}
+
+/**
+ * Adds a motor for the scheduler to drive.
+ *
+ * \returns Whether the motor was added, false if `SM_MAX_MOTORS` motors have
+ * already been added.
+ */
+bool MotionScheduler::addMotor(StepperMotor* sm) {
+  if (this->motor_count >= SM_MAX_MOTORS) return false;
+
+  this->motors[this->motor_count++] = sm;
+  return true;
+}
+
+/**
+ * Gets whether any of the motors are moving.
+ */
+bool MotionScheduler::isActive() {
+  for (int i = 0; i < this->motor_count; i++)
+    if (this->motors[i]->isMoving()) return true;
+
+  return false;
+}
+
+/**
+ * Gets whether any of the motors are soft starting.
+ */
+bool MotionScheduler::isRamping() {
+  for (int i = 0; i < this->motor_count; i++)
+    if (this->motors[i]->isRamping()) return true;
+
+  return false;
+}
+
+/**
+ * Performs the moves of all the motors for up to `budget_us` micro seconds.
+ *
+ * Returns early once no motor is moving, or as soon as the next edge falls
+ * after the budget so that the caller gets control back between two edges.
+ *
+ * When the network is polled rather than serviced in interrupts, it's also
+ * serviced in the gaps between edges that leave `MOTION_POLL_HEADROOM_US` to
+ * spare, at most every `MOTION_POLL_INTERVAL_US` and never while a motor is
+ * soft starting. A service that takes longer than the headroom delays the
+ * next edge, so the longest one is kept and a warning logged after the batch.
+ *
+ * \param budget_us How long to step for, in micro seconds.
+ */
+void MotionScheduler::run(uint64_t budget_us) {
+  uint64_t end_us = time_us_64() + budget_us;
+  uint64_t last_poll_us = time_us_64();
+
+  // Moving motors must be serviced at least every
+  // `SUPERVISOR_MOTION_DEADLINE_MS`.
+  if (!supervisorIsLive(TASK_MOTION)) supervisorResume(TASK_MOTION);
+
+  while (true) {
+    // Service every motor and find the next edge that is due.
+    uint64_t now_us = time_us_64();
+    uint64_t next_edge_us = SM_NO_EDGE;
+    for (int i = 0; i < this->motor_count; i++) {
+      uint64_t motor_next_edge_us = this->motors[i]->serviceMotion(now_us);
+      if (motor_next_edge_us < next_edge_us) next_edge_us = motor_next_edge_us;
+    }
+
+    if (next_edge_us == SM_NO_EDGE || next_edge_us >= end_us) break;
+
+    // Service the network while cruising, if it fits in before the next edge.
+    if (NETWORK_POLLED) {
+      now_us = time_us_64();
+      if (next_edge_us >= now_us + MOTION_POLL_HEADROOM_US &&
+          now_us - last_poll_us >= MOTION_POLL_INTERVAL_US &&
+          !this->isRamping()) {
+        networkPoll();
+        last_poll_us = now_us;
+
+        uint64_t poll_us = time_us_64() - now_us;
+        if (poll_us > this->longest_poll_us) this->longest_poll_us = poll_us;
+      }
+    }
+
+    // Wait for the next edge.
+    while (time_us_64() < next_edge_us) tight_loop_contents();
+  }
+
+  if (this->longest_poll_us > MOTION_POLL_HEADROOM_US &&
+      this->longest_poll_us > this->reported_poll_us) {
+    LOG_WARN("Servicing the network took %lluus, over the %dus headroom.\n",
+             (unsigned long long)this->longest_poll_us,
+             MOTION_POLL_HEADROOM_US);
+    this->reported_poll_us = this->longest_poll_us;
+  }
+
+  supervisorCheckIn(TASK_MOTION);
+  if (!this->isActive()) supervisorSuspend(TASK_MOTION);
+  supervisorService();
+}
@@ -0,0 +1,66 @@
+#ifndef MOTION_SCHEDULER_HH
+#define MOTION_SCHEDULER_HH
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stepper_motor.hh"
+
+// **====================================================**
+// ||          <<<<< Configuration Macros >>>>>          ||
+// **====================================================**
+
+// Longest time (in micro seconds) the scheduler keeps stepping before handing
+// control back to the main loop to process new actions.
+#ifndef MOTION_BATCH_US
+#define MOTION_BATCH_US 20000
+#endif
+
+// Least time (in micro seconds) there has to be before the next edge for the
+// scheduler to service the network in between, when the network is polled.
+// Assumes a poll that finds a few packets waiting takes well under 1ms, as
+// `cyw43_arch_poll` only copies them out of the chip and runs their lwIP
+// callbacks. The scheduler times its polls and warns when one took longer.
+#ifndef MOTION_POLL_HEADROOM_US
+#define MOTION_POLL_HEADROOM_US 1000
+#endif
+
+// Least time (in micro seconds) between two services of the network within a
+// batch. The main loop services it between batches anyway.
+#ifndef MOTION_POLL_INTERVAL_US
+#define MOTION_POLL_INTERVAL_US 5000
+#endif
+
+// **================================================**
+// ||          <<<<< Motion Scheduler >>>>>          ||
+// **================================================**
+
+namespace stepper_motor {
+
+/**
+ * Drives the moves of several stepper motors at the same time.
+ *
+ * Each motor performs its own move one pulse edge at a time (see
+ * `StepperMotor::serviceMotion`). The scheduler repeatedly services every
+ * motor and waits for whichever edge is due next, so the step pulses of all
+ * the motors are interleaved and every motor moves at its own full speed.
+ */
+class MotionScheduler {
+ public:
+  MotionScheduler();
+
+  bool addMotor(StepperMotor* sm);
+  bool isActive();
+  bool isRamping();
+  void run(uint64_t budget_us);
+
+ private:
+  StepperMotor* motors[SM_MAX_MOTORS];
+  int motor_count;
+  uint64_t longest_poll_us;   // Longest service of the network in a batch.
+  uint64_t reported_poll_us;  // Longest one warned about.
+};
+
+}  // namespace stepper_motor
+
+#endif
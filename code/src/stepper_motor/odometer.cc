@@ -0,0 +1,127 @@
+#include "odometer.hh"
+
+#include <pico/time.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "advanced_opts.hh"
+#include "common.hh"
+
+using namespace stepper_motor;
+
+static const char* const event_names[ODOMETER_EVENTS] = {
+    "moves", "cycles", "homings", "ls", "stops", "stalls"};
+
+Odometer::Odometer() {
+  memset(&this->counts, 0, sizeof(this->counts));
+  this->changed = false;
+  this->saved = false;
+  this->saved_us = 0;
+  this->start_position = 0;
+  this->start_us = 0;
+  this->micro_step_index = 0;
+}
+
+/**
+ * Takes over the counts saved before the device booted.
+ */
+void Odometer::restore(const OdometerCounts& counts) {
+  this->counts = counts;
+  this->changed = false;
+}
+
+const OdometerCounts& Odometer::getCounts() { return this->counts; }
+
+/**
+ * Starts a stretch of travel in one direction at one micro step setting.
+ *
+ * \param position The position of the motor, in `SM_SMALLEST_MS` micro steps.
+ * \param micro_steps The micro step setting, 8 to 64.
+ */
+void Odometer::beginTravel(int64_t position, uint32_t micro_steps) {
+  this->start_position = position;
+  this->start_us = time_us_64();
+  this->micro_step_index =
+      MIN(MAX(__builtin_ctz(MAX(micro_steps, 1u)) - 3, 0),
+          ODOMETER_MICRO_STEPS - 1);
+}
+
+/**
+ * Ends the stretch of travel started by `beginTravel` and counts its distance
+ * and the time it took.
+ *
+ * \param position The position of the motor, before it gets corrected by a
+ * limit switch.
+ *
+ * \returns The distance travelled in `SM_SMALLEST_MS` micro steps.
+ */
+uint64_t Odometer::endTravel(int64_t position) {
+  uint64_t steps = (position >= this->start_position)
+                       ? position - this->start_position
+                       : this->start_position - position;
+  if (steps == 0) return 0;
+
+  this->counts.steps += steps;
+  this->counts.moving_ms[this->micro_step_index] +=
+      (time_us_64() - this->start_us) / 1000;
+  this->changed = true;
+
+  return steps;
+}
+
+/**
+ * Gets whether the counts changed and were last saved at least an interval
+ * ago. The first save after boot is due right away, so that a device that
+ * never stays up for long still keeps its counts.
+ *
+ * \param now_us The current time in micro seconds since boot.
+ * \param interval_us The least time between two saves.
+ */
+bool Odometer::saveDue(uint64_t now_us, uint64_t interval_us) {
+  return this->changed &&
+         (!this->saved || now_us - this->saved_us >= interval_us);
+}
+
+void Odometer::markSaved(uint64_t now_us) {
+  this->changed = false;
+  this->saved = true;
+  this->saved_us = now_us;
+}
+
+/**
+ * Writes the counts as compact JSON:
+ * - steps:  Full steps travelled.
+ * - mm:     Millimeters travelled.
+ * - moves, cycles, homings, ls, stops, stalls: See `OdometerEvent`.
+ * - s:      Seconds spent moving at 1/8, 1/16, 1/32 and 1/64 micro steps.
+ *
+ * \param buf Where to write the JSON to.
+ * \param size The size of `buf`.
+ *
+ * \returns The length of the JSON, `size` or more if it didn't fit.
+ */
+int Odometer::format(char* buf, size_t size) {
+  size_t len = 0;
+
+#define APPEND(...) \
+  len += snprintf(buf + MIN(len, size), size - MIN(len, size), __VA_ARGS__)
+
+  APPEND("{\"steps\":%llu,\"mm\":%llu",
+         (unsigned long long)(this->counts.steps / SM_SMALLEST_MS),
+         (unsigned long long)(this->counts.steps /
+                              (SM_FULL_STEPS_PER_MM * SM_SMALLEST_MS)));
+
+  for (int i = 0; i < ODOMETER_EVENTS; i++)
+    APPEND(",\"%s\":%lu", event_names[i],
+           (unsigned long)this->counts.events[i]);
+
+  APPEND(",\"s\":[");
+  for (int i = 0; i < ODOMETER_MICRO_STEPS; i++)
+    APPEND("%s%lu", (i == 0) ? "" : ",",
+           (unsigned long)(this->counts.moving_ms[i] / 1000));
+  APPEND("]}");
+
+#undef APPEND
+
+  return len;
+}
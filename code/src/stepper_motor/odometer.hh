@@ -0,0 +1,86 @@
+#ifndef ODOMETER_HH
+#define ODOMETER_HH
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// **====================================================**
+// ||          <<<<< Configuration Macros >>>>>          ||
+// **====================================================**
+
+// Micro step settings timed apart, 1/8, 1/16, 1/32 and 1/64.
+#define ODOMETER_MICRO_STEPS 4
+
+// **========================================**
+// ||          <<<<< ODOMETER >>>>>          ||
+// **========================================**
+
+namespace stepper_motor {
+
+/**
+ * The things counted by an odometer besides travel.
+ */
+enum OdometerEvent {
+  ODOMETER_MOVE,          // Moves that took at least one step.
+  ODOMETER_CYCLE,         // Closings of the window after it was open.
+  ODOMETER_HOMING,        // Searches for an end stop.
+  ODOMETER_LIMIT_SWITCH,  // Moves and searches ended by a limit switch.
+  ODOMETER_STOP,          // Moves ended by a stop request.
+  ODOMETER_STALL,         // Moves ended by a stall.
+  ODOMETER_EVENTS
+};
+
+/**
+ * What an odometer counted, as kept in the key value store.
+ */
+struct OdometerCounts {
+  uint64_t steps;  // Travelled, in `SM_SMALLEST_MS` micro steps.
+  uint32_t moving_ms[ODOMETER_MICRO_STEPS];  // By micro step setting.
+  uint32_t events[ODOMETER_EVENTS];
+};
+
+/**
+ * Counts how much a motor has worked over its lifetime, for maintenance.
+ *
+ * Travel is counted from the position at either end of a stretch of travel in
+ * one direction, and events once they happened, so nothing is done per step.
+ */
+class Odometer {
+ private:
+  OdometerCounts counts;
+  bool changed;       // Since the counts were last saved.
+  bool saved;         // Whether the counts were saved since boot.
+  uint64_t saved_us;  // When the counts were last saved.
+
+  // --- Travel In Progress ---
+  int64_t start_position;
+  uint64_t start_us;
+  int micro_step_index;
+
+ public:
+  Odometer();
+
+  void restore(const OdometerCounts& counts);
+  const OdometerCounts& getCounts();
+
+  void beginTravel(int64_t position, uint32_t micro_steps);
+  uint64_t endTravel(int64_t position);
+
+  /**
+   * Counts an event.
+   */
+  inline void count(OdometerEvent event) {
+    this->counts.events[event]++;
+    this->changed = true;
+  }
+
+  bool saveDue(uint64_t now_us, uint64_t interval_us);
+  void markSaved(uint64_t now_us);
+
+  int format(char* buf, size_t size);
+};
+
+}  // namespace stepper_motor
+
+#endif
@@ -4,13 +4,19 @@
 #include <math.h>
 #include <pico/cyw43_arch.h>
 #include <pico/platform/compiler.h>
+#include <string.h>
 
 #include "action_queue.hh"
 #include "advanced_opts.hh"
 #include "common.hh"
+#include "kv_store.hh"
+#include "led_pattern.hh"
+#include "logger.hh"
 #include "limit_switch.hh"
 #include "mqtt_topics.hh"
 #include "pins.hh"
+#include "supervisor.hh"
+#include "trace.hh"
 
 using namespace stepper_motor;
 
@@ -20,11 +26,32 @@ using namespace stepper_motor;
 #define US_PER_HALF_MICROSTEP_TO_MM_PER_SEC(us_per_half_ms, micro_step) \
   (1000000.0 / (us_per_half_ms * SM_FULL_STEPS_PER_MM * micro_step * 2))
 
+#define MM_TO_MICROSTEPS(mm, micro_step) \
+  ((uint64_t)(mm) * SM_FULL_STEPS_PER_MM * (micro_step))
+
 #define INIT_PIN(pin, dir, val) \
   gpio_init(pin);               \
   gpio_set_dir(pin, dir);       \
   if (dir == GPIO_OUT) gpio_put(pin, val)
 
+// The motors with a DIAG pin interrupt. The GPIO interrupt callback is shared
+// by all pins, so it needs a way back to the motor.
+static StepperMotor* stall_irq_motors[SM_MAX_MOTORS];
+static int stall_irq_motor_count = 0;
+
+// Motors constructed so far, each motor is traced under its index.
+static uint8_t motor_count = 0;
+
+// The settings of a motor kept in the key value store, under the ID of the
+// motor.
+struct MotorSettings {
+  float speed;
+  uint32_t acceleration;
+  int64_t window_open_step_position;
+  bool quiet_mode;
+  bool soft_start_mode;
+};
+
 //
 //
 // **===========================================**
@@ -34,28 +61,33 @@ using namespace stepper_motor;
 /**
  * Initialize a stepper motor object.
  *
- * \param enable_pin The enable pin of the motor.
- * \param direction_pin The direction pin of the motor.
- * \param pulse_pin The pulse/step pin of the motor.
- * \param micro_step_1_pin The first of the two micro step encoding pins for the
- * motor.
- * \param micro_step_2_pin The second of the two micro step encoding pins for
- * the motor.
+ * \param id The ID of the motor, unique on this device.
+ * \param topic_base The MQTT topic all topics of this motor are relative to.
+ * Must end in a '/'.
+ * \param pins The pins of the motor, its driver and its limit switches.
+ * \param uart The UART connected to the motor driver, or NULL if not
+ * connected.
+ * \param uart_tx_pin The TX pin of the driver UART.
+ * \param uart_rx_pin The RX pin of the driver UART.
  * \param initial_micro_step The initial micros step to set the motor to.
  * \param initial_speed The initial speed to set the motor to.
  */
-stepper_motor::StepperMotor::StepperMotor(uint enable_pin, uint direction_pin,
-                                          uint pulse_pin, uint micro_step_1_pin,
-                                          uint micro_step_2_pin,
-                                          uint initial_micro_step,
-                                          float initial_speed,
-                                          mqtt_client_t* mqtt_client) {
+stepper_motor::StepperMotor::StepperMotor(
+    const char* id, const char* topic_base, struct StepperMotorPins pins,
+    uart_inst_t* uart, uint uart_tx_pin, uint uart_rx_pin,
+    uint initial_micro_step, float initial_speed, mqtt_client_t* mqtt_client) {
+  // Set the identity of the motor.
+  this->id = id;
+  this->topic_base = topic_base;
+  this->trace_index = motor_count++;
+
   // Set stepper motor pins.
-  this->pins.enable = enable_pin;
-  this->pins.direction = direction_pin;
-  this->pins.pulse = pulse_pin;
-  this->pins.ms1 = micro_step_1_pin;
-  this->pins.ms2 = micro_step_2_pin;
+  this->pins = pins;
+
+  // Determine the role of each limit switch.
+  this->ls_home = (HOME_SIDE == RIGHT_SIDE) ? pins.ls_right : pins.ls_left;
+  this->ls_closed = (CLOSED_SIDE == RIGHT_SIDE) ? pins.ls_right : pins.ls_left;
+  this->ls_open = (OPEN_SIDE == RIGHT_SIDE) ? pins.ls_right : pins.ls_left;
 
   // ----- Initialize the pins -----
   // Enable Pin.
@@ -73,6 +105,15 @@ stepper_motor::StepperMotor::StepperMotor(uint enable_pin, uint direction_pin,
   // Stepper Motor Micro-Step Pin B.
   INIT_PIN(this->pins.ms2, GPIO_OUT, 0);
 
+  // Stepper Motor Driver DIAG Pin.
+  INIT_PIN(this->pins.diag, GPIO_IN, 0);
+
+  // Limit Switches.
+  gpio_init(this->pins.ls_left);
+  gpio_init(this->pins.ls_right);
+  gpio_set_pulls(this->pins.ls_left, true, false);   // Pull up
+  gpio_set_pulls(this->pins.ls_right, true, false);  // Pull up
+
   // ----- Set Initial Values -----
 
   // Set the default window width.
@@ -87,6 +128,9 @@ stepper_motor::StepperMotor::StepperMotor(uint enable_pin, uint direction_pin,
   // Soft start mode on by default.
   this->soft_start_mode = true;
 
+  // Default soft start acceleration.
+  this->acceleration = SM_SOFT_START_INCREASE_FACTOR;
+
   // Temporary flag to ignore main soft start flag when performing two
   // actions of the same type in the same direction.
   this->roll_soft_start = false;
@@ -94,25 +138,82 @@ stepper_motor::StepperMotor::StepperMotor(uint enable_pin, uint direction_pin,
   // No call to stop the motor.
   this->stop_motor = false;
 
+  // No stall yet.
+  this->stall_detected = false;
+  this->stall_sg = -1;
+
   // Zero the position (assume).
   this->step_position = 0;
 
-  // Initialize the action queue.
-  this->action_queue = action::ActionQueue();
-
   // Not moving.
   this->state = State::STOPPED;
+  this->move.active = false;
+  this->move.pulse_high = false;
+
+  // Get the position checkpoint and journal slots before anything can step.
+  this->checkpoint_slot = checkpointRegister();
+  this->journal_slot = journalRegister();
+
+  // Powered up, the enable pin is initialized low.
+  this->powered_down = false;
+  this->last_move_us = time_us_64();
+
+  // Take over the settings and calibration saved before the last reboot.
+  float speed = initial_speed;
+  this->loadSettings(&speed);
+  this->loadOdometer();
 
   // Set the initial micro steps value of the motor.
   this->setMicroStep(initial_micro_step);
 
-  // Default motor speed.
-  this->setSpeed(initial_speed);
+  // Default motor speed. Keep it for when quiet mode gets turned off.
+  if (this->quiet_mode) this->speed = speed;
+  this->setSpeed(speed);
+
+  // Seed the configuration the control lane edits with the initial one.
+  this->config_pending = false;
+  this->control.config.init(
+      {speed, this->quiet_mode, this->soft_start_mode, this->acceleration});
+
+  // Setup the motor driver. The UART slave address of the driver is the state
+  // of the micro step pins, so this must happen after they are set.
+  this->driver = TMC2209(uart, uart_tx_pin, uart_rx_pin);
+  if (this->driver.isConnected() &&
+      !this->driver.setupStallGuard(
+          this->getMicroStep(), STALL_THRESHOLD,
+          TMC_MM_PER_SEC_TO_TSTEP(STALL_MIN_SPEED, SM_FULL_STEPS_PER_MM)))
+    printf("Failed to configure StallGuard on the motor driver.\n");
+
+#if STALL_DETECTION
+  // Without StallGuard configured over UART the DIAG pin still goes high on
+  // driver errors (over temperature, short), which should stop the motor too.
+  if (stall_irq_motor_count < SM_MAX_MOTORS) {
+    stall_irq_motors[stall_irq_motor_count++] = this;
+    gpio_set_irq_enabled_with_callback(this->pins.diag, GPIO_IRQ_EDGE_RISE,
+                                       true, &StepperMotor::diagIrqCb);
+  }
+#endif
 
   // Set the MQTT client.
   this->mqtt_client = mqtt_client;
 }
 
+//
+//
+// **========================================**
+// ||          <<<<< IDENTITY >>>>>          ||
+// **========================================**
+
+/**
+ * Gets the ID of the motor.
+ */
+const char* StepperMotor::getId() { return this->id; }
+
+/**
+ * Gets the MQTT topic all the topics of this motor are relative to.
+ */
+const char* StepperMotor::getTopicBase() { return this->topic_base; }
+
 //
 //
 // **=====================================**
@@ -129,6 +230,255 @@ void StepperMotor::enable() { gpio_put(this->pins.enable, 0); }
  */
 void StepperMotor::disable() { gpio_put(this->pins.enable, 1); }
 
+//
+//
+// **=====================================**
+// ||          <<<<< POWER >>>>>          ||
+// **=====================================**
+
+/**
+ * Gets whether the motor has been powered down for being idle.
+ */
+bool StepperMotor::isPoweredDown() { return this->powered_down; }
+
+/**
+ * Powers the motor down while it's idle.
+ *
+ * The driver is either disabled or its standstill current is lowered to
+ * `MOTOR_HOLD_CURRENT`, depending on `MOTOR_IDLE_DISABLE`. The window can't
+ * move the motor, so the position is kept either way.
+ */
+void StepperMotor::powerDown() {
+  if (this->powered_down) return;
+
+  if (MOTOR_IDLE_DISABLE || !this->driver.isConnected() ||
+      !this->driver.setCurrent(this->getMicroStep(), MOTOR_HOLD_CURRENT,
+                               MOTOR_RUN_CURRENT))
+    this->disable();
+
+  this->powered_down = true;
+}
+
+/**
+ * Powers a powered down motor back up.
+ *
+ * \returns Whether the coils have to be given `MOTOR_WAKE_SETTLE_US` to
+ *          energize before the first step.
+ */
+bool StepperMotor::powerUp() {
+  if (!this->powered_down) return false;
+  this->powered_down = false;
+  this->last_move_us = time_us_64();
+
+  if (this->driver.isConnected() && !MOTOR_IDLE_DISABLE)
+    this->driver.setCurrent(this->getMicroStep(), MOTOR_RUN_CURRENT,
+                            MOTOR_RUN_CURRENT);
+
+  // Disabling is also the fall back of lowering the current, so check the pin
+  // rather than the option.
+  if (!gpio_get_out_level(this->pins.enable)) return false;
+
+  this->enable();
+  return true;
+}
+
+/**
+ * Powers the motor down once it hasn't moved for `MOTOR_IDLE_TIMEOUT_MS`.
+ *
+ * \param now_us The current time in micro seconds since boot.
+ */
+void StepperMotor::serviceIdle(uint64_t now_us) {
+  if (this->move.active || this->powered_down) return;
+
+  if (now_us - this->last_move_us >= MOTOR_IDLE_TIMEOUT_MS * 1000ULL)
+    this->powerDown();
+}
+
+//
+//
+// **==============================================**
+// ||          <<<<< SAVED POSITION >>>>>          ||
+// **==============================================**
+
+/**
+ * Marks the position of the motor as not to be trusted after a reboot until
+ * it's saved again. Call before every step.
+ */
+void StepperMotor::markMoving() {
+  checkpointMoveStart(this->checkpoint_slot);
+  journalMoveStart(this->journal_slot);
+}
+
+/**
+ * Saves the position of the motor so that it survives a watchdog reboot, and
+ * journals it to flash once the motor has settled so that it survives a power
+ * cut too. Only call between moves.
+ *
+ * \param homed Whether the motor was just homed.
+ */
+void StepperMotor::savePosition(bool homed) {
+  checkpointSave(this->checkpoint_slot, this->step_position,
+                 this->window_open_step_position, (uint8_t)this->state);
+  journalSave(this->journal_slot, this->step_position,
+              this->window_open_step_position, homed);
+  this->saveOdometer();
+}
+
+/**
+ * Takes the position over from the checkpoint of the previous boot, if there is
+ * one that can be trusted.
+ *
+ * A motor that stalled or was moving when the device rebooted might have lost
+ * steps, so it has to be homed again.
+ *
+ * \returns Whether the position was restored.
+ */
+bool StepperMotor::restoreCheckpoint() {
+  PositionCheckpoint checkpoint;
+  if (!checkpointRestore(this->checkpoint_slot, &checkpoint)) return false;
+
+  State state = (State)checkpoint.state;
+  if (state == State::STALLED || state == State::OPENING ||
+      state == State::CLOSING)
+    return false;
+
+  this->step_position = checkpoint.step_position;
+  this->window_open_step_position = checkpoint.window_open_step_position;
+  this->updateState();
+
+  return true;
+}
+
+/**
+ * Takes the position over from the flash journal, if the motor came to rest
+ * after its last move and `JOURNAL_TRUST_POLICY` trusts it.
+ *
+ * The limit switches have to agree with the journaled position, which catches
+ * a window that was moved by hand while the device was off.
+ *
+ * \returns Whether the position was restored.
+ */
+bool StepperMotor::restoreJournal() {
+  JournalEntry entry;
+  if (!journalRestore(this->journal_slot, &entry) ||
+      JOURNAL_TRUST_POLICY == JOURNAL_TRUST_NEVER ||
+      entry.restores >= JOURNAL_MAX_RESTORES)
+    return false;
+
+  bool at_closed = (entry.step_position <= WINDOW_CLOSED_STEP_POSITION);
+  bool at_open = (entry.step_position >= entry.window_open_step_position);
+  bool ls_closed = LS_TRIGGERED(this->ls_closed);
+  bool ls_open = LS_TRIGGERED(this->ls_open);
+
+  bool trusted;
+  if (JOURNAL_TRUST_POLICY == JOURNAL_TRUST_AT_END_STOP)
+    trusted = (at_closed && ls_closed) || (at_open && ls_open);
+  else
+    trusted = (at_closed == ls_closed) && (at_open == ls_open);
+  if (!trusted) return false;
+
+  this->step_position = entry.step_position;
+  this->window_open_step_position = entry.window_open_step_position;
+  this->updateState();
+
+  return true;
+}
+
+//
+//
+// **========================================**
+// ||          <<<<< SETTINGS >>>>>          ||
+// **========================================**
+
+/**
+ * Takes over the settings and the calibrated open position saved in flash.
+ *
+ * \param speed Where to store the saved speed, left as it is if there are no
+ *              saved settings.
+ *
+ * \returns Whether there were saved settings.
+ */
+bool StepperMotor::loadSettings(float* speed) {
+  const void* value;
+  uint16_t len;
+  if (!kvGet(this->id, &value, &len) || len != sizeof(MotorSettings))
+    return false;
+
+  MotorSettings settings;
+  memcpy(&settings, value, sizeof(settings));
+  if (!(settings.speed > 0) || settings.window_open_step_position <= 0)
+    return false;
+
+  *speed = settings.speed;
+  this->quiet_mode = settings.quiet_mode;
+  this->soft_start_mode = settings.soft_start_mode;
+  this->acceleration = MAX(settings.acceleration, 1);
+  this->window_open_step_position = settings.window_open_step_position;
+
+  return true;
+}
+
+/**
+ * Saves the settings and the calibrated open position to flash, so they
+ * survive a reboot. Written once nothing has been moving for a while, saving
+ * settings that didn't change costs nothing.
+ */
+void StepperMotor::saveSettings() {
+  MotorSettings settings;
+  memset(&settings, 0, sizeof(settings));
+
+  settings.speed = this->speed;
+  settings.acceleration = this->acceleration;
+  settings.window_open_step_position = this->window_open_step_position;
+  settings.quiet_mode = this->quiet_mode;
+  settings.soft_start_mode = this->soft_start_mode;
+
+  if (!kvSet(this->id, &settings, sizeof(settings)))
+    LOG_WARN("[%s] Could not save the settings.\n", this->id);
+}
+
+/**
+ * Gets the key the odometer of a motor is kept under in the key value store.
+ */
+static void getOdometerKey(const char* id, char* key, size_t size) {
+  snprintf(key, size, "%s" ODOMETER_KEY_SUFFIX, id);
+}
+
+/**
+ * Takes over the odometer saved in flash.
+ */
+void StepperMotor::loadOdometer() {
+  char key[KV_STORE_MAX_KEY_LEN + 1];
+  getOdometerKey(this->id, key, sizeof(key));
+
+  const void* value;
+  uint16_t len;
+  if (!kvGet(key, &value, &len) || len != sizeof(OdometerCounts)) return;
+
+  OdometerCounts counts;
+  memcpy(&counts, value, sizeof(counts));
+  this->odometer.restore(counts);
+}
+
+/**
+ * Saves the odometer to flash, at most every `ODOMETER_SAVE_INTERVAL_MS` so
+ * that it costs the flash next to nothing. What was counted since the last
+ * save is lost to a power cut.
+ */
+void StepperMotor::saveOdometer() {
+  uint64_t now_us = time_us_64();
+  if (!this->odometer.saveDue(now_us, ODOMETER_SAVE_INTERVAL_MS * 1000ULL))
+    return;
+
+  char key[KV_STORE_MAX_KEY_LEN + 1];
+  getOdometerKey(this->id, key, sizeof(key));
+
+  if (kvSet(key, &this->odometer.getCounts(), sizeof(OdometerCounts)))
+    this->odometer.markSaved(now_us);
+  else
+    LOG_WARN("[%s] Could not save the odometer.\n", this->id);
+}
+
 //
 //
 // **=========================================**
@@ -210,6 +560,24 @@ void StepperMotor::setSoftStartMode(bool mode) {
   this->publishSoftStartMode();
 }
 
+/**
+ * Gets how much the soft start ramp shortens the half step delay per level.
+ */
+uint StepperMotor::getAcceleration() { return this->acceleration; }
+
+/**
+ * Sets how much the soft start ramp shortens the half step delay per level.
+ *
+ * \param acceleration The decrease in half step delay per ramp level in micro
+ * seconds. Higher values reach the set speed sooner.
+ */
+void StepperMotor::setAcceleration(uint acceleration) {
+  this->acceleration = MAX(acceleration, 1);
+
+  // Relay the change in acceleration to the MQTT server.
+  this->publishAcceleration();
+}
+
 //
 //
 // **===========================================**
@@ -243,6 +611,19 @@ uint StepperMotor::getMicroStepInt() {
  * \param micro_step The micro steps to set the motor to.
  */
 void StepperMotor::setMicroStep(uint micro_step) {
+  this->applyMicroStep(micro_step);
+
+  // Send the update to the MQTT server.
+  this->publishMicroSteps();
+}
+
+/**
+ * Sets the micro step pins, aligning the position to the new micro step first
+ * if needed. Doesn't publish the change.
+ *
+ * \param micro_step The micro steps to set the motor to.
+ */
+void StepperMotor::applyMicroStep(uint micro_step) {
   // Record the current state of the stepper motor.
   uint current_ms_int = this->getMicroStepInt();
   bool saved_dir = this->getDir();
@@ -279,9 +660,6 @@ void StepperMotor::setMicroStep(uint micro_step) {
   // Set the micro step pins for the new micro step value.
   gpio_put(this->pins.ms1, desired_ms & 0b1);
   gpio_put(this->pins.ms2, (desired_ms >> 1) & 0b1);
-
-  // Send the update to the MQTT server.
-  this->publishMicroSteps();
 }
 
 //
@@ -310,10 +688,33 @@ float StepperMotor::getSpeed() {
  * \param speed The speed to set the motor to in millimeters per second.
  */
 void StepperMotor::setSpeed(float speed) {
-  if (this->quiet_mode) {
-    uint64_t half_step_delay = MM_PER_SEC_TO_US_PER_HALF_MICROSTEP(speed, 64);
-    this->setMicroStep(MS_64);
-    this->half_step_delay = MAX(half_step_delay, SM_MS64_MIN_HALF_DELAY_QUIET);
+  uint micro_step;
+  uint64_t half_step_delay;
+  this->chooseTiming(speed, this->quiet_mode, &micro_step, &half_step_delay);
+  this->applyTiming(micro_step, half_step_delay);
+
+  // Send the update to the MQTT server.
+  this->publishMicroSteps();
+  this->publishSpeed();
+  this->publishHalfStepDelay();
+}
+
+/**
+ * Chooses the micro step and half step delay that best match a speed.
+ *
+ * \param speed The speed in millimeters per second.
+ * \param quiet_mode Whether the speed is for quiet mode.
+ * \param micro_step Where to store the chosen micro step (pin encoded).
+ * \param half_step_delay Where to store the chosen half step delay.
+ */
+void StepperMotor::chooseTiming(float speed, bool quiet_mode, uint* micro_step,
+                                uint64_t* half_step_delay) {
+  if (quiet_mode) {
+    uint64_t possible_half_step_delay =
+        MM_PER_SEC_TO_US_PER_HALF_MICROSTEP(speed, 64);
+    *micro_step = MS_64;
+    *half_step_delay =
+        MAX(possible_half_step_delay, SM_MS64_MIN_HALF_DELAY_QUIET);
   } else {
     uint64_t possible_half_step_delay;
     uint64_t chosen_half_step_delay;
@@ -340,10 +741,21 @@ void StepperMotor::setSpeed(float speed) {
       }
     }
 
-    // Set determined values.
-    this->setMicroStep(chosen_micro_step);
-    this->half_step_delay = chosen_half_step_delay;
+    *micro_step = chosen_micro_step;
+    *half_step_delay = chosen_half_step_delay;
   }
+}
+
+/**
+ * Sets the micro step and half step delay of the motor and records the speed
+ * they result in. Doesn't publish the change.
+ *
+ * \param micro_step The micro step to set (pin encoded).
+ * \param half_step_delay The half step delay to set.
+ */
+void StepperMotor::applyTiming(uint micro_step, uint64_t half_step_delay) {
+  this->applyMicroStep(micro_step);
+  this->half_step_delay = half_step_delay;
 
   // Calculate the speed based on what was actually set.
   if (this->quiet_mode)
@@ -352,10 +764,6 @@ void StepperMotor::setSpeed(float speed) {
   else
     this->speed = US_PER_HALF_MICROSTEP_TO_MM_PER_SEC(this->half_step_delay,
                                                       this->getMicroStepInt());
-
-  // Send the update to the MQTT server.
-  this->publishSpeed();
-  this->publishHalfStepDelay();
 }
 
 /**
@@ -427,6 +835,12 @@ uint64_t StepperMotor::percentageToSteps(float percentage) {
  * \param half_step_delay The half value for the total time the step will take.
  */
 void StepperMotor::stepExact(uint64_t half_step_delay) {
+  // Wake a powered down motor first.
+  if (this->powerUp()) sleep_us(MOTOR_WAKE_SETTLE_US);
+
+  // The position can't be trusted after a reboot until the steps are done.
+  this->markMoving();
+
   // Perform the step.
   gpio_put(this->pins.pulse, 1);
   sleep_us(half_step_delay);
@@ -434,7 +848,19 @@ void StepperMotor::stepExact(uint64_t half_step_delay) {
   sleep_us(half_step_delay);
 
   // Record the position change.
+  this->recordStep();
+  this->last_move_us = time_us_64();
+}
 
+/**
+ * Performs one step of the motor.
+ */
+void StepperMotor::step() { this->stepExact(this->half_step_delay); }
+
+/**
+ * Records the position change of one step in the current direction.
+ */
+void StepperMotor::recordStep() {
   // Option A:
   if (this->getDir() == CLOSE_DIR) {
     this->step_position -= SM_SMALLEST_MS / this->getMicroStepInt();
@@ -444,59 +870,144 @@ void StepperMotor::stepExact(uint64_t half_step_delay) {
   // // Option B:
   // this->step_position +=
   //     (1 - 2 * this->getDir()) * (SM_SMALLEST_MS / this->getMicroStepInt());
+}
 
-  // Feed the watchdog when stepping to prevent a timeout during long move
-  // operations.
-  watchdog_update();
+/**
+ * Gets the limit switch at the end of travel in the given direction.
+ */
+int StepperMotor::limitSwitchForDir(direction_t dir) {
+  return (dir == LEFT_DIR) ? this->pins.ls_left : this->pins.ls_right;
 }
 
+//
+//
+// **===============================================**
+// ||          <<<<< STALL DETECTION >>>>>          ||
+// **===============================================**
+
 /**
- * Performs one step of the motor.
+ * Gets whether the motor driver has reported a stall since the last call to
+ * `clearStall`.
  */
-void StepperMotor::step() { this->stepExact(this->half_step_delay); }
+bool StepperMotor::isStalled() {
+  return STALL_DETECTION && this->stall_detected;
+}
+
+/**
+ * Clears a reported stall. Called at the start of every movement.
+ */
+void StepperMotor::clearStall() {
+  this->stall_detected = false;
+  this->stall_sg = -1;
+}
 
 /**
- * Move `steps` number of steps in the provided direction.
+ * Aborts the current movement after a stall.
  *
- * @param steps The number of steps to move.
- * @param dir The direction to move in.
- * @param soft_start Whether to soft start the movement.
+ * Anything else queued is dropped as well: whatever blocked the window is
+ * likely still there and the next move would stall again.
  */
-void StepperMotor::moveSteps(uint64_t steps, direction_t dir) {
-  uint64_t steps_remaining = steps;
+void StepperMotor::handleStall() {
+  LOG_WARN("[%s] Motor stalled at step %lld.\n", this->id, this->step_position);
 
-  // Reset the stop motor command.
-  this->stop_motor = false;
+  this->action_queue.clear();
+  this->setState(State::STALLED);
+  this->publishStall();
+  this->publishPosition();
+}
 
-  // Determine which limit switch will be the edge of this direction.
-  int limit_switch = (dir == LEFT_DIR) ? LS_LEFT : LS_RIGHT;
+/**
+ * GPIO interrupt for the motor driver DIAG pin.
+ *
+ * Only flags the stall, the stepping loops check the flag before every step.
+ */
+void StepperMotor::diagIrqCb(uint gpio, uint32_t events) {
+  if (!(events & GPIO_IRQ_EDGE_RISE)) return;
 
-  // Determine if the window is opening or closing.
-  this->state = (dir == CLOSE_DIR) ? State::CLOSING : State::OPENING;
-  this->publishState();
+  for (int i = 0; i < stall_irq_motor_count; i++)
+    if (gpio == stall_irq_motors[i]->pins.diag)
+      stall_irq_motors[i]->stall_detected = true;
+}
 
-  // Change the motor direction.
-  this->setDir(dir);
+//
+//
+// **============================================**
+// ||          <<<<< CONTROL LANE >>>>>          ||
+// **============================================**
 
-  // Provide a soft start if requested.
-  if (this->soft_start_mode && !this->roll_soft_start)
-    this->softStart(&steps_remaining, SM_SOFT_START_HALF_DELAY);
+/**
+ * Requests the motor to stop and clears all queued actions.
+ *
+ * Safe to call from the MQTT callbacks. Only the actions queued so far are
+ * cleared, so actions that arrive after the stop still get performed.
+ */
+void StepperMotor::requestStop() {
+  this->action_queue.clear();
+  this->control.stop.request(true);
+}
 
-  // Move the rest of the steps at the default speed.
-  while (!this->stop_motor && steps_remaining > 0 &&
-         !LS_TRIGGERED(limit_switch)) {
-    this->step();
-    steps_remaining--;
+/**
+ * Applies the control commands requested since the last call.
+ *
+ * Called by the main loop at every step batch boundary.
+ */
+void StepperMotor::applyControl() {
+  bool stop;
+
+  if (this->control.stop.take(&stop)) this->stop_motor = true;
+
+  // A newer configuration replaces one that is still waiting to be applied.
+  if (this->control.config.take(&this->next_config))
+    this->config_pending = true;
+  if (this->config_pending && this->applyConfig(this->next_config)) {
+    this->config_pending = false;
+    LOG_INFO("[%s] Motor speed set to %f (requested speed: %f)\n", this->id,
+             this->getSpeed(), this->next_config.speed);
   }
+}
 
-  if (LS_TRIGGERED(LS_CLOSED)) this->step_position = 0;
+/**
+ * Swaps in a whole configuration from the control lane at once.
+ *
+ * A new micro step can't be set mid move without losing the step alignment, so
+ * a configuration that needs one waits until the motor is idle. Anything else
+ * takes effect from the next step.
+ *
+ * \param config The configuration to apply.
+ *
+ * \returns Whether the configuration was applied.
+ */
+bool StepperMotor::applyConfig(const action::MotorConfig& config) {
+  uint micro_step;
+  uint64_t half_step_delay;
+  this->chooseTiming(config.speed, config.quiet_mode, &micro_step,
+                     &half_step_delay);
+  if (this->isMoving() && micro_step != this->getMicroStep()) return false;
+
+  if (config.soft_start_mode != this->soft_start_mode)
+    this->roll_soft_start = false;
+  this->quiet_mode = config.quiet_mode;
+  this->soft_start_mode = config.soft_start_mode;
+  this->acceleration = MAX(config.acceleration, 1);
 
-  // Update the state of the window.
-  this->updateState();
+  // Keep the requested speed for when quiet mode gets turned off again.
+  if (this->quiet_mode) this->speed = config.speed;
+  this->applyTiming(micro_step, half_step_delay);
 
-  // Send the update to the MQTT server.
-  this->publishPosition();
-};
+  // Publish the new configuration once, as a whole.
+  this->publishSpeed();
+  this->publishQuietMode();
+  this->publishSoftStartMode();
+  this->publishAcceleration();
+  this->publishMicroSteps();
+  this->publishHalfStepDelay();
+
+  // Aligning to a coarser micro step may have taken a few steps.
+  if (!this->isMoving()) this->savePosition(false);
+  this->saveSettings();
+
+  return true;
+}
 
 //
 //
@@ -507,46 +1018,182 @@ void StepperMotor::moveSteps(uint64_t steps, direction_t dir) {
 /**
  * Sets the flag to stop the motor and clears all queued actions.
  *
- * It is up to the other functions to respect this flag.
+ * It is up to the other functions to respect this flag. To stop the motor from
+ * anywhere but the main loop, request it through the control lane instead.
  */
 void StepperMotor::stop() {
   this->stop_motor = true;
   this->action_queue.clear();
 }
 
-void StepperMotor::calibrateEndstop(direction_t dir) {
+/**
+ * Steps towards an end stop until it is found.
+ *
+ * \param ls The limit switch for the end stop.
+ * \param max_steps The most steps to take before giving up.
+ * \param use_ls Whether to stop on the limit switch. If false, only a stall
+ * will stop the search (sensorless).
+ *
+ * \returns What stopped the search.
+ */
+EndstopResult StepperMotor::seekEndstop(int ls, uint64_t max_steps,
+                                        bool use_ls) {
+  this->clearStall();
+  this->odometer.beginTravel(this->step_position, this->getMicroStepInt());
+
+  for (uint64_t i = 0; i < max_steps; i++) {
+    if ((use_ls && LS_TRIGGERED(ls)) || this->isStalled()) break;
+    this->step();
+    supervisorPoll(TASK_MOTION);
+  }
+
+  this->odometer.endTravel(this->step_position);
+
+  if (use_ls && LS_TRIGGERED(ls)) {
+    this->odometer.count(ODOMETER_LIMIT_SWITCH);
+    return EndstopResult::LIMIT_SWITCH;
+  }
+  return (this->isStalled()) ? EndstopResult::STALL : EndstopResult::NOT_FOUND;
+}
+
+/**
+ * Moves the motor onto the end stop in the given direction.
+ *
+ * The end stop is found with a fast rough pass and then a slow accurate pass.
+ * Normally the limit switch marks the end stop. If the limit switch is missing
+ * (the window stalls against the frame first) or stuck (it stays triggered
+ * after backing off), the stall itself is used as the end stop instead, if
+ * `SENSORLESS_HOMING_FALLBACK` is enabled.
+ *
+ * \param dir The direction of the end stop.
+ *
+ * \returns Whether the end stop was found. If not, the motor is left wherever
+ * the search gave up.
+ */
+bool StepperMotor::calibrateEndstop(direction_t dir) {
   // Get the limit switch for this direction.
-  int ls = (dir == LEFT_DIR) ? LS_LEFT : LS_RIGHT;
+  int ls = this->limitSwitchForDir(dir);
+  bool use_ls = true;
 
   // Set the motor to move in the desired direction.
   this->setDir(dir);
+  this->odometer.count(ODOMETER_HOMING);
 
   // Set the micro steps to the most precise.
   this->setMicroStep(MS_64);
+  uint64_t max_steps = MM_TO_MICROSTEPS(HOMING_MAX_TRAVEL_MM, SM_SMALLEST_MS);
 
   // Perform the first calibration (rough pass).
   this->setSpeed(CALIBRATION_SPEED_PRIMARY);
-  while (!LS_TRIGGERED(ls)) this->step();
+  EndstopResult result = this->seekEndstop(ls, max_steps, use_ls);
 
   // Back off from end stop.
   this->swapDir();
-  while (LS_TRIGGERED(ls)) this->step();  // Back off from limit switch.
+  switch (result) {
+    case EndstopResult::LIMIT_SWITCH: {
+      // Back off from limit switch, a switch that won't release is stuck.
+      uint64_t back_off_steps = 0;
+      this->odometer.beginTravel(this->step_position, this->getMicroStepInt());
+      while (LS_TRIGGERED(ls) &&
+             back_off_steps++ <
+                 MM_TO_MICROSTEPS(LS_STUCK_BACK_OFF_MM, SM_SMALLEST_MS)) {
+        this->step();
+        supervisorPoll(TASK_MOTION);
+      }
+      this->odometer.endTravel(this->step_position);
+
+      if (LS_TRIGGERED(ls)) {
+        LOG_WARN("[%s] Limit switch %d is stuck.\n", this->id, ls);
+        use_ls = false;
+      }
+      break;
+    }
+
+    case EndstopResult::STALL: {
+      LOG_WARN("[%s] Stalled before limit switch %d triggered.\n", this->id,
+               ls);
+      use_ls = false;
+      break;
+    }
+
+    case EndstopResult::NOT_FOUND: {
+      LOG_WARN("[%s] No end stop found within %d mm.\n", this->id,
+               HOMING_MAX_TRAVEL_MM);
+      return false;
+    }
+  }
+
+  if (!use_ls && !(STALL_DETECTION && SENSORLESS_HOMING_FALLBACK)) return false;
+
   uint current_ms = this->getMicroStepInt();
-  for (int i = 0; i < (SM_FULL_STEPS_PER_MM * current_ms * 7); i++)
+  this->odometer.beginTravel(this->step_position, current_ms);
+  for (uint64_t i = 0;
+       i < MM_TO_MICROSTEPS(CALIBRATION_BACK_OFF_MM, current_ms); i++) {
     this->step();
+    supervisorPoll(TASK_MOTION);
+  }
+  this->odometer.endTravel(this->step_position);
 
-  // Perform the second, more accurate calibration pass.
+  // Perform the second, more accurate calibration pass. StallGuard does not
+  // work at the secondary calibration speed, so a sensorless pass stays fast.
   this->setDir(dir);
-  this->setSpeed(CALIBRATION_SPEED_SECONDARY);
-  while (!LS_TRIGGERED(ls)) step();
+  this->setSpeed((use_ls) ? CALIBRATION_SPEED_SECONDARY
+                          : SENSORLESS_HOMING_SPEED);
+  result = this->seekEndstop(ls, max_steps, use_ls);
+
+  return (result != EndstopResult::NOT_FOUND);
 }
 
 /**
- * Homes the stepper motor to find the zero position.
+ * Takes over the position the motor was at before the device booted, so that
+ * a reboot doesn't move the window. This prevents cases of boot cycling and
+ * continuously opening and closing the window, which could be a security risk
+ * (for both malicious and non-malicious cases).
+ *
+ * The position is taken from the checkpoint that survives a watchdog reboot,
+ * or else from the flash journal. A motor that sits on its home switch after
+ * a watchdog reboot is known to be home too. Whichever is used, the others are
+ * discarded so that nothing can be taken over later on.
+ *
+ * Only call once at boot, before the motor first moves. Publishes nothing.
+ *
+ * \returns Whether the position is known, the motor has to be homed if not.
  */
-void StepperMotor::home() {
+bool StepperMotor::restorePosition() {
+  const char* restored_from;
+  bool homed = false;
+  if (this->restoreCheckpoint()) {
+    restored_from = "checkpoint";
+    journalDiscard(this->journal_slot);
+  } else if (this->restoreJournal()) {
+    restored_from = "journal";
+  } else if (LS_TRIGGERED(this->ls_home) && watchdog_enable_caused_reboot()) {
+    restored_from = "home switch";
+    homed = true;
+    this->step_position = 0;
+    this->updateState();
+  } else {
+    return false;
+  }
+
+  LOG_INFO("[%s] Restored position %lld from the %s.\n", this->id,
+           this->step_position, restored_from);
+  this->savePosition(homed);
+  return true;
+}
+
+/**
+ * Homes the stepper motor to find the zero position. Always searches for the
+ * end stop, see `restorePosition` for keeping the position across a reboot.
+ *
+ * \param lock_network Whether to hold the network lock while homing, so that
+ * the network doesn't interrupt the steps. Must be false on core 1, which may
+ * not take the lock while core 0 brings up the network. Without it, nothing
+ * may be published, i.e. `publish_updates` must be false.
+ */
+void StepperMotor::home(bool lock_network) {
   // Acquire the network lock so we don't get interrupted.
-  cyw43_arch_lwip_begin();
+  if (lock_network) cyw43_arch_lwip_begin();
 
   // Save current the state of the motor.
   direction_t saved_dir = this->getDir();
@@ -554,27 +1201,28 @@ void StepperMotor::home() {
   float saved_speed = this->getSpeed();
 
   // Home the motor.
-  // Only home the motor if not already at the hope position and the system was
-  // not caused by the watchdog timing out. This prevents cases of boot cycling
-  // and continuously opening and closing the window, which could be a security
-  // risk (for both malicious and non-malicious cases).
-  if (!LS_TRIGGERED(LS_HOME) || !watchdog_enable_caused_reboot())
-    this->calibrateEndstop(HOME_DIR);
+  bool homed = this->calibrateEndstop(HOME_DIR);
 
   // Update the zero position of the motor.
-  this->step_position = 0;
+  if (!homed)
+    LOG_ERROR("[%s] Homing failed, position is unknown.\n", this->id);
+  else
+    this->step_position = 0;
 
   // Restore the motor settings.
   this->setDir(saved_dir);
   this->setMicroStep(saved_ms);
   this->setSpeed(saved_speed);
 
+  // A failed homing leaves the saved position marked as mid-move.
+  if (homed) this->savePosition(true);
+
   // Send the updates to the MQTT server.
   this->publishState();
   this->publishPosition();
 
   // Release the network lock.
-  cyw43_arch_lwip_end();
+  if (lock_network) cyw43_arch_lwip_end();
 }
 
 void StepperMotor::calibrate() {
@@ -587,22 +1235,35 @@ void StepperMotor::calibrate() {
   float saved_speed = this->getSpeed();
 
   // Home and update the zero position of the motor.
-  this->calibrateEndstop(HOME_DIR);
-  this->step_position = 0;
-
-  // Calibrate the opposite side.
-  this->calibrateEndstop(!HOME_DIR);
-  this->window_open_step_position = this->step_position;
-
-  // Return to a closed position.
-  this->setSpeed(CALIBRATION_SPEED_PRIMARY);
-  this->close();
+  bool homed = this->calibrateEndstop(HOME_DIR);
+  if (homed) {
+    this->step_position = 0;
+
+    // Calibrate the opposite side.
+    if (this->calibrateEndstop(!HOME_DIR)) {
+      this->window_open_step_position = this->step_position;
+      this->saveSettings();
+    } else
+      LOG_WARN("[%s] Calibration failed, keeping the previous open position.\n",
+               this->id);
+
+    // Return to a closed position.
+    this->setSpeed(CALIBRATION_SPEED_PRIMARY);
+    this->close();
+    this->waitForMove();
+  } else {
+    LOG_ERROR("[%s] Calibration failed, could not find the home position.\n",
+              this->id);
+  }
 
   // Restore the motor settings.
   this->setDir(saved_dir);
   this->setMicroStep(saved_ms);
   this->setSpeed(saved_speed);
 
+  // A failed calibration leaves the saved position marked as mid-move.
+  if (homed) this->savePosition(true);
+
   // Send the updates to the MQTT server.
   this->publishState();
   this->publishPosition();
@@ -613,86 +1274,53 @@ void StepperMotor::calibrate() {
 }
 
 /**
- * Opens the stepper motor when controlling a window.
+ * Starts opening the window.
+ *
+ * The window opens until either:
+ * - The motor is told to stop, or
+ * - The end stop is found, or
+ * - The encoded window position in steps reaches the expected open position.
  *
- * \returns Whether the operation was successful and the motor was not told to
- * stop part way.
+ * \returns Whether the move was started.
  */
 bool StepperMotor::open() {
-  // Set the motor to move in the opening direction.
-  this->setDir(OPEN_DIR);
-
-  // Reset any call to stop the motor.
-  this->stop_motor = false;
-
-  // Set the current state.
-  this->setState(State::OPENING);
-
-  // Move the motor in the open direction until either:
-  // - The motor is told to stop, or
-  // - The end stop is found, or
-  // - The encoded window position in steps reaches the expected open position.
-  this->softStart(NULL, SM_SOFT_START_HALF_DELAY);
-  while (!this->stop_motor && !LS_TRIGGERED(LS_OPEN) &&
-         this->step_position < this->window_open_step_position)
-    this->step();
-
-  // Update the motor state.
-  if (LS_TRIGGERED(LS_OPEN)) {
-    this->window_open_step_position = this->step_position;
-    publishFullOpenPosition();
-  }
-  this->updateState();
-  this->publishPosition();
-
-  // Return true if the motor successfully opened the window and was not called
-  // to stop.
-  return !this->stop_motor;
+  return this->startMove(MoveType::OPEN, OPEN_DIR, 0);
 }
 
 /**
- * Closes the stepper motor when controlling a window.
+ * Starts closing the window.
+ *
+ * The window closes until either:
+ * - The motor is told to stop, or
+ * - The end stop is found, or
+ * - The encoded window position in steps reaches the expected closed position.
  *
- * \returns Whether the operation was successful and the motor was not told to
- * stop part way.
+ * \returns Whether the move was started.
  */
 bool StepperMotor::close() {
-  // Set the motor to move in the closing direction.
-  this->setDir(CLOSE_DIR);
-
-  // Reset any call to stop the motor.
-  this->stop_motor = false;
-
-  // Set the current state.
-  this->setState(State::CLOSING);
-
-  // Move the motor in the close direction until either:
-  // - The motor is told to stop, or
-  // - The end stop is found, or
-  // - The encoded window position in steps reaches the expected closed
-  //   position.
-  this->softStart(NULL, SM_SOFT_START_HALF_DELAY);
-  while (!this->stop_motor && !LS_TRIGGERED(LS_CLOSED) &&
-         this->step_position > WINDOW_CLOSED_STEP_POSITION)
-    this->step();
-
-  // Update the motor state.
-  if (LS_TRIGGERED(LS_CLOSED))
-    this->step_position = WINDOW_CLOSED_STEP_POSITION;
-  this->updateState();
-  this->publishPosition();
+  return this->startMove(MoveType::CLOSE, CLOSE_DIR, 0);
+}
 
-  // Return true if the motor successfully closed the window and was not called
-  // to stop.
-  return !this->stop_motor;
+/**
+ * Starts moving `steps` number of steps in the provided direction.
+ *
+ * @param steps The number of steps to move.
+ * @param dir The direction to move in.
+ *
+ * \returns Whether the move was started.
+ */
+bool StepperMotor::moveSteps(uint64_t steps, direction_t dir) {
+  return this->startMove(MoveType::STEPS, dir, steps);
 }
 
 /**
- * Moves the window to an absolute position in steps.
+ * Starts moving the window to an absolute position in steps.
  *
  * @param step The absolute step position to move the motor to.
+ *
+ * \returns Whether the move was started.
  */
-void StepperMotor::moveToPosition(uint64_t step) {
+bool StepperMotor::moveToPosition(uint64_t step) {
   uint64_t current_step_position = this->getPosition();
 
   // Determine the number of steps required to make up the difference between
@@ -709,105 +1337,335 @@ void StepperMotor::moveToPosition(uint64_t step) {
   }
 
   // Move the steps to move to the desired position.
-  this->moveSteps(step_delta, dir);
+  return this->moveSteps(step_delta, dir);
+};
 
-  // If the next action is the same action in the same direction,
-  // inform it that it doesn't need to perform another soft start.
-  if (this->action_queue.isEmpty()) {
-    this->roll_soft_start = false;
+/**
+ * Starts moving the window open to a certain percentage.
+ *
+ * @param percent The open percentage to set the window to.
+ *
+ * \returns Whether the move was started.
+ */
+bool StepperMotor::moveToPositionPercentage(float percent) {
+  // Clamp and convert the percentage to the equivalent position in steps.
+  uint64_t step_position = this->percentageToSteps(CLAMP(0.0, percent, 100.0));
+
+  // Move to that position.
+  return this->moveToPosition(step_position);
+};
+
+/**
+ * Holds the motor still for a while, as if it were moving.
+ *
+ * Lets a sequence of queued actions pause between moves without blocking the
+ * main loop. A stop ends the dwell early.
+ *
+ * \param duration_us How long to dwell for, in micro seconds.
+ *
+ * \returns Whether the dwell was started.
+ */
+bool StepperMotor::dwell(uint64_t duration_us) {
+  if (this->move.active) return false;
+
+  this->stop_motor = false;
+
+  this->move.type = MoveType::DWELL;
+  this->move.pulse_high = false;
+  this->move.ramping = false;
+  this->move.next_edge_us = time_us_64() + duration_us;
+  this->move.active = true;
+
+  return true;
+}
+
+//
+//
+// **======================================**
+// ||          <<<<< MOTION >>>>>          ||
+// **======================================**
+/*
+ * Moves are not performed in one go. Starting a move only records what the
+ * move is, and every call to `serviceMotion` then performs at most one edge of
+ * the step pulse once it is due. This lets the `MotionScheduler` interleave the
+ * steps of several motors so they can all move at once, at full speed.
+ */
+
+/**
+ * Gets whether the motor is in the middle of a move.
+ */
+bool StepperMotor::isMoving() { return this->move.active; }
+
+/**
+ * Gets whether the motor is soft starting, where every edge sets the speed of
+ * the ramp and a late one is felt most.
+ */
+bool StepperMotor::isRamping() {
+  return this->move.active && this->move.ramping;
+}
+
+/**
+ * Sets up a new move. The move is performed by `serviceMotion`.
+ *
+ * \param type What ends the move.
+ * \param dir The direction to move in.
+ * \param steps The number of steps to move for `MoveType::STEPS`.
+ *
+ * \returns Whether the move was started. A move can't start while another is
+ * still in progress.
+ */
+bool StepperMotor::startMove(MoveType type, direction_t dir, uint64_t steps) {
+  if (this->move.active) return false;
+
+  // Reset any call to stop the motor.
+  this->stop_motor = false;
+  this->clearStall();
+
+  // Change the motor direction.
+  this->setDir(dir);
+
+  this->move.type = type;
+  this->move.dir = dir;
+  this->move.limit_switch = this->limitSwitchForDir(dir);
+  this->move.steps_remaining = steps;
+  this->move.pulse_high = false;
+  this->move.next_edge_us = time_us_64();
+  this->move.edge_interval_us = 0;
+  this->move.jitter.reset();
+  this->move.from_closed = (this->state == State::CLOSED);
+  this->odometer.beginTravel(this->step_position, this->getMicroStepInt());
+
+  // Wake a powered down motor and hold off the first step until its coils are
+  // energized.
+  if (this->powerUp()) this->move.next_edge_us += MOTOR_WAKE_SETTLE_US;
+
+  this->markMoving();
+
+  // Provide a soft start if requested. The ramp starts slow and speeds up to
+  // the set speed, so there is nothing to ramp if the set speed is slower.
+  this->move.ramping = this->soft_start_mode && !this->roll_soft_start &&
+                       SM_SOFT_START_HALF_DELAY > this->half_step_delay;
+  this->move.ramp_half_step_delay = SM_SOFT_START_HALF_DELAY;
+  this->move.ramp_level_steps = (uint64_t)ceil(SM_SOFT_START_SKEW_FACTOR);
+
+  this->move.active = true;
+
+  TRACE(TRACE_CAT_MOTION, TRACE_MOVE_START, this->trace_index,
+        (uint16_t)type | (uint16_t)dir << 8);
+  if (this->move.ramping)
+    TRACE(TRACE_CAT_RAMP, TRACE_RAMP_START, this->trace_index,
+          this->move.ramp_half_step_delay);
+
+  // Determine if the window is opening or closing.
+  this->setState((dir == CLOSE_DIR) ? State::CLOSING : State::OPENING);
+
+  return true;
+}
+
+/**
+ * Gets whether the active move should end before taking another step.
+ */
+bool StepperMotor::moveShouldEnd() {
+  // Sample the StallGuard result while the motor is still at its last step,
+  // it means nothing once the move is aborted and the motor stands still.
+  if (this->isStalled()) {
+    this->stall_sg = this->driver.getStallGuardResult(this->getMicroStep());
+    return true;
+  }
+
+  // A requested stop ends the move right away, before the control lane gets
+  // applied.
+  if (this->stop_motor || this->control.stop.isPending()) return true;
+
+  if (LS_TRIGGERED(this->move.limit_switch)) {
+    TRACE(TRACE_CAT_SWITCH, TRACE_LIMIT_SWITCH, this->trace_index,
+          this->move.limit_switch);
+    return true;
+  }
+
+  switch (this->move.type) {
+    case MoveType::STEPS:
+      return (this->move.steps_remaining == 0);
+    case MoveType::OPEN:
+      return (this->step_position >= this->window_open_step_position);
+    case MoveType::CLOSE:
+      return (this->step_position <= WINDOW_CLOSED_STEP_POSITION);
+    case MoveType::DWELL:
+      break;
+  }
+
+  return true;
+}
+
+/**
+ * Advances the soft start ramp by one step.
+ *
+ * The ramp holds each speed for more steps the faster it gets, then increases
+ * the speed until the set speed is reached.
+ */
+void StepperMotor::advanceRamp() {
+  if (--this->move.ramp_level_steps > 0) return;
+
+  if (this->move.ramp_half_step_delay <=
+      this->half_step_delay + this->acceleration) {
+    this->move.ramping = false;
+    TRACE(TRACE_CAT_RAMP, TRACE_RAMP_END, this->trace_index,
+          this->half_step_delay);
+    return;
+  }
+
+  this->move.ramp_half_step_delay -= this->acceleration;
+  TRACE(TRACE_CAT_RAMP, TRACE_RAMP_LEVEL, this->trace_index,
+        this->move.ramp_half_step_delay);
+  this->move.ramp_level_steps = (uint64_t)ceil(
+      (SM_SOFT_START_HALF_DELAY - this->move.ramp_half_step_delay + 1) *
+      SM_SOFT_START_SKEW_FACTOR);
+}
+
+/**
+ * Performs the next pulse edge of the active move if it is due.
+ *
+ * Whether the move should end is checked before each step is started, so a
+ * stop, stall or limit switch ends the move within one step.
+ *
+ * \param now_us The current time in micro seconds since boot.
+ *
+ * \returns The time the next edge is due, or `SM_NO_EDGE` if the motor is not
+ * moving.
+ */
+uint64_t StepperMotor::serviceMotion(uint64_t now_us) {
+  if (!this->move.active) return SM_NO_EDGE;
+
+  // A dwell has no edges, it only needs to end once it is over or stopped.
+  // Neither the position nor the state change, so there is nothing to finish.
+  if (this->move.type == MoveType::DWELL) {
+    if (now_us < this->move.next_edge_us && !this->stop_motor &&
+        !this->control.stop.isPending())
+      return this->move.next_edge_us;
+
+    this->move.active = false;
+    return SM_NO_EDGE;
+  }
+
+  if (now_us < this->move.next_edge_us) return this->move.next_edge_us;
+
+  if (!this->move.pulse_high && this->moveShouldEnd()) {
+    this->finishMove();
+    return SM_NO_EDGE;
+  }
+
+  // Measure how late the edge is against when it was due. The first edge of a
+  // move has nothing to be late against.
+  if (this->move.edge_interval_us != 0)
+    this->move.jitter.record(time_us_32() - (uint32_t)this->move.next_edge_us,
+                             this->move.edge_interval_us);
+  else
+    this->latency.markFirstEdge(time_us_32());
+
+  if (!this->move.pulse_high) {
+    gpio_put(this->pins.pulse, 1);
+    this->move.pulse_high = true;
   } else {
-    action::Action* next_action = this->action_queue.peek();
+    gpio_put(this->pins.pulse, 0);
+    this->move.pulse_high = false;
+
+    this->recordStep();
+    if (this->move.steps_remaining > 0) this->move.steps_remaining--;
+    if (this->move.ramping) this->advanceRamp();
+  }
 
-    switch (next_action->action_type) {
+  // Time the next edge from this one rather than from when it was due, a late
+  // edge must not be made up for with a shorter step.
+  this->move.edge_interval_us = (this->move.ramping)
+                                    ? this->move.ramp_half_step_delay
+                                    : this->half_step_delay;
+  this->move.next_edge_us = now_us + this->move.edge_interval_us;
+  return this->move.next_edge_us;
+}
+
+/**
+ * Ends the active move and updates the state of the window.
+ */
+void StepperMotor::finishMove() {
+  this->move.active = false;
+  this->last_move_us = time_us_64();
+  TRACE(TRACE_CAT_MOTION, TRACE_MOVE_END, this->trace_index,
+        this->step_position);
+
+  if (this->move.jitter.getEdges() > 0) this->publishStepJitter();
+  if (this->latency.finish(time_us_32())) this->publishCommandLatency();
+
+  // Count what the move did, before a limit switch corrects the position.
+  if (this->odometer.endTravel(this->step_position) > 0)
+    this->odometer.count(ODOMETER_MOVE);
+  if (this->stop_motor || this->control.stop.isPending())
+    this->odometer.count(ODOMETER_STOP);
+  if (this->isStalled()) this->odometer.count(ODOMETER_STALL);
+  if (LS_TRIGGERED(this->move.limit_switch))
+    this->odometer.count(ODOMETER_LIMIT_SWITCH);
+
+  // A stall aborts the move.
+  if (this->isStalled()) {
+    this->roll_soft_start = false;
+    this->handleStall();
+    this->savePosition(false);
+    return;
+  }
+
+  // The limit switches are the ground truth for the ends of the window.
+  if (LS_TRIGGERED(this->ls_closed))
+    this->step_position = WINDOW_CLOSED_STEP_POSITION;
+  if (this->move.type == MoveType::OPEN && LS_TRIGGERED(this->ls_open)) {
+    this->window_open_step_position = this->step_position;
+    this->publishFullOpenPosition();
+    this->saveSettings();
+  }
+
+  // If the next action is a move in the same direction, inform it that it
+  // doesn't need to perform another soft start.
+  this->roll_soft_start = false;
+  action::Action next_action;
+  if (this->move.type == MoveType::STEPS && !this->stop_motor &&
+      !this->control.stop.isPending() &&
+      this->action_queue.peek(&next_action)) {
+    switch (next_action.action_type) {
       case action::ActionType::MOVE_TO_STEP:
         this->roll_soft_start =
-            ((next_action->data.step > this->getPosition()) ^
-             (dir == CLOSE_DIR));
+            ((next_action.data.step > this->getPosition()) ^
+             (this->move.dir == CLOSE_DIR));
         break;
 
       case action::ActionType::MOVE_TO_PERCENT:
         this->roll_soft_start =
-            ((next_action->data.percent > this->getPositionPercentageExact()) ^
-             (dir == CLOSE_DIR));
+            ((next_action.data.percent > this->getPositionPercentageExact()) ^
+             (this->move.dir == CLOSE_DIR));
         break;
 
       default:
-        this->roll_soft_start = false;
         break;
     }
   }
 
   // Update state and publish position.
   this->updateState();
+  if (this->state == State::CLOSED && !this->move.from_closed)
+    this->odometer.count(ODOMETER_CYCLE);
   this->publishPosition();
-};
+  this->savePosition(false);
+}
 
 /**
- * Moves the window open to a certain percentage.
+ * Performs the active move to completion before returning.
  *
- * @param percent The open percentage to set the window to.
+ * Only this motor is serviced, for use where blocking is expected anyway such
+ * as during calibration.
  */
-void StepperMotor::moveToPositionPercentage(float percent) {
-  // Clamp and convert the percentage to the equivalent position in steps.
-  uint64_t step_position = this->percentageToSteps(CLAMP(0.0, percent, 100.0));
-
-  // Move to that position.
-  this->moveToPosition(step_position);
-};
-
-/**
- * Starts the motor moving softly.
- *
- * Starts the speed slow and ramps it up.
- *
- * @param steps_remaining A pointer to the number of steps remaining for this
- * move. Will not go past this many steps, even if the number of steps is too
- * few to complete the soft start. The value will be decremented to keep steps
- * aligned with the caller. If NULL, then will be ignored.
- * @param initial_speed_half_step_delay The half step delay in micro seconds for
- * the initial step of the soft start. The speed will be increased from here.
- */
-void StepperMotor::softStart(uint64_t* steps_remaining,
-                             uint64_t initial_speed_half_step_delay) {
-  // Get the bounding limit switch for the current direction.
-  int ls = (this->getDir() == LEFT_DIR) ? LS_LEFT : LS_RIGHT;
-
-  uint64_t full_speed_hs_delay = this->getHalfStepDelay();
-  uint64_t current_speed_hs_delay = SM_SOFT_START_HALF_DELAY;
-
-  if (steps_remaining == NULL) {
-    while (current_speed_hs_delay > full_speed_hs_delay && !LS_TRIGGERED(ls) &&
-           !this->stop_motor) {
-      for (uint64_t j = (uint64_t)ceil(
-               (SM_SOFT_START_HALF_DELAY - current_speed_hs_delay + 1) *
-               SM_SOFT_START_SKEW_FACTOR);
-           j > 0; j--) {
-        if (!LS_TRIGGERED(ls))
-          this->stepExact(current_speed_hs_delay);
-        else
-          break;
-      }
-
-      current_speed_hs_delay -= SM_SOFT_START_INCREASE_FACTOR;
-    }
-  } else {
-    while (*steps_remaining > 0 &&
-           current_speed_hs_delay >= full_speed_hs_delay && !LS_TRIGGERED(ls) &&
-           !this->stop_motor) {
-      for (uint64_t j = (uint64_t)ceil(
-               (SM_SOFT_START_HALF_DELAY - current_speed_hs_delay + 1) *
-               SM_SOFT_START_SKEW_FACTOR);
-           j > 0; j--) {
-        if (*steps_remaining > 0 && !LS_TRIGGERED(ls)) {
-          this->stepExact(current_speed_hs_delay);
-          (*steps_remaining)--;
-        } else {
-          break;
-        }
-      }
-
-      current_speed_hs_delay -= SM_SOFT_START_INCREASE_FACTOR;
-    }
+void StepperMotor::waitForMove() {
+  uint64_t next_edge_us;
+  while ((next_edge_us = this->serviceMotion(time_us_64())) != SM_NO_EDGE) {
+    // Keep the watchdog fed during long moves.
+    supervisorPoll(TASK_MOTION);
+    while (time_us_64() < next_edge_us) tight_loop_contents();
   }
 }
 
@@ -847,9 +1705,9 @@ void StepperMotor::setState(State state) {
 
 void StepperMotor::updateState() {
   // Update the state of the window
-  this->setState((LS_TRIGGERED(LS_OPEN))     ? State::OPEN
-                 : (LS_TRIGGERED(LS_CLOSED)) ? State::CLOSED
-                                             : State::STOPPED);
+  this->setState((LS_TRIGGERED(this->ls_open))     ? State::OPEN
+                 : (LS_TRIGGERED(this->ls_closed)) ? State::CLOSED
+                                                   : State::STOPPED);
 }
 
 //
@@ -860,29 +1718,46 @@ void StepperMotor::updateState() {
 
 /* Called when publish is complete either with success or failure */
 static void stepper_motor::mqttPubRequestCb(void* arg, err_t result) {
+  TRACE_LWIP_SCOPE(TRACE_CB_PUBLISH_REQUEST);
+  TRACE(TRACE_CAT_PUBLISH, TRACE_PUBLISH_RESULT, 0, result);
+
   if (result != ERR_OK) {
-    printf("Publish result: %d\n", result);
-    gpio_put(BLUE_LED_PIN, 1);
-    for (int i = 0; i < 3; i++) {
-      gpio_put(RED_LED_PIN, 1);
-      sleep_ms(150);
-      gpio_put(RED_LED_PIN, 0);
-      sleep_ms(100);
-    }
-    gpio_put(BLUE_LED_PIN, 0);
+    LOG_ERROR("Publish result: %d\n", result);
+    ledPlay(&LED_CODE_PUB_ERR);
   }
 }
 
-bool StepperMotor::basicMqttPublish(const char* topic, const char* payload,
+/**
+ * Publishes to one of the topics of this motor.
+ *
+ * \param subtopic The topic to publish to, relative to the motor's topic base.
+ */
+bool StepperMotor::basicMqttPublish(const char* subtopic, const char* payload,
                                     u8_t qos, u8_t retain) {
+  return this->basicMqttPublish(subtopic, payload, strlen(payload), qos,
+                                retain);
+}
+
+/**
+ * Publishes a binary payload to one of the topics of this motor.
+ *
+ * \param subtopic The topic to publish to, relative to the motor's topic base.
+ * \param len The length of the payload in bytes.
+ */
+bool StepperMotor::basicMqttPublish(const char* subtopic, const void* payload,
+                                    u16_t len, u8_t qos, u8_t retain) {
   if (this->publish_updates) {
+    char topic[SM_MQTT_TOPIC_MAX_LEN];
+    snprintf(topic, sizeof(topic), "%s%s", this->topic_base, subtopic);
+
     err_t err;
     cyw43_arch_lwip_begin();
-    err = mqtt_publish(this->mqtt_client, topic, payload, strlen(payload), qos,
-                       retain, mqttPubRequestCb, NULL);
+    err = mqtt_publish(this->mqtt_client, topic, payload, len, qos, retain,
+                       mqttPubRequestCb, NULL);
     cyw43_arch_lwip_end();
+    TRACE(TRACE_CAT_PUBLISH, TRACE_PUBLISH_QUEUED, this->trace_index, err);
     if (err != ERR_OK) {
-      printf("Publish err: %d\n", err);
+      LOG_ERROR("Publish err: %d\n", err);
       return false;
     }
   }
@@ -900,24 +1775,32 @@ void StepperMotor::publishSpeed() {
   if (this->mqtt_client != NULL) {
     char buf[16];
     sprintf(buf, "%.2f", this->getSpeed());
-    basicMqttPublish(MQTT_TOPIC_STATE_SPEED, buf, 1, 0);
+    basicMqttPublish(MQTT_SUBTOPIC_STATE_SPEED, buf, 1, 0);
   }
 }
 
 void StepperMotor::publishQuietMode() {
   if (this->mqtt_client != NULL) {
-    basicMqttPublish(MQTT_TOPIC_STATE_QUIET,
+    basicMqttPublish(MQTT_SUBTOPIC_STATE_QUIET,
                      (this->getQuietMode()) ? "ON" : "OFF", 1, 0);
   }
 }
 
 void StepperMotor::publishSoftStartMode() {
   if (this->mqtt_client != NULL) {
-    basicMqttPublish(MQTT_TOPIC_STATE_SOFT_START,
+    basicMqttPublish(MQTT_SUBTOPIC_STATE_SOFT_START,
                      (this->getSoftStartMode()) ? "ON" : "OFF", 1, 0);
   }
 }
 
+void StepperMotor::publishAcceleration() {
+  if (this->mqtt_client != NULL) {
+    char buf[16];
+    sprintf(buf, "%u", this->getAcceleration());
+    basicMqttPublish(MQTT_SUBTOPIC_STATE_ACCELERATION, buf, 1, 0);
+  }
+}
+
 void StepperMotor::publishPosition() {
   if (this->mqtt_client != NULL) {
     char buf[64];
@@ -928,7 +1811,7 @@ void StepperMotor::publishPosition() {
 #else
       sprintf(buf, "%d", this->getPositionPercentage());
 #endif
-      basicMqttPublish(MQTT_TOPIC_STATE_POSITION_PERCENT, buf, 1, 0);
+      basicMqttPublish(MQTT_SUBTOPIC_STATE_POSITION_PERCENT, buf, 1, 0);
     }
 
     // ----- STEPS POSITION -----
@@ -938,7 +1821,7 @@ void StepperMotor::publishPosition() {
 #else
       sprintf(buf, "%lld", this->getPosition());
 #endif
-      basicMqttPublish(MQTT_TOPIC_STATE_POSITION_STEPS, buf, 1, 0);
+      basicMqttPublish(MQTT_SUBTOPIC_STATE_POSITION_STEPS, buf, 1, 0);
     }
 
     // ----- MM POSITION -----
@@ -952,7 +1835,7 @@ void StepperMotor::publishPosition() {
               ((double)this->getPosition() /
                (SM_FULL_STEPS_PER_MM * SM_SMALLEST_MS)));
 #endif
-      basicMqttPublish(MQTT_TOPIC_STATE_POSITION_MM, buf, 1, 0);
+      basicMqttPublish(MQTT_SUBTOPIC_STATE_POSITION_MM, buf, 1, 0);
     }
   }
 }
@@ -973,11 +1856,14 @@ void StepperMotor::publishState() {
       case stepper_motor::State::CLOSING:
         payload = (char*)"closing";
         break;
+      // Home Assistant covers have no stalled state, the stall itself is
+      // reported on its own topic.
       case stepper_motor::State::STOPPED:
+      case stepper_motor::State::STALLED:
         payload = (char*)"stopped";
         break;
     }
-    basicMqttPublish(MQTT_TOPIC_STATE_GENERAL, payload, 1, 0);
+    basicMqttPublish(MQTT_SUBTOPIC_STATE_GENERAL, payload, 1, 0);
   }
 }
 
@@ -985,7 +1871,7 @@ void StepperMotor::publishMicroSteps() {
   if (this->mqtt_client != NULL) {
     char buf[4];
     sprintf(buf, "%d", this->getMicroStepInt());
-    basicMqttPublish(MQTT_TOPIC_SENSOR_MICRO_STEPS, buf, 1, 0);
+    basicMqttPublish(MQTT_SUBTOPIC_SENSOR_MICRO_STEPS, buf, 1, 0);
   }
 }
 
@@ -993,7 +1879,7 @@ void StepperMotor::publishHalfStepDelay() {
   if (this->mqtt_client != NULL) {
     char buf[16];
     sprintf(buf, "%llu", this->getHalfStepDelay());
-    basicMqttPublish(MQTT_TOPIC_SENSOR_HALF_STEP_DELAY, buf, 1, 0);
+    basicMqttPublish(MQTT_SUBTOPIC_SENSOR_HALF_STEP_DELAY, buf, 1, 0);
   }
 }
 
@@ -1003,7 +1889,65 @@ void StepperMotor::publishFullOpenPosition() {
     sprintf(buf, "%0.1f",
             ((double)this->window_open_step_position /
              (SM_FULL_STEPS_PER_MM * SM_SMALLEST_MS)));
-    basicMqttPublish(MQTT_TOPIC_SENSOR_FULL_OPEN_MEASUREMENT, buf, 1, 0);
+    basicMqttPublish(MQTT_SUBTOPIC_SENSOR_FULL_OPEN_MEASUREMENT, buf, 1, 0);
+  }
+}
+
+void StepperMotor::publishStall() {
+  if (this->mqtt_client != NULL) {
+    char buf[64];
+    sprintf(buf, "{\"pos\":%lld,\"sg\":%d}", this->step_position,
+            this->stall_sg);
+    basicMqttPublish(MQTT_SUBTOPIC_SENSOR_STALL, buf, 1, 0);
+  }
+}
+
+/**
+ * Reports an action that could not be queued, e.g. because the queue was full.
+ */
+void StepperMotor::publishRejectedAction(action::ActionType action_type) {
+  if (this->mqtt_client != NULL) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "{\"action\":\"%s\",\"queued\":%d}",
+             action::getActionTypeName(action_type),
+             this->action_queue.getCount());
+    basicMqttPublish(MQTT_SUBTOPIC_SENSOR_REJECTED_COMMAND, buf, 1, 0);
+  }
+}
+
+/**
+ * Reports how late the pulse edges of the last move came, see
+ * `JitterHistogram::format`.
+ */
+void StepperMotor::publishStepJitter() {
+  if (this->mqtt_client != NULL) {
+    char buf[256];
+    this->move.jitter.format(buf, sizeof(buf));
+    basicMqttPublish(MQTT_SUBTOPIC_SENSOR_STEP_JITTER, buf, 0, 0);
+  }
+}
+
+/**
+ * Reports the latencies of the commands that moved the window through each
+ * stage, see `CommandLatency::format`.
+ */
+void StepperMotor::publishCommandLatency() {
+  if (this->mqtt_client != NULL) {
+    char buf[384];
+    this->latency.format(buf, sizeof(buf));
+    basicMqttPublish(MQTT_SUBTOPIC_SENSOR_COMMAND_LATENCY, buf, 0, 0);
+  }
+}
+
+/**
+ * Reports how much the motor has worked over its lifetime, see
+ * `Odometer::format`.
+ */
+void StepperMotor::publishOdometer() {
+  if (this->mqtt_client != NULL) {
+    char buf[256];
+    this->odometer.format(buf, sizeof(buf));
+    basicMqttPublish(MQTT_SUBTOPIC_SENSOR_ODOMETER, buf, 1, 0);
   }
 }
 
@@ -1011,6 +1955,7 @@ void StepperMotor::publishAll() {
   this->publishSpeed();
   this->publishQuietMode();
   this->publishSoftStartMode();
+  this->publishAcceleration();
   this->publishPosition();
   this->publishState();
   this->publishMicroSteps();
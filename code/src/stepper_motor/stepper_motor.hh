@@ -7,6 +7,13 @@
 #include <common.hh>
 
 #include "action_queue.hh"
+#include "checkpoint.hh"
+#include "command_latency.hh"
+#include "control_lane.hh"
+#include "jitter_histogram.hh"
+#include "journal.hh"
+#include "odometer.hh"
+#include "tmc2209.hh"
 
 typedef u8_t micro_step_t;
 
@@ -46,13 +53,62 @@ typedef u8_t micro_step_t;
 #define SM_SOFT_START_INCREASE_FACTOR 11
 #define SM_SOFT_START_SKEW_FACTOR 2.9
 
+// **===============================================**
+// ||          <<<<< MULTIPLE MOTORS >>>>>          ||
+// **===============================================**
+
+// Maximum number of stepper motors that can be driven at once.
+#define SM_MAX_MOTORS 4
+
+// Longest MQTT topic a motor publishes to, including its topic base.
+#define SM_MQTT_TOPIC_MAX_LEN 64
+
+// Returned by `serviceMotion` when the motor has no pulse edge scheduled.
+#define SM_NO_EDGE UINT64_MAX
+
 // **=============================================**
 // ||          <<<<< STEPPER MOTOR >>>>>          ||
 // **=============================================**
 
 namespace stepper_motor {
 
-enum class State { OPEN, OPENING, CLOSED, CLOSING, STOPPED };
+enum class State { OPEN, OPENING, CLOSED, CLOSING, STOPPED, STALLED };
+
+/** What ended a search for an end stop. */
+enum class EndstopResult { LIMIT_SWITCH, STALL, NOT_FOUND };
+
+/**
+ * What ends a move, besides a stop, a stall or a limit switch. A dwell holds
+ * the motor still until its time is up and is only ended early by a stop.
+ */
+enum class MoveType { STEPS, OPEN, CLOSE, DWELL };
+
+/**
+ * The state of a move in progress.
+ *
+ * Moves are performed one pulse edge at a time by `serviceMotion` so that the
+ * steps of several motors can be interleaved.
+ */
+struct Move {
+  bool active;
+  MoveType type;
+  direction_t dir;
+  int limit_switch;
+  uint64_t steps_remaining;  // Only used by `MoveType::STEPS`.
+  bool pulse_high;
+  uint64_t next_edge_us;  // When a dwell ends, for `MoveType::DWELL`.
+
+  bool from_closed;  // Whether the window was closed when the move started.
+
+  // --- Edge Timing ---
+  uint32_t edge_interval_us;  // Commanded before the next edge, 0 for none.
+  JitterHistogram jitter;
+
+  // --- Soft Start Ramp ---
+  bool ramping;
+  uint64_t ramp_half_step_delay;
+  uint64_t ramp_level_steps;  // Steps left at the current ramp speed.
+};
 
 struct StepperMotorPins {
   uint enable;
@@ -60,23 +116,38 @@ struct StepperMotorPins {
   uint pulse;
   uint ms1;
   uint ms2;
+  uint diag;
+  uint ls_left;
+  uint ls_right;
 };
 
 class StepperMotor {
  public:
-  StepperMotor(uint enable_pin, uint direction_pin, uint pulse_pin,
-               uint micro_step_1_pin, uint micro_step_2_pin,
-               uint initial_micro_step, float initial_speed,
-               mqtt_client_t* mqtt_client);
+  StepperMotor(const char* id, const char* topic_base,
+               struct StepperMotorPins pins, uart_inst_t* uart,
+               uint uart_tx_pin, uint uart_rx_pin, uint initial_micro_step,
+               float initial_speed, mqtt_client_t* mqtt_client);
 
   // --- Parameters ---
   bool publish_updates;
-  action::ActionQueue action_queue;
+  action::ActionQueue action_queue;  // Motion lane.
+  action::ControlLane control;       // Control lane.
+  CommandLatency latency;            // Of the commands that moved the window.
+
+  // --- Identity ---
+  const char* getId();
+  const char* getTopicBase();
 
   // --- Basic ---
   void enable();
   void disable();
 
+  // --- Power ---
+  bool isPoweredDown();
+  void powerDown();
+  bool powerUp();
+  void serviceIdle(uint64_t now_us);
+
   // --- Direction ---
   direction_t getDir();
   void setDir(direction_t dir);
@@ -101,6 +172,10 @@ class StepperMotor {
 
   uint64_t getHalfStepDelay();
 
+  // --- Acceleration ---
+  uint getAcceleration();
+  void setAcceleration(uint acceleration);
+
   // --- Position ---
   uint64_t getPosition();
   int getPositionPercentage();
@@ -113,23 +188,38 @@ class StepperMotor {
   void stepExact(uint64_t half_step_delay);
   void step();
 
-  void moveSteps(uint64_t steps, direction_t dir);
+  bool moveSteps(uint64_t steps, direction_t dir);
+
+  // --- Stall Detection ---
+  bool isStalled();
+  void clearStall();
+
+  // --- Control Lane ---
+  void requestStop();
+  void applyControl();
 
   // --- Movement ---
   void stop();
 
-  void calibrateEndstop(direction_t dir);
-  void home();
+  EndstopResult seekEndstop(int ls, uint64_t max_steps, bool use_ls);
+  bool calibrateEndstop(direction_t dir);
+  bool restorePosition();
+  void home(bool lock_network = true);
   void calibrate();
 
   bool open();
   bool close();
 
-  void moveToPosition(uint64_t step);
-  void moveToPositionPercentage(float percent);
+  bool moveToPosition(uint64_t step);
+  bool moveToPositionPercentage(float percent);
+
+  bool dwell(uint64_t duration_us);
 
-  void softStart(uint64_t* steps_remaining,
-                 uint64_t initial_speed_half_step_delay);
+  // --- Motion ---
+  bool isMoving();
+  bool isRamping();
+  uint64_t serviceMotion(uint64_t now_us);
+  void waitForMove();
 
   // --- Action Queueing ---
   bool hasQueuedActions();
@@ -140,24 +230,40 @@ class StepperMotor {
   void updateState();
 
   // --- MQTT ---
-  bool basicMqttPublish(const char* topic, const char* payload, u8_t qos,
+  bool basicMqttPublish(const char* subtopic, const char* payload, u8_t qos,
                         u8_t retain);
+  bool basicMqttPublish(const char* subtopic, const void* payload, u16_t len,
+                        u8_t qos, u8_t retain);
 
   void publishSpeed();
   void publishQuietMode();
   void publishSoftStartMode();
+  void publishAcceleration();
   void publishPosition();
   void publishState();
   void publishMicroSteps();
   void publishHalfStepDelay();
   void publishFullOpenPosition();
+  void publishStall();
+  void publishRejectedAction(action::ActionType action_type);
+  void publishStepJitter();
+  void publishCommandLatency();
+  void publishOdometer();
   void publishAll();
 
  private:
+  const char* id;
+  const char* topic_base;
+  uint8_t trace_index;
   State state;
   struct StepperMotorPins pins;
+  int ls_home;
+  int ls_open;
+  int ls_closed;
+  struct Move move;
   bool quiet_mode;
   bool soft_start_mode;
+  uint acceleration;
   bool roll_soft_start;
   bool stop_motor;
   int64_t step_position;
@@ -166,6 +272,44 @@ class StepperMotor {
   float speed;
   float quiet_speed;
   mqtt_client_t* mqtt_client;
+  TMC2209 driver;
+  volatile bool stall_detected;
+  int stall_sg;  // SG_RESULT when the stall ended the move, -1 if unknown.
+  action::MotorConfig next_config;  // Taken from the control lane.
+  bool config_pending;              // Whether `next_config` is still to apply.
+  bool powered_down;
+  uint64_t last_move_us;  // When the motor last stepped.
+  int checkpoint_slot;
+  int journal_slot;
+  Odometer odometer;
+
+  void markMoving();
+  void savePosition(bool homed);
+  bool restoreCheckpoint();
+  bool restoreJournal();
+
+  bool loadSettings(float* speed);
+  void saveSettings();
+
+  void loadOdometer();
+  void saveOdometer();
+
+  void handleStall();
+
+  void applyMicroStep(uint micro_step);
+  void chooseTiming(float speed, bool quiet_mode, uint* micro_step,
+                    uint64_t* half_step_delay);
+  void applyTiming(uint micro_step, uint64_t half_step_delay);
+  bool applyConfig(const action::MotorConfig& config);
+
+  int limitSwitchForDir(direction_t dir);
+  void recordStep();
+  bool startMove(MoveType type, direction_t dir, uint64_t steps);
+  bool moveShouldEnd();
+  void advanceRamp();
+  void finishMove();
+
+  static void diagIrqCb(uint gpio, uint32_t events);
 };
 
 static void mqttPubRequestCb(void* arg, err_t result);
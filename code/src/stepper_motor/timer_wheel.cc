@@ -0,0 +1,123 @@
+#include "timer_wheel.hh"
+
+#include "action_queue.hh"
+#include "logger.hh"
+
+using namespace stepper_motor::action;
+
+#define TW_SLOT_MASK (TW_SLOTS - 1)
+
+TimerWheel::TimerWheel() {
+  for (int i = 0; i < TW_SLOTS; i++) this->slots[i] = -1;
+
+  // Chain all the timers into the free list.
+  for (int i = 0; i < TW_CAPACITY; i++)
+    this->timers[i].next = (i + 1 < TW_CAPACITY) ? i + 1 : -1;
+  this->free_timers = 0;
+
+  this->cursor = 0;
+  this->next_tick_us = 0;
+  this->count = 0;
+}
+
+int TimerWheel::getCount() { return this->count; }
+
+uint64_t TimerWheel::getNextTickUs() {
+  return (this->count > 0) ? this->next_tick_us : UINT64_MAX;
+}
+
+/**
+ * Adds a timer to the slot that is a number of ticks ahead of the cursor.
+ *
+ * \param index The index of the timer in the pool.
+ * \param ticks How many ticks from now the timer is due, at least 1.
+ */
+void TimerWheel::insert(int8_t index, uint32_t ticks) {
+  uint32_t slot = (this->cursor + ticks) & TW_SLOT_MASK;
+
+  this->timers[index].rounds = (ticks - 1) / TW_SLOTS;
+  this->timers[index].next = this->slots[slot];
+  this->slots[slot] = index;
+}
+
+bool TimerWheel::schedule(ActionQueue* queue, Action action,
+                          uint64_t delay_ms) {
+  if (this->free_timers < 0 || delay_ms > TW_MAX_DELAY_MS) return false;
+
+  // Take a timer from the free list.
+  int8_t index = this->free_timers;
+  this->free_timers = this->timers[index].next;
+
+  this->timers[index].queue = queue;
+  this->timers[index].action = action;
+
+  // Round up so an action is never released early.
+  uint64_t ticks = (delay_ms + TW_TICK_MS - 1) / TW_TICK_MS;
+  this->insert(index, (ticks > 0) ? ticks : 1);
+
+  this->count++;
+  return true;
+}
+
+int TimerWheel::cancel(ActionQueue* queue) {
+  int cancelled = 0;
+
+  for (int slot = 0; slot < TW_SLOTS; slot++) {
+    int8_t* link = &this->slots[slot];
+    while (*link >= 0) {
+      int8_t index = *link;
+      if (this->timers[index].queue != queue) {
+        link = &this->timers[index].next;
+        continue;
+      }
+
+      // Unlink the timer and return it to the free list.
+      *link = this->timers[index].next;
+      this->timers[index].next = this->free_timers;
+      this->free_timers = index;
+      cancelled++;
+    }
+  }
+
+  this->count -= cancelled;
+  return cancelled;
+}
+
+void TimerWheel::tick(uint64_t now_us) {
+  if (this->next_tick_us == 0) this->next_tick_us = now_us;
+
+  while (now_us >= this->next_tick_us) {
+    this->next_tick_us += TW_TICK_MS * 1000ULL;
+    this->cursor++;
+
+    // Nothing to do for an empty wheel but keep time.
+    if (this->count == 0) continue;
+
+    // Detach the list of the current slot and go through it, any timers that
+    // are not due yet or get retried are inserted again.
+    uint32_t slot = this->cursor & TW_SLOT_MASK;
+    int8_t index = this->slots[slot];
+    this->slots[slot] = -1;
+
+    while (index >= 0) {
+      Timer* timer = &this->timers[index];
+      int8_t next = timer->next;
+
+      if (timer->rounds > 0) {
+        timer->rounds--;
+        timer->next = this->slots[slot];
+        this->slots[slot] = index;
+      } else if (!timer->queue->enqueue(timer->action)) {
+        LOG_WARN("Action queue full, retrying scheduled %s.\n",
+                 getActionTypeName(timer->action.action_type));
+        this->insert(index, 1);
+      } else {
+        timer->next = this->free_timers;
+        this->free_timers = index;
+        this->count--;
+      }
+
+      index = next;
+    }
+  }
+}
@@ -0,0 +1,134 @@
+#ifndef TIMER_WHEEL_HH
+#define TIMER_WHEEL_HH
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "action_queue.hh"
+
+// **====================================================**
+// ||          <<<<< Configuration Macros >>>>>          ||
+// **====================================================**
+
+// Maximum number of actions that can be scheduled at once.
+#ifndef TW_CAPACITY
+#define TW_CAPACITY 16
+#endif
+
+// Number of slots in the wheel. Must be a power of two.
+#ifndef TW_SLOTS
+#define TW_SLOTS 64
+#endif
+
+// Time per slot, i.e. the resolution of the scheduled times.
+#ifndef TW_TICK_MS
+#define TW_TICK_MS 100
+#endif
+
+// Longest delay an action can be scheduled with, 31 days. The delay in ticks
+// has to fit into 32 bits.
+#ifndef TW_MAX_DELAY_MS
+#define TW_MAX_DELAY_MS (31ULL * 24 * 60 * 60 * 1000)
+#endif
+
+// **===========================================**
+// ||          <<<<< Timer Wheel >>>>>          ||
+// **===========================================**
+
+namespace stepper_motor::action {
+
+/**
+ * An action waiting in the timer wheel.
+ */
+struct Timer {
+  ActionQueue* queue;  // Where to release the action to.
+  Action action;
+  uint32_t rounds;  // Full turns of the wheel left before the timer is due.
+  int8_t next;      // Next timer in the same slot, -1 for none.
+};
+
+/**
+ * A hashed timer wheel that holds actions until they are due and then releases
+ * them into their action queue.
+ *
+ * Each slot of the wheel covers `TW_TICK_MS` and holds a list of the timers
+ * that fall into it, longer delays take several turns of the wheel. Every tick
+ * only looks at a single slot, so the cost per tick doesn't depend on how many
+ * actions are scheduled or how far ahead.
+ *
+ * The timers come from a fixed pool of `TW_CAPACITY`, nothing is allocated.
+ *
+ * Not thread safe. Scheduling, cancelling and ticking must be serialized by the
+ * caller, and the caller must be the only producer of the action queues the
+ * timers release into while doing so.
+ */
+class TimerWheel {
+  static_assert(TW_SLOTS > 0 && (TW_SLOTS & (TW_SLOTS - 1)) == 0,
+                "TimerWheel slot count must be a power of two");
+  static_assert(TW_MAX_DELAY_MS / TW_TICK_MS < UINT32_MAX,
+                "TW_MAX_DELAY_MS must fit into 32 bits of ticks");
+
+ private:
+  Timer timers[TW_CAPACITY];
+  int8_t slots[TW_SLOTS];  // First timer of each slot, -1 for none.
+  int8_t free_timers;      // First unused timer, -1 for none.
+  uint32_t cursor;         // Ticks so far.
+  uint64_t next_tick_us;   // When the next tick is due, 0 before the first.
+  int count;
+
+  void insert(int8_t index, uint32_t ticks);
+
+ public:
+  /**
+   * Initializes an empty timer wheel.
+   */
+  TimerWheel();
+
+  /**
+   * Gets the number of scheduled actions.
+   */
+  int getCount();
+
+  /**
+   * Gets when `tick` next needs to be called, in micro seconds since boot, or
+   * UINT64_MAX while nothing is scheduled.
+   */
+  uint64_t getNextTickUs();
+
+  /**
+   * Schedules an action to be released into a queue after a delay.
+   *
+   * @param queue The queue to release the action to.
+   * @param action The action to schedule.
+   * @param delay_ms How long from now to release the action, rounded up to the
+   * next `TW_TICK_MS`. At most `TW_MAX_DELAY_MS`.
+   *
+   * @returns TRUE if the action was scheduled, FALSE if `TW_CAPACITY` actions
+   * are already scheduled or the delay is too long.
+   */
+  bool schedule(ActionQueue* queue, Action action, uint64_t delay_ms);
+
+  /**
+   * Cancels all the actions scheduled for a queue.
+   *
+   * @param queue The queue the actions are for.
+   *
+   * @returns The number of actions cancelled.
+   */
+  int cancel(ActionQueue* queue);
+
+  /**
+   * Advances the wheel to the current time, releasing the actions that are
+   * due. Call at least every `TW_TICK_MS` for on time releases, ticks that
+   * were missed are caught up on.
+   *
+   * An action whose queue is full is retried on the next tick.
+   *
+   * @param now_us The current time in micro seconds since boot.
+   */
+  void tick(uint64_t now_us);
+};
+
+}  // namespace stepper_motor::action
+
+#endif
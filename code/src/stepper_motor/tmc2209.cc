@@ -0,0 +1,222 @@
+#include "tmc2209.hh"
+
+#include <hardware/gpio.h>
+#include <hardware/uart.h>
+#include <stddef.h>
+
+using namespace stepper_motor;
+
+//
+//
+// **============================================**
+// ||          <<<<< CONSTRUCTORS >>>>>          ||
+// **============================================**
+
+/**
+ * Creates a driver with no UART connection.
+ */
+TMC2209::TMC2209() { this->uart = NULL; }
+
+/**
+ * Creates a driver for a TMC2209 connected over a single wire UART.
+ *
+ * The TX pin should connect to PDN_UART through a 1k resistor and the RX pin
+ * directly to PDN_UART. Everything written is therefore echoed back on RX and
+ * gets discarded by the read functions.
+ *
+ * \param uart The UART instance to use, or NULL for no UART.
+ * \param tx_pin The UART TX pin.
+ * \param rx_pin The UART RX pin.
+ */
+TMC2209::TMC2209(uart_inst_t* uart, uint tx_pin, uint rx_pin) {
+  this->uart = uart;
+  if (uart == NULL) return;
+
+  uart_init(uart, TMC_UART_BAUD);
+  gpio_set_function(tx_pin, GPIO_FUNC_UART);
+  gpio_set_function(rx_pin, GPIO_FUNC_UART);
+}
+
+/**
+ * Gets whether this driver has a UART to talk to the TMC2209 over.
+ */
+bool TMC2209::isConnected() { return (this->uart != NULL); }
+
+//
+//
+// **=========================================**
+// ||          <<<<< DATAGRAMS >>>>>          ||
+// **=========================================**
+
+/**
+ * Calculates the CRC8 of a datagram as specified in the TMC2209 datasheet
+ * (polynomial x^8 + x^2 + x + 1, data shifted in LSB first).
+ *
+ * \param datagram The bytes to calculate the CRC of.
+ * \param len The number of bytes, not including the CRC byte.
+ */
+uint8_t TMC2209::crc(const uint8_t* datagram, int len) {
+  uint8_t crc = 0;
+  for (int i = 0; i < len; i++) {
+    uint8_t byte = datagram[i];
+    for (int j = 0; j < 8; j++) {
+      if ((crc >> 7) ^ (byte & 0x01))
+        crc = (crc << 1) ^ 0x07;
+      else
+        crc = (crc << 1);
+      byte >>= 1;
+    }
+  }
+  return crc;
+}
+
+/**
+ * Discards anything sitting in the RX FIFO.
+ */
+void TMC2209::flushRx() {
+  while (uart_is_readable(this->uart)) uart_getc(this->uart);
+}
+
+/**
+ * Writes a 32 bit value to a register.
+ *
+ * Writes are not acknowledged by the TMC2209, so success only means the
+ * datagram was sent and echoed back intact.
+ *
+ * \param address The slave address of the driver (MS2:MS1).
+ * \param reg The register to write.
+ * \param value The value to write.
+ *
+ * \returns Whether the write was sent.
+ */
+bool TMC2209::writeRegister(uint8_t address, uint8_t reg, uint32_t value) {
+  if (!this->isConnected()) return false;
+
+  uint8_t datagram[8] = {TMC_SYNC_BYTE,
+                         address,
+                         (uint8_t)(reg | TMC_WRITE_BIT),
+                         (uint8_t)(value >> 24),
+                         (uint8_t)(value >> 16),
+                         (uint8_t)(value >> 8),
+                         (uint8_t)(value),
+                         0};
+  datagram[7] = crc(datagram, 7);
+
+  this->flushRx();
+  uart_write_blocking(this->uart, datagram, sizeof(datagram));
+
+  // Consume the echo of our own datagram.
+  for (size_t i = 0; i < sizeof(datagram); i++) {
+    if (!uart_is_readable_within_us(this->uart, TMC_UART_TIMEOUT_US))
+      return false;
+    uart_getc(this->uart);
+  }
+
+  return true;
+}
+
+/**
+ * Reads a 32 bit value from a register.
+ *
+ * \param address The slave address of the driver (MS2:MS1).
+ * \param reg The register to read.
+ * \param value Where to store the value read. Untouched on failure.
+ *
+ * \returns Whether a reply with a valid CRC was received.
+ */
+bool TMC2209::readRegister(uint8_t address, uint8_t reg, uint32_t* value) {
+  if (!this->isConnected()) return false;
+
+  uint8_t request[4] = {TMC_SYNC_BYTE, address, reg, 0};
+  request[3] = crc(request, 3);
+
+  this->flushRx();
+  uart_write_blocking(this->uart, request, sizeof(request));
+
+  // The first 4 bytes are the echo of the request, the next 8 are the reply.
+  uint8_t reply[sizeof(request) + 8];
+  for (size_t i = 0; i < sizeof(reply); i++) {
+    if (!uart_is_readable_within_us(this->uart, TMC_UART_TIMEOUT_US))
+      return false;
+    reply[i] = uart_getc(this->uart);
+  }
+
+  uint8_t* datagram = &reply[sizeof(request)];
+  if (datagram[0] != TMC_SYNC_BYTE || datagram[1] != TMC_MASTER_ADDRESS ||
+      datagram[2] != reg || datagram[7] != crc(datagram, 7))
+    return false;
+
+  *value = ((uint32_t)datagram[3] << 24) | ((uint32_t)datagram[4] << 16) |
+           ((uint32_t)datagram[5] << 8) | (uint32_t)datagram[6];
+  return true;
+}
+
+//
+//
+// **==========================================**
+// ||          <<<<< STALLGUARD >>>>>          ||
+// **==========================================**
+
+/**
+ * Configures the driver for StallGuard4 stall detection on the DIAG pin.
+ *
+ * Micro stepping stays selected by the MS1/MS2 pins and the motor current by
+ * the VREF potentiometer, so the rest of the motor driving code is unaffected.
+ *
+ * \param address The slave address of the driver (MS2:MS1).
+ * \param threshold The StallGuard threshold (SGTHRS). A stall is signalled when
+ *   SG_RESULT drops below double this value. Higher is more sensitive.
+ * \param tcoolthrs The TSTEP value above which (i.e. the speed below which)
+ *   stall detection is disabled. StallGuard is unreliable at very low speeds.
+ *
+ * \returns Whether all the writes were sent.
+ */
+bool TMC2209::setupStallGuard(uint8_t address, uint8_t threshold,
+                              uint32_t tcoolthrs) {
+  bool success = true;
+
+  // The UART takes over the PDN pin, keep the analog current scaling and the
+  // pin based micro step selection.
+  success &= this->writeRegister(
+      address, TMC_REG_GCONF,
+      TMC_GCONF_I_SCALE_ANALOG | TMC_GCONF_PDN_DISABLE |
+          TMC_GCONF_MULTISTEP_FILT);
+  success &= this->writeRegister(address, TMC_REG_TCOOLTHRS, tcoolthrs);
+  success &= this->setStallThreshold(address, threshold);
+
+  return success;
+}
+
+/**
+ * Sets the StallGuard threshold (SGTHRS).
+ */
+bool TMC2209::setStallThreshold(uint8_t address, uint8_t threshold) {
+  return this->writeRegister(address, TMC_REG_SGTHRS, threshold);
+}
+
+/**
+ * Reads the current StallGuard4 load measurement.
+ *
+ * \returns SG_RESULT (0 to 510, lower means more load), or -1 on failure.
+ */
+int TMC2209::getStallGuardResult(uint8_t address) {
+  uint32_t value;
+  if (!this->readRegister(address, TMC_REG_SG_RESULT, &value)) return -1;
+  return (int)(value & 0x3FF);
+}
+
+/**
+ * Sets the motor current while moving and while standing still (IHOLD_IRUN),
+ * in 1/32 of the full scale current set by VREF.
+ *
+ * The driver only drops to the hold current once the motor has been standing
+ * still for a moment (TPOWERDOWN) and then ramps down to it slowly.
+ *
+ * \param hold_current The standstill current, 0 to 31.
+ * \param run_current The current while moving, 0 to 31.
+ */
+bool TMC2209::setCurrent(uint8_t address, uint8_t hold_current,
+                         uint8_t run_current) {
+  return this->writeRegister(address, TMC_REG_IHOLD_IRUN,
+                             TMC_IHOLD_IRUN(hold_current, run_current, 1));
+}
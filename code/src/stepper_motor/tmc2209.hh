@@ -0,0 +1,101 @@
+#ifndef TMC2209_HH
+#define TMC2209_HH
+
+#include <hardware/uart.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// **====================================================**
+// ||          <<<<< Configuration Macros >>>>>          ||
+// **====================================================**
+
+// Baud rate of the single wire UART interface. The TMC2209 auto detects the
+// baud rate, anything between 9600 and 500k works.
+#ifndef TMC_UART_BAUD
+#define TMC_UART_BAUD 115200
+#endif
+
+// How long to wait for a reply byte before giving up on a read.
+#ifndef TMC_UART_TIMEOUT_US
+#define TMC_UART_TIMEOUT_US 2000
+#endif
+
+// **==================================================**
+// ||          <<<<< Register Addresses >>>>>          ||
+// **==================================================**
+
+#define TMC_REG_GCONF 0x00
+#define TMC_REG_GSTAT 0x01
+#define TMC_REG_IFCNT 0x02
+#define TMC_REG_IHOLD_IRUN 0x10
+#define TMC_REG_TSTEP 0x12
+#define TMC_REG_TCOOLTHRS 0x14
+#define TMC_REG_SGTHRS 0x40
+#define TMC_REG_SG_RESULT 0x41
+#define TMC_REG_DRV_STATUS 0x6F
+
+// GCONF bits.
+#define TMC_GCONF_I_SCALE_ANALOG (1 << 0)
+#define TMC_GCONF_PDN_DISABLE (1 << 6)
+#define TMC_GCONF_MSTEP_REG_SELECT (1 << 7)
+#define TMC_GCONF_MULTISTEP_FILT (1 << 8)
+
+// IHOLD_IRUN fields, the currents are in 1/32 of the full scale current.
+#define TMC_IHOLD_IRUN(ihold, irun, ihold_delay)                   \
+  (((uint32_t)(ihold) & 0x1F) | (((uint32_t)(irun) & 0x1F) << 8) | \
+   (((uint32_t)(ihold_delay) & 0x0F) << 16))
+
+#define TMC_SYNC_BYTE 0x05
+#define TMC_MASTER_ADDRESS 0xFF
+#define TMC_WRITE_BIT 0x80
+
+// Internal clock of the TMC2209 in Hz, used to convert speeds to TSTEP.
+#define TMC_FCLK 12000000
+
+/**
+ * Converts a speed in mm/s to the TSTEP register value the driver would measure
+ * at that speed. TSTEP is the time between two 1/256 micro steps in clock
+ * cycles, so it is independent of the selected micro step resolution.
+ */
+#define TMC_MM_PER_SEC_TO_TSTEP(mm_per_sec, full_steps_per_mm) \
+  ((uint32_t)(TMC_FCLK / ((mm_per_sec) * (full_steps_per_mm) * 256)))
+
+namespace stepper_motor {
+
+/**
+ * Minimal driver for the single wire UART interface of a TMC2209.
+ *
+ * Only the registers required for StallGuard4 stall detection are used. The
+ * micro step resolution is still selected through the MS1/MS2 pins, which on
+ * the TMC2209 double as the UART slave address (AD0/AD1). Because of this the
+ * slave address is not fixed and must be passed in with every access.
+ *
+ * A driver constructed without a UART (`uart == NULL`) is valid but inert: all
+ * accesses fail and stall detection falls back to the DIAG pin alone.
+ */
+class TMC2209 {
+ public:
+  TMC2209();
+  TMC2209(uart_inst_t* uart, uint tx_pin, uint rx_pin);
+
+  bool isConnected();
+
+  bool writeRegister(uint8_t address, uint8_t reg, uint32_t value);
+  bool readRegister(uint8_t address, uint8_t reg, uint32_t* value);
+
+  bool setupStallGuard(uint8_t address, uint8_t threshold, uint32_t tcoolthrs);
+  bool setStallThreshold(uint8_t address, uint8_t threshold);
+  int getStallGuardResult(uint8_t address);
+
+  bool setCurrent(uint8_t address, uint8_t hold_current, uint8_t run_current);
+
+ private:
+  uart_inst_t* uart;
+
+  static uint8_t crc(const uint8_t* datagram, int len);
+  void flushRx();
+};
+
+}  // namespace stepper_motor
+
+#endif
@@ -0,0 +1,180 @@
+#include "supervisor.hh"
+
+#include <hardware/watchdog.h>
+#include <pico/time.h>
+#include <stdio.h>
+
+#include "advanced_opts.hh"
+
+// **================================================**
+// ||          <<<<< SCRATCH REGISTER >>>>>          ||
+// **================================================**
+
+/*
+ * Watchdog scratch register 0 survives a watchdog reboot and holds:
+ * - [31:24] `SUPERVISOR_SCRATCH_MAGIC`, marks the rest as valid.
+ * - [15:8]  The task that checked in last, i.e. was running at the time.
+ * - [7:0]   A bit per task that missed its deadline.
+ *
+ * If no task missed its deadline but the watchdog still rebooted the device,
+ * nothing called `supervisorService` anymore and the last task to check in is
+ * the one that hung.
+ */
+
+#define SUPERVISOR_SCRATCH 0
+#define SUPERVISOR_SCRATCH_MAGIC 0x5Au
+#define SUPERVISOR_SCRATCH_LAST_SHIFT 8
+
+#define SUPERVISOR_SCRATCH_VALUE(last, missed)           \
+  ((SUPERVISOR_SCRATCH_MAGIC << 24) |                    \
+   ((uint32_t)(last) << SUPERVISOR_SCRATCH_LAST_SHIFT) | \
+   (uint32_t)(missed))
+
+// **================================================**
+// ||          <<<<< STATIC VARIABLES >>>>>          ||
+// **================================================**
+
+static struct {
+  bool live;
+  uint32_t deadline_us;
+  uint32_t last_check_in_us;
+} tasks[TASK_COUNT];
+
+static SupervisedTask last_task = TASK_MAIN_LOOP;
+static uint8_t missed_tasks = 0;
+static uint32_t last_poll_us = 0;
+
+// **==========================================**
+// ||          <<<<< SUPERVISOR >>>>>          ||
+// **==========================================**
+
+/**
+ * Reports why the previous boot ended if the watchdog rebooted the device, and
+ * then enables the watchdog.
+ *
+ * \param watchdog_timeout_ms How long the hardware watchdog waits for a feed.
+ */
+void supervisorInit(uint32_t watchdog_timeout_ms) {
+  uint32_t scratch = watchdog_hw->scratch[SUPERVISOR_SCRATCH];
+
+  if (watchdog_enable_caused_reboot() &&
+      (scratch >> 24) == SUPERVISOR_SCRATCH_MAGIC) {
+    SupervisedTask last =
+        (SupervisedTask)((scratch >> SUPERVISOR_SCRATCH_LAST_SHIFT) &
+                              0xFF);
+    uint8_t missed = scratch & 0xFF;
+
+    if (missed == 0)
+      printf("Watchdog reboot: hung in %s.\n", supervisorGetTaskName(last));
+    for (int i = 0; i < TASK_COUNT; i++)
+      if (missed & (1 << i))
+        printf("Watchdog reboot: %s missed its deadline.\n",
+               supervisorGetTaskName((SupervisedTask)i));
+  }
+
+  watchdog_hw->scratch[SUPERVISOR_SCRATCH] =
+      SUPERVISOR_SCRATCH_VALUE(last_task, 0);
+  watchdog_enable(watchdog_timeout_ms, 1);
+}
+
+/**
+ * Starts supervising a task. From now on the task must check in at least every
+ * `deadline_ms` for the watchdog to be fed.
+ */
+void supervisorStart(SupervisedTask task, uint32_t deadline_ms) {
+  tasks[task].deadline_us = deadline_ms * 1000;
+  supervisorResume(task);
+}
+
+/**
+ * Stops supervising a task for now, e.g. while it has nothing to do.
+ */
+void supervisorSuspend(SupervisedTask task) { tasks[task].live = false; }
+
+/**
+ * Supervises a suspended task again, counting from now.
+ */
+void supervisorResume(SupervisedTask task) {
+  tasks[task].last_check_in_us = time_us_32();
+  tasks[task].live = true;
+}
+
+/**
+ * Gets whether a task is being supervised.
+ */
+bool supervisorIsLive(SupervisedTask task) { return tasks[task].live; }
+
+/**
+ * Records that a task is making progress.
+ */
+void supervisorCheckIn(SupervisedTask task) {
+  tasks[task].last_check_in_us = time_us_32();
+
+  if (task != last_task) {
+    last_task = task;
+    watchdog_hw->scratch[SUPERVISOR_SCRATCH] =
+        SUPERVISOR_SCRATCH_VALUE(last_task, missed_tasks);
+  }
+}
+
+/**
+ * Feeds the hardware watchdog if every supervised task checked in within its
+ * deadline.
+ *
+ * Once a task misses its deadline the watchdog is never fed again and reboots
+ * the device, with the tasks that missed their deadline recorded for the next
+ * boot.
+ */
+void supervisorService() {
+  if (missed_tasks != 0) return;
+
+  uint32_t now_us = time_us_32();
+  for (int i = 0; i < TASK_COUNT; i++)
+    if (tasks[i].live &&
+        now_us - tasks[i].last_check_in_us > tasks[i].deadline_us)
+      missed_tasks |= (1 << i);
+
+  if (missed_tasks == 0) {
+    watchdog_update();
+    return;
+  }
+
+  watchdog_hw->scratch[SUPERVISOR_SCRATCH] =
+      SUPERVISOR_SCRATCH_VALUE(last_task, missed_tasks);
+  for (int i = 0; i < TASK_COUNT; i++)
+    if (missed_tasks & (1 << i))
+      printf("Supervisor: %s missed its deadline, rebooting.\n",
+             supervisorGetTaskName((SupervisedTask)i));
+}
+
+/**
+ * Checks a task in and services the supervisor, at most once per
+ * `SUPERVISOR_POLL_INTERVAL_MS`. For loops that block the main loop for a long
+ * time, such as homing, and would be slowed down by servicing every round.
+ */
+void supervisorPoll(SupervisedTask task) {
+  uint32_t now_us = time_us_32();
+  if (now_us - last_poll_us < SUPERVISOR_POLL_INTERVAL_MS * 1000) return;
+  last_poll_us = now_us;
+
+  supervisorCheckIn(task);
+  supervisorService();
+}
+
+/**
+ * Gets the name of a task, for reporting.
+ */
+const char* supervisorGetTaskName(SupervisedTask task) {
+  switch (task) {
+    case TASK_MAIN_LOOP:
+      return "main loop";
+    case TASK_MOTION:
+      return "motion";
+    case TASK_MQTT:
+      return "MQTT";
+    case TASK_WIFI:
+      return "Wi-Fi";
+    default:
+      return "unknown";
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef SUPERVISOR_HH
+#define SUPERVISOR_HH
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The tasks the supervisor keeps an eye on.
+ */
+enum SupervisedTask {
+  TASK_MAIN_LOOP,  // The main loop going around.
+  TASK_MOTION,     // The motors being stepped while they move.
+  TASK_MQTT,       // The MQTT client staying connected.
+  TASK_WIFI,       // The Wi-Fi link being up or being reconnected.
+  TASK_COUNT,
+};
+
+void supervisorInit(uint32_t watchdog_timeout_ms);
+
+void supervisorStart(SupervisedTask task, uint32_t deadline_ms);
+void supervisorSuspend(SupervisedTask task);
+void supervisorResume(SupervisedTask task);
+bool supervisorIsLive(SupervisedTask task);
+
+void supervisorCheckIn(SupervisedTask task);
+void supervisorService();
+void supervisorPoll(SupervisedTask task);
+
+const char* supervisorGetTaskName(SupervisedTask task);
+
+#endif
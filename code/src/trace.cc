@@ -0,0 +1,143 @@
+#include "trace.hh"
+
+#include <hardware/sync.h>
+#include <pico/time.h>
+#include <string.h>
+
+#include "common.hh"
+
+static_assert((TRACE_CAPACITY & (TRACE_CAPACITY - 1)) == 0,
+              "TRACE_CAPACITY must be a power of two");
+static_assert(TRACE_CHUNK_RECORDS <= UINT8_MAX,
+              "A chunk counts its records in a byte");
+
+// **================================================**
+// ||          <<<<< STATIC VARIABLES >>>>>          ||
+// **================================================**
+
+static TraceRecord trace_ring[TRACE_CAPACITY];
+
+// Records written so far, free running, and how many of them are still in the
+// ring.
+static uint32_t trace_head = 0;
+static uint32_t trace_size = 0;
+
+// Records overwritten, or dropped while a dump was in progress, since boot.
+static uint32_t trace_lost = 0;
+
+// Serializes the producers, which include the lwIP callbacks. NULL until
+// `traceInit`, nothing is recorded until then.
+static spin_lock_t* trace_lock = NULL;
+
+// The records being dumped. Recording is paused during a dump so the records
+// don't get overwritten while they are sent.
+static bool trace_paused = false;
+static struct {
+  uint32_t first;
+  uint32_t size;
+  uint32_t now_us;
+  uint32_t lost;
+} dump;
+
+// **=====================================**
+// ||          <<<<< TRACE >>>>>          ||
+// **=====================================**
+
+/**
+ * Gets the number of chunks in the dump, at least one so that even an empty
+ * dump gets a header out.
+ */
+static uint16_t dumpChunks() {
+  return MAX(1, (dump.size + TRACE_CHUNK_RECORDS - 1) / TRACE_CHUNK_RECORDS);
+}
+
+void traceInit() {
+  trace_lock = spin_lock_instance(spin_lock_claim_unused(true));
+}
+
+/**
+ * Adds an event to the trace ring, stamped with the current time, overwriting
+ * the oldest record if the ring is full. Cheap enough for interrupts.
+ *
+ * Use the `TRACE` macro rather than calling this directly.
+ *
+ * \param event The `TraceEvent`.
+ * \param a The window or callback index of the event.
+ * \param b The argument of the event.
+ */
+void traceRecord(uint8_t event, uint8_t a, uint16_t b) {
+  if (trace_lock == NULL) return;
+
+  TraceRecord record = {time_us_32(), event, a, b};
+
+  uint32_t saved_irq = spin_lock_blocking(trace_lock);
+  if (trace_paused) {
+    trace_lost++;
+  } else {
+    if (trace_size == TRACE_CAPACITY)
+      trace_lost++;
+    else
+      trace_size++;
+    trace_ring[trace_head++ & (TRACE_CAPACITY - 1)] = record;
+  }
+  spin_unlock(trace_lock, saved_irq);
+}
+
+/**
+ * Starts a dump of the records in the ring and pauses recording until
+ * `traceDumpEnd`.
+ *
+ * \returns The number of chunks in the dump.
+ */
+uint16_t traceDumpBegin() {
+  uint32_t saved_irq = spin_lock_blocking(trace_lock);
+  trace_paused = true;
+  dump.first = trace_head - trace_size;
+  dump.size = trace_size;
+  dump.now_us = time_us_32();
+  dump.lost = trace_lost;
+  spin_unlock(trace_lock, saved_irq);
+
+  return dumpChunks();
+}
+
+/**
+ * Writes one chunk of the dump started by `traceDumpBegin`.
+ *
+ * \param seq The index of the chunk.
+ * \param buf Where to write the chunk to.
+ * \param size The size of `buf`, at least `TRACE_CHUNK_MAX_SIZE`.
+ *
+ * \returns The length of the chunk in bytes, or 0 if there is no such chunk.
+ */
+size_t traceDumpChunk(uint16_t seq, uint8_t* buf, size_t size) {
+  uint16_t total = dumpChunks();
+  if (seq >= total || size < TRACE_CHUNK_MAX_SIZE) return 0;
+
+  uint32_t offset = (uint32_t)seq * TRACE_CHUNK_RECORDS;
+  uint32_t count = MIN(TRACE_CHUNK_RECORDS, dump.size - offset);
+
+  TraceChunkHeader header = {TRACE_CHUNK_MAGIC, TRACE_CHUNK_VERSION,
+                             (uint8_t)count,    seq,
+                             total,             dump.now_us,
+                             dump.lost};
+  memcpy(buf, &header, sizeof(header));
+
+  // The records may have wrapped around the end of the ring.
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t index = (dump.first + offset + i) & (TRACE_CAPACITY - 1);
+    memcpy(buf + sizeof(header) + i * sizeof(TraceRecord), &trace_ring[index],
+           sizeof(TraceRecord));
+  }
+
+  return sizeof(header) + count * sizeof(TraceRecord);
+}
+
+/**
+ * Ends a dump and resumes recording. The dumped records stay in the ring.
+ */
+void traceDumpEnd() {
+  uint32_t saved_irq = spin_lock_blocking(trace_lock);
+  trace_paused = false;
+  spin_unlock(trace_lock, saved_irq);
+}
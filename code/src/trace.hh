@@ -0,0 +1,147 @@
+#ifndef TRACE_HH
+#define TRACE_HH
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "advanced_opts.hh"
+
+// **==========================================**
+// ||          <<<<< CATEGORIES >>>>>          ||
+// **==========================================**
+
+#define TRACE_CAT_COMMAND (1 << 0)  // Commands received and queued.
+#define TRACE_CAT_MOTION (1 << 1)   // Moves starting and ending.
+#define TRACE_CAT_RAMP (1 << 2)     // Soft start ramp phases.
+#define TRACE_CAT_SWITCH (1 << 3)   // Limit switches ending a move.
+#define TRACE_CAT_PUBLISH (1 << 4)  // Publishes queued and their results.
+#define TRACE_CAT_LWIP (1 << 5)     // lwIP callbacks entered and left.
+#define TRACE_CAT_LINK (1 << 6)     // Wi-Fi link and MQTT connection changes.
+
+#define TRACE_CAT_ALL 0x7F
+
+#ifndef TRACE_CATEGORIES
+#define TRACE_CATEGORIES TRACE_CAT_ALL
+#endif
+
+// Records kept in the ring, the oldest are overwritten. Must be a power of two.
+#ifndef TRACE_CAPACITY
+#define TRACE_CAPACITY 512
+#endif
+
+// Records per dump chunk.
+#define TRACE_CHUNK_RECORDS 64
+
+// **======================================**
+// ||          <<<<< EVENTS >>>>>          ||
+// **======================================**
+
+/*
+ * Every record has a window or callback index `a` and an argument `b`, noted
+ * next to each event. Keep in sync with trace_decode.py.
+ */
+enum TraceEvent : uint8_t {
+  TRACE_NONE,
+  TRACE_COMMAND_RECEIVED,  // a: window, b: command topic.
+  TRACE_COMMAND_DROPPED,   // a: window, b: command topic.
+  TRACE_COMMAND_ENQUEUED,  // a: window, b: action type.
+  TRACE_COMMAND_REJECTED,  // a: window, b: action type.
+  TRACE_MOVE_START,        // a: window, b: move type | direction << 8.
+  TRACE_MOVE_END,          // a: window, b: step position, low 16 bits.
+  TRACE_RAMP_START,        // a: window, b: half step delay.
+  TRACE_RAMP_LEVEL,        // a: window, b: half step delay.
+  TRACE_RAMP_END,          // a: window, b: half step delay.
+  TRACE_LIMIT_SWITCH,      // a: window, b: GPIO.
+  TRACE_PUBLISH_QUEUED,    // a: window, b: error.
+  TRACE_PUBLISH_RESULT,    // a: 0, b: result.
+  TRACE_LWIP_ENTER,        // a: callback, b: 0.
+  TRACE_LWIP_EXIT,         // a: callback, b: 0.
+  TRACE_LINK_CHANGED,      // a: 0, b: whether the link is up.
+  TRACE_MQTT_CONNECTION,   // a: 0, b: connection status.
+};
+
+// The lwIP callbacks, for `TRACE_LWIP_ENTER` and `TRACE_LWIP_EXIT`.
+enum TraceCallback : uint8_t {
+  TRACE_CB_INCOMING_PUBLISH,
+  TRACE_CB_INCOMING_DATA,
+  TRACE_CB_CONNECTION,
+  TRACE_CB_PUBLISH_REQUEST,
+  TRACE_CB_SUBSCRIBE_REQUEST,
+  TRACE_CB_LINK_CHANGED,
+};
+
+/*
+ * Events of categories left out of `TRACE_CATEGORIES` are compiled out. Their
+ * arguments are not evaluated.
+ */
+#define TRACE(category, event, a, b)                     \
+  do {                                                   \
+    if constexpr (((category) & TRACE_CATEGORIES) != 0)  \
+      traceRecord((event), (uint8_t)(a), (uint16_t)(b)); \
+  } while (0)
+
+/*
+ * Traces entering an lwIP callback here and leaving it at the end of the
+ * enclosing scope.
+ */
+#define TRACE_LWIP_SCOPE(callback) TraceLwipScope trace_lwip_scope(callback)
+
+// **=====================================**
+// ||          <<<<< TRACE >>>>>          ||
+// **=====================================**
+
+/**
+ * One traced event, 8 bytes. The time wraps every 71 minutes, which the
+ * decoder unwraps.
+ */
+struct TraceRecord {
+  uint32_t time_us;
+  uint8_t event;
+  uint8_t a;
+  uint16_t b;
+};
+
+/**
+ * The header of each dump chunk, followed by `count` records, oldest first.
+ * All fields are little endian.
+ */
+struct TraceChunkHeader {
+  uint16_t magic;   // `TRACE_CHUNK_MAGIC`.
+  uint8_t version;  // `TRACE_CHUNK_VERSION`.
+  uint8_t count;    // Records in this chunk.
+  uint16_t seq;     // Index of this chunk in the dump.
+  uint16_t total;   // Chunks in the dump.
+  uint32_t now_us;  // When the dump started.
+  uint32_t lost;    // Records overwritten, or dropped during a dump, so far.
+};
+
+#define TRACE_CHUNK_MAGIC 0x5254  // "TR"
+#define TRACE_CHUNK_VERSION 1
+#define TRACE_CHUNK_MAX_SIZE \
+  (sizeof(TraceChunkHeader) + TRACE_CHUNK_RECORDS * sizeof(TraceRecord))
+
+void traceInit();
+void traceRecord(uint8_t event, uint8_t a, uint16_t b);
+
+uint16_t traceDumpBegin();
+size_t traceDumpChunk(uint16_t seq, uint8_t* buf, size_t size);
+void traceDumpEnd();
+
+/**
+ * Traces entering an lwIP callback when constructed and leaving it when
+ * destroyed. Use `TRACE_LWIP_SCOPE`.
+ */
+class TraceLwipScope {
+ private:
+  uint8_t callback;
+
+ public:
+  TraceLwipScope(uint8_t callback) : callback(callback) {
+    TRACE(TRACE_CAT_LWIP, TRACE_LWIP_ENTER, callback, 0);
+  }
+  ~TraceLwipScope() {
+    TRACE(TRACE_CAT_LWIP, TRACE_LWIP_EXIT, this->callback, 0);
+  }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef WAKE_EVENT_HH
+#define WAKE_EVENT_HH
+
+#include <hardware/sync.h>
+#include <pico/time.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <atomic>
+
+// **==========================================**
+// ||          <<<<< WAKE EVENT >>>>>          ||
+// **==========================================**
+
+/**
+ * Wakes a consumer that sleeps while it has nothing to do.
+ *
+ * Producers signal the event whenever they hand the consumer new work. The
+ * consumer clears the event, does all the work it has, and then sleeps on WFE
+ * until the event is signalled again. A signal that arrives while the consumer
+ * is still working is not lost, the next wait returns right away.
+ *
+ * Interrupts also end a WFE, so the pending flag is what tells a real signal
+ * apart from any other interrupt and lets the consumer go straight back to
+ * sleep on the latter.
+ */
+class WakeEvent {
+ private:
+  std::atomic<bool> pending;
+
+ public:
+  WakeEvent() : pending(false) {}
+
+  /**
+   * Wakes the consumer. Safe to call from any context on either core.
+   */
+  void signal() {
+    this->pending.store(true, std::memory_order_release);
+    __sev();
+  }
+
+  /**
+   * Gets whether the event is signalled, without clearing it. Consumer only.
+   */
+  bool isSignalled() { return this->pending.load(std::memory_order_acquire); }
+
+  /**
+   * Sleeps until the event is signalled or a deadline passes, then clears the
+   * event. Consumer only.
+   *
+   * @param until_us The deadline in micro seconds since boot.
+   *
+   * @returns TRUE if the event was signalled, FALSE if the deadline passed.
+   */
+  bool waitUntil(uint64_t until_us) {
+    bool signalled;
+    while (!(signalled = this->pending.load(std::memory_order_acquire)) &&
+           time_us_64() < until_us)
+      best_effort_wfe_or_timeout(from_us_since_boot(until_us));
+
+    this->pending.store(false, std::memory_order_relaxed);
+    return signalled;
+  }
+};
+
+/**
+ * Wakes the main loop when there are actions, control requests or network
+ * changes for it to handle.
+ */
+inline WakeEvent main_loop_wake;
+
+#endif
@@ -0,0 +1,180 @@
+#! /usr/bin/env python3
+"""
+Decodes a dump of the event trace ring into a timeline.
+
+The dump is read as lines of hex chunks, either the "TRACE <hex>" lines printed
+on USB after a "USB" on the cmd/trace topic of a window, or the snsr/trace
+publishes after a "DUMP", e.g. captured with:
+
+  mosquitto_sub -h <broker> -t '<base><window>/snsr/trace' -F %x > dump.txt
+
+Any other lines, like the rest of the USB log, are skipped. Reads the files
+given, or stdin if none are.
+"""
+
+import fileinput
+import re
+import struct
+
+# Keep in sync with trace.hh.
+CHUNK_MAGIC = 0x5254
+CHUNK_VERSION = 1
+HEADER = struct.Struct("<HBBHHII")
+RECORD = struct.Struct("<IBBH")
+
+EVENTS = [
+    "NONE",
+    "COMMAND_RECEIVED",
+    "COMMAND_DROPPED",
+    "COMMAND_ENQUEUED",
+    "COMMAND_REJECTED",
+    "MOVE_START",
+    "MOVE_END",
+    "RAMP_START",
+    "RAMP_LEVEL",
+    "RAMP_END",
+    "LIMIT_SWITCH",
+    "PUBLISH_QUEUED",
+    "PUBLISH_RESULT",
+    "LWIP_ENTER",
+    "LWIP_EXIT",
+    "LINK_CHANGED",
+    "MQTT_CONNECTION",
+]
+
+CALLBACKS = [
+    "incoming publish",
+    "incoming data",
+    "connection",
+    "publish request",
+    "subscribe request",
+    "link changed",
+]
+
+# The `InPub` of ha_device.cc.
+COMMANDS = [
+    "other", "general", "percent", "steps", "mm", "quiet", "soft start",
+    "speed", "acceleration", "home", "calibrate", "batch", "schedule",
+    "memory", "trace",
+]
+
+# The `ActionType` of action_queue.hh.
+ACTIONS = [
+    "NONE", "OPEN", "CLOSE", "MOVE_TO_PERCENT", "MOVE_TO_STEP", "HOME",
+    "CALIBRATE", "WAIT",
+]
+
+# The `MoveType` of stepper_motor.hh.
+MOVES = ["STEPS", "OPEN", "CLOSE", "DWELL"]
+
+HEX_LINE = re.compile(r"^(?:TRACE )?([0-9a-fA-F]+)\s*$")
+
+
+def name(names, index):
+    return names[index] if index < len(names) else str(index)
+
+
+def signed16(value):
+    return value - 0x10000 if value & 0x8000 else value
+
+
+def describe(event, a, b):
+    """Describes the arguments of an event."""
+    event_name = name(EVENTS, event)
+    if event_name in ("COMMAND_RECEIVED", "COMMAND_DROPPED"):
+        return f"window {a} {name(COMMANDS, b)}"
+    if event_name in ("COMMAND_ENQUEUED", "COMMAND_REJECTED"):
+        return f"window {a} {name(ACTIONS, b)}"
+    if event_name == "MOVE_START":
+        return f"window {a} {name(MOVES, b & 0xFF)} dir {b >> 8}"
+    if event_name == "MOVE_END":
+        return f"window {a} step position {b} (mod 65536)"
+    if event_name.startswith("RAMP_"):
+        return f"window {a} half step delay {b}us"
+    if event_name == "LIMIT_SWITCH":
+        return f"window {a} GPIO {b}"
+    if event_name == "PUBLISH_QUEUED":
+        return f"window {a} err {signed16(b)}"
+    if event_name == "PUBLISH_RESULT":
+        return f"result {signed16(b)}"
+    if event_name in ("LWIP_ENTER", "LWIP_EXIT"):
+        return name(CALLBACKS, a)
+    if event_name == "LINK_CHANGED":
+        return "up" if b else "down"
+    if event_name == "MQTT_CONNECTION":
+        return f"status {b}"
+    return f"a {a} b {b}"
+
+
+def read_chunks(lines):
+    """Gets the header and the records of every chunk in the lines."""
+    chunks = {}
+    for line in lines:
+        match = HEX_LINE.match(line.strip())
+        if match is None or len(match.group(1)) % 2 != 0:
+            continue
+
+        data = bytes.fromhex(match.group(1))
+        if len(data) < HEADER.size:
+            continue
+        magic, version, count, seq, total, now_us, lost = \
+            HEADER.unpack_from(data)
+        if magic != CHUNK_MAGIC or version != CHUNK_VERSION:
+            continue
+
+        records = [
+            RECORD.unpack_from(data, HEADER.size + i * RECORD.size)
+            for i in range(count)
+            if HEADER.size + (i + 1) * RECORD.size <= len(data)
+        ]
+        chunks[seq] = (total, now_us, lost, records)
+
+    return chunks
+
+
+def main():
+    chunks = read_chunks(fileinput.input())
+    if not chunks:
+        print("No trace chunks found.")
+        return
+
+    total, now_us, lost, _ = chunks[min(chunks)]
+    missing = [seq for seq in range(total) if seq not in chunks]
+    print(f"{total} chunks, {lost} records lost so far", end="")
+    print(f", chunks {missing} missing" if missing else "")
+
+    records = [r for seq in sorted(chunks) for r in chunks[seq][3]]
+    if not records:
+        print("The trace is empty.")
+        return
+
+    # The times are the low 32 bits of the time since boot, unwrap them and
+    # show them relative to when the dump was taken.
+    wraps = 0
+    previous = records[0][0]
+    times = []
+    for time_us, _, _, _ in records:
+        if time_us < previous:
+            wraps += 1
+        previous = time_us
+        times.append(time_us + (wraps << 32))
+    now = now_us + (wraps << 32)
+    if now < times[-1]:
+        now += 1 << 32
+
+    entered = {}
+    for time_us, (_, event, a, b) in zip(times, records):
+        line = (f"{(time_us - now) / 1e6:14.6f}s  "
+                f"{name(EVENTS, event):<18} {describe(event, a, b)}")
+
+        # Show how long each lwIP callback ran for.
+        if name(EVENTS, event) == "LWIP_ENTER":
+            entered[a] = time_us
+        elif name(EVENTS, event) == "LWIP_EXIT" and a in entered:
+            line += f" after {time_us - entered.pop(a)}us"
+
+        print(line)
+
+
+if __name__ == "__main__":
+    main()